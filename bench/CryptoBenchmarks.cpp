@@ -0,0 +1,154 @@
+#include "common.h"
+#include "encrypt.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <sstream>
+
+namespace {
+
+const int64_t MinSize = 64;
+const int64_t MaxSize = 1LL << 30;
+
+// Sizes from 64 B to 1 GB in steps of 16x. QRYPT_BENCH_MAX_BYTES lowers the upper bound on hosts
+// without the several GB of memory that the largest cases need.
+void sizeRange(benchmark::internal::Benchmark* bench) {
+    int64_t max_size = MaxSize;
+    if (const char* env_max = std::getenv("QRYPT_BENCH_MAX_BYTES")) {
+        max_size = std::max<int64_t>(MinSize, std::strtoll(env_max, nullptr, 10));
+    }
+    bench->RangeMultiplier(16)->Range(MinSize, max_size);
+}
+
+// Random bytes, generated once per size and shared between benchmarks
+const std::vector<uint8_t>& randomBytes(size_t size, uint64_t seed = 1) {
+    static std::map<std::pair<size_t, uint64_t>, std::vector<uint8_t>> cache;
+    auto& bytes = cache[{size, seed}];
+    if (bytes.size() != size) {
+        std::mt19937_64 rng(seed);
+        bytes.resize(size);
+        for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+            uint64_t word = rng();
+            memcpy(bytes.data() + i, &word, std::min(sizeof(word), size - i));
+        }
+    }
+    return bytes;
+}
+
+const std::vector<uint8_t>& aesKey() {
+    return randomBytes(AESKeyLengthInBytes, 2);
+}
+
+void setThroughput(benchmark::State& state) {
+    state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+void BM_XorVectors(benchmark::State& state) {
+    const auto& data = randomBytes(state.range(0));
+    const auto& otp = randomBytes(state.range(0), 2);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(xorVectors(otp, data));
+    }
+    setThroughput(state);
+}
+
+void BM_ByteVecToHexStr(benchmark::State& state) {
+    std::vector<uint8_t> data = randomBytes(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(byteVecToHexStr(data));
+    }
+    setThroughput(state);
+}
+
+void BM_HexStrToByteVec(benchmark::State& state) {
+    std::vector<uint8_t> data = randomBytes(state.range(0));
+    std::string hex = byteVecToHexStr(data);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hexStrToByteVec(hex));
+    }
+    setThroughput(state);
+}
+
+template <std::vector<uint8_t> (*Crypt)(const std::vector<uint8_t>, const std::vector<uint8_t>&)>
+void BM_AESEncrypt(benchmark::State& state) {
+    const auto& data = randomBytes(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Crypt(aesKey(), data));
+    }
+    setThroughput(state);
+}
+
+template <std::vector<uint8_t> (*Encrypt)(const std::vector<uint8_t>, const std::vector<uint8_t>&),
+          std::vector<uint8_t> (*Decrypt)(const std::vector<uint8_t>, const std::vector<uint8_t>&)>
+void BM_AESDecrypt(benchmark::State& state) {
+    std::vector<uint8_t> ciphertext = Encrypt(aesKey(), randomBytes(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Decrypt(aesKey(), ciphertext));
+    }
+    setThroughput(state);
+}
+
+// The whole encryptDecrypt() path used by "qrypt encrypt", including key parsing and stream I/O,
+// with in-memory streams standing in for the files.
+void BM_EncryptDecrypt(benchmark::State& state, const std::string& key_type, const std::string& aes_mode) {
+    const auto& data = randomBytes(state.range(0));
+    std::vector<uint8_t> key = key_type == "otp" ? randomBytes(state.range(0), 2) : aesKey();
+    std::string key_string(key.begin(), key.end());
+    std::string plaintext(data.begin(), data.end());
+
+    std::istringstream key_stream(key_string);
+    std::istringstream input_stream(plaintext);
+    std::ostringstream output_stream;
+    for (auto _ : state) {
+        key_stream.clear();
+        key_stream.seekg(0);
+        input_stream.clear();
+        input_stream.seekg(0);
+        output_stream.str("");
+        encryptDecrypt("encrypt", input_stream, key_stream, output_stream, "binary", aes_mode, key_type);
+    }
+    setThroughput(state);
+}
+
+} // namespace
+
+BENCHMARK(BM_XorVectors)->Apply(sizeRange);
+BENCHMARK(BM_ByteVecToHexStr)->Apply(sizeRange);
+BENCHMARK(BM_HexStrToByteVec)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_AESEncrypt, encryptAES256ECB)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_AESDecrypt, encryptAES256ECB, decryptAES256ECB)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_AESEncrypt, encryptAES256OCB)->Apply(sizeRange);
+BENCHMARK_TEMPLATE(BM_AESDecrypt, encryptAES256OCB, decryptAES256OCB)->Apply(sizeRange);
+BENCHMARK_CAPTURE(BM_EncryptDecrypt, otp, "otp", "ocb")->Apply(sizeRange);
+BENCHMARK_CAPTURE(BM_EncryptDecrypt, aes_ecb, "aes", "ecb")->Apply(sizeRange);
+BENCHMARK_CAPTURE(BM_EncryptDecrypt, aes_ocb, "aes", "ocb")->Apply(sizeRange);
+
+// Print the usual console table, and unless the caller chose their own output file, also write the
+// results as JSON to qrypt_bench.json in the build directory for comparison between releases (e.g. with
+// Google Benchmark's tools/compare.py).
+int main(int argc, char** argv) {
+    std::vector<char*> args(argv, argv + argc);
+    bool has_out = false;
+    for (int i = 1; i < argc; i++) {
+        has_out |= strncmp(argv[i], "--benchmark_out=", strlen("--benchmark_out=")) == 0;
+    }
+    std::string out_arg = "--benchmark_out=" QRYPT_BENCH_OUT_DIR "/qrypt_bench.json";
+    std::string format_arg = "--benchmark_out_format=json";
+    if (!has_out) {
+        args.push_back(&out_arg[0]);
+        args.push_back(&format_arg[0]);
+    }
+    int args_count = (int)args.size();
+
+    benchmark::Initialize(&args_count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_count, args.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
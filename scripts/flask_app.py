@@ -1,16 +1,132 @@
-from flask import Flask, send_from_directory, request
+from flask import Flask, send_from_directory, request, jsonify
+import hashlib
+import os
+import shutil
 
 app = Flask(__name__)
 
+UPLOAD_DIR = '/workspaces/qrypt-security-quickstarts-cpp/'
+
 @app.route('/upload', methods=['POST'])
 def upload_file():
     file = request.files['file']
     if file:
-        dest_path = '/workspaces/qrypt-security-quickstarts-cpp/' + file.filename
-        file.save(dest_path)
+        dest_path = UPLOAD_DIR + os.path.basename(file.filename)
+        # Save under a temporary name first so that a watcher ("qrypt replicate --watch-dir") never sees a
+        # partly written file
+        tmp_path = os.path.join(UPLOAD_DIR, '.' + os.path.basename(file.filename) + '.tmp')
+        file.save(tmp_path)
+        os.replace(tmp_path, dest_path)
         return 'File uploaded successfully to the remote codespace at ' + dest_path
     else:
         return 'No file received.'
 
+# Chunked uploads ("qrypt send --chunk-size=<KB>")
+#
+# Chunks are kept in a hidden directory next to the destination until every chunk has arrived, so an
+# interrupted upload can be resumed by asking which chunks were already received. A status request starts
+# the session; chunks and completion for a session that is gone, or that belongs to another upload of the
+# same name, are answered with 404 or 409 so that the client starts over from the status request.
+
+class SessionError(Exception):
+    def __init__(self, message, status_code):
+        super().__init__(message)
+        self.status_code = status_code
+
+def _upload_session(args, create=False):
+    name = os.path.basename(args.get('name', ''))
+    size = int(args.get('size', -1))
+    chunk_size = int(args.get('chunk_size', 0))
+    if not name or size < 0 or chunk_size <= 0:
+        raise ValueError('Missing or invalid name, size or chunk_size')
+    chunk_count = max(1, (size + chunk_size - 1) // chunk_size)
+
+    parts_dir = os.path.join(UPLOAD_DIR, '.' + name + '.parts')
+    session_id = '%d:%d' % (size, chunk_size)
+    session_path = os.path.join(parts_dir, 'session')
+    try:
+        with open(session_path) as session_file:
+            current_id = session_file.read()
+    except OSError:
+        current_id = None
+    if current_id != session_id:
+        if not create:
+            if current_id is None:
+                raise SessionError('Upload session for %s not found. Restart the upload.' % name, 404)
+            raise SessionError('Upload session for %s belongs to another upload. Restart the upload.' % name, 409)
+        # Discard chunks left over from an upload of a different file with the same name, or from a
+        # session whose session file was lost
+        shutil.rmtree(parts_dir, ignore_errors=True)
+        os.makedirs(parts_dir)
+        with open(session_path, 'w') as session_file:
+            session_file.write(session_id)
+    return name, size, chunk_size, chunk_count, parts_dir
+
+def _received_chunks(parts_dir):
+    return sorted(int(part) for part in os.listdir(parts_dir) if part.isdigit())
+
+@app.errorhandler(SessionError)
+def session_error(ex):
+    return str(ex), ex.status_code
+
+@app.route('/upload/status', methods=['GET'])
+def upload_status():
+    try:
+        _, _, _, _, parts_dir = _upload_session(request.args, create=True)
+    except ValueError as ex:
+        return str(ex), 400
+    return jsonify(received=_received_chunks(parts_dir))
+
+@app.route('/upload/chunk', methods=['POST'])
+def upload_chunk():
+    try:
+        name, size, chunk_size, chunk_count, parts_dir = _upload_session(request.form)
+        index = int(request.form['index'])
+    except (KeyError, ValueError) as ex:
+        return str(ex), 400
+    chunk = request.files.get('chunk')
+    if chunk is None or index < 0 or index >= chunk_count:
+        return 'No chunk received.', 400
+
+    data = chunk.read()
+    expected_len = min(chunk_size, size - index * chunk_size)
+    if len(data) != expected_len or hashlib.sha256(data).hexdigest() != request.form.get('sha256'):
+        return 'Chunk %d failed its checksum.' % index, 400
+
+    # Write then rename, so a dropped connection never leaves a partial chunk that looks complete
+    part_path = os.path.join(parts_dir, str(index))
+    try:
+        with open(part_path + '.tmp', 'wb') as part_file:
+            part_file.write(data)
+        os.replace(part_path + '.tmp', part_path)
+    except FileNotFoundError:
+        raise SessionError('Upload session for %s was removed. Restart the upload.' % name, 404)
+    return 'ok'
+
+@app.route('/upload/complete', methods=['POST'])
+def upload_complete():
+    try:
+        name, _, _, chunk_count, parts_dir = _upload_session(request.form)
+    except ValueError as ex:
+        return str(ex), 400
+    missing = set(range(chunk_count)) - set(_received_chunks(parts_dir))
+    if missing:
+        return 'Missing chunks: ' + ','.join(str(index) for index in sorted(missing)), 400
+
+    dest_path = UPLOAD_DIR + name
+    tmp_path = os.path.join(UPLOAD_DIR, '.' + name + '.tmp')
+    try:
+        with open(tmp_path, 'wb') as dest_file:
+            for index in range(chunk_count):
+                with open(os.path.join(parts_dir, str(index)), 'rb') as part_file:
+                    shutil.copyfileobj(part_file, dest_file)
+    except FileNotFoundError:
+        if os.path.exists(tmp_path):
+            os.remove(tmp_path)
+        raise SessionError('Upload session for %s was removed. Restart the upload.' % name, 404)
+    os.replace(tmp_path, dest_path)
+    shutil.rmtree(parts_dir)
+    return 'File uploaded successfully to the remote codespace at ' + dest_path
+
 if __name__ == '__main__':
     app.run(debug=True, port=5000, host='0.0.0.0')
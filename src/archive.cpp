@@ -0,0 +1,321 @@
+#include "archive.h"
+#include "common.h"
+#include "encrypt.h"
+#include "trace.h"
+
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+static void appendU64(std::vector<uint8_t>& out, uint64_t value) {
+    std::vector<uint8_t> encoded = encodeU64Field(value);
+    out.insert(out.end(), encoded.begin(), encoded.end());
+}
+
+static uint64_t readU64(const uint8_t* data) {
+    return decodeU64Field(std::vector<uint8_t>(data, data + 8));
+}
+
+// Encrypt or decrypt one segment, or the index, with its own derived key
+static void cryptSegment(const std::string& operation, const std::vector<uint8_t>& key, const std::vector<uint8_t>& salt,
+                         const std::string& key_context, uint64_t index, const std::vector<uint8_t>& aad,
+                         const uint8_t* input, size_t size, std::vector<uint8_t>& output) {
+    CryptStream stream(operation, key, "ocb", "aes");
+    stream.useDerivedKey(chunkSalt(salt, index), key_context);
+    stream.setAssociatedData(aad.data(), aad.size());
+    output.clear();
+    stream.update(input, size, output);
+    stream.finish(output);
+}
+
+ArchiveWriter::ArchiveWriter(std::ostream& output, const std::vector<uint8_t>& key, const std::string& key_context,
+                             uint64_t segment_size) :
+                             output(output), key(key), key_context(key_context), segment_size(segment_size) {
+    if (key.size() != AESKeyLengthInBytes) {
+        throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
+    }
+    if (segment_size == 0) {
+        throw std::invalid_argument("Invalid archive segment size: 0");
+    }
+    if (key_context.size() > MAX_KEY_CONTEXT_SIZE) {
+        throw std::invalid_argument("Key context must be at most " + std::to_string(MAX_KEY_CONTEXT_SIZE) + " bytes");
+    }
+    salt.resize(HKDF_SALT_SIZE);
+    if (RAND_bytes(salt.data(), salt.size()) != OPENSSL_SUCCESS) {
+        throw std::runtime_error("RAND_bytes() failed!");
+    }
+    CryptHeader crypt_header;
+    crypt_header.flags = CRYPT_HEADER_FLAG_HKDF | CRYPT_HEADER_FLAG_ARCHIVE;
+    crypt_header.fields[CRYPT_HEADER_FIELD_HKDF_SALT] = salt;
+    if (!key_context.empty()) {
+        crypt_header.fields[CRYPT_HEADER_FIELD_KEY_CONTEXT].assign(key_context.begin(), key_context.end());
+    }
+    crypt_header.fields[CRYPT_HEADER_FIELD_CHUNK_SIZE] = encodeU64Field(segment_size);
+    header = crypt_header.serialize();
+    if (!output.write((const char*)header.data(), header.size())) {
+        throw std::runtime_error("Unable to write archive.");
+    }
+    segment.reserve(segment_size);
+}
+
+void ArchiveWriter::add(const std::string& name, std::istream& data) {
+    TRACE_SCOPE("archive add");
+    if (name.empty() || name.size() > 0xFFFF) {
+        throw std::invalid_argument("Invalid archive member name: \"" + name + "\"");
+    }
+    if (!names.emplace(name, members.size()).second) {
+        throw std::invalid_argument("Archive already has a member named \"" + name + "\"");
+    }
+    ArchiveMember member = { name, contents_size, 0 };
+    while (data) {
+        size_t start = segment.size();
+        segment.resize(segment_size);
+        data.read((char*)segment.data() + start, segment_size - start);
+        segment.resize(start + data.gcount());
+        member.size += data.gcount();
+        if (segment.size() == segment_size) {
+            writeSegment();
+        }
+    }
+    if (data.bad()) {
+        throw std::runtime_error("Unable to read archive member \"" + name + "\"");
+    }
+    contents_size += member.size;
+    members.push_back(member);
+}
+
+void ArchiveWriter::writeSegment() {
+    TRACE_SCOPE("archive segment", segment.size());
+    cryptSegment("encrypt", key, salt, key_context, segments_written++, header, segment.data(), segment.size(),
+                 ciphertext);
+    if (!output.write((const char*)ciphertext.data(), ciphertext.size())) {
+        throw std::runtime_error("Unable to write archive.");
+    }
+    segment.clear();
+}
+
+void ArchiveWriter::finish() {
+    if (!segment.empty()) {
+        writeSegment();
+    }
+    std::vector<uint8_t> index;
+    for (const ArchiveMember& member : members) {
+        index.push_back((uint8_t)(member.name.size() & 0xFF));
+        index.push_back((uint8_t)(member.name.size() >> 8));
+        index.insert(index.end(), member.name.begin(), member.name.end());
+        appendU64(index, member.offset);
+        appendU64(index, member.size);
+    }
+    std::vector<uint8_t> trailer;
+    appendU64(trailer, contents_size);
+    appendU64(trailer, index.size());
+    trailer.insert(trailer.end(), ARCHIVE_TRAILER_MAGIC, ARCHIVE_TRAILER_MAGIC + sizeof(ARCHIVE_TRAILER_MAGIC));
+
+    // The trailer is authenticated with the index, so neither can be swapped for another archive's
+    std::vector<uint8_t> aad = header;
+    aad.insert(aad.end(), trailer.begin(), trailer.end());
+    cryptSegment("encrypt", key, salt, key_context, segments_written, aad, index.data(), index.size(), ciphertext);
+    if (!output.write((const char*)ciphertext.data(), ciphertext.size()) ||
+        !output.write((const char*)trailer.data(), trailer.size()) || !output.flush()) {
+        throw std::runtime_error("Unable to write archive.");
+    }
+}
+
+ArchiveReader::ArchiveReader(std::istream& input, const std::vector<uint8_t>& key) : input(input), key(key) {
+    TRACE_SCOPE("archive read index");
+    if (key.size() != AESKeyLengthInBytes) {
+        throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
+    }
+    uint8_t magic[CRYPT_HEADER_MAGIC_SIZE];
+    if (!input.read((char*)magic, sizeof(magic)) || !startsWithCryptHeader(magic, sizeof(magic))) {
+        throw std::invalid_argument("Input is not an archive.");
+    }
+    header = CryptHeader::read(input, raw_header);
+    if (header.flags != (CRYPT_HEADER_FLAG_HKDF | CRYPT_HEADER_FLAG_ARCHIVE)) {
+        throw std::invalid_argument("Input is not an archive.");
+    }
+    if (header.fields[CRYPT_HEADER_FIELD_HKDF_SALT].empty()) {
+        throw std::invalid_argument("Ciphertext header is missing the key derivation salt.");
+    }
+    segment_size = decodeU64Field(header.fields[CRYPT_HEADER_FIELD_CHUNK_SIZE]);
+
+    input.seekg(0, std::ios::end);
+    std::streamoff archive_size = input.tellg();
+    uint8_t trailer[ARCHIVE_TRAILER_SIZE];
+    if (archive_size < (std::streamoff)(raw_header.size() + ARCHIVE_TRAILER_SIZE) ||
+        !input.seekg(archive_size - ARCHIVE_TRAILER_SIZE) || !input.read((char*)trailer, sizeof(trailer)) ||
+        memcmp(trailer + 16, ARCHIVE_TRAILER_MAGIC, sizeof(ARCHIVE_TRAILER_MAGIC)) != 0) {
+        throw std::invalid_argument("Archive is truncated.");
+    }
+    contents_size = readU64(trailer);
+    uint64_t index_size = readU64(trailer + 8);
+    ChunkLayout layout(contents_size, segment_size, "ocb");
+    uint64_t index_offset = raw_header.size();
+    if (layout.count > 0) {
+        index_offset += layout.ciphertextOffset(layout.count - 1) + layout.ciphertextSize(layout.count - 1);
+    }
+    if (index_offset + encryptedSize(index_size, "ocb", "aes") + ARCHIVE_TRAILER_SIZE != (uint64_t)archive_size) {
+        throw std::invalid_argument("Archive is truncated or has unexpected data.");
+    }
+
+    std::vector<uint8_t> aad = raw_header;
+    aad.insert(aad.end(), trailer, trailer + sizeof(trailer));
+    std::vector<uint8_t> plain_index =
+        decryptSegment(layout.count, index_offset, encryptedSize(index_size, "ocb", "aes"), aad);
+    for (size_t offset = 0; offset < plain_index.size();) {
+        if (plain_index.size() - offset < 2) {
+            throw std::invalid_argument("Archive index is malformed.");
+        }
+        size_t name_size = plain_index[offset] | (plain_index[offset + 1] << 8);
+        offset += 2;
+        if (plain_index.size() - offset < name_size + 16) {
+            throw std::invalid_argument("Archive index is malformed.");
+        }
+        ArchiveMember member;
+        member.name.assign(plain_index.begin() + offset, plain_index.begin() + offset + name_size);
+        offset += name_size;
+        member.offset = readU64(plain_index.data() + offset);
+        member.size = readU64(plain_index.data() + offset + 8);
+        offset += 16;
+        if (member.offset > contents_size || member.size > contents_size - member.offset) {
+            throw std::invalid_argument("Archive index is malformed.");
+        }
+        names[member.name] = index.size();
+        index.push_back(member);
+    }
+}
+
+std::vector<uint8_t> ArchiveReader::decryptSegment(uint64_t segment, uint64_t offset, uint64_t size,
+                                                   const std::vector<uint8_t>& aad) {
+    std::vector<uint8_t> ciphertext(size), plaintext;
+    input.clear();
+    if (!input.seekg(offset) || !input.read((char*)ciphertext.data(), size)) {
+        throw std::invalid_argument("Archive is truncated.");
+    }
+    const std::vector<uint8_t>& salt = header.fields[CRYPT_HEADER_FIELD_HKDF_SALT];
+    const std::vector<uint8_t>& context = header.fields[CRYPT_HEADER_FIELD_KEY_CONTEXT];
+    cryptSegment("decrypt", key, salt, std::string(context.begin(), context.end()), segment, aad,
+                 ciphertext.data(), ciphertext.size(), plaintext);
+    return plaintext;
+}
+
+const std::vector<uint8_t>& ArchiveReader::contentsSegment(uint64_t segment) {
+    if (segment != cached_segment) {
+        ChunkLayout layout(contents_size, segment_size, "ocb");
+        cached_segment = UINT64_MAX; // in case decryption throws
+        cached_plaintext = decryptSegment(segment, raw_header.size() + layout.ciphertextOffset(segment),
+                                          layout.ciphertextSize(segment), raw_header);
+        cached_segment = segment;
+    }
+    return cached_plaintext;
+}
+
+const ArchiveMember& ArchiveReader::find(const std::string& name) const {
+    auto found = names.find(name);
+    if (found == names.end()) {
+        throw std::invalid_argument("Archive has no member named \"" + name + "\"");
+    }
+    return index[found->second];
+}
+
+void ArchiveReader::extract(const ArchiveMember& member, std::ostream& output) {
+    TRACE_SCOPE("archive extract", member.size);
+    if (member.size == 0) {
+        return;
+    }
+    uint64_t first = member.offset / segment_size;
+    uint64_t last = (member.offset + member.size - 1) / segment_size;
+    for (uint64_t segment = first; segment <= last; segment++) {
+        const std::vector<uint8_t>& plaintext = contentsSegment(segment);
+        uint64_t segment_offset = segment * segment_size;
+        uint64_t begin = std::max(member.offset, segment_offset) - segment_offset;
+        uint64_t end = std::min(member.offset + member.size, segment_offset + plaintext.size()) - segment_offset;
+        if (!output.write((const char*)plaintext.data() + begin, end - begin)) {
+            throw std::runtime_error("Unable to write archive member \"" + member.name + "\"");
+        }
+    }
+}
+
+static std::vector<uint8_t> readAESKey(const std::string& key_filename) {
+    std::ifstream key_file(key_filename, std::ios::in | std::ios::binary);
+    if (!key_file.is_open()) {
+        throw std::invalid_argument("Unable to open key file " + key_filename);
+    }
+    return readKey(key_file);
+}
+
+size_t createArchive(const std::string& input_dir, const std::string& archive_filename,
+                     const std::string& key_filename, const std::string& key_context) {
+    TRACE_SCOPE("createArchive");
+    std::vector<fs::path> files;
+    for (const auto& entry : fs::recursive_directory_iterator(input_dir, fs::directory_options::skip_permission_denied)) {
+        if (entry.is_regular_file()) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    std::ofstream archive(archive_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!archive.is_open()) {
+        throw std::invalid_argument("Unable to open output file " + archive_filename);
+    }
+    ArchiveWriter writer(archive, readAESKey(key_filename), key_context);
+    for (const fs::path& file : files) {
+        std::ifstream data(file, std::ios::in | std::ios::binary);
+        if (!data.is_open()) {
+            throw std::runtime_error("Unable to open input file " + file.string());
+        }
+        writer.add(fs::relative(file, input_dir).generic_string(), data);
+    }
+    writer.finish();
+    return files.size();
+}
+
+static std::ifstream openArchive(const std::string& archive_filename) {
+    std::ifstream archive(archive_filename, std::ios::in | std::ios::binary);
+    if (!archive.is_open()) {
+        throw std::invalid_argument("Unable to open input file " + archive_filename);
+    }
+    return archive;
+}
+
+std::vector<ArchiveMember> listArchive(const std::string& archive_filename, const std::string& key_filename) {
+    std::ifstream archive = openArchive(archive_filename);
+    return ArchiveReader(archive, readAESKey(key_filename)).members();
+}
+
+void extractArchiveMember(const std::string& archive_filename, const std::string& key_filename,
+                          const std::string& name, std::ostream& output) {
+    std::ifstream archive = openArchive(archive_filename);
+    ArchiveReader reader(archive, readAESKey(key_filename));
+    reader.extract(reader.find(name), output);
+    output.flush();
+}
+
+size_t extractArchive(const std::string& archive_filename, const std::string& key_filename,
+                      const std::string& output_dir) {
+    TRACE_SCOPE("extractArchive");
+    std::ifstream archive = openArchive(archive_filename);
+    ArchiveReader reader(archive, readAESKey(key_filename));
+    for (const ArchiveMember& member : reader.members()) {
+        // Never write outside output_dir, whatever the index says
+        fs::path name = fs::path(member.name).lexically_normal();
+        if (name.empty() || name.is_absolute() || name.has_root_path() || *name.begin() == "..") {
+            throw std::invalid_argument("Archive member has an unsafe name: \"" + member.name + "\"");
+        }
+        fs::path output_path = fs::path(output_dir) / name;
+        fs::create_directories(output_path.parent_path());
+        std::ofstream output(output_path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!output.is_open()) {
+            throw std::runtime_error("Unable to open output file " + output_path.string());
+        }
+        reader.extract(member, output);
+    }
+    return reader.members().size();
+}
@@ -0,0 +1,106 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "crypt_header.h"
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// An archive packs many files into one ciphertext, so a tree of small files costs one file on disk rather
+// than one each. Layout:
+//
+//   CryptHeader   flags HKDF | ARCHIVE, with the salt, key context and segment size (CHUNK_SIZE field)
+//   segments      the members' contents back to back, cut into segments of segment size bytes. Segment i
+//                 is encrypted with AES-256-OCB under the key derived from salt || i, see chunkSalt(), with
+//                 the header as associated data.
+//   index         each member's name, offset in the contents and size, encrypted like segment n, where n
+//                 is the number of segments, with the header and trailer as associated data
+//   trailer       size of the contents (8 bytes, little endian), size of the index (8 bytes, little endian)
+//                 and ARCHIVE_TRAILER_MAGIC
+//
+// A reader finds the index from the trailer, then decrypts only the segments that hold the member it wants.
+const uint64_t DEFAULT_ARCHIVE_SEGMENT_SIZE = 1024 * 1024;
+const uint8_t ARCHIVE_TRAILER_MAGIC[] = {'Q', 'R', 'Y', 'P', 'T', 'I', 'D', 'X'};
+const size_t ARCHIVE_TRAILER_SIZE = 16 + sizeof(ARCHIVE_TRAILER_MAGIC);
+
+struct ArchiveMember {
+    std::string name; // relative path, with / between directories
+    uint64_t offset;  // in the archive's contents
+    uint64_t size;
+};
+
+class ArchiveWriter {
+public:
+    ArchiveWriter(std::ostream& output, const std::vector<uint8_t>& key, const std::string& key_context = "",
+                  uint64_t segment_size = DEFAULT_ARCHIVE_SEGMENT_SIZE);
+
+    // Append a member, reading data to the end
+    void add(const std::string& name, std::istream& data);
+    // Write the last segment, the index and the trailer
+    void finish();
+
+    uint64_t contentsSize() const { return contents_size; }
+
+private:
+    void writeSegment();
+
+    std::ostream& output;
+    std::vector<uint8_t> key;
+    std::string key_context;
+    uint64_t segment_size;
+    std::vector<uint8_t> salt;
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> segment;
+    std::vector<uint8_t> ciphertext;
+    uint64_t segments_written = 0;
+    uint64_t contents_size = 0;
+    std::vector<ArchiveMember> members;
+    std::map<std::string, size_t> names; // to reject duplicates
+};
+
+class ArchiveReader {
+public:
+    // Reads and authenticates the index; input must be seekable
+    ArchiveReader(std::istream& input, const std::vector<uint8_t>& key);
+
+    const std::vector<ArchiveMember>& members() const { return index; }
+    // Throws std::invalid_argument if the archive has no member of this name
+    const ArchiveMember& find(const std::string& name) const;
+    // Decrypt one member, reading only the segments that hold it. The last segment decrypted is kept, so
+    // extracting members in index order decrypts each segment once.
+    void extract(const ArchiveMember& member, std::ostream& output);
+
+private:
+    std::vector<uint8_t> decryptSegment(uint64_t segment, uint64_t offset, uint64_t size, const std::vector<uint8_t>& aad);
+    const std::vector<uint8_t>& contentsSegment(uint64_t segment);
+
+    std::istream& input;
+    std::vector<uint8_t> key;
+    CryptHeader header;
+    std::vector<uint8_t> raw_header;
+    uint64_t segment_size = 0;
+    uint64_t contents_size = 0;
+    std::vector<ArchiveMember> index;
+    std::map<std::string, size_t> names;
+    uint64_t cached_segment = UINT64_MAX; // none
+    std::vector<uint8_t> cached_plaintext;
+};
+
+// Archive every regular file under input_dir into archive_filename. Returns the number of members.
+size_t createArchive(const std::string& input_dir, const std::string& archive_filename,
+                     const std::string& key_filename, const std::string& key_context = "");
+
+std::vector<ArchiveMember> listArchive(const std::string& archive_filename, const std::string& key_filename);
+
+// Decrypt one member of the archive to output
+void extractArchiveMember(const std::string& archive_filename, const std::string& key_filename,
+                          const std::string& name, std::ostream& output);
+
+// Extract every member of the archive under output_dir. Returns the number of members.
+size_t extractArchive(const std::string& archive_filename, const std::string& key_filename,
+                      const std::string& output_dir);
+
+#endif /* ARCHIVE_H */
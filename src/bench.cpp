@@ -0,0 +1,240 @@
+#include "bench.h"
+#include "common.h"
+#include "encrypt.h"
+#include "offline_keygen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const size_t BenchWriteBlockSize = 1024 * 1024;
+
+// Start a new peak RSS measurement. Only Linux can reset the peak; elsewhere the process peak so far
+// is reported, so run the largest sizes last.
+void resetPeakRss() {
+#if defined(__linux__)
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+#endif
+}
+
+uint64_t readPeakRss() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) {
+            return std::stoull(line.substr(strlen("VmHWM:"))) * 1024;
+        }
+    }
+    return 0;
+#elif defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters = {};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t)usage.ru_maxrss; // bytes on macOS
+#endif
+}
+
+// Run fn(thread_index) on each of thread_count threads and return the wall time taken
+double runThreads(unsigned thread_count, const std::function<void(unsigned)>& fn) {
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < thread_count; t++) {
+        workers.emplace_back([&, t]() {
+            try {
+                fn(t);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return elapsed;
+}
+
+void writeRandomFile(const std::string& filename, uint64_t size, uint64_t seed) {
+    std::ofstream file(filename, std::ios::out | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open " + filename);
+    }
+    std::mt19937_64 rng(seed);
+    std::vector<uint64_t> block(BenchWriteBlockSize / sizeof(uint64_t));
+    for (uint64_t written = 0; written < size; ) {
+        std::generate(block.begin(), block.end(), std::ref(rng));
+        size_t len = (size_t)std::min<uint64_t>(BenchWriteBlockSize, size - written);
+        file.write((const char*)block.data(), len);
+        written += len;
+    }
+    if (!file) {
+        throw std::runtime_error("Unable to write " + filename);
+    }
+}
+
+bool filesEqual(const std::string& a, const std::string& b) {
+    std::ifstream file_a(a, std::ios::in | std::ios::binary);
+    std::ifstream file_b(b, std::ios::in | std::ios::binary);
+    return std::equal(std::istreambuf_iterator<char>(file_a), {}, std::istreambuf_iterator<char>(file_b), {});
+}
+
+// Same steps as "qrypt encrypt" and "qrypt decrypt"
+void cryptFile(const std::string& operation, const std::string& input_filename, const std::string& key_filename,
+               const std::string& output_filename, const std::string& aes_mode, const std::string& key_type) {
+    std::ifstream input_file(input_filename, std::ios::in | std::ios::binary);
+    std::ifstream key_file(key_filename, std::ios::in | std::ios::binary);
+    std::ofstream output_file(output_filename, std::ios::out | std::ios::binary);
+    if (!input_file.is_open() || !key_file.is_open() || !output_file.is_open()) {
+        throw std::runtime_error("Unable to open benchmark files in the work directory");
+    }
+    encryptDecrypt(operation, input_file, key_file, output_file, "binary", aes_mode, key_type);
+}
+
+std::string humanSize(uint64_t size) {
+    const char* units[] = {"B", "KB", "MB", "GB"};
+    int unit = 0;
+    while (unit < 3 && size >= 1024 && size % 1024 == 0) {
+        size /= 1024;
+        unit++;
+    }
+    return std::to_string(size) + units[unit];
+}
+
+} // namespace
+
+std::vector<BenchResult> runBench(const BenchConfig& config) {
+    unsigned max_threads = *std::max_element(config.threads.begin(), config.threads.end());
+    std::string prefix = (fs::path(config.work_dir) / "qrypt-bench-").string();
+    auto filename = [&](unsigned t, const std::string& suffix) { return prefix + std::to_string(t) + suffix; };
+
+    auto remove_files = [&]() {
+        for (unsigned t = 0; t < max_threads; t++) {
+            for (const char* suffix : {".plain", ".key", ".enc", ".dec"}) {
+                fs::remove(filename(t, suffix));
+            }
+        }
+    };
+
+    std::vector<BenchResult> results;
+    OfflineKeyGen keygen;
+    try {
+        for (uint64_t size : config.sizes) {
+            // Synthetic plaintext, one file per thread
+            for (unsigned t = 0; t < max_threads; t++) {
+                writeRandomFile(filename(t, ".plain"), size, t + 1);
+            }
+
+            for (const auto& key_type : config.key_types) {
+                std::vector<std::string> aes_modes = key_type == "otp" ? std::vector<std::string>{"-"} : config.aes_modes;
+                for (const auto& aes_mode : aes_modes) {
+                    for (unsigned threads : config.threads) {
+                        size_t key_size = key_type == "otp" ? size : AESKeyLengthInBytes;
+                        std::string mode = key_type == "otp" ? "ocb" : aes_mode;
+                        uint64_t ops = (uint64_t)threads * config.iterations;
+
+                        auto measure = [&](const std::string& operation, uint64_t op_size,
+                                           const std::function<void(unsigned)>& op) {
+                            resetPeakRss();
+                            double seconds = runThreads(threads, [&](unsigned t) {
+                                for (unsigned i = 0; i < config.iterations; i++) {
+                                    op(t);
+                                }
+                            });
+                            results.push_back({operation, key_type, aes_mode, op_size, threads, ops, seconds,
+                                               (double)op_size * ops / seconds / 1e9, ops / seconds, readPeakRss()});
+                        };
+
+                        // Sender generates the key, receiver replicates it from the metadata
+                        measure("keygen", key_size, [&](unsigned t) {
+                            QryptSecurity::SymmetricKeyData key_and_metadata = keygen.genInit(key_size);
+                            std::vector<uint8_t> key = keygen.genSync(key_and_metadata.metadata);
+                            std::ofstream key_file(filename(t, ".key"), std::ios::out | std::ios::binary);
+                            key_file.write((const char*)key.data(), key.size());
+                        });
+                        measure("encrypt", size, [&](unsigned t) {
+                            cryptFile("encrypt", filename(t, ".plain"), filename(t, ".key"), filename(t, ".enc"), mode, key_type);
+                        });
+                        measure("decrypt", size, [&](unsigned t) {
+                            cryptFile("decrypt", filename(t, ".enc"), filename(t, ".key"), filename(t, ".dec"), mode, key_type);
+                        });
+
+                        for (unsigned t = 0; t < threads; t++) {
+                            if (!filesEqual(filename(t, ".plain"), filename(t, ".dec"))) {
+                                throw std::runtime_error("Decrypted output does not match the plaintext!");
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    catch (...) {
+        remove_files();
+        throw;
+    }
+    remove_files();
+    return results;
+}
+
+void printBenchTable(const std::vector<BenchResult>& results, std::ostream& out) {
+    out << std::left << std::setw(10) << "Operation" << std::setw(6) << "Key" << std::setw(6) << "Mode"
+        << std::right << std::setw(8) << "Size" << std::setw(9) << "Threads" << std::setw(14) << "Ops/sec"
+        << std::setw(10) << "GB/s" << std::setw(16) << "Peak RSS (MB)" << std::endl;
+    for (const auto& result : results) {
+        out << std::left << std::setw(10) << result.operation << std::setw(6) << result.key_type
+            << std::setw(6) << result.aes_mode << std::right << std::setw(8) << humanSize(result.size)
+            << std::setw(9) << result.threads << std::fixed << std::setprecision(1) << std::setw(14) << result.ops_per_sec
+            << std::setprecision(3) << std::setw(10) << result.gb_per_sec
+            << std::setprecision(1) << std::setw(16) << result.peak_rss / (1024.0 * 1024.0) << std::endl;
+    }
+    out << std::defaultfloat;
+}
+
+void writeBenchJson(const std::vector<BenchResult>& results, std::ostream& out) {
+    out << "{\"results\":[" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto& result = results[i];
+        out << "  {\"operation\":\"" << result.operation << "\",\"key_type\":\"" << result.key_type
+            << "\",\"aes_mode\":\"" << result.aes_mode << "\",\"size\":" << result.size
+            << ",\"threads\":" << result.threads << ",\"ops\":" << result.ops
+            << ",\"seconds\":" << result.seconds << ",\"gb_per_sec\":" << result.gb_per_sec
+            << ",\"ops_per_sec\":" << result.ops_per_sec << ",\"peak_rss_bytes\":" << result.peak_rss << "}"
+            << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "]}" << std::endl;
+}
@@ -0,0 +1,39 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchConfig {
+    std::vector<std::string> key_types;
+    std::vector<std::string> aes_modes;
+    std::vector<uint64_t> sizes;
+    std::vector<unsigned> threads;
+    unsigned iterations;
+    std::string work_dir;
+};
+
+struct BenchResult {
+    std::string operation; // keygen, encrypt or decrypt
+    std::string key_type;
+    std::string aes_mode;  // "-" for otp
+    uint64_t size;         // bytes per operation
+    unsigned threads;
+    uint64_t ops;
+    double seconds;
+    double gb_per_sec;
+    double ops_per_sec;
+    uint64_t peak_rss;     // bytes, 0 if unknown
+};
+
+// For every combination of key type, AES mode, size and thread count, generate keys with
+// OfflineKeyGen and run the same file-based encrypt and decrypt path as "qrypt encrypt/decrypt" over
+// synthetic data, with each thread working on its own files. Every decrypted file is checked against
+// its plaintext.
+std::vector<BenchResult> runBench(const BenchConfig& config);
+
+void printBenchTable(const std::vector<BenchResult>& results, std::ostream& out = std::cout);
+void writeBenchJson(const std::vector<BenchResult>& results, std::ostream& out);
+
+#endif /* BENCH_H */
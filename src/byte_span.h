@@ -0,0 +1,45 @@
+#ifndef BYTE_SPAN_H
+#define BYTE_SPAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+// Non-owning view of contiguous memory, standing in for C++20 std::span until the project moves past C++17
+template <typename T>
+class Span {
+public:
+    Span() = default;
+    Span(T* data, size_t size) : ptr(data), len(size) {}
+    template <typename U, typename A>
+    Span(std::vector<U, A>& vector) : ptr(vector.data()), len(vector.size()) {}
+    template <typename U, typename A>
+    Span(const std::vector<U, A>& vector) : ptr(vector.data()), len(vector.size()) {}
+    // A span of bytes converts to a span of const bytes
+    template <typename U>
+    Span(Span<U> other) : ptr(other.data()), len(other.size()) {}
+
+    T* data() const { return ptr; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    T* begin() const { return ptr; }
+    T* end() const { return ptr + len; }
+    T& operator[](size_t index) const { return ptr[index]; }
+
+    Span subspan(size_t offset, size_t count = SIZE_MAX) const {
+        if (offset > len) {
+            throw std::out_of_range("Span offset is out of range");
+        }
+        return Span(ptr + offset, count < len - offset ? count : len - offset);
+    }
+
+private:
+    T* ptr = nullptr;
+    size_t len = 0;
+};
+
+using ByteSpan = Span<const uint8_t>;
+using MutableByteSpan = Span<uint8_t>;
+
+#endif /* BYTE_SPAN_H */
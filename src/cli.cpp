@@ -1,15 +1,40 @@
 #include "common.h"
 #include "cli.h"
 #include "encrypt.h"
+#include "compress.h"
+#include "archive.h"
+#include "incremental.h"
+#include "dir_crypt.h"
+#include "io_engine.h"
+#include "pad_ledger.h"
+#include "key_file.h"
+#include "mem_profile.h"
+#include "metrics.h"
+#include "trace.h"
 #include "keygen.h"
 #include "eaas.h"
+#include "drbg.h"
+#include "nist.h"
+#include "upload.h"
+#include "bench.h"
 
-#include "QryptSecurity/qryptsecurity_exceptions.h"
-
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <thread>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #ifdef ENABLE_TESTS
 #include <gtest/gtest.h>
@@ -17,29 +42,58 @@
 
 namespace fs = std::filesystem;
 
-void printUsage(std::string mode) {
+// Where errors are reported; stderr once stdout is carrying encrypted or decrypted data
+static std::ostream* message_out = &std::cout;
+
+void printUsage(std::string mode, std::ostream& out = std::cout) {
     if (mode == "generate") {
-        std::cout << GenerateUsage;
+        out << GenerateUsage;
     } else if (mode == "replicate") {
-        std::cout << ReplicateUsage;
+        out << ReplicateUsage;
     } else if (mode == "encrypt") {
-        std::cout << EncryptUsage;
+        out << EncryptUsage;
     } else if (mode == "decrypt") {
-        std::cout << DecryptUsage;
+        out << DecryptUsage;
     } else if (mode == "send") {
-        std::cout << FileSendUsage;
+        out << FileSendUsage;
     } else if (mode == "entropy") {
-        std::cout << EntropyUsage;          
+        out << EntropyUsage;          
+    } else if (mode == "random") {
+        out << RandomUsage;
+    } else if (mode == "bench") {
+        out << BenchUsage;
 #ifdef ENABLE_TESTS
     } else if (mode == "test") {
-        std::cout << TestUsage;
+        out << TestUsage;
 #endif
     } else {
-        std::cout << GeneralUsage;
+        out << GeneralUsage;
     }
 }
 
-int main(int argc, char* argv[]) {
+// Put stdin and stdout in binary mode and, where they are pipes, enlarge the pipe buffers so that each
+// block can be moved with fewer, larger reads and writes.
+static void prepareStdio() {
+#if defined(_WIN32)
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#elif defined(__linux__)
+    for (int fd : {STDIN_FILENO, STDOUT_FILENO}) {
+        if (fcntl(fd, F_GETPIPE_SZ) > 0) {
+            fcntl(fd, F_SETPIPE_SZ, (int)DEFAULT_STREAM_BLOCK_SIZE); // best effort, capped by fs.pipe-max-size
+        }
+    }
+#endif
+}
+
+static void reportPadRange(const std::optional<PadRange>& pad_range, uint64_t pad_left) {
+    if (pad_range) {
+        *message_out << "Used one-time-pad bytes " << pad_range->offset << " to "
+                     << pad_range->offset + pad_range->length << "; " << pad_left << " bytes left." << std::endl;
+    }
+}
+
+static int runCommand(int argc, char* argv[]) {
     // Set mode and handle --help
     if (argc < 2) {
         std::cout << GeneralUsage;
@@ -79,8 +133,31 @@ int main(int argc, char* argv[]) {
             // Parse and unpack cli arguments
             auto keygen_args = parseKeygenArgs(++argv);
             const auto& [
-                key_filename, metadata_filename, token, key_type, key_len, key_ttl, key_format, log_level, cacert_path
+                key_filename, metadata_filename, token, key_type, key_len, key_ttl, key_format, log_level, cacert_path,
+                count, destination, queue_depth, watch_dir
             ] = keygen_args;
+            if (mode == "generate" && !watch_dir.empty()) {
+                throw std::invalid_argument("--watch-dir is only valid for qrypt replicate");
+            }
+            if (mode == "replicate" && (!destination.empty() || (count && watch_dir.empty()))) {
+                throw std::invalid_argument("qrypt replicate takes --count only with --watch-dir, and no --destination");
+            }
+            // The receiver's /upload endpoint, from a codespace name or a full URL
+            std::string upload_url;
+            if (!destination.empty()) {
+                upload_url = destination.rfind("http", 0) == 0 ? destination : codespaceUploadUrl(destination);
+            }
+
+            // Pipelined batches of numbered files
+            if (count || !watch_dir.empty()) {
+                KeyGen keygen_client(token, key_type, key_len, key_ttl, key_format, log_level, cacert_path);
+                if (mode == "generate") {
+                    keygen_client.generateBatch(key_filename, metadata_filename, *count, upload_url, queue_depth);
+                } else {
+                    keygen_client.replicateWatch(watch_dir, key_filename, metadata_filename, count.value_or(0));
+                }
+                return 0;
+            }
 
             // Open input/output streams
             auto metadata_io_flags = ((mode == "generate") ? std::ios::out : std::ios::in) | std::ios::binary;
@@ -118,53 +195,278 @@ int main(int argc, char* argv[]) {
                 std::cout << "Wrote metadata to file: " << metadata_filename << std::endl;
             }
             metadata_file.close();
+            if (!upload_url.empty()) {
+                uploadFile(metadata_filename, upload_url);
+            }
         }
         // Use a key to encrypt or decrypt a file
         else if (mode == "encrypt" || mode == "decrypt") {
             // Parse and unpack cli arguments
             auto encrypt_decrypt_args = parseEncryptDecryptArgs(++argv);
             const auto& [
-                input_filename, output_filename, key_filename, key_type, aes_mode, file_type
+                input_filename, output_filename, key_filename, key_type, aes_mode, file_type, io_engine, compress,
+                key_context, pad_ledger, input_dir, output_dir, threads, archive, list, member, incremental
             ] = encrypt_decrypt_args;
 
-            std::ifstream input_file(input_filename, std::ios::in | std::ios::binary);
-            if (!input_file.is_open()) {
-                throw std::invalid_argument("Unable to open input file " + input_filename);
+            if (incremental) {
+                if ((mode == "encrypt") != !output_dir.empty()) {
+                    throw std::invalid_argument(mode == "encrypt" ? "encrypt --incremental writes to --output-dir"
+                                                                  : "decrypt --incremental reads from --input-dir");
+                }
+                if (mode == "encrypt") {
+                    printIncrementalSummary(mode, encryptIncremental(input_filename, output_dir, key_filename));
+                }
+                else if (output_filename == "-") {
+                    prepareStdio();
+                    printIncrementalSummary(mode, decryptIncremental(input_dir, key_filename, std::cout), std::cerr);
+                }
+                else {
+                    printIncrementalSummary(mode, decryptIncremental(input_dir, key_filename, output_filename));
+                }
+                return 0;
             }
-            std::ifstream key_file(key_filename, std::ios::in | std::ios::binary);
-            if (!key_file.is_open()) {
-                throw std::invalid_argument("Unable to open key file " + key_filename);
+
+            if (archive) {
+                if ((mode == "encrypt") != !input_dir.empty()) {
+                    throw std::invalid_argument(mode == "encrypt" ? "encrypt --archive requires --input-dir"
+                                                                  : "decrypt --archive takes --input-filename");
+                }
+                if (mode == "encrypt") {
+                    size_t members = createArchive(input_dir, output_filename, key_filename, key_context.value_or(""));
+                    std::cout << "Archived " << members << " files into " << output_filename << std::endl;
+                }
+                else if (list) {
+                    for (const ArchiveMember& archive_member : listArchive(input_filename, key_filename)) {
+                        std::cout << archive_member.size << "\t" << archive_member.name << "\n";
+                    }
+                }
+                else if (!member.empty()) {
+                    if (output_filename == "-") {
+                        prepareStdio();
+                        extractArchiveMember(input_filename, key_filename, member, std::cout);
+                    } else {
+                        std::ofstream output_file(output_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+                        if (!output_file.is_open()) {
+                            throw std::invalid_argument("Unable to open output file " + output_filename);
+                        }
+                        extractArchiveMember(input_filename, key_filename, member, output_file);
+                    }
+                }
+                else {
+                    size_t members = extractArchive(input_filename, key_filename, output_dir);
+                    std::cout << "Extracted " << members << " files into " << output_dir << std::endl;
+                }
+                return 0;
             }
-            std::ofstream output_file(output_filename, std::ios::out | std::ios::binary);
-            if (!output_file.is_open()) {
-                throw std::invalid_argument("Unable to open output file " + output_filename);
+
+            if (!input_dir.empty()) {
+                if (pad_ledger && mode != "encrypt") {
+                    throw std::invalid_argument("--pad-ledger only applies to encrypt; decrypt finds the pad range itself");
+                }
+                if (mode == "encrypt" && key_type == "otp" && !pad_ledger) {
+                    throw std::invalid_argument("Encrypting a directory with a one-time-pad requires --pad-ledger");
+                }
+                DirCryptConfig config;
+                config.operation = mode;
+                config.input_dir = input_dir;
+                config.output_dir = output_dir;
+                config.key_filename = key_filename;
+                config.aes_mode = aes_mode;
+                config.key_type = key_type;
+                config.threads = threads;
+                config.compress = compress;
+                config.key_context = key_context.value_or("");
+                if (!io_engine.empty()) {
+                    config.io_engine = parseIoEngine(io_engine);
+                }
+                DirCryptSummary summary = encryptDecryptDirectory(config);
+                printDirCryptSummary(mode, summary);
+                return summary.failures.empty() ? 0 : 1;
+            }
+
+            // Take the next unused part of a pad that has a ledger; never reuse its start
+            std::optional<PadRange> pad_range;
+            uint64_t pad_left = 0;
+            std::string ledger_filename = padLedgerFilename(key_filename);
+            if (pad_ledger) {
+                if (mode != "encrypt") {
+                    throw std::invalid_argument("--pad-ledger only applies to encrypt; decrypt finds the pad range itself");
+                }
+                std::ifstream pad_file(key_filename, std::ios::in | std::ios::binary);
+                PadLedger ledger(ledger_filename, keySize(pad_file));
+                uint64_t data_offset = file_type == "bitmap" ? BMP_HEADER_SIZE : 0;
+                uint64_t input_size = fs::file_size(input_filename);
+                pad_range = ledger.reserve(input_size - std::min(input_size, data_offset));
+                pad_left = ledger.padSize() - pad_range->offset - pad_range->length;
+            }
+            else if (mode == "encrypt" && key_type == "otp" && fs::exists(ledger_filename)) {
+                throw std::invalid_argument("The one-time-pad " + key_filename + " has a ledger, " + ledger_filename +
+                                            ", so its bytes must be handed out with --pad-ledger");
             }
 
-            encryptDecrypt(mode, input_file, key_file, output_file, file_type, aes_mode, key_type);
+            if (!io_engine.empty()) {
+                std::vector<CryptJob> jobs = {{ input_filename, output_filename, key_filename, file_type, pad_range, "" }};
+                if (runCryptJobs(jobs, mode, aes_mode, key_type, parseIoEngine(io_engine), DEFAULT_IO_QUEUE_DEPTH,
+                                 DEFAULT_IO_BLOCK_SIZE, compress, key_context) > 0) {
+                    throw std::runtime_error(jobs[0].error);
+                }
+                reportPadRange(pad_range, pad_left);
+                return 0;
+            }
+
+            // "-" reads from stdin or writes to stdout
+            bool use_stdin = input_filename == "-";
+            bool use_stdout = output_filename == "-";
+            std::ifstream input_file;
+            if (!use_stdin) {
+                input_file.open(input_filename, std::ios::in | std::ios::binary);
+                if (!input_file.is_open()) {
+                    throw std::invalid_argument("Unable to open input file " + input_filename);
+                }
+            }
+            // A key file container is mapped rather than read, however large the pad
+            std::unique_ptr<KeyFile> mapped_key;
+            std::ifstream key_file;
+            if (isKeyFileContainer(key_filename)) {
+                mapped_key = std::make_unique<KeyFile>(key_filename);
+            } else {
+                key_file.open(key_filename, std::ios::in | std::ios::binary);
+                if (!key_file.is_open()) {
+                    throw std::invalid_argument("Unable to open key file " + key_filename);
+                }
+            }
+            std::ofstream output_file;
+            if (!use_stdout) {
+                output_file.open(output_filename, std::ios::out | std::ios::binary);
+                if (!output_file.is_open()) {
+                    throw std::invalid_argument("Unable to open output file " + output_filename);
+                }
+            }
+
+            if (use_stdin || use_stdout) {
+                // Stream in blocks so memory stays bounded however much data comes through the pipe
+                if (use_stdout) {
+                    message_out = &std::cerr;
+                }
+                prepareStdio();
+                std::istream& input = use_stdin ? std::cin : input_file;
+                std::ostream& output = use_stdout ? std::cout : output_file;
+                if (mapped_key) {
+                    encryptDecryptStream(mode, input, *mapped_key, output, file_type, aes_mode, key_type,
+                                         DEFAULT_STREAM_BLOCK_SIZE, compress, key_context, pad_range);
+                } else {
+                    encryptDecryptStream(mode, input, key_file, output, file_type, aes_mode, key_type,
+                                         DEFAULT_STREAM_BLOCK_SIZE, compress, key_context, pad_range);
+                }
+            } else if (mapped_key) {
+                encryptDecrypt(mode, input_file, *mapped_key, output_file, file_type, aes_mode, key_type, compress,
+                               key_context, pad_range);
+            } else {
+                encryptDecrypt(mode, input_file, key_file, output_file, file_type, aes_mode, key_type, compress,
+                               key_context, pad_range);
+            }
 
             input_file.close();
             output_file.close();
             key_file.close();
+            reportPadRange(pad_range, pad_left);
 
         // Send the metadata file to a remote github codespace
         } else if (mode == "send") {
             auto file_send_args = parseFileSendArgs(++argv);
             const auto& [
-                destination_codespace, filename
+                destination_codespace, filename, chunk_size, parallel, encrypt, key_filename, key_type, aes_mode
             ] = file_send_args;
 
-            uploadFileToCodespace(filename, destination_codespace);
+            if (encrypt) {
+                // Sending XORs from the start of the pad, which the ledger may already have handed out
+                std::string ledger_filename = padLedgerFilename(key_filename);
+                if (key_type == "otp" && fs::exists(ledger_filename)) {
+                    throw std::invalid_argument("The one-time-pad " + key_filename + " has a ledger, " + ledger_filename +
+                                                ", so it cannot be used by send --encrypt. Encrypt the file with "
+                                                "--pad-ledger and send the output instead.");
+                }
+                std::ifstream key_file(key_filename, std::ios::in | std::ios::binary);
+                if (!key_file.is_open()) {
+                    throw std::invalid_argument("Unable to open key file " + key_filename);
+                }
+                uploadFileEncrypted(filename, key_file, key_type, aes_mode,
+                                    codespaceUploadUrl(destination_codespace));
+            } else if (chunk_size > 0) {
+                uploadFileChunked(filename, codespaceUploadUrl(destination_codespace), chunk_size, parallel);
+            } else {
+                uploadFileToCodespace(filename, destination_codespace);
+            }
         
         // Request entropy from EaaS
         } else if (mode == "entropy") {
             auto entropy_args = parseEntropyArgs(++argv);
             const auto& [
-                size
+                size, nist
             ] = entropy_args;
 
             EaaS eaasClient(sdk_token);
 
-            eaasClient.requestEntropy(size);
+            std::string response = eaasClient.requestEntropy(size);
+            std::cout << response << std::endl;
+            if (nist) {
+                std::cout << std::endl;
+                printNistResults(runNistTests(EaaS::decodeEntropy(response)));
+            }
+
+        // Generate random bytes locally from DRBGs seeded with EaaS entropy
+        } else if (mode == "random") {
+            auto random_args = parseRandomArgs(++argv);
+            const auto& [
+                size, output_filename, threads, reseed_interval, eaas_url
+            ] = random_args;
+
+            bool use_stdout = (output_filename == "-");
+            std::ofstream output_file;
+            if (use_stdout) {
+                message_out = &std::cerr;
+                prepareStdio();
+            } else {
+                output_file.open(output_filename, std::ios::out | std::ios::binary);
+                if (!output_file.is_open()) {
+                    throw std::invalid_argument("Unable to open output file " + output_filename);
+                }
+            }
+
+            // Count the entropy drawn for the summary
+            auto entropy_used = std::make_shared<uint64_t>(0);
+            EntropySource eaas = eaasEntropySource(sdk_token, eaas_url);
+            setRandomSource([eaas, entropy_used](size_t count) {
+                *entropy_used += count;
+                return eaas(count);
+            }, reseed_interval);
+
+            unsigned thread_count = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+            auto start = std::chrono::steady_clock::now();
+            writeRandomBytes(use_stdout ? std::cout : output_file, size, thread_count);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            output_file.close();
+
+            *message_out << "Wrote " << size << " random bytes in " << seconds << " s ("
+                         << (seconds > 0 ? size / seconds / 1e6 : 0) << " MB/s) on " << thread_count
+                         << " threads from " << *entropy_used << " bytes of EaaS entropy." << std::endl;
+
+        // Measure throughput with offline keys and synthetic data
+        } else if (mode == "bench") {
+            auto bench_args = parseBenchArgs(++argv);
+            const auto& [
+                config, json_filename
+            ] = bench_args;
+
+            std::ofstream json_file(json_filename, std::ios::out);
+            if (!json_file.is_open()) {
+                throw std::invalid_argument("Unable to open JSON file " + json_filename);
+            }
+
+            auto results = runBench(config);
+            printBenchTable(results);
+            writeBenchJson(results, json_file);
+            std::cout << "Wrote results to file: " << json_filename << std::endl;
 
         // Unrecognized command
         } else {
@@ -174,32 +476,85 @@ int main(int argc, char* argv[]) {
         }
     }
     catch (std::invalid_argument& ex) {
-        printUsage(mode);
-        std::cout << "\nERROR: " << ex.what() << std::endl << std::endl;
+        printUsage(mode, *message_out);
+        *message_out << "\nERROR: " << ex.what() << std::endl << std::endl;
         return 1;
     }
-    catch (QryptSecurity::QryptSecurityException& ex) {
-        std::cout << "\nSDK ERROR: " << ex.what() << std::endl << std::endl;
+    catch (SdkError& ex) {
+        *message_out << "\nSDK ERROR: " << ex.what() << std::endl << std::endl;
         return 1;
     }
     catch (const std::exception& ex) {
-        std::cout << "\nERROR: " << ex.what() << std::endl << std::endl;
+        *message_out << "\nERROR: " << ex.what() << std::endl << std::endl;
+        return 1;
     }
     return 0;
 }
 
-// Tokenize arguments into key-value pairs
-std::tuple<std::string, std::string> tokenizeArg(std::string arg) {
-    std::string flag, value;
-    if(!(arg.find("--") == 0)) {
-        throw std::invalid_argument("Invalid argument: " + arg);
+// Metrics are written after the command finishes, to --metrics-file (which any command accepts) or to the
+// file named by QRYPT_METRICS_FILE
+int main(int argc, char* argv[]) {
+    const char* metrics_env = getenv("QRYPT_METRICS_FILE");
+    std::string metrics_filename = metrics_env ? metrics_env : "";
+    std::string trace_filename;
+    bool profile_memory = false;
+    int kept = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--metrics-file=", 15) == 0) {
+            metrics_filename = argv[i] + 15;
+        } else if (strncmp(argv[i], "--trace=", 8) == 0) {
+            trace_filename = argv[i] + 8;
+        } else if (strcmp(argv[i], "--profile-memory") == 0) {
+            profile_memory = true;
+        } else {
+            argv[kept++] = argv[i];
+        }
+    }
+    argv[kept] = nullptr;
+    argc = kept;
+
+    if (!trace_filename.empty()) {
+        startTrace();
+    }
+    if (profile_memory) {
+        startMemoryProfile();
+    }
+    auto start = std::chrono::steady_clock::now();
+    int result;
+    {
+        TRACE_SCOPE(argc >= 2 ? argv[1] : "qrypt");
+        result = runCommand(argc, argv);
+    }
+    if (profile_memory) {
+        writeMemoryProfile();
+    }
+    if (!trace_filename.empty()) {
+        try {
+            writeTrace(trace_filename);
+        }
+        catch (const std::exception& ex) {
+            std::cerr << "WARNING: " << ex.what() << std::endl;
+        }
+    }
+    if (metrics_filename.empty() || argc < 2) {
+        return result;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::string command = argv[1];
+    incrementCounter(METRIC_RUNS, {{"command", command}, {"result", result == 0 ? "success" : "failure"}});
+    setGauge(METRIC_LAST_RUN_TIMESTAMP, {{"command", command}}, (double)time(nullptr));
+    setGauge(METRIC_LAST_RUN_DURATION, {{"command", command}}, seconds);
+    if (cryptBytesCounted() > 0 && seconds > 0) {
+        setGauge(METRIC_CRYPT_THROUGHPUT, {{"command", command}}, cryptBytesCounted() / seconds);
+    }
+    try {
+        writeMetricsFile(metrics_filename);
     }
-    size_t delim_pos = arg.find("=");
-    flag = arg.substr(0, delim_pos);
-    if (arg.length() > delim_pos) {
-        value = arg.substr(delim_pos + 1);
+    catch (const std::exception& ex) {
+        std::cerr << "WARNING: " << ex.what() << std::endl;
     }
-    return {flag, value};
+    return result;
 }
 
 KeygenArgs parseKeygenArgs(char** unparsed_args) {
@@ -211,6 +566,9 @@ KeygenArgs parseKeygenArgs(char** unparsed_args) {
     std::string key_format = "hexstr";
     std::string metadata_format = "text";
     ::QryptSecurity::LogLevel log_level = ::QryptSecurity::LogLevel::QRYPTSECURITY_LOG_LEVEL_DISABLE;
+    std::optional<size_t> count;
+    std::string destination, watch_dir;
+    size_t queue_depth = 4;
 
     while(*unparsed_args) {
         auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
@@ -251,6 +609,28 @@ KeygenArgs parseKeygenArgs(char** unparsed_args) {
                 case KEYGEN_FLAG_CACERT_PATH:
                     cacert_path = arg_value;
                     break;
+                case KEYGEN_FLAG_COUNT:
+                    try {
+                        count = std::stoul(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --count=\"" + arg_value + "\" as a number!\n");
+                    }
+                    break;
+                case KEYGEN_FLAG_DESTINATION:
+                    destination = arg_value;
+                    break;
+                case KEYGEN_FLAG_QUEUE_DEPTH:
+                    try {
+                        queue_depth = std::stoul(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --queue-depth=\"" + arg_value + "\" as a number!\n");
+                    }
+                    break;
+                case KEYGEN_FLAG_WATCH_DIR:
+                    watch_dir = arg_value;
+                    break;
                 case KEYGEN_FLAG_LOG_LEVEL_DISABLE:
                 case KEYGEN_FLAG_LOG_LEVEL_TRACE:
                 case KEYGEN_FLAG_LOG_LEVEL_DEBUG:
@@ -266,8 +646,8 @@ KeygenArgs parseKeygenArgs(char** unparsed_args) {
             throw std::invalid_argument("Invalid argument: " + arg_name);
         }
     }
-    if (key_filename.empty() && key_format == "binary") {
-        throw std::invalid_argument("Cannot output key with key-type \"binary\" to stdout!");
+    if (key_filename.empty() && (key_format == "binary" || key_format == "container")) {
+        throw std::invalid_argument("Cannot output key with key-format \"" + key_format + "\" to stdout!");
     }
     if (!cacert_path.empty() && !fs::exists(fs::path{cacert_path})) {
         throw std::invalid_argument("CA Certificate \"" + cacert_path + "\" does not exist!");
@@ -278,11 +658,18 @@ KeygenArgs parseKeygenArgs(char** unparsed_args) {
     if (key_type == "aes" && key_len != 32) {
         throw std::invalid_argument("AES-256 keys must be 32 bytes long!");
     }
-    if (key_format != "hexstr" && key_format != "binary") {
+    if (key_format != "hexstr" && key_format != "binary" && key_format != "container") {
         throw std::invalid_argument("Invalid key-format: \"" + key_format + "\"");
     }
+    if ((count || !watch_dir.empty()) && key_filename.empty()) {
+        throw std::invalid_argument("--count and --watch-dir write numbered key files and require --key-filename");
+    }
+    if (queue_depth == 0) {
+        throw std::invalid_argument("Queue depth must be greater than zero");
+    }
 
-    return { key_filename, metadata_filename, sdk_token, key_type, key_len, key_ttl, key_format, log_level, cacert_path };
+    return { key_filename, metadata_filename, sdk_token, key_type, key_len, key_ttl, key_format, log_level, cacert_path,
+             count, destination, queue_depth, watch_dir };
 }
 
 EncryptDecryptArgs parseEncryptDecryptArgs(char** unparsed_args) {
@@ -290,6 +677,16 @@ EncryptDecryptArgs parseEncryptDecryptArgs(char** unparsed_args) {
     std::string key_type = "otp";
     std::string aes_mode = "ocb";
     std::string file_type = "binary";
+    std::string io_engine;
+    bool compress = false;
+    std::optional<std::string> key_context;
+    bool pad_ledger = false;
+    std::string input_dir, output_dir;
+    unsigned threads = 0;
+    bool archive = false;
+    bool list = false;
+    std::string member;
+    bool incremental = false;
 
     while(*unparsed_args) {
         auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
@@ -312,18 +709,108 @@ EncryptDecryptArgs parseEncryptDecryptArgs(char** unparsed_args) {
                     break;
                 case CRYPT_FLAG_FILE_TYPE:
                     file_type = arg_value;
+                    break;
+                case CRYPT_FLAG_IO_ENGINE:
+                    io_engine = arg_value;
+                    break;
+                case CRYPT_FLAG_COMPRESS:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    compress = true;
+                    break;
+                case CRYPT_FLAG_DERIVE_KEY:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    key_context = key_context.value_or("");
+                    break;
+                case CRYPT_FLAG_KEY_CONTEXT:
+                    key_context = arg_value;
+                    break;
+                case CRYPT_FLAG_PAD_LEDGER:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    pad_ledger = true;
+                    break;
+                case CRYPT_FLAG_INPUT_DIR:
+                    input_dir = arg_value;
+                    break;
+                case CRYPT_FLAG_OUTPUT_DIR:
+                    output_dir = arg_value;
+                    break;
+                case CRYPT_FLAG_THREADS:
+                    try {
+                        threads = stoul(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --threads=\"" + arg_value + "\" as a number!\n");
+                    }
+                    break;
+                case CRYPT_FLAG_ARCHIVE:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    archive = true;
+                    break;
+                case CRYPT_FLAG_LIST:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    list = true;
+                    break;
+                case CRYPT_FLAG_MEMBER:
+                    member = arg_value;
+                    break;
+                case CRYPT_FLAG_INCREMENTAL:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    incremental = true;
+                    break;
             }
         } catch (std::out_of_range& /*ex*/) {
             throw std::invalid_argument("Invalid argument: " + std::string(arg_name));
         }
     }
-    if (input_filename.empty()) {
+    if (list || !member.empty()) {
+        archive = true;
+    }
+    if (!input_dir.empty()) {
+        // Directory mode
+        if (!input_filename.empty()) {
+            throw std::invalid_argument("--input-dir replaces --input-filename");
+        }
+        if (!fs::is_directory(fs::path(input_dir))) {
+            throw std::invalid_argument("Input directory \"" + input_dir + "\" does not exist!");
+        }
+        if (archive && (output_filename.empty() || !output_dir.empty())) {
+            throw std::invalid_argument("--archive writes the directory to one file, --output-filename");
+        }
+        if (incremental && (output_filename.empty() || !output_dir.empty())) {
+            throw std::invalid_argument("decrypt --incremental rebuilds the file into --output-filename");
+        }
+        if (!archive && !incremental && (output_dir.empty() || !output_filename.empty())) {
+            throw std::invalid_argument("--input-dir requires --output-dir instead of --output-filename");
+        }
+        if (file_type != "binary") {
+            throw std::invalid_argument("--input-dir only applies to --file-type=binary");
+        }
+    }
+    else if (threads > 0) {
+        throw std::invalid_argument("--threads requires --input-dir");
+    }
+    else if (!output_dir.empty() && !archive && !incremental) {
+        throw std::invalid_argument("--output-dir requires --input-dir, --archive or --incremental");
+    }
+    else if (input_filename.empty()) {
         throw std::invalid_argument("Missing input-filename");
     } 
-    else if (!fs::exists(fs::path(input_filename))) {
+    else if (input_filename != "-" && !fs::exists(fs::path(input_filename))) {
         throw std::invalid_argument("Input file \"" + input_filename + "\" does not exist!");
     }
-    if (output_filename.empty()) {
+    else if (output_filename.empty() && !archive && !incremental) {
         throw std::invalid_argument("Missing output-filename");
     }
     if (key_filename.empty()) {
@@ -341,13 +828,80 @@ EncryptDecryptArgs parseEncryptDecryptArgs(char** unparsed_args) {
     if (file_type != "binary" && file_type != "bitmap") {
         throw std::invalid_argument("Invalid file-type: \"" + file_type + "\"");
     }
+    if (!io_engine.empty() && (input_filename == "-" || output_filename == "-")) {
+        throw std::invalid_argument("--io-engine only applies to files, not stdin or stdout");
+    }
+
+    if (compress && !compressionAvailable()) {
+        throw std::invalid_argument("--compress is not supported by this build (zstd was not found)");
+    }
+    if (compress && key_type != "aes") {
+        throw std::invalid_argument("--compress requires --key-type=aes");
+    }
+    if (compress && file_type != "binary") {
+        throw std::invalid_argument("--compress only applies to --file-type=binary");
+    }
+
+    if (key_context && key_type != "aes") {
+        throw std::invalid_argument("--derive-key and --key-context require --key-type=aes");
+    }
+    if (key_context && key_context->size() > MAX_KEY_CONTEXT_SIZE) {
+        throw std::invalid_argument("--key-context must be at most " + std::to_string(MAX_KEY_CONTEXT_SIZE) + " bytes");
+    }
+
+    if (pad_ledger && key_type != "otp") {
+        throw std::invalid_argument("--pad-ledger requires --key-type=otp");
+    }
+    if (pad_ledger && input_filename == "-") {
+        throw std::invalid_argument("--pad-ledger needs the input size up front, so it cannot read from stdin");
+    }
+
+    if (archive) {
+        if (key_type != "aes" || aes_mode != "ocb") {
+            throw std::invalid_argument("--archive requires --key-type=aes and --aes-mode=ocb");
+        }
+        if (compress || !io_engine.empty() || threads > 0) {
+            throw std::invalid_argument("--archive does not combine with --compress, --io-engine or --threads");
+        }
+        if (input_filename == "-") {
+            throw std::invalid_argument("--archive reads the index from the end of the file, so it cannot read from stdin");
+        }
+        if (input_dir.empty() && (int)list + !member.empty() + !output_dir.empty() != 1) {
+            throw std::invalid_argument("Decrypting an archive takes one of --list, --member or --output-dir");
+        }
+        if (!member.empty() && output_filename.empty()) {
+            throw std::invalid_argument("--member requires --output-filename");
+        }
+    }
 
-    return { input_filename, output_filename, key_filename, key_type, aes_mode, file_type };
+    if (incremental) {
+        if (key_type != "aes" || aes_mode != "ocb") {
+            throw std::invalid_argument("--incremental requires --key-type=aes and --aes-mode=ocb");
+        }
+        if (archive || compress || !io_engine.empty() || threads > 0 || key_context || file_type != "binary") {
+            throw std::invalid_argument("--incremental does not combine with --archive, --compress, --io-engine, "
+                                        "--threads, --derive-key or --file-type");
+        }
+        if (input_filename == "-") {
+            throw std::invalid_argument("--incremental cannot read from stdin");
+        }
+    }
+
+    return {
+        input_filename, output_filename, key_filename, key_type, aes_mode, file_type, io_engine, compress, key_context,
+        pad_ledger, input_dir, output_dir, threads, archive, list, member, incremental
+    };
 }
 
 FileSendArgs parseFileSendArgs(char** unparsed_args) {
     std::string destination_codespace;
     std::string filename = "meta.dat";
+    size_t chunk_size = 0;
+    unsigned parallel = DEFAULT_UPLOAD_PARALLELISM;
+    bool encrypt = false;
+    std::string key_filename;
+    std::string key_type = "otp";
+    std::string aes_mode = "ocb";
 
     while(*unparsed_args) {
         auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
@@ -359,6 +913,37 @@ FileSendArgs parseFileSendArgs(char** unparsed_args) {
                 case FILE_SEND_FLAG_FILENAME:
                     filename = arg_value;
                     break;
+                case FILE_SEND_FLAG_CHUNK_SIZE:
+                    try {
+                        chunk_size = stoul(arg_value) * 1024;
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --chunk-size=\"" + arg_value + "\" as a number!\n");
+                    }
+                    break;
+                case FILE_SEND_FLAG_PARALLEL:
+                    try {
+                        parallel = stoul(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --parallel=\"" + arg_value + "\" as a number!\n");
+                    }
+                    break;
+                case FILE_SEND_FLAG_ENCRYPT:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    encrypt = true;
+                    break;
+                case FILE_SEND_FLAG_KEY_FILENAME:
+                    key_filename = arg_value;
+                    break;
+                case FILE_SEND_FLAG_KEY_TYPE:
+                    key_type = arg_value;
+                    break;
+                case FILE_SEND_FLAG_AES_MODE:
+                    aes_mode = arg_value;
+                    break;
             }
         } catch (std::out_of_range& /*ex*/) {
             throw std::invalid_argument("Invalid argument: " + std::string(arg_name));
@@ -373,11 +958,34 @@ FileSendArgs parseFileSendArgs(char** unparsed_args) {
         throw std::invalid_argument("File \"" + filename + "\" does not exist!");
     }
 
-    return { destination_codespace, filename };
+    if (parallel == 0) {
+        throw std::invalid_argument("--parallel must be greater than zero");
+    }
+
+    if (encrypt) {
+        if (chunk_size > 0) {
+            throw std::invalid_argument("--encrypt cannot be combined with --chunk-size");
+        }
+        if (key_filename.empty()) {
+            throw std::invalid_argument("Missing key-filename");
+        }
+        else if (!fs::exists(fs::path(key_filename))) {
+            throw std::invalid_argument("Key file \"" + key_filename + "\" does not exist!");
+        }
+        if (key_type != "aes" && key_type != "otp") {
+            throw std::invalid_argument("Invalid key-type: \"" + key_type + "\"");
+        }
+        if (aes_mode != "ecb" && aes_mode != "ocb") {
+            throw std::invalid_argument("Invalid aes-mode: \"" + aes_mode + "\"");
+        }
+    }
+
+    return { destination_codespace, filename, chunk_size, parallel, encrypt, key_filename, key_type, aes_mode };
 }
 
 EntropyArgs parseEntropyArgs(char** unparsed_args) {
     uint32_t size = 1;
+    bool nist = false;
 
     while(*unparsed_args) {
         auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
@@ -390,11 +998,202 @@ EntropyArgs parseEntropyArgs(char** unparsed_args) {
                     catch(...) {
                         throw std::invalid_argument("Could not interpret --size=\"" + arg_value + "\" as a number!\n");
                     }
+                    break;
+                case ENTROPY_FLAG_NIST:
+                    if(!arg_value.empty()) {
+                        throw std::invalid_argument("Invalid argument: " + arg_name + "=" + arg_value);
+                    }
+                    nist = true;
+                    break;
             }
         } catch (std::out_of_range& /*ex*/) {
             throw std::invalid_argument("Invalid argument: " + std::string(arg_name));
         }
     }
 
-    return { size };
+    return { size, nist };
+}
+
+// Split a comma-separated list, e.g. "otp,aes"
+static std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        items.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+// Parse a byte count with an optional K, M or G suffix, e.g. "64M"
+static uint64_t parseByteSize(const std::string& arg_value) {
+    size_t pos = 0;
+    uint64_t size = stoull(arg_value, &pos);
+    std::string suffix = arg_value.substr(pos);
+    if (suffix == "K" || suffix == "k") {
+        size <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        size <<= 20;
+    } else if (suffix == "G" || suffix == "g") {
+        size <<= 30;
+    } else if (!suffix.empty()) {
+        throw std::invalid_argument("Invalid size suffix");
+    }
+    return size;
+}
+
+BenchArgs parseBenchArgs(char** unparsed_args) {
+    BenchConfig config = {
+        {"otp", "aes"}, {"ecb", "ocb"}, {4 << 10, 1 << 20, 64 << 20}, {1}, 3, fs::temp_directory_path().string()
+    };
+    unsigned cores = std::thread::hardware_concurrency();
+    if (cores > 1) {
+        config.threads.push_back(cores);
+    }
+    std::string json_filename = "bench.json";
+
+    while(*unparsed_args) {
+        auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
+        try {
+            switch(BenchFlagsMap.at(arg_name)){
+                case BENCH_FLAG_KEY_TYPES:
+                    config.key_types = splitList(arg_value);
+                    break;
+                case BENCH_FLAG_AES_MODES:
+                    config.aes_modes = splitList(arg_value);
+                    break;
+                case BENCH_FLAG_SIZES:
+                    config.sizes.clear();
+                    for (const auto& item : splitList(arg_value)) {
+                        try {
+                            config.sizes.push_back(parseByteSize(item));
+                        }
+                        catch(...) {
+                            throw std::invalid_argument("Could not interpret size \"" + item + "\" in --sizes!\n");
+                        }
+                    }
+                    break;
+                case BENCH_FLAG_THREADS:
+                    config.threads.clear();
+                    for (const auto& item : splitList(arg_value)) {
+                        try {
+                            config.threads.push_back(stoul(item));
+                        }
+                        catch(...) {
+                            throw std::invalid_argument("Could not interpret thread count \"" + item + "\" in --threads!\n");
+                        }
+                    }
+                    break;
+                case BENCH_FLAG_ITERATIONS:
+                    try {
+                        config.iterations = stoul(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --iterations=\"" + arg_value + "\" as a number!\n");
+                    }
+                    break;
+                case BENCH_FLAG_WORK_DIR:
+                    config.work_dir = arg_value;
+                    break;
+                case BENCH_FLAG_JSON_FILENAME:
+                    json_filename = arg_value;
+                    break;
+            }
+        } catch (std::out_of_range& /*ex*/) {
+            throw std::invalid_argument("Invalid argument: " + std::string(arg_name));
+        }
+    }
+
+    for (const auto& key_type : config.key_types) {
+        if (key_type != "aes" && key_type != "otp") {
+            throw std::invalid_argument("Invalid key type in --key-types: \"" + key_type + "\"");
+        }
+    }
+    for (const auto& aes_mode : config.aes_modes) {
+        if (aes_mode != "ecb" && aes_mode != "ocb") {
+            throw std::invalid_argument("Invalid aes mode in --aes-modes: \"" + aes_mode + "\"");
+        }
+    }
+    if (std::find(config.sizes.begin(), config.sizes.end(), 0) != config.sizes.end()) {
+        throw std::invalid_argument("--sizes must be greater than zero");
+    }
+    if (std::find(config.threads.begin(), config.threads.end(), 0) != config.threads.end()) {
+        throw std::invalid_argument("--threads must be greater than zero");
+    }
+    if (config.iterations == 0) {
+        throw std::invalid_argument("--iterations must be greater than zero");
+    }
+    if (!fs::is_directory(fs::path(config.work_dir))) {
+        throw std::invalid_argument("Work directory \"" + config.work_dir + "\" does not exist!");
+    }
+
+    return { config, json_filename };
+}
+
+RandomArgs parseRandomArgs(char** unparsed_args) {
+    uint64_t size = 0;
+    std::string output_filename;
+    unsigned threads = 0;
+    uint64_t reseed_interval = DEFAULT_RESEED_BYTES;
+    std::string eaas_url = EAAS_FQDN;
+
+    while(*unparsed_args) {
+        auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
+        try {
+            switch(RandomFlagsMap.at(arg_name)){
+                case RANDOM_FLAG_SIZE:
+                    try {
+                        size = parseByteSize(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --size=\"" + arg_value + "\" as a size!\n");
+                    }
+                    break;
+                case RANDOM_FLAG_OUTPUT_FILENAME:
+                    output_filename = arg_value;
+                    break;
+                case RANDOM_FLAG_TOKEN:
+                    sdk_token = arg_value;
+                    break;
+                case RANDOM_FLAG_THREADS:
+                    try {
+                        threads = stoul(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --threads=\"" + arg_value + "\" as a number!\n");
+                    }
+                    if (threads == 0) {
+                        throw std::invalid_argument("--threads must be greater than zero");
+                    }
+                    break;
+                case RANDOM_FLAG_RESEED_INTERVAL:
+                    try {
+                        reseed_interval = parseByteSize(arg_value);
+                    }
+                    catch(...) {
+                        throw std::invalid_argument("Could not interpret --reseed-interval=\"" + arg_value +
+                                                    "\" as a size!\n");
+                    }
+                    break;
+                case RANDOM_FLAG_EAAS_URL:
+                    eaas_url = arg_value;
+                    break;
+            }
+        } catch (std::out_of_range& /*ex*/) {
+            throw std::invalid_argument("Invalid argument: " + std::string(arg_name));
+        }
+    }
+
+    if (size == 0) {
+        throw std::invalid_argument("--size must be greater than zero");
+    }
+    if (output_filename.empty()) {
+        throw std::invalid_argument("Missing output-filename");
+    }
+    if (reseed_interval == 0) {
+        throw std::invalid_argument("--reseed-interval must be greater than zero");
+    }
+
+    return { size, output_filename, threads, reseed_interval, eaas_url };
 }
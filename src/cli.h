@@ -2,14 +2,14 @@
 #define QRYPTCLI_H
 
 #include "common.h"
+#include "bench.h"
 #include "QryptSecurity/qryptsecurity_logging.h"
 
 #include <map>
+#include <optional>
 #include <string>
 #include <vector>
 
-std::tuple<std::string, std::string> tokenizeArg(std::string arg);
-
 static const char* GeneralUsage = 
     "Commands:\n"
     "  generate    Initialize an AES-256 key or one-time-pad using BLAST distributed key generation.\n"
@@ -18,9 +18,16 @@ static const char* GeneralUsage =
     "  decrypt     Decrypt data using an AES-256 key or one-time-pad.\n"
     "  send        Send a file to a remote github codespace.\n"
     "  entropy     Request 1KB base-64 encoded entropy.\n"
+    "  random      Generate any amount of random bytes locally, seeded with Qrypt entropy.\n"
+    "  bench       Measure keygen, encryption and decryption throughput on this host.\n"
 #ifdef ENABLE_TESTS
     "  test        Validate the Qrypt SDK using a set of end-to-end tests.\n"
 #endif
+    "\n"
+    "Any command also accepts --metrics-file=<file>, or the QRYPT_METRICS_FILE environment variable, to add its\n"
+    "metrics to a Prometheus textfile collector file, and --trace=<file> to write a Chrome trace-event JSON\n"
+    "timeline of where its time went, which opens in Perfetto (ui.perfetto.dev). --profile-memory prints the\n"
+    "allocations and peak heap and resident memory of each stage to stderr when the command finishes.\n"
     "\n";
 
 static const char* GenerateUsage = 
@@ -29,17 +36,31 @@ static const char* GenerateUsage =
     "Initialize an AES-256 key or one-time-pad using BLAST distributed key generation. Also outputs a metadata file for\n"
     "replicating the same key at a different time/location."
     "\n"
+    "\n"
+    "With --destination, the metadata file is sent to the receiver as well. Add --count to generate several keys\n"
+    "into numbered files, e.g. key.0.dat and meta.0.dat, key.1.dat and meta.1.dat, ...; each metadata file is sent\n"
+    "while the next key is generated, so a receiver running \"qrypt replicate --watch-dir\" can start replicating\n"
+    "as soon as the first one arrives.\n"
+    "\n"
     "Optional Arguments:\n"
     "  --help                          Display this message.\n"
     "  --token=<token>                 API token for portal.qrypt.com. Defaults to a demo token.\n"
     "  --key-filename=<filename>       Path of the key output file. Prints key to stdout if not set.\n"
     "  --metadata-filename=<filename>  Path of the metadata output file. Default \"./meta.dat\"\n"
+    "  --count=<count>                 Generate this many keys into numbered files. Requires --key-filename.\n"
+    "  --destination=<codespace_name>  Receiver's github codespace to send the metadata to, or the full URL of its\n"
+    "                                  /upload endpoint.\n"
+    "  --queue-depth=<count>           With --count and --destination, the number of metadata files that may wait to\n"
+    "                                  be sent before key generation pauses. Default 4.\n"
     "  --key-type=<aes|otp>            Type of key to generate; AES-256 or one-time-pad. Default \"otp\".\n"
     "  --key-len=<byte_length>         Length of key to generate, if otp. Ignored for aes. Default 32.\n"
     "  --key-ttl=<ttl>                 Length of time that the key can be replicated for in seconds. Default 3600.\n"
-    "  --key-format=<hexstr|binary>    Key output format. Default \"hexstr\".\n"
+    "  --key-format=<hexstr|binary|container>\n"
+    "                                  Key output format. Default \"hexstr\".\n"
     "                                  hexstr - key file will be in human-readable hex format.\n"
     "                                  binary - key file will be in binary format.\n"
+    "                                  container - binary key after a header with the key type, length and\n"
+    "                                  checksum, which encrypt and decrypt check without reading the key.\n"
     "  --log-level-<level>             Set logging level for the Qrypt SDK. Default \"disable\".\n"
     "                                  Valid options: \"disable\", \"trace\", \"debug\", \"info\", \"warning\", \"error\".\n"
     "  --ca-cert=<path>                Full or relative path to a public root ca-certificate (such as the one at\n"
@@ -58,9 +79,18 @@ static const char* ReplicateUsage =
     "  --token=<token>                 API token for portal.qrypt.com. Defaults to a demo token.\n"
     "  --key-filename=<filename>       Path of the key output file. Prints key to stdout if not set.\n"
     "  --metadata-filename=<filename>  Path of the metadata input file. Default \"./meta.dat\"\n"
-    "  --key-format=<hexstr|binary>    Key output format. Default \"hexstr\".\n"
+    "  --watch-dir=<directory>         Wait for numbered metadata files, named as by \"qrypt generate --count\"\n"
+    "                                  after --metadata-filename, to arrive in this directory and replicate each one\n"
+    "                                  into a numbered key file as it does. Requires --key-filename.\n"
+    "  --count=<count>                 With --watch-dir, stop after this many keys. Default: run until interrupted.\n"
+    "  --key-type=<aes|otp>            Type of key being replicated, which a container key file records.\n"
+    "                                  Default \"otp\".\n"
+    "  --key-format=<hexstr|binary|container>\n"
+    "                                  Key output format. Default \"hexstr\".\n"
     "                                  hexstr - key file will be in human-readable hex format.\n"
     "                                  binary - key file will be in binary format.\n"
+    "                                  container - binary key after a header with the key type, length and\n"
+    "                                  checksum, which encrypt and decrypt check without reading the key.\n"
     "  --log-level-<level>             Set logging level for the Qrypt SDK. Default \"disable\".\n"
     "                                  Valid options: \"disable\", \"trace\", \"debug\", \"info\", \"warning\", \"error\".\n"
     "  --ca-cert=<path>                Full or relative path to a public root ca-certificate (such as the one at\n"
@@ -83,7 +113,11 @@ enum KeygenFlag {
     KEYGEN_FLAG_KEY_TTL,
     KEYGEN_FLAG_KEY_FORMAT,
     KEYGEN_FLAG_TOKEN,
-    KEYGEN_FLAG_CACERT_PATH
+    KEYGEN_FLAG_CACERT_PATH,
+    KEYGEN_FLAG_COUNT,
+    KEYGEN_FLAG_DESTINATION,
+    KEYGEN_FLAG_QUEUE_DEPTH,
+    KEYGEN_FLAG_WATCH_DIR
 };
 
 static const std::map<std::string, KeygenFlag> KeygenFlagsMap = {
@@ -95,6 +129,10 @@ static const std::map<std::string, KeygenFlag> KeygenFlagsMap = {
     {"--key-ttl", KEYGEN_FLAG_KEY_TTL},
     {"--key-format", KEYGEN_FLAG_KEY_FORMAT},
     {"--ca-cert", KEYGEN_FLAG_CACERT_PATH},
+    {"--count", KEYGEN_FLAG_COUNT},
+    {"--destination", KEYGEN_FLAG_DESTINATION},
+    {"--queue-depth", KEYGEN_FLAG_QUEUE_DEPTH},
+    {"--watch-dir", KEYGEN_FLAG_WATCH_DIR},
     {"--log-level-disable", KEYGEN_FLAG_LOG_LEVEL_DISABLE},
     {"--log-level-trace", KEYGEN_FLAG_LOG_LEVEL_TRACE},
     {"--log-level-debug", KEYGEN_FLAG_LOG_LEVEL_DEBUG},
@@ -113,17 +151,29 @@ struct KeygenArgs {
     std::string key_format;
     ::QryptSecurity::LogLevel log_level;
     std::string cacert_path;
+    std::optional<size_t> count;
+    std::string destination;
+    size_t queue_depth;
+    std::string watch_dir;
 };
 KeygenArgs parseKeygenArgs(char** unparsed_args);
 
 static const char* EncryptUsage = 
     "Usage: qrypt encrypt --input-filename=<file> --key-filename=<file> --output-filename=<file> [Optional Args]\n"
+    "       qrypt encrypt --input-dir=<dir> --key-filename=<file> --output-dir=<dir> [Optional Args]\n"
+    "       qrypt encrypt --incremental --input-filename=<file> --key-filename=<file> --output-dir=<store>\n"
     "\n"
     "Encrypt data using an AES-256 key or one-time-pad.\n"
     "\n"
+    "With --input-dir, every file under the directory is encrypted into the same path under --output-dir, in\n"
+    "parallel. Files larger than 8 MiB are split into chunks that are encrypted in parallel too. Each AES file\n"
+    "gets a derived key of its own, as with --derive-key; a one-time-pad requires --pad-ledger.\n"
+    "\n"
     "Required Arguments:\n"
-    "  --input-filename=<filename>     Plaintext input file.\n"
-    "  --output-filename=<filename>    Encrypted output file.\n"
+    "  --input-filename=<filename>     Plaintext input file, or \"-\" to read from stdin.\n"
+    "  --output-filename=<filename>    Encrypted output file, or \"-\" to write to stdout.\n"
+    "  --input-dir=<directory>         Encrypt every file under this directory instead of --input-filename.\n"
+    "  --output-dir=<directory>        Directory for the encrypted files, instead of --output-filename.\n"
     "  --key-filename=<filename>       Key input file.\n"
     "Optional Arguments:\n"
     "  --help                          Display this message.\n"
@@ -132,16 +182,50 @@ static const char* EncryptUsage =
     "                                  ecb - Legacy ECB algorithm with known vulnerabilities. Useful for demo purposes.\n"
     "                                  ocb - Standard OCB algorithm.\n"
     "  --file-type=<binary|bitmap>     If \"bitmap\", preserve .bmp header for visual demonstration. Default \"binary\".\n"
+    "  --compress                      (AES only) Compress the data with zstd before encrypting it. Decrypt detects\n"
+    "                                  this and decompresses automatically.\n"
+    "  --derive-key                    (AES only) Encrypt with a key and IV of this file's own, derived from the key\n"
+    "                                  file with HKDF and a random salt that is stored in the output. One key from\n"
+    "                                  BLAST key generation can then safely encrypt any number of files. Decrypt\n"
+    "                                  detects this and derives the same key automatically.\n"
+    "  --key-context=<label>           Same as --derive-key, with a label (up to 255 bytes) that is mixed into the\n"
+    "                                  derivation and stored in the output, to keep keys for different uses apart.\n"
+    "  --pad-ledger                    (OTP only) Use the next unused part of a one-time-pad larger than the input,\n"
+    "                                  so one pad covers many messages. Used bytes are recorded in\n"
+    "                                  <key-filename>.ledger and never handed out again; the part used is stored\n"
+    "                                  in the output for decrypt. Once a pad has a ledger, it must always be used.\n"
+    "  --io-engine=<auto|sync|io_uring>\n"
+    "                                  Stream the file in blocks instead of loading it whole. io_uring (Linux) overlaps\n"
+    "                                  the disk reads and writes with the encryption; auto uses it where available.\n"
+    "                                  With --input-dir, the engine for files that are not split into chunks;\n"
+    "                                  io_uring keeps several of them in flight on each thread.\n"
+    "  --threads=<count>               (With --input-dir) Number of worker threads. Default one per core.\n"
+    "  --archive                       (With --input-dir, AES OCB only) Pack every file into one archive,\n"
+    "                                  --output-filename, instead of a file each. Members are stored in authenticated\n"
+    "                                  segments with an encrypted index, so decrypt can list the archive or extract one\n"
+    "                                  member without decrypting the rest.\n"
+    "  --incremental                   (AES OCB only) Encrypt a large file into a chunk store, --output-dir, split at\n"
+    "                                  content-defined boundaries. Encrypting the file into the same store again only\n"
+    "                                  encrypts and writes the chunks that changed, and removes those no longer used.\n"
     "\n";
 
 static const char* DecryptUsage = 
     "Usage: qrypt decrypt --input-filename=<file> --key-filename=<file> --output-filename=<file> [Optional Args]\n"
+    "       qrypt decrypt --input-dir=<dir> --key-filename=<file> --output-dir=<dir> [Optional Args]\n"
+    "       qrypt decrypt --archive --input-filename=<file> --key-filename=<file> --output-dir=<dir> [Optional Args]\n"
+    "       qrypt decrypt --incremental --input-dir=<store> --key-filename=<file> --output-filename=<file>\n"
     "\n"
     "Decrypt data using an AES-256 key or one-time-pad.\n"
     "\n"
+    "When reading from stdin or writing to stdout, data is decrypted as it streams through. With --aes-mode=ocb the\n"
+    "tag at the end of the input is only checked once everything before it has been written, so discard the output\n"
+    "if the command fails.\n"
+    "\n"
     "Required Arguments:\n"
-    "  --input-filename=<filename>     Encrypted input file.\n"
-    "  --output-filename=<filename>    Decrypted output file.\n"
+    "  --input-filename=<filename>     Encrypted input file, or \"-\" to read from stdin.\n"
+    "  --output-filename=<filename>    Decrypted output file, or \"-\" to write to stdout.\n"
+    "  --input-dir=<directory>         Decrypt every file under this directory instead of --input-filename.\n"
+    "  --output-dir=<directory>        Directory for the decrypted files, instead of --output-filename.\n"
     "  --key-filename=<filename>       Key input file.\n"
     "Optional Arguments:\n"
     "  --help                          Display this message.\n"
@@ -150,6 +234,19 @@ static const char* DecryptUsage =
     "                                  ecb - Legacy ECB algorithm with known vulnerabilities. Useful for demo purposes.\n"
     "                                  ocb - Standard OCB algorithm.\n"
     "  --file-type=<binary|bitmap>     If \"bitmap\", preserve .bmp header for visual demonstration. Default \"binary\".\n"
+    "  --io-engine=<auto|sync|io_uring>\n"
+    "                                  Stream the file in blocks instead of loading it whole. io_uring (Linux) overlaps\n"
+    "                                  the disk reads and writes with the encryption; auto uses it where available.\n"
+    "                                  With --input-dir, the engine for files that are not split into chunks;\n"
+    "                                  io_uring keeps several of them in flight on each thread.\n"
+    "  --threads=<count>               (With --input-dir) Number of worker threads. Default one per core.\n"
+    "  --archive                       The input is an archive written by encrypt --archive. Extract every member under\n"
+    "                                  --output-dir, or use --list or --member.\n"
+    "  --list                          (Archive) Print the name and size of each member.\n"
+    "  --member=<name>                 (Archive) Extract only this member to --output-filename, reading only the\n"
+    "                                  segments that hold it.\n"
+    "  --incremental                   The input is a chunk store written by encrypt --incremental, --input-dir.\n"
+    "                                  Rebuild the file into --output-filename.\n"
     "\n";
 
 enum EncryptDecryptFlag {
@@ -158,7 +255,19 @@ enum EncryptDecryptFlag {
     CRYPT_FLAG_KEY_FILENAME,
     CRYPT_FLAG_KEY_TYPE,
     CRYPT_FLAG_AES_MODE,
-    CRYPT_FLAG_FILE_TYPE
+    CRYPT_FLAG_FILE_TYPE,
+    CRYPT_FLAG_IO_ENGINE,
+    CRYPT_FLAG_COMPRESS,
+    CRYPT_FLAG_DERIVE_KEY,
+    CRYPT_FLAG_KEY_CONTEXT,
+    CRYPT_FLAG_PAD_LEDGER,
+    CRYPT_FLAG_INPUT_DIR,
+    CRYPT_FLAG_OUTPUT_DIR,
+    CRYPT_FLAG_THREADS,
+    CRYPT_FLAG_ARCHIVE,
+    CRYPT_FLAG_LIST,
+    CRYPT_FLAG_MEMBER,
+    CRYPT_FLAG_INCREMENTAL
 };
 
 static const std::map<std::string, EncryptDecryptFlag> EncryptDecryptFlagsMap = {
@@ -167,7 +276,19 @@ static const std::map<std::string, EncryptDecryptFlag> EncryptDecryptFlagsMap =
     {"--key-filename", CRYPT_FLAG_KEY_FILENAME},
     {"--key-type", CRYPT_FLAG_KEY_TYPE},
     {"--aes-mode", CRYPT_FLAG_AES_MODE},
-    {"--file-type", CRYPT_FLAG_FILE_TYPE}
+    {"--file-type", CRYPT_FLAG_FILE_TYPE},
+    {"--io-engine", CRYPT_FLAG_IO_ENGINE},
+    {"--compress", CRYPT_FLAG_COMPRESS},
+    {"--derive-key", CRYPT_FLAG_DERIVE_KEY},
+    {"--key-context", CRYPT_FLAG_KEY_CONTEXT},
+    {"--pad-ledger", CRYPT_FLAG_PAD_LEDGER},
+    {"--input-dir", CRYPT_FLAG_INPUT_DIR},
+    {"--output-dir", CRYPT_FLAG_OUTPUT_DIR},
+    {"--threads", CRYPT_FLAG_THREADS},
+    {"--archive", CRYPT_FLAG_ARCHIVE},
+    {"--list", CRYPT_FLAG_LIST},
+    {"--member", CRYPT_FLAG_MEMBER},
+    {"--incremental", CRYPT_FLAG_INCREMENTAL}
 };
 
 struct EncryptDecryptArgs {
@@ -177,6 +298,17 @@ struct EncryptDecryptArgs {
     std::string key_type;
     std::string aes_mode;
     std::string file_type;
+    std::string io_engine; // empty to load the whole file
+    bool compress;
+    std::optional<std::string> key_context; // set to derive a key for the file
+    bool pad_ledger;
+    std::string input_dir;  // set instead of input_filename to process a whole directory
+    std::string output_dir;
+    unsigned threads;       // 0 for one per core
+    bool archive;
+    bool list;              // list the archive's members
+    std::string member;     // extract only this member of the archive
+    bool incremental;       // encrypt into, or decrypt from, a chunk store
 };
 EncryptDecryptArgs parseEncryptDecryptArgs(char** unparsed_args);
 
@@ -189,21 +321,48 @@ static const char* FileSendUsage =
     "  --help                          Display this message.\n"
     "  --destination=<codespace_name>  Receiver's gitHub codespace destination name to send the file to.\n"
     "  --filename=<filename>           Path of the file to be sent to the remote codespace. Default \"./meta.dat\"\n"
+    "  --chunk-size=<size in KB>       Send the file in checksummed chunks of this size. If an upload is interrupted,\n"
+    "                                  running the same command again resumes from the chunks already received.\n"
+    "                                  The file is sent in a single request if not set.\n"
+    "  --parallel=<count>              (Requires --chunk-size) Number of chunks sent concurrently. Default 4.\n"
+    "  --encrypt                       Encrypt the file while it is being sent, without writing the ciphertext to\n"
+    "                                  disk. The receiver gets \"<filename>.enc\", which \"qrypt decrypt\" can decrypt.\n"
+    "  --key-filename=<filename>       (Requires --encrypt) Key input file.\n"
+    "  --key-type=<aes|otp>            (Requires --encrypt) Key type; AES-256 or one-time-pad. Default otp.\n"
+    "  --aes-mode=<ecb|ocb>            (Requires --encrypt, ignored with --key-type=otp) AES encryption mode. Default ocb.\n"
     "\n";
 
 enum FileSendFlag {
     FILE_SEND_FLAG_DESTINATION,
-    FILE_SEND_FLAG_FILENAME
+    FILE_SEND_FLAG_FILENAME,
+    FILE_SEND_FLAG_CHUNK_SIZE,
+    FILE_SEND_FLAG_PARALLEL,
+    FILE_SEND_FLAG_ENCRYPT,
+    FILE_SEND_FLAG_KEY_FILENAME,
+    FILE_SEND_FLAG_KEY_TYPE,
+    FILE_SEND_FLAG_AES_MODE
 };
 
 static const std::map<std::string, FileSendFlag> FileSendFlagsMap = {
     {"--destination", FILE_SEND_FLAG_DESTINATION},
-    {"--filename", FILE_SEND_FLAG_FILENAME}
+    {"--filename", FILE_SEND_FLAG_FILENAME},
+    {"--chunk-size", FILE_SEND_FLAG_CHUNK_SIZE},
+    {"--parallel", FILE_SEND_FLAG_PARALLEL},
+    {"--encrypt", FILE_SEND_FLAG_ENCRYPT},
+    {"--key-filename", FILE_SEND_FLAG_KEY_FILENAME},
+    {"--key-type", FILE_SEND_FLAG_KEY_TYPE},
+    {"--aes-mode", FILE_SEND_FLAG_AES_MODE}
 };
 
 struct FileSendArgs {
     std::string destination_codespace;
     std::string filename;
+    size_t chunk_size;
+    unsigned parallel;
+    bool encrypt;
+    std::string key_filename;
+    std::string key_type;
+    std::string aes_mode;
 };
 FileSendArgs parseFileSendArgs(char** unparsed_args);
 
@@ -227,19 +386,115 @@ static const char* EntropyUsage =
     "Optional Arguments:\n"
     "  --help                          Display this message.\n"
     "  --size=<amount in KB>           The amount of entropy to request, in KBs. Min=1. Max=512. Default=1.\n"
+    "  --nist                          Run the NIST SP 800-22 statistical tests locally over the received entropy.\n"
     "\n";
 
 enum EntropyFlag {
     ENTROPY_FLAG_SIZE,
+    ENTROPY_FLAG_NIST
 };
 
 static const std::map<std::string, EntropyFlag> EntropyFlagsMap = {
-    {"--size", ENTROPY_FLAG_SIZE}
+    {"--size", ENTROPY_FLAG_SIZE},
+    {"--nist", ENTROPY_FLAG_NIST}
 };
 
 struct EntropyArgs {
     uint32_t size;
+    bool nist;
 };
 EntropyArgs parseEntropyArgs(char** unparsed_args);
 
+static const char* RandomUsage = 
+    "Usage: qrypt random --size=<bytes> --output-filename=<file> [Optional Args]\n"
+    "\n"
+    "Generate random bytes with a NIST SP 800-90A CTR_DRBG (AES-256) on each thread, seeded and periodically reseeded\n"
+    "with entropy from the Qrypt Quantum Entropy as a Service API. Each seed takes 48 bytes, so one 1 KB request\n"
+    "seeds 21 generators and the output is limited by AES speed rather than the network.\n"
+    "\n"
+    "Required Arguments:\n"
+    "  --size=<bytes>                  Amount of random data, with an optional K, M or G suffix, e.g. 4G.\n"
+    "  --output-filename=<filename>    Output file, or \"-\" to write to stdout.\n"
+    "Optional Arguments:\n"
+    "  --help                          Display this message.\n"
+    "  --token=<token>                 API token for portal.qrypt.com. Defaults to a demo token.\n"
+    "  --threads=<count>               Number of generating threads, each with its own DRBG. Default one per core.\n"
+    "  --reseed-interval=<bytes>       Bytes each DRBG generates before it reseeds, with an optional K, M or G\n"
+    "                                  suffix. Default 1G.\n"
+    "  --eaas-url=<url>                Entropy endpoint to use instead of the Qrypt EaaS API.\n"
+    "\n";
+
+enum RandomFlag {
+    RANDOM_FLAG_SIZE,
+    RANDOM_FLAG_OUTPUT_FILENAME,
+    RANDOM_FLAG_TOKEN,
+    RANDOM_FLAG_THREADS,
+    RANDOM_FLAG_RESEED_INTERVAL,
+    RANDOM_FLAG_EAAS_URL
+};
+
+static const std::map<std::string, RandomFlag> RandomFlagsMap = {
+    {"--size", RANDOM_FLAG_SIZE},
+    {"--output-filename", RANDOM_FLAG_OUTPUT_FILENAME},
+    {"--token", RANDOM_FLAG_TOKEN},
+    {"--threads", RANDOM_FLAG_THREADS},
+    {"--reseed-interval", RANDOM_FLAG_RESEED_INTERVAL},
+    {"--eaas-url", RANDOM_FLAG_EAAS_URL}
+};
+
+struct RandomArgs {
+    uint64_t size;
+    std::string output_filename;
+    unsigned threads;         // 0 for one per core
+    uint64_t reseed_interval;
+    std::string eaas_url;
+};
+RandomArgs parseRandomArgs(char** unparsed_args);
+
+static const char* BenchUsage = 
+    "Usage: qrypt bench [Optional Args]\n"
+    "\n"
+    "Measure keygen, encryption and decryption throughput on this host, for capacity planning. Keys come from an\n"
+    "offline stand-in for BLAST key generation, so no network access or API token is needed. Each thread encrypts and\n"
+    "decrypts its own files of synthetic data the same way as \"qrypt encrypt\" and \"qrypt decrypt\". Build with\n"
+    "-DCMAKE_BUILD_TYPE=Release for representative numbers.\n"
+    "\n"
+    "Optional Arguments:\n"
+    "  --help                          Display this message.\n"
+    "  --key-types=<list>              Comma-separated key types to measure. Default \"otp,aes\".\n"
+    "  --aes-modes=<list>              Comma-separated AES modes to measure with --key-types=aes. Default \"ecb,ocb\".\n"
+    "  --sizes=<list>                  Comma-separated file sizes in bytes, with an optional K, M or G suffix.\n"
+    "                                  Default \"4K,1M,64M\".\n"
+    "  --threads=<list>                Comma-separated numbers of concurrent threads. Default \"1\" and the number of cores.\n"
+    "  --iterations=<count>            Operations per thread for each measurement. Default 3.\n"
+    "  --work-dir=<dir>                Directory for the temporary files. Default is the system temporary directory.\n"
+    "  --json-filename=<filename>      Path of the JSON results file. Default \"./bench.json\".\n"
+    "\n";
+
+enum BenchFlag {
+    BENCH_FLAG_KEY_TYPES,
+    BENCH_FLAG_AES_MODES,
+    BENCH_FLAG_SIZES,
+    BENCH_FLAG_THREADS,
+    BENCH_FLAG_ITERATIONS,
+    BENCH_FLAG_WORK_DIR,
+    BENCH_FLAG_JSON_FILENAME
+};
+
+static const std::map<std::string, BenchFlag> BenchFlagsMap = {
+    {"--key-types", BENCH_FLAG_KEY_TYPES},
+    {"--aes-modes", BENCH_FLAG_AES_MODES},
+    {"--sizes", BENCH_FLAG_SIZES},
+    {"--threads", BENCH_FLAG_THREADS},
+    {"--iterations", BENCH_FLAG_ITERATIONS},
+    {"--work-dir", BENCH_FLAG_WORK_DIR},
+    {"--json-filename", BENCH_FLAG_JSON_FILENAME}
+};
+
+struct BenchArgs {
+    BenchConfig config;
+    std::string json_filename;
+};
+BenchArgs parseBenchArgs(char** unparsed_args);
+
 #endif /* QRYPTCLI_H */
@@ -1,4 +1,6 @@
 #include "common.h"
+#include "metrics.h"
+#include "trace.h"
 
 #include <exception>
 #include <fstream>
@@ -7,6 +9,7 @@
 #include <algorithm>
 #include <iostream>
 #include <curl/curl.h>
+#include <openssl/evp.h>
 
 static const char* FLASK_PORT = "5000";
 static long curlConnectionTimeout = 10L;
@@ -20,17 +23,43 @@ const char* _demo_token = "eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCIsImtpZCI6ImM1NDM3N
 }
 std::string sdk_token = _demo_token;
 
+// Tokenize arguments into key-value pairs
+std::tuple<std::string, std::string> tokenizeArg(std::string arg) {
+    std::string flag, value;
+    if(!(arg.find("--") == 0)) {
+        throw std::invalid_argument("Invalid argument: " + arg);
+    }
+    size_t delim_pos = arg.find("=");
+    flag = arg.substr(0, delim_pos);
+    if (arg.length() > delim_pos) {
+        value = arg.substr(delim_pos + 1);
+    }
+    return {flag, value};
+}
+
 std::vector<uint8_t> xorVectors(const std::vector<uint8_t> otp, const std::vector<uint8_t> &data) {
-    std::vector<uint8_t> result;
     if(otp.size() != data.size()) {
         throw std::runtime_error("One time pad size does not match data size.");
     }
-    for(int i = 0; i < otp.size(); i++) {
-        result.push_back(otp[i] ^ data[i]);
-    }
+    std::vector<uint8_t> result(data.size());
+    xorBytes(otp, data, result);
     return result;
 }
 
+size_t xorBytes(ByteSpan otp, ByteSpan data, MutableByteSpan output) {
+    TRACE_SCOPE("xorBytes", data.size());
+    if (otp.size() != data.size()) {
+        throw std::invalid_argument("One time pad size does not match data size.");
+    }
+    if (output.size() < data.size()) {
+        throw std::invalid_argument("Output buffer is too small.");
+    }
+    for (size_t i = 0; i < data.size(); i++) {
+        output[i] = otp[i] ^ data[i];
+    }
+    return data.size();
+}
+
 std::string byteVecToHexStr(std::vector<uint8_t>& bytes) {
     std::ostringstream oss;
     oss << std::hex << std::setfill('0');
@@ -52,6 +81,7 @@ size_t hexCharToInt(char input) {
 }
 
 std::vector<uint8_t> hexStrToByteVec(std::string& str) {
+    TRACE_SCOPE("hexStrToByteVec", str.size());
     std::vector<uint8_t> buffer(str.size() / 2);
     for (size_t i = 0; i < str.size(); i += 2) {
         buffer[i / 2] = (hexCharToInt(str[i + 1]) & 0x0F) + ((hexCharToInt(str[i]) << 4) & 0xF0);
@@ -59,6 +89,18 @@ std::vector<uint8_t> hexStrToByteVec(std::string& str) {
     return buffer;
 }
 
+std::vector<uint8_t> base64StrToByteVec(const std::string& str) {
+    std::vector<uint8_t> buffer(3 * ((str.size() + 3) / 4));
+    int len = EVP_DecodeBlock(buffer.data(), (const unsigned char*)str.data(), str.size());
+    if (len < 0) {
+        throw std::runtime_error("Invalid base64 string");
+    }
+    // EVP_DecodeBlock counts padding characters as zero bytes
+    size_t padding = str.size() - str.find_last_not_of('=') - 1;
+    buffer.resize(len - std::min<size_t>(padding, 2));
+    return buffer;
+}
+
 static size_t curlWriteCallback(char* data, size_t size, size_t nmemb, std::string* response) {
     size_t totalSize = size * nmemb;
     response->append(data, totalSize);
@@ -67,6 +109,7 @@ static size_t curlWriteCallback(char* data, size_t size, size_t nmemb, std::stri
 
 std::string curlRequest(const std::string& fqdn, const std::string& filename, const std::vector<std::string>& headers) {
 
+    TRACE_SCOPE("curlRequest");
     CURL *curl;
     std::string serverResponse;
     curl = curl_easy_init();
@@ -99,22 +142,18 @@ std::string curlRequest(const std::string& fqdn, const std::string& filename, co
         }
 
         // execute
-        CURLcode res = curl_easy_perform(curl);
-
-        // process response
+        CURLcode res;
+        {
+            TRACE_SCOPE("curl_easy_perform");
+            res = curl_easy_perform(curl);
+        }
+        long http_response_code = 0;
         if (res == CURLE_OK) {
-            long http_response_code = 0;
             curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_response_code);
-            if (http_response_code == 200) {
-                std::cout << serverResponse << std::endl;
-            } else if (http_response_code != 200) {
-                throw std::runtime_error("Unexpected HTTP response:\n" + serverResponse);
-            }
-        } else {
-            throw std::runtime_error(std::string(curl_easy_strerror(res)));
         }
-     
-        // cleanup
+        countHttpResponse(http_response_code);
+
+        // cleanup before reporting errors so failed requests do not leak connections
         curl_easy_cleanup(curl);
         if (mime != NULL) {
             curl_mime_free(mime);
@@ -122,6 +161,15 @@ std::string curlRequest(const std::string& fqdn, const std::string& filename, co
         if (list != NULL) {
             curl_slist_free_all(list);
         }
+
+        // process response
+        if (res == CURLE_OK) {
+            if (http_response_code != 200) {
+                throw std::runtime_error("Unexpected HTTP response:\n" + serverResponse);
+            }
+        } else {
+            throw std::runtime_error(std::string(curl_easy_strerror(res)));
+        }
     }
     else {
         throw std::runtime_error("Failed to initialize libcurl");
@@ -130,14 +178,19 @@ std::string curlRequest(const std::string& fqdn, const std::string& filename, co
     return serverResponse;
 }
 
-void uploadFileToCodespace(const std::string& filename, const std::string& codespaceName) {
-    
-    // fqdn
-    std::string url = "https://" + codespaceName + "-" + FLASK_PORT +  ".app.github.dev/upload";
+void uploadFile(const std::string& filename, const std::string& url) {
 
     // no headers
     std::vector<std::string> empty;
 
     // send request
-    curlRequest(url, filename.c_str(), empty);
+    std::cout << curlRequest(url, filename.c_str(), empty) << std::endl;
+}
+
+std::string codespaceUploadUrl(const std::string& codespaceName) {
+    return "https://" + codespaceName + "-" + FLASK_PORT +  ".app.github.dev/upload";
+}
+
+void uploadFileToCodespace(const std::string& filename, const std::string& codespaceName) {
+    uploadFile(filename, codespaceUploadUrl(codespaceName));
 }
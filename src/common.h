@@ -1,6 +1,8 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include "byte_span.h"
+
 #include <stdexcept>
 #include <map>
 #include <vector>
@@ -18,14 +20,25 @@ constexpr int BMP_HEADER_SIZE = 54;
 
 std::vector<uint8_t> xorVectors(const std::vector<uint8_t> otp, const std::vector<uint8_t> &data);
 
+// Allocation-free form of xorVectors(); output may alias data. Returns the number of bytes written.
+size_t xorBytes(ByteSpan otp, ByteSpan data, MutableByteSpan output);
+
 std::string byteVecToHexStr(std::vector<uint8_t>& bytes);
 
 size_t hexCharToInt(char input);
 
 std::vector<uint8_t> hexStrToByteVec(std::string& str);
 
+std::vector<uint8_t> base64StrToByteVec(const std::string& str);
+
+std::tuple<std::string, std::string> tokenizeArg(std::string arg);
+
 std::string curlRequest(const std::string& fqdn, const std::string& filename, const std::vector<std::string>& headers);
 
+void uploadFile(const std::string& filename, const std::string& url);
+
+std::string codespaceUploadUrl(const std::string& codespaceName);
+
 void uploadFileToCodespace(const std::string& filename, const std::string& codespaceName);
 
 #endif /* COMMON_H */
@@ -0,0 +1,112 @@
+#include "compress.h"
+#include "trace.h"
+
+#include <stdexcept>
+#include <string>
+
+#ifdef QRYPT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+bool compressionAvailable() {
+#ifdef QRYPT_HAVE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+#ifdef QRYPT_HAVE_ZSTD
+
+static size_t checkZstd(size_t result, const char* operation) {
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(std::string(operation) + " failed: " + ZSTD_getErrorName(result));
+    }
+    return result;
+}
+
+ZstdStream::ZstdStream(bool compress, int level) : compress(compress) {
+    if (compress) {
+        cctx = ZSTD_createCCtx();
+        if (cctx == nullptr) {
+            throw std::runtime_error("ZSTD_createCCtx() returned NULL!");
+        }
+        checkZstd(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level), "ZSTD_CCtx_setParameter()");
+        checkZstd(ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1), "ZSTD_CCtx_setParameter()");
+    }
+    else {
+        dctx = ZSTD_createDCtx();
+        if (dctx == nullptr) {
+            throw std::runtime_error("ZSTD_createDCtx() returned NULL!");
+        }
+    }
+}
+
+ZstdStream::~ZstdStream() {
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+}
+
+void ZstdStream::update(const uint8_t* input, size_t size, std::vector<uint8_t>& output) {
+    update(input, size, [&output](const uint8_t* data, size_t len) {
+        output.insert(output.end(), data, data + len);
+    });
+}
+
+void ZstdStream::update(const uint8_t* input, size_t size, const ZstdSink& sink) {
+    TRACE_SCOPE(compress ? "zstd compress" : "zstd decompress", size);
+    ZSTD_inBuffer in = {input, size, 0};
+    buffer.resize(compress ? ZSTD_CStreamOutSize() : ZSTD_DStreamOutSize());
+    bool output_full = true;
+    while (in.pos < in.size || output_full) {
+        if (!compress && frame_complete && in.pos < in.size) {
+            throw std::runtime_error("Unexpected data after the end of the compressed stream.");
+        }
+        ZSTD_outBuffer out = {buffer.data(), buffer.size(), 0};
+        if (compress) {
+            checkZstd(ZSTD_compressStream2(cctx, &out, &in, ZSTD_e_continue), "ZSTD_compressStream2()");
+        }
+        else {
+            frame_complete = checkZstd(ZSTD_decompressStream(dctx, &out, &in), "ZSTD_decompressStream()") == 0;
+        }
+        if (out.pos > 0) {
+            sink(buffer.data(), out.pos);
+        }
+        // A full output buffer may mean more output is waiting inside zstd
+        output_full = out.pos == buffer.size();
+    }
+}
+
+void ZstdStream::finish(std::vector<uint8_t>& output) {
+    if (!compress) {
+        if (!frame_complete) {
+            throw std::runtime_error("Compressed stream is truncated.");
+        }
+        return;
+    }
+    ZSTD_inBuffer in = {nullptr, 0, 0};
+    size_t remaining = 1;
+    while (remaining != 0) {
+        size_t offset = output.size();
+        output.resize(offset + ZSTD_CStreamOutSize());
+        ZSTD_outBuffer out = {output.data() + offset, ZSTD_CStreamOutSize(), 0};
+        remaining = checkZstd(ZSTD_compressStream2(cctx, &out, &in, ZSTD_e_end), "ZSTD_compressStream2()");
+        output.resize(offset + out.pos);
+    }
+}
+
+#else
+
+ZstdStream::ZstdStream(bool compress, int /*level*/) : compress(compress) {
+    throw std::runtime_error("This build of qrypt does not support compression (zstd was not found).");
+}
+
+ZstdStream::~ZstdStream() {}
+
+void ZstdStream::update(const uint8_t* /*input*/, size_t /*size*/, std::vector<uint8_t>& /*output*/) {}
+
+void ZstdStream::update(const uint8_t* /*input*/, size_t /*size*/, const ZstdSink& /*sink*/) {}
+
+void ZstdStream::finish(std::vector<uint8_t>& /*output*/) {}
+
+#endif // QRYPT_HAVE_ZSTD
@@ -0,0 +1,44 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+typedef struct ZSTD_DCtx_s ZSTD_DCtx;
+
+// Whether zstd was found when this was built
+bool compressionAvailable();
+
+const int DEFAULT_COMPRESSION_LEVEL = 3;
+
+// Receives output as soon as it is ready
+typedef std::function<void(const uint8_t* data, size_t size)> ZstdSink;
+
+// Streaming zstd compression or decompression of a single frame
+class ZstdStream {
+public:
+    explicit ZstdStream(bool compress, int level = DEFAULT_COMPRESSION_LEVEL);
+    ~ZstdStream();
+    ZstdStream(const ZstdStream&) = delete;
+    ZstdStream& operator=(const ZstdStream&) = delete;
+
+    // Process size bytes of input, appending any output that is ready
+    void update(const uint8_t* input, size_t size, std::vector<uint8_t>& output);
+    // Process size bytes of input, passing output to sink one zstd output buffer at a time. A few bytes of
+    // input can decompress to gigabytes, so decompression should use this rather than collect the output.
+    void update(const uint8_t* input, size_t size, const ZstdSink& sink);
+    // Flush the end of the frame. When decompressing, throws if the frame is incomplete.
+    void finish(std::vector<uint8_t>& output);
+
+private:
+    bool compress;
+    ZSTD_CCtx* cctx = nullptr;
+    ZSTD_DCtx* dctx = nullptr;
+    bool frame_complete = false;
+    std::vector<uint8_t> buffer;
+};
+
+#endif /* COMPRESS_H */
@@ -0,0 +1,89 @@
+#include "crypt_header.h"
+
+#include <cstring>
+#include <stdexcept>
+
+static void appendU16(std::vector<uint8_t>& out, size_t value) {
+    if (value > 0xFFFF) {
+        throw std::invalid_argument("Ciphertext header field is too large.");
+    }
+    out.push_back((uint8_t)(value & 0xFF));
+    out.push_back((uint8_t)(value >> 8));
+}
+
+std::vector<uint8_t> CryptHeader::serialize() const {
+    std::vector<uint8_t> encoded_fields;
+    for (const auto& [type, value] : fields) {
+        encoded_fields.push_back(type);
+        appendU16(encoded_fields, value.size());
+        encoded_fields.insert(encoded_fields.end(), value.begin(), value.end());
+    }
+
+    std::vector<uint8_t> header(CRYPT_HEADER_MAGIC, CRYPT_HEADER_MAGIC + CRYPT_HEADER_MAGIC_SIZE);
+    header.push_back(CRYPT_HEADER_VERSION);
+    header.push_back(flags);
+    appendU16(header, encoded_fields.size());
+    header.insert(header.end(), encoded_fields.begin(), encoded_fields.end());
+    return header;
+}
+
+CryptHeader CryptHeader::read(std::istream& stream, std::vector<uint8_t>& raw) {
+    raw.assign(CRYPT_HEADER_MAGIC, CRYPT_HEADER_MAGIC + CRYPT_HEADER_MAGIC_SIZE);
+    raw.resize(CRYPT_HEADER_MAGIC_SIZE + 4);
+    if (!stream.read((char*)raw.data() + CRYPT_HEADER_MAGIC_SIZE, 4)) {
+        throw std::invalid_argument("Ciphertext header is truncated.");
+    }
+    const uint8_t* fixed = raw.data() + CRYPT_HEADER_MAGIC_SIZE;
+    if (fixed[0] != CRYPT_HEADER_VERSION) {
+        throw std::invalid_argument("Ciphertext header version " + std::to_string(fixed[0]) + " is not supported.");
+    }
+    CryptHeader header;
+    header.flags = fixed[1];
+    if (header.flags & ~CRYPT_HEADER_KNOWN_FLAGS) {
+        throw std::invalid_argument("Ciphertext was written with options this version does not support.");
+    }
+
+    size_t fields_size = fixed[2] | (fixed[3] << 8);
+    size_t offset = raw.size();
+    raw.resize(offset + fields_size);
+    if (!stream.read((char*)raw.data() + offset, fields_size)) {
+        throw std::invalid_argument("Ciphertext header is truncated.");
+    }
+    while (offset < raw.size()) {
+        if (raw.size() - offset < 3) {
+            throw std::invalid_argument("Ciphertext header is malformed.");
+        }
+        uint8_t type = raw[offset];
+        size_t size = raw[offset + 1] | (raw[offset + 2] << 8);
+        offset += 3;
+        if (raw.size() - offset < size) {
+            throw std::invalid_argument("Ciphertext header is malformed.");
+        }
+        header.fields[type].assign(raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    }
+    return header;
+}
+
+bool startsWithCryptHeader(const uint8_t* data, size_t size) {
+    return size >= CRYPT_HEADER_MAGIC_SIZE && memcmp(data, CRYPT_HEADER_MAGIC, CRYPT_HEADER_MAGIC_SIZE) == 0;
+}
+
+std::vector<uint8_t> encodeU64Field(uint64_t value) {
+    std::vector<uint8_t> field(8);
+    for (size_t i = 0; i < field.size(); i++) {
+        field[i] = (uint8_t)(value >> (8 * i));
+    }
+    return field;
+}
+
+uint64_t decodeU64Field(const std::vector<uint8_t>& field) {
+    if (field.size() != 8) {
+        throw std::invalid_argument("Ciphertext header field has the wrong size.");
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < field.size(); i++) {
+        value |= (uint64_t)field[i] << (8 * i);
+    }
+    return value;
+}
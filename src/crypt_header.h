@@ -0,0 +1,50 @@
+#ifndef CRYPT_HEADER_H
+#define CRYPT_HEADER_H
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <vector>
+
+// Ciphertext that uses options beyond the original format starts with a header telling decrypt how it
+// was produced. Layout: the magic, a version byte, a flags byte, the total length of the fields (2 bytes,
+// little endian), then each field as a type byte, a 2-byte length and its value. With OCB the whole header
+// is authenticated as associated data. Ciphertext without options has no header, as before.
+const uint8_t CRYPT_HEADER_MAGIC[] = {'Q', 'R', 'Y', 'P', 'T', 'E', 'N', 'C'};
+const size_t CRYPT_HEADER_MAGIC_SIZE = sizeof(CRYPT_HEADER_MAGIC);
+const uint8_t CRYPT_HEADER_VERSION = 1;
+
+const uint8_t CRYPT_HEADER_FLAG_ZSTD = 0x01; // the plaintext was compressed with zstd before encryption
+const uint8_t CRYPT_HEADER_FLAG_HKDF = 0x02; // the key and IV were derived from the key file, see deriveKey()
+const uint8_t CRYPT_HEADER_FLAG_PAD_RANGE = 0x04; // only part of the one-time-pad was used, see PadLedger
+const uint8_t CRYPT_HEADER_FLAG_CHUNKED = 0x08; // AES chunks with keys of their own, see ChunkLayout
+const uint8_t CRYPT_HEADER_FLAG_ARCHIVE = 0x10; // an indexed archive of many files, see ArchiveWriter
+const uint8_t CRYPT_HEADER_KNOWN_FLAGS = CRYPT_HEADER_FLAG_ZSTD | CRYPT_HEADER_FLAG_HKDF |
+    CRYPT_HEADER_FLAG_PAD_RANGE | CRYPT_HEADER_FLAG_CHUNKED | CRYPT_HEADER_FLAG_ARCHIVE;
+
+// Field types
+const uint8_t CRYPT_HEADER_FIELD_HKDF_SALT = 0x01;   // random salt of the key derivation
+const uint8_t CRYPT_HEADER_FIELD_KEY_CONTEXT = 0x02; // context label of the key derivation, if not empty
+const uint8_t CRYPT_HEADER_FIELD_PAD_OFFSET = 0x03;  // first byte of the pad used (8 bytes, little endian)
+const uint8_t CRYPT_HEADER_FIELD_PAD_LENGTH = 0x04;  // bytes of the pad used (8 bytes, little endian)
+const uint8_t CRYPT_HEADER_FIELD_CHUNK_SIZE = 0x05;  // plaintext bytes per chunk (8 bytes, little endian)
+const uint8_t CRYPT_HEADER_FIELD_PLAINTEXT_SIZE = 0x06; // plaintext bytes in all (8 bytes, little endian)
+
+struct CryptHeader {
+    uint8_t flags = 0;
+    std::map<uint8_t, std::vector<uint8_t>> fields; // unknown field types are skipped by older readers
+
+    std::vector<uint8_t> serialize() const;
+
+    // Parse the rest of a header whose magic has just been read from stream. The header's bytes, magic
+    // included, are stored in raw for use as associated data.
+    static CryptHeader read(std::istream& stream, std::vector<uint8_t>& raw);
+};
+
+bool startsWithCryptHeader(const uint8_t* data, size_t size);
+
+// Fixed-size little endian integer fields
+std::vector<uint8_t> encodeU64Field(uint64_t value);
+uint64_t decodeU64Field(const std::vector<uint8_t>& field);
+
+#endif /* CRYPT_HEADER_H */
@@ -0,0 +1,461 @@
+#include "dir_crypt.h"
+#include "common.h"
+#include "crypt_header.h"
+#include "encrypt.h"
+#include "pad_ledger.h"
+#include "trace.h"
+#include "work_stealing_pool.h"
+
+#include <openssl/rand.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct FileState {
+    fs::path input;
+    fs::path output;
+    uint64_t input_size = 0;
+    std::optional<PadRange> pad_range; // when encrypting with a one-time-pad
+    std::atomic<size_t> chunks_left{0};
+    std::mutex mutex;
+    std::string error;
+};
+
+// Builds the CryptStream for one chunk. key_file is open on the pad when the key type is otp.
+typedef std::function<std::unique_ptr<CryptStream>(std::istream& key_file)> StreamFactory;
+
+struct ChunkPlan {
+    uint64_t input_offset;
+    uint64_t input_size;
+    uint64_t output_offset;
+    StreamFactory make_stream;
+};
+
+class DirectoryCrypt {
+public:
+    explicit DirectoryCrypt(const DirCryptConfig& config) :
+        config(config), encrypt(config.operation == "encrypt"), pool(config.threads) {}
+
+    DirCryptSummary run();
+
+private:
+    void processFile(const std::shared_ptr<FileState>& file);
+    void processWhole(const std::vector<std::shared_ptr<FileState>>& files);
+    bool encryptChunks(const std::shared_ptr<FileState>& file);
+    bool decryptChunks(const std::shared_ptr<FileState>& file);
+    void submitChunks(const std::shared_ptr<FileState>& file, std::vector<ChunkPlan>& chunks);
+    void runChunk(FileState& file, const ChunkPlan& chunk);
+    void fail(FileState& file, const std::string& error);
+    void finishFile(FileState& file, size_t chunks);
+
+    const DirCryptConfig& config;
+    bool encrypt;
+    std::vector<uint8_t> aes_key;
+    std::mutex summary_mutex;
+    DirCryptSummary summary;
+    WorkStealingPool pool; // last, so its threads stop before anything they use is destroyed
+};
+
+DirCryptSummary DirectoryCrypt::run() {
+    auto start = std::chrono::steady_clock::now();
+    if (config.operation != "encrypt" && config.operation != "decrypt") {
+        throw std::invalid_argument("Invalid operation: \"" + config.operation + "\"");
+    }
+    if (config.key_type != "aes" && config.key_type != "otp") {
+        throw std::invalid_argument("Invalid key type: \"" + config.key_type + "\"");
+    }
+    if (config.aes_mode != "ecb" && config.aes_mode != "ocb") {
+        throw std::invalid_argument("Invalid aes mode: \"" + config.aes_mode + "\"");
+    }
+    if (config.chunk_size == 0 || config.chunk_size % 16 != 0 || config.chunk_size > MAX_CHUNK_SIZE) {
+        throw std::invalid_argument("Chunk size must be a positive multiple of 16 bytes, at most " +
+                                    std::to_string(MAX_CHUNK_SIZE / (1024 * 1024)) + " MiB.");
+    }
+    if (config.queue_depth == 0) {
+        throw std::invalid_argument("Queue depth must be greater than zero.");
+    }
+    if (!fs::is_directory(config.input_dir)) {
+        throw std::invalid_argument("Input directory \"" + config.input_dir + "\" does not exist!");
+    }
+    fs::path input_dir = fs::canonical(config.input_dir);
+    fs::path output_dir = fs::weakly_canonical(config.output_dir);
+    if (std::mismatch(input_dir.begin(), input_dir.end(), output_dir.begin(), output_dir.end()).first == input_dir.end()) {
+        throw std::invalid_argument("The output directory must not be inside the input directory.");
+    }
+
+    // Largest first, so the long tasks are not the last to start
+    std::vector<std::shared_ptr<FileState>> files;
+    for (const auto& entry : fs::recursive_directory_iterator(input_dir, fs::directory_options::skip_permission_denied)) {
+        if (entry.is_regular_file()) {
+            auto file = std::make_shared<FileState>();
+            file->input = entry.path();
+            file->output = output_dir / fs::relative(entry.path(), input_dir);
+            file->input_size = entry.file_size();
+            files.push_back(file);
+        }
+    }
+    std::stable_sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+        return a->input_size > b->input_size;
+    });
+
+    std::ifstream key_file(config.key_filename, std::ios::in | std::ios::binary);
+    if (!key_file.is_open()) {
+        throw std::invalid_argument("Unable to open key file " + config.key_filename);
+    }
+    if (config.key_type == "aes") {
+        aes_key = readKey(key_file);
+        if (aes_key.size() != AESKeyLengthInBytes) {
+            throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
+        }
+    }
+    else if (encrypt) {
+        // Reserve the pad for the whole tree at once, then give each file the next part of it
+        uint64_t total_size = 0;
+        for (const auto& file : files) {
+            total_size += file->input_size;
+        }
+        PadLedger ledger(padLedgerFilename(config.key_filename), keySize(key_file));
+        uint64_t offset = ledger.reserve(total_size).offset;
+        for (const auto& file : files) {
+            file->pad_range = PadRange{ offset, file->input_size };
+            offset += file->input_size;
+        }
+    }
+
+    // Files that may be split go one per task. The rest are batched, spread evenly over the threads but no more
+    // than the engine keeps in flight at once.
+    std::vector<std::shared_ptr<FileState>> whole_files;
+    for (const auto& file : files) {
+        if (file->input_size > config.chunk_size) {
+            pool.submit([this, file]() { processFile(file); });
+        }
+        else {
+            whole_files.push_back(file);
+        }
+    }
+    size_t batch_size = 1;
+    if (config.io_engine != IoEngine::Sync) {
+        size_t per_thread = (whole_files.size() + pool.size() - 1) / pool.size();
+        batch_size = std::max<size_t>(1, std::min<size_t>(config.queue_depth, per_thread));
+    }
+    for (size_t begin = 0; begin < whole_files.size(); begin += batch_size) {
+        size_t end = std::min(begin + batch_size, whole_files.size());
+        std::vector<std::shared_ptr<FileState>> batch(whole_files.begin() + begin, whole_files.begin() + end);
+        pool.submit([this, batch = std::move(batch)]() {
+            std::vector<std::shared_ptr<FileState>> ready;
+            for (const auto& file : batch) {
+                try {
+                    fs::create_directories(file->output.parent_path());
+                    ready.push_back(file);
+                }
+                catch (const std::exception& ex) {
+                    fail(*file, ex.what());
+                }
+            }
+            processWhole(ready);
+            for (const auto& file : batch) {
+                finishFile(*file, 0);
+            }
+        });
+    }
+    pool.wait();
+
+    summary.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(summary.failures.begin(), summary.failures.end());
+    return summary;
+}
+
+void DirectoryCrypt::processFile(const std::shared_ptr<FileState>& file) {
+    TRACE_SCOPE("directory file", file->input_size);
+    try {
+        fs::create_directories(file->output.parent_path());
+        if (encrypt ? encryptChunks(file) : decryptChunks(file)) {
+            return; // the last chunk to finish finishes the file
+        }
+        processWhole({ file });
+    }
+    catch (const std::exception& ex) {
+        fail(*file, ex.what());
+    }
+    finishFile(*file, 0);
+}
+
+void DirectoryCrypt::processWhole(const std::vector<std::shared_ptr<FileState>>& files) {
+    TRACE_SCOPE("directory batch", files.size());
+    std::vector<CryptJob> jobs;
+    for (const auto& file : files) {
+        jobs.push_back({ file->input.string(), file->output.string(), config.key_filename, "binary", file->pad_range, "" });
+    }
+    std::optional<std::string> key_context;
+    if (encrypt && config.key_type == "aes") {
+        key_context = config.key_context;
+    }
+    try {
+        runCryptJobs(jobs, config.operation, config.aes_mode, config.key_type, config.io_engine, config.queue_depth,
+                     DEFAULT_IO_BLOCK_SIZE, encrypt && config.compress, key_context);
+    }
+    catch (const std::exception& ex) {
+        // The engine itself failed, e.g. io_uring could not be set up
+        for (auto& job : jobs) {
+            job.error = ex.what();
+        }
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        if (!jobs[i].error.empty()) {
+            fail(*files[i], jobs[i].error);
+        }
+    }
+}
+
+static void writeHeader(const fs::path& output, const std::vector<uint8_t>& header) {
+    std::ofstream output_file(output, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!output_file.write((const char*)header.data(), header.size()) || (output_file.close(), !output_file)) {
+        throw std::runtime_error("Unable to write output file " + output.string());
+    }
+}
+
+bool DirectoryCrypt::encryptChunks(const std::shared_ptr<FileState>& file) {
+    if (file->input_size <= config.chunk_size || config.compress) {
+        return false;
+    }
+    CryptHeader header;
+    std::vector<ChunkPlan> chunks;
+    if (config.key_type == "aes") {
+        std::vector<uint8_t> salt(HKDF_SALT_SIZE);
+        if (RAND_bytes(salt.data(), salt.size()) != OPENSSL_SUCCESS) {
+            throw std::runtime_error("RAND_bytes() failed!");
+        }
+        header.flags = CRYPT_HEADER_FLAG_HKDF | CRYPT_HEADER_FLAG_CHUNKED;
+        header.fields[CRYPT_HEADER_FIELD_HKDF_SALT] = salt;
+        if (!config.key_context.empty()) {
+            header.fields[CRYPT_HEADER_FIELD_KEY_CONTEXT].assign(config.key_context.begin(), config.key_context.end());
+        }
+        header.fields[CRYPT_HEADER_FIELD_CHUNK_SIZE] = encodeU64Field(config.chunk_size);
+        header.fields[CRYPT_HEADER_FIELD_PLAINTEXT_SIZE] = encodeU64Field(file->input_size);
+        auto header_bytes = std::make_shared<const std::vector<uint8_t>>(header.serialize());
+
+        ChunkLayout layout(file->input_size, config.chunk_size, config.aes_mode);
+        for (uint64_t index = 0; index < layout.count; index++) {
+            StreamFactory make_stream = [this, header_bytes, salt, index](std::istream&) {
+                auto stream = std::make_unique<CryptStream>("encrypt", aes_key, config.aes_mode, "aes");
+                stream->useDerivedKey(chunkSalt(salt, index), config.key_context);
+                stream->setAssociatedData(header_bytes->data(), header_bytes->size());
+                return stream;
+            };
+            chunks.push_back({ layout.plaintextOffset(index), layout.plaintextSize(index),
+                               header_bytes->size() + layout.ciphertextOffset(index), make_stream });
+        }
+        writeHeader(file->output, *header_bytes);
+    }
+    else {
+        // A one-time-pad works byte by byte, so chunk i is simply XORed with the matching part of the file's range
+        PadRange range = *file->pad_range;
+        header.flags = CRYPT_HEADER_FLAG_PAD_RANGE;
+        header.fields[CRYPT_HEADER_FIELD_PAD_OFFSET] = encodeU64Field(range.offset);
+        header.fields[CRYPT_HEADER_FIELD_PAD_LENGTH] = encodeU64Field(range.length);
+        std::vector<uint8_t> header_bytes = header.serialize();
+        for (uint64_t offset = 0; offset < range.length; offset += config.chunk_size) {
+            PadRange chunk_range = { range.offset + offset, std::min(config.chunk_size, range.length - offset) };
+            StreamFactory make_stream = [chunk_range](std::istream& key_file) {
+                auto stream = std::make_unique<CryptStream>("encrypt", key_file, "ocb", "otp");
+                stream->usePadRange(chunk_range);
+                return stream;
+            };
+            chunks.push_back({ offset, chunk_range.length, header_bytes.size() + offset, make_stream });
+        }
+        writeHeader(file->output, header_bytes);
+    }
+    submitChunks(file, chunks);
+    return true;
+}
+
+bool DirectoryCrypt::decryptChunks(const std::shared_ptr<FileState>& file) {
+    if (file->input_size <= config.chunk_size) {
+        return false;
+    }
+    std::ifstream input_file(file->input, std::ios::in | std::ios::binary);
+    uint8_t magic[CRYPT_HEADER_MAGIC_SIZE];
+    if (!input_file.read((char*)magic, sizeof(magic)) || !startsWithCryptHeader(magic, sizeof(magic))) {
+        return false;
+    }
+    auto raw_header = std::make_shared<std::vector<uint8_t>>();
+    CryptHeader header = CryptHeader::read(input_file, *raw_header);
+    uint64_t header_size = raw_header->size();
+
+    // The sizes come from the header, so each branch checks them against the file before planning any chunk
+    const char* size_mismatch = "Ciphertext is truncated or has unexpected data after the last chunk.";
+    std::vector<ChunkPlan> chunks;
+    if (config.key_type == "aes" && header.flags == (CRYPT_HEADER_FLAG_HKDF | CRYPT_HEADER_FLAG_CHUNKED)) {
+        std::vector<uint8_t> salt = header.fields[CRYPT_HEADER_FIELD_HKDF_SALT];
+        const std::vector<uint8_t>& context_field = header.fields[CRYPT_HEADER_FIELD_KEY_CONTEXT];
+        std::string context(context_field.begin(), context_field.end());
+        if (salt.empty()) {
+            throw std::invalid_argument("Ciphertext header is missing the key derivation salt.");
+        }
+        ChunkLayout layout(decodeU64Field(header.fields[CRYPT_HEADER_FIELD_PLAINTEXT_SIZE]),
+                           decodeU64Field(header.fields[CRYPT_HEADER_FIELD_CHUNK_SIZE]), config.aes_mode);
+        if (layout.ciphertextTotalSize() != file->input_size - header_size) {
+            throw std::invalid_argument(size_mismatch);
+        }
+        for (uint64_t index = 0; index < layout.count; index++) {
+            StreamFactory make_stream = [this, raw_header, salt, context, index](std::istream&) {
+                auto stream = std::make_unique<CryptStream>("decrypt", aes_key, config.aes_mode, "aes");
+                stream->useDerivedKey(chunkSalt(salt, index), context);
+                stream->setAssociatedData(raw_header->data(), raw_header->size());
+                return stream;
+            };
+            chunks.push_back({ header_size + layout.ciphertextOffset(index), layout.ciphertextSize(index),
+                               layout.plaintextOffset(index), make_stream });
+        }
+    }
+    else if (config.key_type == "otp" && header.flags == CRYPT_HEADER_FLAG_PAD_RANGE) {
+        PadRange range = { decodeU64Field(header.fields[CRYPT_HEADER_FIELD_PAD_OFFSET]),
+                           decodeU64Field(header.fields[CRYPT_HEADER_FIELD_PAD_LENGTH]) };
+        if (range.length != file->input_size - header_size) {
+            throw std::invalid_argument(size_mismatch);
+        }
+        for (uint64_t offset = 0; offset < range.length; offset += config.chunk_size) {
+            PadRange chunk_range = { range.offset + offset, std::min(config.chunk_size, range.length - offset) };
+            StreamFactory make_stream = [chunk_range](std::istream& key_file) {
+                auto stream = std::make_unique<CryptStream>("decrypt", key_file, "ocb", "otp");
+                stream->usePadRange(chunk_range);
+                return stream;
+            };
+            chunks.push_back({ header_size + offset, chunk_range.length, offset, make_stream });
+        }
+    }
+    else {
+        // Anything else is decrypted in one piece, which reports any mismatch with the options given
+        return false;
+    }
+    writeHeader(file->output, {});
+    submitChunks(file, chunks);
+    return true;
+}
+
+void DirectoryCrypt::submitChunks(const std::shared_ptr<FileState>& file, std::vector<ChunkPlan>& chunks) {
+    size_t count = chunks.size();
+    file->chunks_left = count;
+    for (auto& chunk : chunks) {
+        pool.submit([this, file, chunk = std::move(chunk), count]() {
+            runChunk(*file, chunk);
+            if (--file->chunks_left == 0) {
+                finishFile(*file, count);
+            }
+        });
+    }
+}
+
+void DirectoryCrypt::runChunk(FileState& file, const ChunkPlan& chunk) {
+    TRACE_SCOPE("directory chunk", chunk.input_size);
+    {
+        // Once one chunk has failed, the file's output is discarded anyway
+        std::lock_guard<std::mutex> lock(file.mutex);
+        if (!file.error.empty()) {
+            return;
+        }
+    }
+    try {
+        std::ifstream key_file;
+        if (config.key_type == "otp") {
+            key_file.open(config.key_filename, std::ios::in | std::ios::binary);
+            if (!key_file.is_open()) {
+                throw std::runtime_error("Unable to open key file " + config.key_filename);
+            }
+        }
+        std::unique_ptr<CryptStream> stream = chunk.make_stream(key_file);
+
+        // Each worker reuses its buffers from one chunk to the next
+        thread_local std::vector<uint8_t> input, output;
+        input.resize(chunk.input_size);
+        output.clear();
+        output.reserve(input.size() + CRYPT_STREAM_OVERHEAD);
+        std::ifstream input_file(file.input, std::ios::in | std::ios::binary);
+        if (!input_file.seekg(chunk.input_offset) || !input_file.read((char*)input.data(), input.size())) {
+            throw std::runtime_error("Unable to read input file " + file.input.string());
+        }
+        stream->update(input.data(), input.size(), output);
+        stream->finish(output);
+
+        // Chunks write to separate parts of the output, each through its own handle
+        std::fstream output_file(file.output, std::ios::in | std::ios::out | std::ios::binary);
+        if (!output_file.seekp(chunk.output_offset) || !output_file.write((const char*)output.data(), output.size()) ||
+            !output_file.flush()) {
+            throw std::runtime_error("Unable to write output file " + file.output.string());
+        }
+    }
+    catch (const std::exception& ex) {
+        fail(file, ex.what());
+    }
+}
+
+void DirectoryCrypt::fail(FileState& file, const std::string& error) {
+    std::lock_guard<std::mutex> lock(file.mutex);
+    if (file.error.empty()) {
+        file.error = error;
+    }
+}
+
+void DirectoryCrypt::finishFile(FileState& file, size_t chunks) {
+    std::string error;
+    {
+        std::lock_guard<std::mutex> lock(file.mutex);
+        error = file.error;
+    }
+    std::error_code ignored;
+    if (!error.empty()) {
+        fs::remove(file.output, ignored);
+    }
+    uint64_t output_size = error.empty() ? fs::file_size(file.output, ignored) : 0;
+
+    std::lock_guard<std::mutex> lock(summary_mutex);
+    if (!error.empty()) {
+        summary.failures.push_back({ file.input.string(), error });
+        return;
+    }
+    summary.files++;
+    summary.chunked_files += chunks > 0;
+    summary.chunks += chunks;
+    summary.input_bytes += file.input_size;
+    summary.output_bytes += output_size;
+}
+
+} // namespace
+
+DirCryptSummary encryptDecryptDirectory(const DirCryptConfig& config) {
+    TRACE_SCOPE("encryptDecryptDirectory");
+    DirectoryCrypt directory_crypt(config);
+    return directory_crypt.run();
+}
+
+void printDirCryptSummary(const std::string& operation, const DirCryptSummary& summary, std::ostream& out) {
+    double megabytes = summary.input_bytes / 1e6;
+    out << (operation == "encrypt" ? "Encrypted " : "Decrypted ") << summary.files << " files";
+    if (summary.chunks > 0) {
+        out << " (" << summary.chunked_files << " split into " << summary.chunks << " chunks)";
+    }
+    out << std::fixed << std::setprecision(1) << ": " << megabytes << " MB in " << std::setprecision(2)
+        << summary.seconds << " s";
+    if (summary.seconds > 0) {
+        out << " (" << std::setprecision(1) << megabytes / summary.seconds << " MB/s)";
+    }
+    out << std::endl;
+    if (!summary.failures.empty()) {
+        out << summary.failures.size() << " files failed:" << std::endl;
+        for (const auto& [filename, error] : summary.failures) {
+            out << "  " << filename << ": " << error << std::endl;
+        }
+    }
+}
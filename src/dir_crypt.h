@@ -0,0 +1,53 @@
+#ifndef DIR_CRYPT_H
+#define DIR_CRYPT_H
+
+#include "io_engine.h"
+
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+const uint64_t DEFAULT_DIR_CHUNK_SIZE = 8 * 1024 * 1024;
+
+struct DirCryptConfig {
+    std::string operation; // encrypt or decrypt
+    std::string input_dir;
+    std::string output_dir;
+    std::string key_filename;
+    std::string aes_mode = "ocb";
+    std::string key_type = "otp";
+    unsigned threads = 0;                         // 0 for one per core
+    uint64_t chunk_size = DEFAULT_DIR_CHUNK_SIZE; // larger files are split into chunks of this size
+    bool compress = false;
+    std::string key_context;                      // label for the keys derived for each AES file
+    IoEngine io_engine = IoEngine::Sync;          // for the files that are not split into chunks
+    unsigned queue_depth = DEFAULT_IO_QUEUE_DEPTH; // files each thread keeps in flight with io_uring
+};
+
+struct DirCryptSummary {
+    size_t files = 0;         // files processed successfully
+    size_t chunked_files = 0; // of which were split into chunks
+    size_t chunks = 0;
+    uint64_t input_bytes = 0;
+    uint64_t output_bytes = 0;
+    double seconds = 0;
+    std::vector<std::pair<std::string, std::string>> failures; // input file and error
+};
+
+// Encrypt or decrypt every regular file under input_dir into the same relative path under output_dir, on a
+// WorkStealingPool. Files larger than chunk_size are split into chunks that are tasks of their own; the rest
+// are handed to runCryptJobs() in batches of up to queue_depth, one task each, so with io_uring each thread
+// keeps a batch of small files in flight. A tree that mixes both keeps every thread busy.
+//
+// A key used for more than one file must not repeat its IV, so each AES file is encrypted with its own
+// derived key, as with the key_context option of encryptDecrypt(); a large file's chunks each get their
+// own, see chunkSalt(). A one-time-pad is handed out through its PadLedger, each file taking the next part.
+// Compressed files are never split. A file that fails has its output removed and is listed in failures.
+DirCryptSummary encryptDecryptDirectory(const DirCryptConfig& config);
+
+void printDirCryptSummary(const std::string& operation, const DirCryptSummary& summary, std::ostream& out = std::cout);
+
+#endif /* DIR_CRYPT_H */
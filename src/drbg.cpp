@@ -0,0 +1,254 @@
+#include "drbg.h"
+#include "common.h"
+#include "crypt_header.h"
+#include "trace.h"
+
+#include <openssl/crypto.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <ostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+const size_t BLOCK_SIZE = 16;
+
+// V + count, with V a 128-bit big-endian counter
+void addToCounter(std::array<uint8_t, 16>& v, uint64_t count) {
+    for (int i = 15; i >= 0 && count > 0; i--) {
+        uint64_t sum = v[i] + (count & 0xff);
+        v[i] = (uint8_t)sum;
+        count = (count >> 8) + (sum >> 8);
+    }
+}
+
+// Pad input with zeros to CTR_DRBG_SEED_SIZE bytes
+std::array<uint8_t, CTR_DRBG_SEED_SIZE> padSeed(ByteSpan input, const char* name) {
+    if (input.size() > CTR_DRBG_SEED_SIZE) {
+        throw std::invalid_argument(std::string(name) + " must be at most " + std::to_string(CTR_DRBG_SEED_SIZE) +
+                                    " bytes");
+    }
+    std::array<uint8_t, CTR_DRBG_SEED_SIZE> padded = {};
+    if (!input.empty()) {
+        memcpy(padded.data(), input.data(), input.size());
+    }
+    return padded;
+}
+
+// Entropy input XOR padded personalization or additional input
+std::array<uint8_t, CTR_DRBG_SEED_SIZE> seedMaterial(ByteSpan entropy_input, ByteSpan input, const char* name) {
+    if (entropy_input.size() != CTR_DRBG_SEED_SIZE) {
+        throw std::invalid_argument("CTR_DRBG entropy input must be " + std::to_string(CTR_DRBG_SEED_SIZE) + " bytes");
+    }
+    std::array<uint8_t, CTR_DRBG_SEED_SIZE> material = padSeed(input, name);
+    for (size_t i = 0; i < material.size(); i++) {
+        material[i] ^= entropy_input[i];
+    }
+    return material;
+}
+
+} // namespace
+
+CtrDrbg::CtrDrbg(ByteSpan entropy_input, ByteSpan personalization) :
+                 key(), v(), reseed_counter(1), ctx(EVP_CIPHER_CTX_new(), ::EVP_CIPHER_CTX_free) {
+    if (!ctx) {
+        throw std::runtime_error("EVP_CIPHER_CTX_new() failed!");
+    }
+    std::array<uint8_t, CTR_DRBG_SEED_SIZE> material = seedMaterial(entropy_input, personalization, "Personalization");
+    update(ByteSpan(material.data(), material.size()));
+    OPENSSL_cleanse(material.data(), material.size());
+}
+
+CtrDrbg::~CtrDrbg() {
+    OPENSSL_cleanse(key.data(), key.size());
+    OPENSSL_cleanse(v.data(), v.size());
+}
+
+void CtrDrbg::keystream(uint8_t* output, size_t size) {
+    std::array<uint8_t, 16> counter = v;
+    addToCounter(counter, 1);
+    int len = 0;
+    memset(output, 0, size);
+    if (EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_ctr(), nullptr, key.data(), counter.data()) != OPENSSL_SUCCESS ||
+        EVP_EncryptUpdate(ctx.get(), output, &len, output, (int)size) != OPENSSL_SUCCESS) {
+        throw std::runtime_error("EVP_EncryptUpdate() failed!");
+    }
+    addToCounter(v, (size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+}
+
+void CtrDrbg::update(ByteSpan provided_data) {
+    std::array<uint8_t, CTR_DRBG_SEED_SIZE> temp;
+    keystream(temp.data(), temp.size());
+    for (size_t i = 0; i < provided_data.size(); i++) {
+        temp[i] ^= provided_data[i];
+    }
+    memcpy(key.data(), temp.data(), key.size());
+    memcpy(v.data(), temp.data() + key.size(), v.size());
+    OPENSSL_cleanse(temp.data(), temp.size());
+}
+
+void CtrDrbg::reseed(ByteSpan entropy_input, ByteSpan additional_input) {
+    std::array<uint8_t, CTR_DRBG_SEED_SIZE> material = seedMaterial(entropy_input, additional_input, "Additional input");
+    update(ByteSpan(material.data(), material.size()));
+    OPENSSL_cleanse(material.data(), material.size());
+    reseed_counter = 1;
+}
+
+void CtrDrbg::generate(uint8_t* output, size_t size, ByteSpan additional_input) {
+    if (size > CTR_DRBG_MAX_REQUEST) {
+        throw std::invalid_argument("CTR_DRBG requests are limited to " + std::to_string(CTR_DRBG_MAX_REQUEST) + " bytes");
+    }
+    if (reseed_counter > CTR_DRBG_MAX_RESEED_INTERVAL) {
+        throw std::runtime_error("CTR_DRBG must be reseeded");
+    }
+    std::array<uint8_t, CTR_DRBG_SEED_SIZE> additional = padSeed(additional_input, "Additional input");
+    if (!additional_input.empty()) {
+        update(ByteSpan(additional.data(), additional.size()));
+    }
+    if (size > 0) {
+        keystream(output, size);
+    }
+    update(ByteSpan(additional.data(), additional.size()));
+    reseed_counter++;
+}
+
+EntropySource eaasEntropySource(const std::string& token, const std::string& fqdn, uint32_t request_kb) {
+    auto client = std::make_shared<EaaS>(token, fqdn);
+    auto pool = std::make_shared<std::vector<uint8_t>>();
+    return [client, pool, request_kb](size_t size) {
+        std::vector<uint8_t> entropy;
+        while (entropy.size() < size) {
+            if (pool->empty()) {
+                *pool = EaaS::decodeEntropy(client->requestEntropy(request_kb));
+                if (pool->empty()) {
+                    throw std::runtime_error("EaaS returned no entropy");
+                }
+            }
+            size_t count = std::min(size - entropy.size(), pool->size());
+            entropy.insert(entropy.end(), pool->end() - count, pool->end());
+            OPENSSL_cleanse(pool->data() + pool->size() - count, count);
+            pool->resize(pool->size() - count);
+        }
+        return entropy;
+    };
+}
+
+namespace {
+
+std::mutex source_mutex;
+EntropySource random_source;
+uint64_t random_reseed_bytes = DEFAULT_RESEED_BYTES;
+uint64_t generators_seeded = 0;
+// Bumped by setRandomSource(), so each thread notices a new source without taking the lock
+std::atomic<uint64_t> source_generation(0);
+
+struct ThreadDrbg {
+    std::unique_ptr<CtrDrbg> drbg;
+    uint64_t generation = 0;
+    uint64_t reseed_bytes = 0;
+    uint64_t since_reseed = 0;
+};
+
+void seedThreadDrbg(ThreadDrbg& thread) {
+    TRACE_SCOPE("DRBG seed");
+    std::lock_guard<std::mutex> lock(source_mutex);
+    if (!random_source) {
+        throw std::runtime_error("No entropy source for random bytes; call setRandomSource() first");
+    }
+    std::vector<uint8_t> entropy = random_source(CTR_DRBG_SEED_SIZE);
+    if (entropy.size() != CTR_DRBG_SEED_SIZE) {
+        throw std::runtime_error("Entropy source returned the wrong number of bytes");
+    }
+    if (thread.drbg) {
+        thread.drbg->reseed(entropy);
+    }
+    else {
+        // Distinct per generator, though the entropy already is
+        std::vector<uint8_t> personalization = encodeU64Field(generators_seeded++);
+        thread.drbg = std::make_unique<CtrDrbg>(entropy, personalization);
+    }
+    OPENSSL_cleanse(entropy.data(), entropy.size());
+    thread.generation = source_generation;
+    thread.reseed_bytes = random_reseed_bytes;
+    thread.since_reseed = 0;
+}
+
+} // namespace
+
+void setRandomSource(EntropySource source, uint64_t reseed_bytes) {
+    if (reseed_bytes == 0 || reseed_bytes / CTR_DRBG_MAX_REQUEST >= CTR_DRBG_MAX_RESEED_INTERVAL) {
+        throw std::invalid_argument("Invalid reseed interval");
+    }
+    std::lock_guard<std::mutex> lock(source_mutex);
+    random_source = std::move(source);
+    random_reseed_bytes = reseed_bytes;
+    source_generation++;
+}
+
+void randomBytes(uint8_t* output, size_t size) {
+    thread_local ThreadDrbg thread;
+    while (size > 0) {
+        if (!thread.drbg || thread.generation != source_generation.load(std::memory_order_relaxed) ||
+            thread.since_reseed >= thread.reseed_bytes) {
+            seedThreadDrbg(thread);
+        }
+        size_t count = (size_t)std::min<uint64_t>({size, CTR_DRBG_MAX_REQUEST, thread.reseed_bytes - thread.since_reseed});
+        thread.drbg->generate(output, count);
+        output += count;
+        size -= count;
+        thread.since_reseed += count;
+    }
+}
+
+void writeRandomBytes(std::ostream& output, uint64_t size, unsigned thread_count) {
+    const uint64_t block_size = 1 << 20;
+    uint64_t block_count = (size + block_size - 1) / block_size;
+    std::atomic<uint64_t> next_block(0);
+    std::mutex output_mutex;
+    std::exception_ptr error;
+
+    // Random bytes are interchangeable, so blocks are written in whatever order they are finished
+    auto worker = [&]() {
+        std::vector<uint8_t> block(block_size);
+        try {
+            for (uint64_t index = next_block++; index < block_count; index = next_block++) {
+                size_t count = (size_t)std::min(block_size, size - index * block_size);
+                randomBytes(block.data(), count);
+                std::lock_guard<std::mutex> lock(output_mutex);
+                if (error) {
+                    break;
+                }
+                output.write((const char*)block.data(), count);
+                if (!output) {
+                    throw std::runtime_error("Unable to write random bytes");
+                }
+            }
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            next_block = block_count;
+        }
+        OPENSSL_cleanse(block.data(), block.size());
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < std::max(1u, thread_count); i++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    output.flush();
+}
@@ -0,0 +1,67 @@
+#ifndef DRBG_H
+#define DRBG_H
+
+#include "byte_span.h"
+#include "eaas.h"
+
+#include <openssl/evp.h>
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+// NIST SP 800-90A CTR_DRBG with AES-256 and no derivation function. It turns a little Qrypt entropy into any
+// amount of random bytes at AES-CTR speed, with no network round trip per request.
+const size_t CTR_DRBG_SEED_SIZE = 48;                   // seedlen: the key and V
+const size_t CTR_DRBG_MAX_REQUEST = 1 << 16;            // bytes per generate request, 2^19 bits
+const uint64_t CTR_DRBG_MAX_RESEED_INTERVAL = 1ull << 48; // requests between reseeds
+
+class CtrDrbg {
+public:
+    // entropy_input must be CTR_DRBG_SEED_SIZE bytes of full entropy; personalization is at most that long
+    explicit CtrDrbg(ByteSpan entropy_input, ByteSpan personalization = ByteSpan());
+    ~CtrDrbg();
+    CtrDrbg(const CtrDrbg&) = delete;
+    CtrDrbg& operator=(const CtrDrbg&) = delete;
+
+    void reseed(ByteSpan entropy_input, ByteSpan additional_input = ByteSpan());
+    // Fill output with up to CTR_DRBG_MAX_REQUEST bytes
+    void generate(uint8_t* output, size_t size, ByteSpan additional_input = ByteSpan());
+
+private:
+    // CTR_DRBG_Update with provided_data padded to CTR_DRBG_SEED_SIZE bytes
+    void update(ByteSpan provided_data);
+    // Encrypt size bytes of zeros with AES-256-CTR under key from V + 1, i.e. the blocks E(key, V + 1),
+    // E(key, V + 2), ..., and advance V past the blocks used
+    void keystream(uint8_t* output, size_t size);
+
+    std::array<uint8_t, 32> key;
+    std::array<uint8_t, 16> v;
+    uint64_t reseed_counter;
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> ctx;
+};
+
+// Supplies full-entropy bytes for seeding. Only called by one thread at a time.
+typedef std::function<std::vector<uint8_t>(size_t size)> EntropySource;
+
+// Entropy from Qrypt EaaS, requested request_kb KB at a time. Every byte is handed out once.
+EntropySource eaasEntropySource(const std::string& token, const std::string& fqdn = EAAS_FQDN, uint32_t request_kb = 1);
+
+const uint64_t DEFAULT_RESEED_BYTES = 1ull << 30;
+
+// Use source to seed the generator of every thread, and reseed each one after it has produced reseed_bytes.
+// Generators seeded from an earlier source reseed from this one on their next request.
+void setRandomSource(EntropySource source, uint64_t reseed_bytes = DEFAULT_RESEED_BYTES);
+
+// Fill output from the calling thread's own CtrDrbg, so threads generate without locking. The generator
+// draws from the source set by setRandomSource() when it is first used and each time it is due a reseed.
+void randomBytes(uint8_t* output, size_t size);
+
+// Write size bytes from randomBytes() to output using thread_count threads, each filling its own blocks
+void writeRandomBytes(std::ostream& output, uint64_t size, unsigned thread_count);
+
+#endif /* DRBG_H */
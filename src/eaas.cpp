@@ -1,12 +1,12 @@
 #include "common.h"
 #include "eaas.h"
+#include "metrics.h"
 #include <curl/curl.h>
 
 #include <iostream>
 
 const uint32_t MIN_REQUEST = 1;
 const uint32_t MAX_REQUEST = 512;
-const std::string EAAS_FQDN = "https://api-eus.qrypt.com/api/v1/quantum-entropy";
 
 
 // Request
@@ -19,7 +19,7 @@ std::string EaaS::requestEntropy(uint32_t size) {
     }
 
     //fqdn
-    std::string url = EAAS_FQDN + std::string("?size=") + std::to_string(size);
+    std::string url = _fqdn + std::string("?size=") + std::to_string(size);
 
     //headers
     std::vector<std::string> headers;
@@ -32,6 +32,32 @@ std::string EaaS::requestEntropy(uint32_t size) {
 
     // send request
     std::string response = curlRequest(url, empty, headers);
+    incrementCounter(METRIC_EAAS_BYTES, {}, size * 1024.0);
 
     return response;
 }
+
+std::vector<uint8_t> EaaS::decodeEntropy(const std::string& response) {
+
+    // The response has the form {"random":["<base64>",...],"size":<KB>}
+    size_t array_start = response.find("\"random\"");
+    array_start = (array_start == std::string::npos) ? array_start : response.find('[', array_start);
+    size_t array_end = (array_start == std::string::npos) ? array_start : response.find(']', array_start);
+    if (array_end == std::string::npos) {
+        throw std::runtime_error("Entropy response does not contain any random data");
+    }
+
+    std::vector<uint8_t> entropy;
+    size_t pos = array_start;
+    while (true) {
+        size_t value_start = response.find('"', pos);
+        if (value_start == std::string::npos || value_start > array_end) {
+            break;
+        }
+        size_t value_end = response.find('"', value_start + 1);
+        std::vector<uint8_t> bytes = base64StrToByteVec(response.substr(value_start + 1, value_end - value_start - 1));
+        entropy.insert(entropy.end(), bytes.begin(), bytes.end());
+        pos = value_end + 1;
+    }
+    return entropy;
+}
@@ -2,14 +2,21 @@
 #define EAAS_H
 
 #include <string>
+#include <vector>
+
+const std::string EAAS_FQDN = "https://api-eus.qrypt.com/api/v1/quantum-entropy";
 
 class EaaS {
 public:
-    EaaS(const std::string& token): _token{token} {};
+    EaaS(const std::string& token, const std::string& fqdn = EAAS_FQDN): _token{token}, _fqdn{fqdn} {};
     std::string requestEntropy(uint32_t size = 1);
 
+    // Decode the random bytes from a requestEntropy() response
+    static std::vector<uint8_t> decodeEntropy(const std::string& response);
+
 private:
     std::string _token;
+    std::string _fqdn;
 };
 
 #endif /* EAAS_H */
@@ -1,18 +1,115 @@
 #include "common.h"
 #include "encrypt.h"
+#include "compress.h"
+#include "crypt_header.h"
+#include "key_file.h"
+#include "metrics.h"
+#include "trace.h"
 
+#include <openssl/crypto.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/kdf.h>
 #include <openssl/rand.h>
 #include <openssl/sha.h>
 
+#include <algorithm>
+#include <cctype>
+#include <cstring>
 #include <memory>
+#include <sstream>
+
+std::vector<uint8_t> readKey(std::istream& key_stream) {
+    TRACE_SCOPE("readKey");
+    if (std::optional<KeyFileHeader> header = readKeyFileHeader(key_stream)) {
+        std::vector<uint8_t> key(header->length);
+        key_stream.seekg(KEY_FILE_HEADER_SIZE);
+        if (!key_stream.read((char*)key.data(), key.size()) ||
+            key_stream.peek() != std::char_traits<char>::eof()) {
+            throw std::invalid_argument("Key file is truncated or has trailing data.");
+        }
+        verifyKeyChecksum(*header, key);
+        return key;
+    }
 
-void encryptDecrypt(std::string operation,
-                    std::istream& input_stream, std::istream& key_stream, std::ostream& output_stream,
-                    std::string file_type, std::string aes_mode, std::string key_type) {
+    std::vector<uint8_t> key(std::istreambuf_iterator<char>(key_stream), {});
+    // Convert key to binary if it is hexadecimal
+    std::string key_string(key.begin(), key.end());
+    if (key_string.find_first_not_of("0123456789abcdefABCDEF", 2) == std::string::npos) {
+        key = hexStrToByteVec(key_string);
+    }
+    return key;
+}
+
+uint64_t keySize(std::istream& key_stream, bool* hex, uint64_t* data_offset) {
+    if (std::optional<KeyFileHeader> header = readKeyFileHeader(key_stream)) {
+        std::streamoff end = key_stream.seekg(0, std::ios::end).tellg();
+        key_stream.seekg(0);
+        if (end < 0 || (uint64_t)end != KEY_FILE_HEADER_SIZE + header->length) {
+            throw std::invalid_argument("Key file is truncated or has trailing data.");
+        }
+        if (hex) {
+            *hex = false;
+        }
+        if (data_offset) {
+            *data_offset = KEY_FILE_HEADER_SIZE;
+        }
+        return header->length;
+    }
+    if (data_offset) {
+        *data_offset = 0;
+    }
 
+    // Scan for the length and whether it is hexadecimal, as readKey() would decide
+    std::vector<char> block(64 * 1024);
+    uint64_t length = 0;
+    bool is_hex = true;
+    while (key_stream) {
+        key_stream.read(block.data(), block.size());
+        size_t len = key_stream.gcount();
+        for (size_t i = 0; i < len && is_hex; i++) {
+            is_hex = length + i < 2 || isxdigit((unsigned char)block[i]);
+        }
+        length += len;
+        if (!is_hex) {
+            // A binary key is as long as the file, so there is no need to read the rest of a large pad
+            key_stream.clear();
+            std::streamoff end = key_stream.seekg(0, std::ios::end).tellg();
+            if (end < 0) {
+                throw std::invalid_argument("The key file must be seekable.");
+            }
+            length = end;
+            break;
+        }
+    }
+    key_stream.clear();
+    if (!key_stream.seekg(0)) {
+        throw std::invalid_argument("The key file must be seekable.");
+    }
+    if (hex) {
+        *hex = is_hex;
+    }
+    return is_hex ? length / 2 : length;
+}
+
+// The key for encryptDecrypt(): a key file stream is read whole, a KeyFile is used in place
+static std::vector<uint8_t> loadKey(std::istream& key_stream, const std::string& key_type) {
+    checkKeyFileType(key_stream, key_type);
+    return readKey(key_stream);
+}
+
+static ByteSpan loadKey(const KeyFile& key_file, const std::string& key_type) {
+    key_file.checkType(key_type);
+    return key_file.key();
+}
+
+template <typename KeySource>
+static void encryptDecryptWith(std::string operation,
+                               std::istream& input_stream, KeySource& key_source, std::ostream& output_stream,
+                               std::string file_type, std::string aes_mode, std::string key_type, bool compress,
+                               const std::optional<std::string>& key_context, const std::optional<PadRange>& pad_range) {
+
+    TRACE_SCOPE("encryptDecrypt");
     if (operation != "encrypt" && operation != "decrypt") {
         throw std::invalid_argument("Invalid operation: \"" + operation + "\"");
     }
@@ -26,255 +123,824 @@ void encryptDecrypt(std::string operation,
         throw std::invalid_argument("Invalid file type: \"" + file_type + "\"");
     }
 
+    // Anything with a CryptHeader, whether being written or read, goes through the streaming path
+    if (compress || key_context || pad_range) {
+        encryptDecryptStream(operation, input_stream, key_source, output_stream, file_type, aes_mode, key_type,
+                             DEFAULT_STREAM_BLOCK_SIZE, compress, key_context, pad_range);
+        return;
+    }
+
     // Read inputs
-    std::vector<uint8_t> header;
-    std::vector<uint8_t> input(std::istreambuf_iterator<char>(input_stream), {});
-    std::vector<uint8_t> key(std::istreambuf_iterator<char>(key_stream), {});
+    std::vector<uint8_t> input;
+    {
+        TRACE_SCOPE("read input");
+        input.assign(std::istreambuf_iterator<char>(input_stream), {});
+    }
+    size_t data_offset = file_type == "bitmap" ? BMP_HEADER_SIZE : 0;
+    if (operation == "decrypt" && input.size() > data_offset &&
+        startsWithCryptHeader(input.data() + data_offset, input.size() - data_offset)) {
+        std::istringstream buffered_input(std::string(input.begin(), input.end()));
+        encryptDecryptStream(operation, buffered_input, key_source, output_stream, file_type, aes_mode, key_type);
+        return;
+    }
+    auto loaded_key = loadKey(key_source, key_type);
+    ByteSpan key = loaded_key;
     // Preserve bmp header so it doesn't get decrypted
-    if (file_type == "bitmap") {
-        header = std::vector<uint8_t>(input.begin(), input.begin() + BMP_HEADER_SIZE);
-        input = std::vector<uint8_t>(input.begin() + BMP_HEADER_SIZE, input.end());
-    }
-    // Convert key to binary if it is hexadecimal
-    std::string key_string(key.begin(), key.end());
-    if (key_string.find_first_not_of("0123456789abcdefABCDEF", 2) == std::string::npos) {
-        key = hexStrToByteVec(key_string);
+    if (input.size() < data_offset) {
+        throw std::invalid_argument("Input is too short to be a bitmap.");
     }
+    ByteSpan data(input.data() + data_offset, input.size() - data_offset);
 
     // Run cryptography operation
     std::vector<uint8_t> output;
+    size_t output_len = 0;
     if (key_type == "aes") {
         if (key.size() != AESKeyLengthInBytes) {
             throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
         }
         if (operation == "encrypt") {
-            output = (aes_mode == "ecb") ? encryptAES256ECB(key, input) : encryptAES256OCB(key, input);
+            output.resize(encryptedSize(data.size(), aes_mode, key_type));
+            output_len = (aes_mode == "ecb") ? encryptAES256ECB(key, data, output) : encryptAES256OCB(key, data, output);
         }
         else { // operation == "decrypt"
-            output = (aes_mode == "ecb") ? decryptAES256ECB(key, input) : decryptAES256OCB(key, input);
+            output.resize(data.size());
+            output_len = (aes_mode == "ecb") ? decryptAES256ECB(key, data, output) : decryptAES256OCB(key, data, output);
         }
     }
     else { // key_type == "otp"
-        if (key.size() != input.size()) {
+        if (key.size() != data.size()) {
             throw std::invalid_argument("One-time-pad is invalid. The key file must be the same length as the input file.");
         }
-        output = xorVectors(key, input);
+        output.resize(data.size());
+        output_len = xorBytes(key, data, output);
+        countCryptBytes(operation == "encrypt", "otp", data.size());
     }
 
     // Write output
-    output_stream.write((char *)&(header)[0], header.size());
-    output_stream.write((char *)&(output)[0], output.size());
+    TRACE_SCOPE("write output", data_offset + output_len);
+    output_stream.write((const char*)input.data(), data_offset);
+    output_stream.write((const char*)output.data(), output_len);
 }
 
-std::vector<uint8_t> encryptAES256ECB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data) {
-    int resCode = 0;
+void encryptDecrypt(std::string operation,
+                    std::istream& input_stream, std::istream& key_stream, std::ostream& output_stream,
+                    std::string file_type, std::string aes_mode, std::string key_type, bool compress,
+                    const std::optional<std::string>& key_context, const std::optional<PadRange>& pad_range) {
+    encryptDecryptWith(operation, input_stream, key_stream, output_stream, file_type, aes_mode, key_type, compress,
+                       key_context, pad_range);
+}
 
-    // 1. Create context
-    std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> pEvpCtx(EVP_CIPHER_CTX_new(), ::EVP_CIPHER_CTX_free);
-    if (pEvpCtx == nullptr) {
-        throw std::runtime_error("EVP_CIPHER_CTX_new() returned NULL!");
+void encryptDecrypt(std::string operation,
+                    std::istream& input_stream, const KeyFile& key_file, std::ostream& output_stream,
+                    std::string file_type, std::string aes_mode, std::string key_type, bool compress,
+                    const std::optional<std::string>& key_context, const std::optional<PadRange>& pad_range) {
+    encryptDecryptWith(operation, input_stream, key_file, output_stream, file_type, aes_mode, key_type, compress,
+                       key_context, pad_range);
+}
+
+std::vector<uint8_t> beginEncryptHeader(CryptStream& crypt_stream, bool compress,
+                                        const std::optional<std::string>& key_context,
+                                        const std::optional<PadRange>& pad_range) {
+    if (!compress && !key_context && !pad_range) {
+        return {};
+    }
+    CryptHeader header;
+    if (key_context) {
+        std::vector<uint8_t> salt(HKDF_SALT_SIZE);
+        if (RAND_bytes(salt.data(), salt.size()) != OPENSSL_SUCCESS) {
+            throw std::runtime_error("RAND_bytes() failed!");
+        }
+        crypt_stream.useDerivedKey(salt, *key_context);
+        header.flags |= CRYPT_HEADER_FLAG_HKDF;
+        header.fields[CRYPT_HEADER_FIELD_HKDF_SALT] = salt;
+        if (!key_context->empty()) {
+            header.fields[CRYPT_HEADER_FIELD_KEY_CONTEXT].assign(key_context->begin(), key_context->end());
+        }
     }
+    if (pad_range) {
+        crypt_stream.usePadRange(*pad_range);
+        header.flags |= CRYPT_HEADER_FLAG_PAD_RANGE;
+        header.fields[CRYPT_HEADER_FIELD_PAD_OFFSET] = encodeU64Field(pad_range->offset);
+        header.fields[CRYPT_HEADER_FIELD_PAD_LENGTH] = encodeU64Field(pad_range->length);
+    }
+    if (compress) {
+        header.flags |= CRYPT_HEADER_FLAG_ZSTD;
+    }
+    std::vector<uint8_t> header_bytes = header.serialize();
+    crypt_stream.setAssociatedData(header_bytes.data(), header_bytes.size());
+    return header_bytes;
+}
 
-    // 2. Set engine EVP_aes_256_ecb: AES-256 Electronic Codebook
-    resCode = EVP_EncryptInit_ex(pEvpCtx.get(), EVP_aes_256_ecb(), nullptr, aesKey.data(), nullptr); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_EncryptInit_ex() failed!");
+void useCryptHeader(CryptStream& crypt_stream, const CryptHeader& header) {
+    if (header.flags & CRYPT_HEADER_FLAG_HKDF) {
+        auto salt = header.fields.find(CRYPT_HEADER_FIELD_HKDF_SALT);
+        auto context = header.fields.find(CRYPT_HEADER_FIELD_KEY_CONTEXT);
+        if (salt == header.fields.end() || salt->second.empty()) {
+            throw std::invalid_argument("Ciphertext header is missing the key derivation salt.");
+        }
+        crypt_stream.useDerivedKey(salt->second, context == header.fields.end() ? std::string() :
+                                   std::string(context->second.begin(), context->second.end()));
+    }
+    if (header.flags & CRYPT_HEADER_FLAG_PAD_RANGE) {
+        auto offset = header.fields.find(CRYPT_HEADER_FIELD_PAD_OFFSET);
+        auto length = header.fields.find(CRYPT_HEADER_FIELD_PAD_LENGTH);
+        if (offset == header.fields.end() || length == header.fields.end()) {
+            throw std::invalid_argument("Ciphertext header is missing the pad range.");
+        }
+        crypt_stream.usePadRange({ decodeU64Field(offset->second), decodeU64Field(length->second) });
+    }
+}
+
+// Bytes left to read from a seekable stream, or nothing for a pipe
+static std::optional<uint64_t> remainingSize(std::istream& stream) {
+    std::streamoff pos = stream.tellg();
+    if (pos < 0) {
+        return std::nullopt;
+    }
+    std::streamoff end = stream.seekg(0, std::ios::end).tellg();
+    stream.clear();
+    stream.seekg(pos);
+    if (end < pos || !stream) {
+        stream.clear();
+        return std::nullopt;
     }
+    return end - pos;
+}
 
-    // Over allocate vector for encrypted data to account for block size
-    int blockSizeInBytes = EVP_CIPHER_CTX_block_size(pEvpCtx.get());
-    std::vector<uint8_t> encryptedData(data.size() + blockSizeInBytes);
+template <typename KeySource>
+static void encryptDecryptStreamWith(std::string operation,
+                                     std::istream& input_stream, KeySource& key_source, std::ostream& output_stream,
+                                     std::string file_type, std::string aes_mode, std::string key_type,
+                                     size_t block_size, bool compress, const std::optional<std::string>& key_context,
+                                     const std::optional<PadRange>& pad_range) {
 
-    // 3. Encrypt the plaintext
-    int len;
-    resCode = EVP_EncryptUpdate(pEvpCtx.get(), encryptedData.data(), &len, data.data(), data.size()); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_EncryptUpdate() failed!");
+    TRACE_SCOPE("encryptDecryptStream");
+    if (file_type != "binary" && file_type != "bitmap") {
+        throw std::invalid_argument("Invalid file type: \"" + file_type + "\"");
     }
+    if (compress && (operation != "encrypt" || key_type != "aes" || file_type != "binary")) {
+        // A one-time-pad must match the data length, and compressing a bitmap would spoil the demonstration
+        throw std::invalid_argument("Compression is only supported when encrypting binary files with an AES key.");
+    }
+    if (key_context && (operation != "encrypt" || key_type != "aes")) {
+        throw std::invalid_argument("Key derivation is only supported when encrypting with an AES key.");
+    }
+    if (pad_range && (operation != "encrypt" || key_type != "otp")) {
+        throw std::invalid_argument("A pad range is only supported when encrypting with a one-time-pad.");
+    }
+    CryptStream crypt_stream(operation, key_source, aes_mode, key_type);
 
-    // Finalize encrypt
-    resCode = EVP_EncryptFinal_ex(pEvpCtx.get(), encryptedData.data() + len, &len); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_EncryptFinal_ex() failed!");
+    std::vector<uint8_t> input(std::max<size_t>(block_size, BMP_HEADER_SIZE));
+    std::vector<uint8_t> output;
+    output.reserve(input.size() + EVP_MAX_BLOCK_LENGTH + AETagSizeInBytes);
+    auto write_output = [&]() {
+        TRACE_SCOPE("write output", output.size());
+        if (!output_stream.write((const char*)output.data(), output.size())) {
+            throw std::runtime_error("Unable to write the output.");
+        }
+        output.clear();
+    };
+
+    // Preserve bmp header so it doesn't get decrypted
+    if (file_type == "bitmap") {
+        if (!input_stream.read((char*)input.data(), BMP_HEADER_SIZE)) {
+            throw std::invalid_argument("Input is too short to be a bitmap.");
+        }
+        output.assign(input.begin(), input.begin() + BMP_HEADER_SIZE);
+        write_output();
     }
 
-    return encryptedData;
+    std::unique_ptr<ZstdStream> zstd;
+    if (compress || key_context || pad_range) {
+        output = beginEncryptHeader(crypt_stream, compress, key_context, pad_range);
+        if (compress) {
+            zstd = std::make_unique<ZstdStream>(true);
+        }
+        write_output();
+    }
+    else if (operation == "decrypt") {
+        // Look for a header; without one these bytes are the start of the ciphertext
+        input_stream.read((char*)input.data(), CRYPT_HEADER_MAGIC_SIZE);
+        size_t len = input_stream.gcount();
+        if (startsWithCryptHeader(input.data(), len)) {
+            std::vector<uint8_t> raw_header;
+            CryptHeader header = CryptHeader::read(input_stream, raw_header);
+            if (header.flags & CRYPT_HEADER_FLAG_ARCHIVE) {
+                throw std::invalid_argument("Ciphertext is an archive; list it or extract its members instead.");
+            }
+            useCryptHeader(crypt_stream, header);
+            if (header.flags & CRYPT_HEADER_FLAG_CHUNKED) {
+                // Each chunk has its own key, derived from the file's salt and the chunk's index
+                if (!(header.flags & CRYPT_HEADER_FLAG_HKDF) || (header.flags & CRYPT_HEADER_FLAG_ZSTD)) {
+                    throw std::invalid_argument("Ciphertext header has an invalid combination of options.");
+                }
+                const std::vector<uint8_t>& salt = header.fields[CRYPT_HEADER_FIELD_HKDF_SALT];
+                const std::vector<uint8_t>& context = header.fields[CRYPT_HEADER_FIELD_KEY_CONTEXT];
+                ChunkLayout layout(decodeU64Field(header.fields[CRYPT_HEADER_FIELD_PLAINTEXT_SIZE]),
+                                   decodeU64Field(header.fields[CRYPT_HEADER_FIELD_CHUNK_SIZE]), aes_mode);
+                // The sizes come from the header, so check them against the input before trusting them
+                std::optional<uint64_t> remaining = remainingSize(input_stream);
+                if (remaining && *remaining != layout.ciphertextTotalSize()) {
+                    throw std::invalid_argument("Ciphertext is truncated or has unexpected data after the last chunk.");
+                }
+                std::vector<uint8_t> chunk;
+                for (uint64_t index = 0; index < layout.count; index++) {
+                    chunk.resize(layout.ciphertextSize(index));
+                    if (!input_stream.read((char*)chunk.data(), chunk.size())) {
+                        throw std::invalid_argument("Ciphertext is truncated.");
+                    }
+                    crypt_stream.useDerivedKey(chunkSalt(salt, index), std::string(context.begin(), context.end()));
+                    crypt_stream.setAssociatedData(raw_header.data(), raw_header.size());
+                    crypt_stream.update(chunk.data(), chunk.size(), output);
+                    crypt_stream.finish(output);
+                    write_output();
+                }
+                if (input_stream.peek() != std::char_traits<char>::eof()) {
+                    throw std::invalid_argument("Unexpected data after the last chunk of the ciphertext.");
+                }
+                output_stream.flush();
+                return;
+            }
+            crypt_stream.setAssociatedData(raw_header.data(), raw_header.size());
+            if (header.flags & CRYPT_HEADER_FLAG_ZSTD) {
+                zstd = std::make_unique<ZstdStream>(false);
+            }
+        }
+        else {
+            crypt_stream.update(input.data(), len, output);
+            write_output();
+        }
+    }
+
+    // Compression comes before encryption, and decompression after decryption
+    std::vector<uint8_t> staged;
+    auto process = [&](const uint8_t* data, size_t size, bool last) {
+        if (zstd && compress) {
+            zstd->update(data, size, staged);
+            if (last) {
+                zstd->finish(staged);
+            }
+            crypt_stream.update(staged.data(), staged.size(), output);
+            if (last) {
+                crypt_stream.finish(output);
+            }
+        }
+        else if (zstd) {
+            crypt_stream.update(data, size, staged);
+            if (last) {
+                crypt_stream.finish(staged);
+            }
+            // Written out piece by piece, since a small ciphertext can decompress to far more than a block
+            zstd->update(staged.data(), staged.size(), [&](const uint8_t* piece, size_t piece_size) {
+                output.assign(piece, piece + piece_size);
+                write_output();
+            });
+            if (last) {
+                zstd->finish(output);
+            }
+        }
+        else {
+            crypt_stream.update(data, size, output);
+            if (last) {
+                crypt_stream.finish(output);
+            }
+        }
+        staged.clear();
+        write_output();
+    };
+
+    while (input_stream) {
+        {
+            TRACE_SCOPE("read input", block_size);
+            input_stream.read((char*)input.data(), block_size);
+        }
+        process(input.data(), input_stream.gcount(), false);
+    }
+    if (input_stream.bad()) {
+        throw std::runtime_error("Unable to read the input.");
+    }
+    process(nullptr, 0, true);
+    output_stream.flush();
 }
 
-std::vector<uint8_t> decryptAES256ECB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data) {
-    int resCode = 0;
+void encryptDecryptStream(std::string operation,
+                          std::istream& input_stream, std::istream& key_stream, std::ostream& output_stream,
+                          std::string file_type, std::string aes_mode, std::string key_type, size_t block_size,
+                          bool compress, const std::optional<std::string>& key_context,
+                          const std::optional<PadRange>& pad_range) {
+    encryptDecryptStreamWith(operation, input_stream, key_stream, output_stream, file_type, aes_mode, key_type,
+                             block_size, compress, key_context, pad_range);
+}
+
+void encryptDecryptStream(std::string operation,
+                          std::istream& input_stream, const KeyFile& key_file, std::ostream& output_stream,
+                          std::string file_type, std::string aes_mode, std::string key_type, size_t block_size,
+                          bool compress, const std::optional<std::string>& key_context,
+                          const std::optional<PadRange>& pad_range) {
+    encryptDecryptStreamWith(operation, input_stream, key_file, output_stream, file_type, aes_mode, key_type,
+                             block_size, compress, key_context, pad_range);
+}
 
-    // 1. Create context
-    std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> pEvpCtx(EVP_CIPHER_CTX_new(), ::EVP_CIPHER_CTX_free);
-    if (pEvpCtx == nullptr) {
+struct CipherCtxDeleter {
+    void operator()(EVP_CIPHER_CTX* ctx) const { EVP_CIPHER_CTX_free(ctx); }
+};
+
+struct ThreadCipher {
+    std::unique_ptr<EVP_CIPHER_CTX, CipherCtxDeleter> ctx;
+    bool keyed = false;
+    uint8_t key[AESKeyLengthInBytes];
+};
+
+// In practice IV shouldn't be a zero vector, but to keep this demo simple we will set it to zero vector
+static const uint8_t ZeroIV[IVLengthInBytes] = {};
+
+static std::unique_ptr<EVP_CIPHER_CTX, CipherCtxDeleter> newCipherContext(bool ocb, bool encrypt) {
+    std::unique_ptr<EVP_CIPHER_CTX, CipherCtxDeleter> new_ctx(EVP_CIPHER_CTX_new());
+    if (new_ctx == nullptr) {
         throw std::runtime_error("EVP_CIPHER_CTX_new() returned NULL!");
     }
+    const EVP_CIPHER* cipher = ocb ? EVP_aes_256_ocb() : EVP_aes_256_ecb();
+    if (EVP_CipherInit_ex(new_ctx.get(), cipher, nullptr, nullptr, nullptr, encrypt) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_CipherInit_ex() failed!");
+    }
+    if (ocb) {
+        if (EVP_CIPHER_CTX_ctrl(new_ctx.get(), EVP_CTRL_AEAD_SET_TAG, AETagSizeInBytes, nullptr) != OPENSSL_SUCCESS) { // NOLINT
+            throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_TAG failed!");
+        }
+        if (EVP_CIPHER_CTX_ctrl(new_ctx.get(), EVP_CTRL_AEAD_SET_IVLEN, IVLengthInBytes, nullptr) != OPENSSL_SUCCESS) { // NOLINT
+            throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_IVLEN failed!");
+        }
+    }
+    return new_ctx;
+}
 
-    // 2. Set engine EVP_aes_256_ecb: AES-256 Electronic Codebook
-    resCode = EVP_DecryptInit_ex(pEvpCtx.get(), EVP_aes_256_ecb(), nullptr, aesKey.data(), nullptr); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_DecryptInit_ex() failed!");
+// The span functions keep one cipher context per mode and direction on each thread, so after a thread's
+// first call they allocate nothing from the C++ heap. Setting a new OCB key makes OpenSSL allocate its
+// offset table, so a repeated key only resets the IV.
+static EVP_CIPHER_CTX* threadCipherContext(bool ocb, bool encrypt, ByteSpan aesKey) {
+    thread_local ThreadCipher ciphers[2][2];
+    ThreadCipher& cipher = ciphers[ocb][encrypt];
+    if (cipher.ctx == nullptr) {
+        cipher.ctx = newCipherContext(ocb, encrypt);
+    }
+
+    // Setting the key or IV also clears anything left from the previous call
+    bool same_key = cipher.keyed && CRYPTO_memcmp(cipher.key, aesKey.data(), AESKeyLengthInBytes) == 0;
+    cipher.keyed = false;
+    TRACE_SCOPE(same_key ? "EVP reset IV" : "EVP set key");
+    if (EVP_CipherInit_ex(cipher.ctx.get(), nullptr, nullptr, same_key ? nullptr : aesKey.data(),
+                          ocb ? ZeroIV : nullptr, encrypt) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error(encrypt ? "EVP_EncryptInit_ex() failed!" : "EVP_DecryptInit_ex() failed!");
+    }
+    memcpy(cipher.key, aesKey.data(), AESKeyLengthInBytes);
+    cipher.keyed = true;
+    return cipher.ctx.get();
+}
+
+static void checkAESBuffers(ByteSpan aesKey, MutableByteSpan output, size_t output_needed) {
+    if (aesKey.size() != AESKeyLengthInBytes) {
+        throw std::invalid_argument("AES key is of the wrong size.");
     }
+    if (output.size() < output_needed) {
+        throw std::invalid_argument("Output buffer is too small.");
+    }
+}
 
-    // Allocate vector for decrypted data
-    std::vector<uint8_t> decryptedData(data.size());
+size_t encryptAES256ECB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output) {
+    TRACE_SCOPE("encryptAES256ECB", data.size());
+    checkAESBuffers(aesKey, output, (data.size() / 16 + 1) * 16);
+    EVP_CIPHER_CTX* ctx = threadCipherContext(false, true, aesKey);
+    int len;
+    if (EVP_EncryptUpdate(ctx, output.data(), &len, data.data(), data.size()) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_EncryptUpdate() failed!");
+    }
+    int finalLen;
+    if (EVP_EncryptFinal_ex(ctx, output.data() + len, &finalLen) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_EncryptFinal_ex() failed!");
+    }
+    countCryptBytes(true, "ecb", data.size());
+    return len + finalLen;
+}
 
-    // 3. Decrypt the ciphertext
+size_t decryptAES256ECB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output) {
+    TRACE_SCOPE("decryptAES256ECB", data.size());
+    checkAESBuffers(aesKey, output, data.size());
+    EVP_CIPHER_CTX* ctx = threadCipherContext(false, false, aesKey);
     int len;
-    resCode = EVP_DecryptUpdate(pEvpCtx.get(), decryptedData.data(), &len, data.data(), data.size()); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
+    if (EVP_DecryptUpdate(ctx, output.data(), &len, data.data(), data.size()) != OPENSSL_SUCCESS) { // NOLINT
         throw std::runtime_error("EVP_DecryptUpdate() failed!");
     }
+    int finalLen;
+    if (EVP_DecryptFinal_ex(ctx, output.data() + len, &finalLen) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_DecryptFinal_ex() failed!");
+    }
+    countCryptBytes(false, "ecb", data.size());
+    return len + finalLen;
+}
 
-    // Finalize decrypt
-    resCode = EVP_DecryptFinal_ex(pEvpCtx.get(), decryptedData.data() + len, &len); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
+size_t encryptAES256OCB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output) {
+    TRACE_SCOPE("encryptAES256OCB", data.size());
+    checkAESBuffers(aesKey, output, data.size() + AETagSizeInBytes);
+    EVP_CIPHER_CTX* ctx = threadCipherContext(true, true, aesKey);
+    int len;
+    if (EVP_EncryptUpdate(ctx, output.data(), &len, data.data(), data.size()) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_EncryptUpdate() failed!");
+    }
+    int finalLen;
+    if (EVP_EncryptFinal_ex(ctx, output.data() + len, &finalLen) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_EncryptFinal_ex() failed!");
+    }
+    size_t ciphertext_len = len + finalLen;
+
+    // The tag goes straight after the ciphertext
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, AETagSizeInBytes, output.data() + ciphertext_len) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_GET_TAG failed!");
+    }
+    countCryptBytes(true, "ocb", data.size());
+    return ciphertext_len + AETagSizeInBytes;
+}
+
+size_t decryptAES256OCB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output) {
+    TRACE_SCOPE("decryptAES256OCB", data.size());
+    if (data.size() < AETagSizeInBytes) {
+        throw std::runtime_error("Ciphertext is too short to contain a tag.");
+    }
+    size_t ciphertext_len = data.size() - AETagSizeInBytes;
+    checkAESBuffers(aesKey, output, ciphertext_len);
+    EVP_CIPHER_CTX* ctx = threadCipherContext(true, false, aesKey);
+    void* tag = const_cast<uint8_t*>(data.data() + ciphertext_len);
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, AETagSizeInBytes, tag) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_TAG failed!");
+    }
+    int len;
+    if (EVP_DecryptUpdate(ctx, output.data(), &len, data.data(), ciphertext_len) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("EVP_DecryptUpdate() failed!");
+    }
+    int finalLen;
+    if (EVP_DecryptFinal_ex(ctx, output.data() + len, &finalLen) != OPENSSL_SUCCESS) { // NOLINT
         throw std::runtime_error("EVP_DecryptFinal_ex() failed!");
     }
+    countCryptBytes(false, "ocb", data.size());
+    return len + finalLen;
+}
 
+std::vector<uint8_t> encryptAES256ECB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> encryptedData(encryptedSize(data.size(), "ecb", "aes"));
+    encryptedData.resize(encryptAES256ECB(ByteSpan(aesKey), ByteSpan(data), MutableByteSpan(encryptedData)));
+    return encryptedData;
+}
+
+std::vector<uint8_t> decryptAES256ECB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> decryptedData(data.size());
+    decryptedData.resize(decryptAES256ECB(ByteSpan(aesKey), ByteSpan(data), MutableByteSpan(decryptedData)));
     return decryptedData;
 }
 
 std::vector<uint8_t> encryptAES256OCB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data) {
-    if (aesKey.size() != AESKeyLengthInBytes) {
-        throw std::runtime_error("AES key is of the wrong size.");
-    }
+    std::vector<uint8_t> encryptedData(encryptedSize(data.size(), "ocb", "aes"));
+    encryptedData.resize(encryptAES256OCB(ByteSpan(aesKey), ByteSpan(data), MutableByteSpan(encryptedData)));
+    return encryptedData;
+}
 
-    // In practice IV shouldn't be a zero vector, but to keep this demo simple we will set it to zero vector
-    std::vector<uint8_t> aesKeyWithIV(IVLengthInBytes, 0);
-    aesKeyWithIV.insert(aesKeyWithIV.begin(), aesKey.begin(), aesKey.end());
-    int resCode = 0;
+std::vector<uint8_t> decryptAES256OCB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> decryptedData(data.size() > AETagSizeInBytes ? data.size() - AETagSizeInBytes : 0);
+    decryptedData.resize(decryptAES256OCB(ByteSpan(aesKey), ByteSpan(data), MutableByteSpan(decryptedData)));
+    return decryptedData;
+}
 
-    // 1. Create context
-    std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> pEvpCtx(EVP_CIPHER_CTX_new(), ::EVP_CIPHER_CTX_free);
-    if (pEvpCtx == nullptr) {
-        throw std::runtime_error("EVP_CIPHER_CTX_new() returned NULL!");
+uint64_t encryptedSize(uint64_t plaintext_size, const std::string& aes_mode, const std::string& key_type) {
+    if (key_type == "otp") {
+        return plaintext_size;
     }
-
-    // 2. Set engine EVP_aes_256_ocb: AES-256 Offset Codebook
-    resCode = EVP_EncryptInit_ex(pEvpCtx.get(), EVP_aes_256_ocb(), nullptr, nullptr, nullptr); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_EncryptInit_ex() failed!");
+    if (aes_mode == "ecb") {
+        // PKCS#7 padding always adds between 1 and 16 bytes
+        return (plaintext_size / 16 + 1) * 16;
     }
+    return plaintext_size + AETagSizeInBytes;
+}
 
-    // Set Tag length
-    resCode = EVP_CIPHER_CTX_ctrl(pEvpCtx.get(), EVP_CTRL_AEAD_SET_TAG, AETagSizeInBytes, nullptr); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_TAG failed!");
-    }
+// Kept apart from any other use of HKDF with the same key; bump the version if the derivation ever changes
+static const char HKDFInfoPrefix[] = "qrypt file key v1";
+
+DerivedKey deriveKey(ByteSpan master_key, ByteSpan salt, const std::string& context) {
+    TRACE_SCOPE("deriveKey");
+    if (master_key.size() != AESKeyLengthInBytes) {
+        throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
+    }
+    if (salt.empty()) {
+        throw std::invalid_argument("Key derivation salt must not be empty.");
+    }
+    if (context.size() > MAX_KEY_CONTEXT_SIZE) {
+        throw std::invalid_argument("Key context must be at most " + std::to_string(MAX_KEY_CONTEXT_SIZE) + " bytes.");
+    }
+    // The prefix's terminating zero separates it from the context
+    std::vector<uint8_t> info(HKDFInfoPrefix, HKDFInfoPrefix + sizeof(HKDFInfoPrefix));
+    info.insert(info.end(), context.begin(), context.end());
+
+    std::unique_ptr<EVP_PKEY_CTX, decltype(&::EVP_PKEY_CTX_free)> pctx(EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr),
+                                                                       ::EVP_PKEY_CTX_free);
+    uint8_t okm[AESKeyWithIVLengthInBytes];
+    size_t okm_len = sizeof(okm);
+    if (pctx == nullptr ||
+        EVP_PKEY_derive_init(pctx.get()) != OPENSSL_SUCCESS ||
+        EVP_PKEY_CTX_set_hkdf_md(pctx.get(), EVP_sha256()) != OPENSSL_SUCCESS ||
+        EVP_PKEY_CTX_set1_hkdf_salt(pctx.get(), salt.data(), salt.size()) != OPENSSL_SUCCESS ||
+        EVP_PKEY_CTX_set1_hkdf_key(pctx.get(), master_key.data(), master_key.size()) != OPENSSL_SUCCESS ||
+        EVP_PKEY_CTX_add1_hkdf_info(pctx.get(), info.data(), info.size()) != OPENSSL_SUCCESS ||
+        EVP_PKEY_derive(pctx.get(), okm, &okm_len) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error("HKDF key derivation failed!");
+    }
+    DerivedKey derived = {
+        std::vector<uint8_t>(okm, okm + AESKeyLengthInBytes),
+        std::vector<uint8_t>(okm + AESKeyLengthInBytes, okm + AESKeyWithIVLengthInBytes)
+    };
+    OPENSSL_cleanse(okm, sizeof(okm));
+    return derived;
+}
 
-    // Set IV length
-    resCode = EVP_CIPHER_CTX_ctrl(pEvpCtx.get(), EVP_CTRL_AEAD_SET_IVLEN, IVLengthInBytes, nullptr); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_IVLEN failed!");
+std::vector<uint8_t> chunkSalt(ByteSpan salt, uint64_t index) {
+    std::vector<uint8_t> chunk_salt(salt.begin(), salt.end());
+    std::vector<uint8_t> encoded_index = encodeU64Field(index);
+    chunk_salt.insert(chunk_salt.end(), encoded_index.begin(), encoded_index.end());
+    return chunk_salt;
+}
+
+ChunkLayout::ChunkLayout(uint64_t plaintext_size, uint64_t chunk_size, const std::string& aes_mode) :
+                         plaintext_size(plaintext_size), chunk_size(chunk_size), aes_mode(aes_mode) {
+    // ECB pads each chunk, so only whole blocks may come before the last one
+    if (chunk_size == 0 || chunk_size > MAX_CHUNK_SIZE || (aes_mode == "ecb" && chunk_size % 16 != 0)) {
+        throw std::invalid_argument("Invalid chunk size: " + std::to_string(chunk_size));
     }
+    count = plaintext_size / chunk_size + (plaintext_size % chunk_size != 0);
+    if (count > 0 && (count - 1 > UINT64_MAX / encryptedSize(chunk_size, aes_mode, "aes") ||
+                      ciphertextOffset(count - 1) > UINT64_MAX - ciphertextSize(count - 1))) {
+        throw std::invalid_argument("Invalid plaintext size: " + std::to_string(plaintext_size));
+    }
+}
 
-    // Set AES key and IV
-    resCode = EVP_EncryptInit_ex(pEvpCtx.get(), nullptr, nullptr, aesKeyWithIV.data(),
-                                 aesKeyWithIV.data() + AESKeyLengthInBytes); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_EncryptInit_ex() failed!");
+uint64_t ChunkLayout::plaintextSize(uint64_t index) const {
+    return std::min(chunk_size, plaintext_size - plaintextOffset(index));
+}
+
+uint64_t ChunkLayout::ciphertextOffset(uint64_t index) const {
+    return index * encryptedSize(chunk_size, aes_mode, "aes");
+}
+
+uint64_t ChunkLayout::ciphertextSize(uint64_t index) const {
+    return encryptedSize(plaintextSize(index), aes_mode, "aes");
+}
+
+uint64_t ChunkLayout::ciphertextTotalSize() const {
+    return count == 0 ? 0 : ciphertextOffset(count - 1) + ciphertextSize(count - 1);
+}
+
+static void checkCryptArgs(const std::string& operation, const std::string& aes_mode, const std::string& key_type) {
+    if (operation != "encrypt" && operation != "decrypt") {
+        throw std::invalid_argument("Invalid operation: \"" + operation + "\"");
+    }
+    if (key_type != "aes" && key_type != "otp") {
+        throw std::invalid_argument("Invalid key type: \"" + key_type + "\"");
     }
+    if (aes_mode != "ecb" && aes_mode != "ocb") {
+        throw std::invalid_argument("Invalid aes mode: \"" + aes_mode + "\"");
+    }
+}
 
-    // Over allocate vector for encrypted data to account for block size
-    int blockSizeInBytes = EVP_CIPHER_CTX_block_size(pEvpCtx.get());
-    std::vector<uint8_t> encryptedData(data.size() + blockSizeInBytes);
+CryptStream::CryptStream(const std::string& operation, const std::vector<uint8_t>& key,
+                         const std::string& aes_mode, const std::string& key_type) :
+                         encrypt(operation == "encrypt"), aes_mode(aes_mode), key_type(key_type), key(key),
+                         pad_size(key.size()), ctx(nullptr, ::EVP_CIPHER_CTX_free) {
 
-    // 3. Encrypt the plaintext
-    int len;
-    resCode = EVP_EncryptUpdate(pEvpCtx.get(), encryptedData.data(), &len, data.data(), data.size()); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_EncryptUpdate() failed!");
+    checkCryptArgs(operation, aes_mode, key_type);
+    initCipher();
+}
+
+CryptStream::CryptStream(const std::string& operation, std::istream& key_stream,
+                         const std::string& aes_mode, const std::string& key_type) :
+                         encrypt(operation == "encrypt"), aes_mode(aes_mode), key_type(key_type),
+                         ctx(nullptr, ::EVP_CIPHER_CTX_free) {
+
+    checkCryptArgs(operation, aes_mode, key_type);
+    checkKeyFileType(key_stream, key_type);
+    if (key_type == "aes") {
+        key = readKey(key_stream);
+        initCipher();
+        return;
     }
-    int ciphertext_len = len;
 
-    // Finalize encrypt
-    resCode = EVP_EncryptFinal_ex(pEvpCtx.get(), encryptedData.data() + len, &len); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_EncryptFinal_ex() failed!");
+    pad_size = keySize(key_stream, &pad_hex, &pad_data_offset);
+    pad_stream = &key_stream;
+    if (!pad_stream->seekg(pad_data_offset)) {
+        throw std::invalid_argument("The key file must be seekable.");
     }
-    ciphertext_len += len;
+}
 
-    // 4. Get tag
-    std::vector<uint8_t> tag(AETagSizeInBytes);
-    resCode = EVP_CIPHER_CTX_ctrl(pEvpCtx.get(), EVP_CTRL_AEAD_GET_TAG, AETagSizeInBytes, tag.data()); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_GET_TAG failed!");
+CryptStream::CryptStream(const std::string& operation, const KeyFile& key_file,
+                         const std::string& aes_mode, const std::string& key_type) :
+                         encrypt(operation == "encrypt"), aes_mode(aes_mode), key_type(key_type),
+                         ctx(nullptr, ::EVP_CIPHER_CTX_free) {
+
+    checkCryptArgs(operation, aes_mode, key_type);
+    key_file.checkType(key_type);
+    if (key_type == "aes") {
+        key.assign(key_file.key().begin(), key_file.key().end());
+        initCipher();
+        return;
     }
 
-    // 5. Resize vector for encrypted data and append tag
-    encryptedData.resize(ciphertext_len);
-    encryptedData.insert(encryptedData.end(), tag.begin(), tag.end());
-    return encryptedData;
+    mapped_pad = key_file.key().data();
+    pad_size = key_file.key().size();
 }
 
-std::vector<uint8_t> decryptAES256OCB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data) {
-    if (aesKey.size() != AESKeyLengthInBytes) {
-        throw std::runtime_error("AES key is of the wrong size.");
+void CryptStream::initCipher() {
+    if (key_type == "otp") {
+        return;
+    }
+    TRACE_SCOPE("EVP init");
+    if (key.size() != AESKeyLengthInBytes) {
+        throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
     }
 
-    std::vector<uint8_t> aesKeyWithIV(IVLengthInBytes, 0);
-    aesKeyWithIV.insert(aesKeyWithIV.begin(), aesKey.begin(), aesKey.end());
+    // Same cipher setup as the one-shot helpers, kept open across calls to update()
     int resCode = 0;
-
-    // 1. Create context
-    std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> pEvpCtx(EVP_CIPHER_CTX_new(), ::EVP_CIPHER_CTX_free);
-    if (pEvpCtx == nullptr) {
+    ctx.reset(EVP_CIPHER_CTX_new());
+    if (ctx == nullptr) {
         throw std::runtime_error("EVP_CIPHER_CTX_new() returned NULL!");
     }
+    if (aes_mode == "ecb") {
+        resCode = EVP_CipherInit_ex(ctx.get(), EVP_aes_256_ecb(), nullptr, key.data(), nullptr, encrypt); // NOLINT
+        if (resCode != OPENSSL_SUCCESS) {
+            throw std::runtime_error("EVP_CipherInit_ex() failed!");
+        }
+        return;
+    }
 
-    // 2. Set engine EVP_aes_256_ocb: AES-256 Offset Codebook
-    resCode = EVP_DecryptInit_ex(pEvpCtx.get(), EVP_aes_256_ocb(), nullptr, nullptr, nullptr); // NOLINT
+    resCode = EVP_CipherInit_ex(ctx.get(), EVP_aes_256_ocb(), nullptr, nullptr, nullptr, encrypt); // NOLINT
     if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_DecryptInit_ex() failed!");
+        throw std::runtime_error("EVP_CipherInit_ex() failed!");
     }
-
-    // Set Tag length
-    resCode = EVP_CIPHER_CTX_ctrl(pEvpCtx.get(), EVP_CTRL_AEAD_SET_TAG, AETagSizeInBytes, nullptr); // NOLINT
+    resCode = EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_TAG, AETagSizeInBytes, nullptr); // NOLINT
     if (resCode != OPENSSL_SUCCESS) {
         throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_TAG failed!");
     }
-
-    // Set IV length
-    resCode = EVP_CIPHER_CTX_ctrl(pEvpCtx.get(), EVP_CTRL_AEAD_SET_IVLEN, IVLengthInBytes, nullptr); // NOLINT
+    resCode = EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_IVLEN, IVLengthInBytes, nullptr); // NOLINT
     if (resCode != OPENSSL_SUCCESS) {
         throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_IVLEN failed!");
     }
-
-    // Set AES key and IV
-    resCode = EVP_DecryptInit_ex(pEvpCtx.get(), nullptr, nullptr, aesKeyWithIV.data(),
-                                 aesKeyWithIV.data() + AESKeyLengthInBytes); // NOLINT
+    // Zero IV, as in encryptAES256OCB(), unless the key was derived
+    resCode = EVP_CipherInit_ex(ctx.get(), nullptr, nullptr, key.data(), iv.empty() ? ZeroIV : iv.data(), encrypt); // NOLINT
     if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_DecryptInit_ex() failed!");
+        throw std::runtime_error("EVP_CipherInit_ex() failed!");
     }
+}
 
-    // 3. Set tag
-    std::vector<uint8_t> tag(data.end() - AETagSizeInBytes, data.end());
-    resCode = EVP_CIPHER_CTX_ctrl(pEvpCtx.get(), EVP_CTRL_AEAD_SET_TAG, AETagSizeInBytes, tag.data()); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_TAG failed!");
+// Read the next size bytes of a pad that is being streamed from a key file
+const uint8_t* CryptStream::readPad(size_t size) {
+    size_t chars = pad_hex ? 2 * size : size;
+    pad_chars.resize(chars);
+    if (!pad_stream->read(pad_chars.data(), chars)) {
+        throw std::runtime_error("Unable to read the one-time-pad from the key file.");
+    }
+    if (pad_hex) {
+        for (size_t i = 0; i < size; i++) {
+            pad_chars[i] = (char)((hexCharToInt(pad_chars[2 * i]) << 4) | hexCharToInt(pad_chars[2 * i + 1]));
+        }
     }
+    return (const uint8_t*)pad_chars.data();
+}
 
-    // Allocate vector for decrypted data
-    int ciphertext_len = data.size() - AETagSizeInBytes;
-    std::vector<uint8_t> decryptedData(ciphertext_len);
+void CryptStream::useDerivedKey(ByteSpan salt, const std::string& context) {
+    if (key_type != "aes") {
+        throw std::invalid_argument("Key derivation requires an AES key.");
+    }
+    if (master_key.empty()) {
+        master_key = key;
+    }
+    DerivedKey derived = deriveKey(master_key, salt, context);
+    key = derived.key;
+    iv = derived.iv;
+    held_tag.clear();
+    initCipher();
+}
 
-    // 4. Decrypt the ciphertext
-    int len;
-    resCode = EVP_DecryptUpdate(pEvpCtx.get(), decryptedData.data(), &len, data.data(), ciphertext_len); // NOLINT
-    if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_DecryptUpdate() failed!");
+void CryptStream::usePadRange(const PadRange& range) {
+    if (key_type != "otp") {
+        throw std::invalid_argument("A pad range requires a one-time-pad.");
+    }
+    if (pad_offset != 0) {
+        throw std::logic_error("usePadRange() must be called before update().");
+    }
+    if (range.offset > pad_size || range.length > pad_size - range.offset) {
+        throw std::invalid_argument("One-time-pad is invalid. The pad range goes beyond the end of the key file.");
+    }
+    if (pad_stream) {
+        pad_stream->clear();
+        if (!pad_stream->seekg(pad_data_offset + (pad_hex ? 2 * range.offset : range.offset))) {
+            throw std::invalid_argument("The key file must be seekable.");
+        }
+    }
+    pad_offset = range.offset;
+    pad_size = range.offset + range.length;
+}
+
+void CryptStream::setAssociatedData(const uint8_t* data, size_t size) {
+    if (key_type == "otp" || aes_mode != "ocb" || size == 0) {
+        return;
+    }
+    int len = 0;
+    if (EVP_CipherUpdate(ctx.get(), nullptr, &len, data, size) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error(encrypt ? "EVP_EncryptUpdate() failed!" : "EVP_DecryptUpdate() failed!");
+    }
+}
+
+size_t CryptStream::cipherUpdate(const uint8_t* input, size_t size, uint8_t* output) {
+    if (size == 0) {
+        return 0;
+    }
+    int len = 0;
+    if (EVP_CipherUpdate(ctx.get(), output, &len, input, size) != OPENSSL_SUCCESS) { // NOLINT
+        throw std::runtime_error(encrypt ? "EVP_EncryptUpdate() failed!" : "EVP_DecryptUpdate() failed!");
+    }
+    return len;
+}
+
+size_t CryptStream::update(const uint8_t* input, size_t size, uint8_t* output) {
+    TRACE_SCOPE("CryptStream::update", size);
+    countCryptBytes(encrypt, key_type == "otp" ? "otp" : aes_mode.c_str(), size);
+    if (key_type == "otp") {
+        if (pad_offset + size > pad_size) {
+            throw std::invalid_argument("One-time-pad is invalid. The key file must be the same length as the input file.");
+        }
+        const uint8_t* pad = pad_stream ? readPad(size) : (mapped_pad ? mapped_pad : key.data()) + pad_offset;
+        for (size_t i = 0; i < size; i++) {
+            output[i] = pad[i] ^ input[i];
+        }
+        pad_offset += size;
+        return size;
+    }
+    if (encrypt || aes_mode == "ecb") {
+        return cipherUpdate(input, size, output);
+    }
+
+    // The last AETagSizeInBytes of the ciphertext are the tag, so always hold that many back
+    size_t len = 0;
+    if (size >= AETagSizeInBytes) {
+        len += cipherUpdate(held_tag.data(), held_tag.size(), output);
+        len += cipherUpdate(input, size - AETagSizeInBytes, output + len);
+        held_tag.assign(input + size - AETagSizeInBytes, input + size);
+    }
+    else {
+        held_tag.insert(held_tag.end(), input, input + size);
+        size_t ready = held_tag.size() - std::min<size_t>(held_tag.size(), AETagSizeInBytes);
+        len += cipherUpdate(held_tag.data(), ready, output);
+        held_tag.erase(held_tag.begin(), held_tag.begin() + ready);
+    }
+    return len;
+}
+
+void CryptStream::update(const uint8_t* input, size_t size, std::vector<uint8_t>& output) {
+    size_t offset = output.size();
+    output.resize(offset + size + CRYPT_STREAM_OVERHEAD);
+    output.resize(offset + update(input, size, output.data() + offset));
+}
+
+size_t CryptStream::finish(uint8_t* output) {
+    if (key_type == "otp") {
+        if (pad_offset != pad_size) {
+            throw std::invalid_argument("One-time-pad is invalid. The key file must be the same length as the input file.");
+        }
+        return 0;
+    }
+
+    int resCode = 0;
+    if (!encrypt && aes_mode == "ocb") {
+        if (held_tag.size() != AETagSizeInBytes) {
+            throw std::runtime_error("Ciphertext is too short to contain a tag.");
+        }
+        resCode = EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_SET_TAG, AETagSizeInBytes, held_tag.data()); // NOLINT
+        if (resCode != OPENSSL_SUCCESS) {
+            throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_SET_TAG failed!");
+        }
     }
-    int plaintext_len = len;
 
-    // Finalize decrypt
-    resCode = EVP_DecryptFinal_ex(pEvpCtx.get(), decryptedData.data() + len, &len); // NOLINT
+    int len = 0;
+    resCode = EVP_CipherFinal_ex(ctx.get(), output, &len); // NOLINT
     if (resCode != OPENSSL_SUCCESS) {
-        throw std::runtime_error("EVP_DecryptFinal_ex() failed!");
+        throw std::runtime_error(encrypt ? "EVP_EncryptFinal_ex() failed!" : "EVP_DecryptFinal_ex() failed!");
     }
-    plaintext_len += len;
 
-    // Resize vector for decrypted data
-    decryptedData.resize(plaintext_len);
-    return decryptedData;
+    if (encrypt && aes_mode == "ocb") {
+        resCode = EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_AEAD_GET_TAG, AETagSizeInBytes, output + len); // NOLINT
+        if (resCode != OPENSSL_SUCCESS) {
+            throw std::runtime_error("EVP_CIPHER_CTX_ctrl() EVP_CTRL_AEAD_GET_TAG failed!");
+        }
+        len += AETagSizeInBytes;
+    }
+    return len;
+}
+
+void CryptStream::finish(std::vector<uint8_t>& output) {
+    size_t offset = output.size();
+    output.resize(offset + CRYPT_STREAM_OVERHEAD);
+    output.resize(offset + finish(output.data() + offset));
 }
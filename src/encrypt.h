@@ -1,18 +1,199 @@
 #ifndef ENCRYPT_H
 #define ENCRYPT_H
 
+#include "byte_span.h"
+
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include <openssl/evp.h>
+
+class KeyFile;
+struct CryptHeader;
+
+// Read a whole key file. A key file container (see key_file.h) is checked against its checksum; any other
+// key file is converted to binary if it is hexadecimal.
+std::vector<uint8_t> readKey(std::istream& key_stream);
+
+// Length in bytes of the key that readKey() would return, found without holding the key in memory: from the
+// header of a container, otherwise by scanning for non-hex characters. Sets hex, if given, to whether the key
+// file is hexadecimal, and data_offset to where the key starts in it. key_stream must be seekable and is left
+// at its start.
+uint64_t keySize(std::istream& key_stream, bool* hex = nullptr, uint64_t* data_offset = nullptr);
+
+// Part of a one-time-pad, in bytes
+struct PadRange {
+    uint64_t offset;
+    uint64_t length;
+};
+
+// With compress, the plaintext is compressed with zstd before AES encryption and the output starts with a
+// CryptHeader recording it. With a key_context, the file is encrypted with its own key and IV, derived from
+// the AES key with deriveKey() and a random salt, and the salt and context are stored in the CryptHeader.
+// With a pad_range, only that part of the one-time-pad is used, typically from a PadLedger; its length must
+// equal the data's, and it is stored in the CryptHeader. Decryption reads the header, if there is one, and
+// decompresses, derives the key or finds the pad range automatically.
 void encryptDecrypt(std::string operation,
                     std::istream& input_stream, std::istream& key_stream, std::ostream& output_stream,
-                    std::string file_type = "binary", std::string aes_mode = "ocb", std::string key_type = "otp");
+                    std::string file_type = "binary", std::string aes_mode = "ocb", std::string key_type = "otp",
+                    bool compress = false, const std::optional<std::string>& key_context = std::nullopt,
+                    const std::optional<PadRange>& pad_range = std::nullopt);
+// Same, with a key file container that is used in place rather than read
+void encryptDecrypt(std::string operation,
+                    std::istream& input_stream, const KeyFile& key_file, std::ostream& output_stream,
+                    std::string file_type = "binary", std::string aes_mode = "ocb", std::string key_type = "otp",
+                    bool compress = false, const std::optional<std::string>& key_context = std::nullopt,
+                    const std::optional<PadRange>& pad_range = std::nullopt);
+
+const size_t DEFAULT_STREAM_BLOCK_SIZE = 1024 * 1024;
+
+// Same as encryptDecrypt(), but the input is processed in blocks as it is read, so input_stream and
+// output_stream may be pipes and memory use does not depend on the data size. key_stream must be
+// seekable. When decrypting with OCB, plaintext is written before the tag at the end of the input has
+// been checked; if this throws, the output must be discarded.
+void encryptDecryptStream(std::string operation,
+                          std::istream& input_stream, std::istream& key_stream, std::ostream& output_stream,
+                          std::string file_type = "binary", std::string aes_mode = "ocb", std::string key_type = "otp",
+                          size_t block_size = DEFAULT_STREAM_BLOCK_SIZE, bool compress = false,
+                          const std::optional<std::string>& key_context = std::nullopt,
+                          const std::optional<PadRange>& pad_range = std::nullopt);
+void encryptDecryptStream(std::string operation,
+                          std::istream& input_stream, const KeyFile& key_file, std::ostream& output_stream,
+                          std::string file_type = "binary", std::string aes_mode = "ocb", std::string key_type = "otp",
+                          size_t block_size = DEFAULT_STREAM_BLOCK_SIZE, bool compress = false,
+                          const std::optional<std::string>& key_context = std::nullopt,
+                          const std::optional<PadRange>& pad_range = std::nullopt);
+
+const size_t HKDF_SALT_SIZE = 16;
+const size_t MAX_KEY_CONTEXT_SIZE = 255;
+
+struct DerivedKey {
+    std::vector<uint8_t> key; // AES-256 key
+    std::vector<uint8_t> iv;  // OCB nonce
+};
+
+// Derive a key and IV from an AES-256 master key with HKDF-SHA256. Each distinct salt, such as a random
+// one per file or a record number, gives an independent key, so one key from BLAST key generation can
+// safely encrypt any number of files or records. context separates keys used for different purposes.
+DerivedKey deriveKey(ByteSpan master_key, ByteSpan salt, const std::string& context = "");
+
+// Large AES files may be split into chunks that are encrypted independently, so they can be processed in
+// parallel. Chunk i is encrypted with the key derived from the file's salt followed by i as 8 bytes, little
+// endian, and the file's CryptHeader as associated data, so chunks cannot be reordered or dropped. The
+// ciphertext is the header followed by each chunk's ciphertext.
+std::vector<uint8_t> chunkSalt(ByteSpan salt, uint64_t index);
+
+// Largest chunk a ChunkLayout accepts, which bounds the buffer a chunk needs; the sizes come from an
+// untrusted header when decrypting
+const uint64_t MAX_CHUNK_SIZE = 256 * 1024 * 1024;
+
+// Where each chunk lies in the plaintext and in the ciphertext after the header. Throws if the chunk size is
+// out of range or the ciphertext size would not fit in 64 bits.
+struct ChunkLayout {
+    ChunkLayout(uint64_t plaintext_size, uint64_t chunk_size, const std::string& aes_mode);
+
+    uint64_t plaintextOffset(uint64_t index) const { return index * chunk_size; }
+    uint64_t plaintextSize(uint64_t index) const;
+    uint64_t ciphertextOffset(uint64_t index) const;
+    uint64_t ciphertextSize(uint64_t index) const;
+    uint64_t ciphertextTotalSize() const; // of every chunk, without the header
+
+    uint64_t plaintext_size;
+    uint64_t chunk_size;
+    std::string aes_mode;
+    uint64_t count; // number of chunks
+};
 
 std::vector<uint8_t> encryptAES256ECB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data);
 std::vector<uint8_t> decryptAES256ECB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data);
 std::vector<uint8_t> encryptAES256OCB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data);
 std::vector<uint8_t> decryptAES256OCB(const std::vector<uint8_t> aesKey, const std::vector<uint8_t> &data);
 
+// Allocation-free forms of the above, for hot paths: output is a caller buffer of at least encryptedSize()
+// bytes when encrypting, or data.size() (less the tag for OCB) when decrypting. Return the number of bytes
+// written. Each thread reuses its cipher contexts, so after its first call nothing is allocated, except
+// inside OpenSSL when OCB is given a different key from the previous call.
+size_t encryptAES256ECB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output);
+size_t decryptAES256ECB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output);
+size_t encryptAES256OCB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output);
+size_t decryptAES256OCB(ByteSpan aesKey, ByteSpan data, MutableByteSpan output);
+
+// Size of the output of encrypting plaintext_size bytes
+uint64_t encryptedSize(uint64_t plaintext_size, const std::string& aes_mode = "ocb", const std::string& key_type = "otp");
+
+// Most output that CryptStream can produce beyond the size of its input: a block held back by the
+// cipher, plus room for the tag
+const size_t CRYPT_STREAM_OVERHEAD = EVP_MAX_BLOCK_LENGTH + 16;
+
+// Incremental form of encryptDecrypt() for data that does not fit in memory or arrives in pieces.
+// Input may be split at any point; the concatenated output is identical to processing it all at once.
+class CryptStream {
+public:
+    CryptStream(const std::string& operation, const std::vector<uint8_t>& key,
+                const std::string& aes_mode = "ocb", const std::string& key_type = "otp");
+    // Reads a one-time-pad from key_stream only as update() consumes it, so large pads are never held in
+    // memory. key_stream must be seekable and outlive the CryptStream.
+    CryptStream(const std::string& operation, std::istream& key_stream,
+                const std::string& aes_mode = "ocb", const std::string& key_type = "otp");
+    // Reads a one-time-pad straight from the mapped key file, which must outlive the CryptStream
+    CryptStream(const std::string& operation, const KeyFile& key_file,
+                const std::string& aes_mode = "ocb", const std::string& key_type = "otp");
+
+    // Switch to the key and IV that deriveKey() gives for the AES key. Must be called before update() and
+    // setAssociatedData(). May be called again after finish() to start an independent chunk with another salt.
+    void useDerivedKey(ByteSpan salt, const std::string& context);
+
+    // Use only this part of the one-time-pad; its length must equal the data's. Must be called before update().
+    void usePadRange(const PadRange& range);
+
+    // Authenticate data that is stored alongside the ciphertext, such as a CryptHeader. OCB only; a no-op
+    // otherwise. Must be called before update().
+    void setAssociatedData(const uint8_t* data, size_t size);
+
+    // Process size bytes of input, appending any output that is ready
+    void update(const uint8_t* input, size_t size, std::vector<uint8_t>& output);
+    // Flush the remaining output, including the padding or tag of the AES modes
+    void finish(std::vector<uint8_t>& output);
+
+    // Same as above, writing to a buffer with room for size + CRYPT_STREAM_OVERHEAD bytes (update) or
+    // CRYPT_STREAM_OVERHEAD bytes (finish). Return the number of bytes written.
+    size_t update(const uint8_t* input, size_t size, uint8_t* output);
+    size_t finish(uint8_t* output);
+
+private:
+    void initCipher();
+    size_t cipherUpdate(const uint8_t* input, size_t size, uint8_t* output);
+    const uint8_t* readPad(size_t size);
+
+    bool encrypt;
+    std::string aes_mode;
+    std::string key_type;
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> master_key; // the key read in, once a key has been derived from it
+    std::vector<uint8_t> iv; // empty for the zero IV
+    uint64_t pad_offset = 0;
+    uint64_t pad_size = 0;
+    std::istream* pad_stream = nullptr;
+    bool pad_hex = false;
+    uint64_t pad_data_offset = 0; // where the pad starts in pad_stream
+    const uint8_t* mapped_pad = nullptr;
+    std::vector<char> pad_chars;
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&::EVP_CIPHER_CTX_free)> ctx;
+    std::vector<uint8_t> held_tag; // trailing bytes that may be the OCB tag when decrypting
+};
+
+// Set crypt_stream up for the compress, key_context and pad_range options of encryptDecrypt() and return the
+// CryptHeader that goes before the ciphertext, which is also set as associated data. Empty if no option is used.
+std::vector<uint8_t> beginEncryptHeader(CryptStream& crypt_stream, bool compress,
+                                        const std::optional<std::string>& key_context,
+                                        const std::optional<PadRange>& pad_range);
+
+// Switch crypt_stream to the derived key or pad range that a ciphertext's header records. The caller handles
+// the other flags and sets the header's bytes as associated data.
+void useCryptHeader(CryptStream& crypt_stream, const CryptHeader& header);
+
 #endif /* ENCRYPT_H */
\ No newline at end of file
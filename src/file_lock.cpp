@@ -0,0 +1,114 @@
+#include "file_lock.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+FileLock::FileLock(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA((path + ".lock").c_str(), GENERIC_READ | GENERIC_WRITE,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    // Lock the whole possible range, blocking until no other process holds it
+    OVERLAPPED overlapped = {};
+    if (file == INVALID_HANDLE_VALUE || !LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+        throw std::runtime_error("Unable to lock " + path + ".lock");
+    }
+    handle = file;
+#else
+    fd = open((path + ".lock").c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("Unable to lock " + path + ".lock");
+    }
+#endif
+}
+
+FileLock::~FileLock() {
+#ifdef _WIN32
+    OVERLAPPED overlapped = {};
+    UnlockFileEx(handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+    CloseHandle(handle);
+#else
+    close(fd);
+#endif
+}
+
+void replaceFile(const std::string& path, const std::string& contents) {
+    std::string temp_path = path + ".tmp";
+#ifndef _WIN32
+    int temp_fd = open(temp_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = temp_fd >= 0;
+    for (size_t pos = 0; written && pos < contents.size();) {
+        ssize_t len = write(temp_fd, contents.data() + pos, contents.size() - pos);
+        written = len > 0;
+        pos += written ? len : 0;
+    }
+    written = written && fsync(temp_fd) == 0;
+    if (temp_fd >= 0) {
+        written = close(temp_fd) == 0 && written;
+    }
+    if (!written) {
+        throw std::runtime_error("Unable to write " + temp_path);
+    }
+    fs::rename(temp_path, path);
+    // Make the rename itself durable
+    syncDirectory(fs::path(path).parent_path().string());
+#else
+    writeFileUnsynced(temp_path, contents);
+    fs::rename(temp_path, path);
+#endif
+}
+
+void writeFileUnsynced(const std::string& path, const std::string& contents) {
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open() || !out.write(contents.data(), contents.size()) || !out.flush()) {
+        throw std::runtime_error("Unable to write " + path);
+    }
+}
+
+void syncFileSystem(const std::string& path) {
+#if defined(__linux__)
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    bool synced = fd >= 0 && syncfs(fd) == 0;
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (!synced) {
+        throw std::runtime_error("Unable to flush " + path + " to disk");
+    }
+#elif !defined(_WIN32)
+    (void)path;
+    sync();
+#else
+    (void)path;
+#endif
+}
+
+void syncDirectory(const std::string& dir) {
+#ifndef _WIN32
+    int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+#else
+    (void)dir;
+#endif
+}
@@ -0,0 +1,38 @@
+#ifndef FILE_LOCK_H
+#define FILE_LOCK_H
+
+#include <string>
+
+// Exclusive lock on path + ".lock" for as long as the object lives, serializing processes that update the
+// same file: flock() on POSIX systems, LockFileEx() on Windows.
+class FileLock {
+public:
+    explicit FileLock(const std::string& path);
+    ~FileLock();
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+
+private:
+#ifdef _WIN32
+    void* handle = nullptr; // HANDLE of the lock file
+#else
+    int fd = -1;
+#endif
+};
+
+// Replace the file at path with contents, durably: write a temporary file, flush it to disk and rename it
+// over path, so a crash leaves either the old contents or the new ones.
+void replaceFile(const std::string& path, const std::string& contents);
+
+// Write contents to path without flushing it to disk, for callers that write many files and then flush them
+// all at once with syncFileSystem()
+void writeFileUnsynced(const std::string& path, const std::string& contents);
+
+// Flush every file written to the file system holding path to disk: syncfs() on Linux, sync() on other POSIX
+// systems. Does nothing on Windows, where replaceFile() does not flush either.
+void syncFileSystem(const std::string& path);
+
+// Make renames into dir durable
+void syncDirectory(const std::string& dir);
+
+#endif /* FILE_LOCK_H */
@@ -0,0 +1,425 @@
+#include "incremental.h"
+#include "common.h"
+#include "crypt_header.h"
+#include "encrypt.h"
+#include "file_lock.h"
+#include "trace.h"
+
+#include <openssl/crypto.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <stdexcept>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const uint8_t MANIFEST_MAGIC[] = {'Q', 'R', 'Y', 'P', 'T', 'C', 'D', 'C'};
+const uint8_t MANIFEST_VERSION = 1;
+const size_t CHUNK_ID_SIZE = 32;
+const size_t MANIFEST_ENTRY_SIZE = CHUNK_ID_SIZE + 4;
+const size_t MANIFEST_MAC_SIZE = 32;
+const char* CHUNK_ID_CONTEXT = "qrypt incremental chunk id";
+const char* CHUNK_KEY_CONTEXT = "qrypt incremental chunk";
+const char* MANIFEST_MAC_CONTEXT = "qrypt incremental manifest";
+
+typedef std::array<uint8_t, CHUNK_ID_SIZE> ChunkId;
+
+struct ManifestEntry {
+    ChunkId id;
+    uint32_t size;
+};
+
+struct Manifest {
+    uint32_t min_size = DEFAULT_CDC_MIN_SIZE;
+    uint32_t avg_size = DEFAULT_CDC_AVG_SIZE;
+    uint32_t max_size = DEFAULT_CDC_MAX_SIZE;
+    std::vector<uint8_t> salt;
+    uint64_t plaintext_size = 0;
+    std::vector<ManifestEntry> entries;
+};
+
+// Keys for naming chunks and authenticating the manifest, derived from the AES key and the store's salt
+struct StoreKeys {
+    StoreKeys(const std::vector<uint8_t>& master_key, const std::vector<uint8_t>& salt) :
+        id_key(deriveKey(master_key, salt, CHUNK_ID_CONTEXT).key),
+        mac_key(deriveKey(master_key, salt, MANIFEST_MAC_CONTEXT).key) {}
+
+    std::vector<uint8_t> id_key;
+    std::vector<uint8_t> mac_key;
+};
+
+// Gear hash table for the chunker: fixed pseudo-random values (splitmix64), so boundaries never change
+const uint64_t* gearTable() {
+    static const std::array<uint64_t, 256> table = []() {
+        std::array<uint64_t, 256> values;
+        uint64_t state = 0x5172797074434443ull;
+        for (uint64_t& value : values) {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            value = z ^ (z >> 31);
+        }
+        return values;
+    }();
+    return table.data();
+}
+
+void appendU32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        out.push_back((uint8_t)(value >> (8 * i)));
+    }
+}
+
+uint32_t readU32(const uint8_t* data) {
+    return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+void appendU64(std::vector<uint8_t>& out, uint64_t value) {
+    std::vector<uint8_t> encoded = encodeU64Field(value);
+    out.insert(out.end(), encoded.begin(), encoded.end());
+}
+
+uint64_t readU64(const uint8_t* data) {
+    return decodeU64Field(std::vector<uint8_t>(data, data + 8));
+}
+
+ChunkId hmacSha256(const std::vector<uint8_t>& key, const uint8_t* data, size_t size) {
+    ChunkId mac;
+    unsigned int len = 0;
+    if (HMAC(EVP_sha256(), key.data(), key.size(), data, size, mac.data(), &len) == nullptr) {
+        throw std::runtime_error("HMAC() failed!");
+    }
+    return mac;
+}
+
+std::string chunkIdHex(const ChunkId& id) {
+    std::vector<uint8_t> bytes(id.begin(), id.end());
+    return byteVecToHexStr(bytes);
+}
+
+fs::path chunkPath(const std::string& store_dir, const std::string& id_hex) {
+    return fs::path(store_dir) / "chunks" / id_hex.substr(0, 2) / id_hex;
+}
+
+fs::path manifestPath(const std::string& store_dir) {
+    return fs::path(store_dir) / "manifest";
+}
+
+// Each chunk has its own key and IV, derived from its id, so a chunk can be rewritten or reused on its own
+std::vector<uint8_t> cryptChunk(const std::string& operation, const std::vector<uint8_t>& key, const ChunkId& id,
+                                const uint8_t* input, size_t size) {
+    CryptStream stream(operation, key, "ocb", "aes");
+    stream.useDerivedKey(ByteSpan(id.data(), id.size()), CHUNK_KEY_CONTEXT);
+    stream.setAssociatedData(id.data(), id.size());
+    std::vector<uint8_t> output;
+    stream.update(input, size, output);
+    stream.finish(output);
+    return output;
+}
+
+std::string serializeManifest(const Manifest& manifest, const StoreKeys& keys) {
+    std::vector<uint8_t> out(MANIFEST_MAGIC, MANIFEST_MAGIC + sizeof(MANIFEST_MAGIC));
+    out.push_back(MANIFEST_VERSION);
+    out.resize(out.size() + 7);
+    appendU32(out, manifest.min_size);
+    appendU32(out, manifest.avg_size);
+    appendU32(out, manifest.max_size);
+    appendU32(out, 0);
+    out.insert(out.end(), manifest.salt.begin(), manifest.salt.end());
+    appendU64(out, manifest.plaintext_size);
+    appendU64(out, manifest.entries.size());
+    for (const ManifestEntry& entry : manifest.entries) {
+        out.insert(out.end(), entry.id.begin(), entry.id.end());
+        appendU32(out, entry.size);
+    }
+    ChunkId mac = hmacSha256(keys.mac_key, out.data(), out.size());
+    out.insert(out.end(), mac.begin(), mac.end());
+    return std::string(out.begin(), out.end());
+}
+
+Manifest readManifest(const std::string& store_dir, const std::vector<uint8_t>& key) {
+    std::ifstream file(manifestPath(store_dir), std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::invalid_argument("Unable to open manifest in " + store_dir);
+    }
+    std::vector<uint8_t> bytes(std::istreambuf_iterator<char>(file), {});
+    const size_t fixed_size = sizeof(MANIFEST_MAGIC) + 8 + 16 + HKDF_SALT_SIZE + 16;
+    if (bytes.size() < fixed_size + MANIFEST_MAC_SIZE ||
+        memcmp(bytes.data(), MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0) {
+        throw std::invalid_argument(store_dir + " does not hold an incrementally encrypted file.");
+    }
+    if (bytes[sizeof(MANIFEST_MAGIC)] != MANIFEST_VERSION) {
+        throw std::invalid_argument("Unsupported manifest version " + std::to_string(bytes[sizeof(MANIFEST_MAGIC)]));
+    }
+
+    // The salt is needed for the MAC key; nothing else is trusted until the MAC has been checked
+    Manifest manifest;
+    const uint8_t* pos = bytes.data() + sizeof(MANIFEST_MAGIC) + 8;
+    manifest.salt.assign(pos + 16, pos + 16 + HKDF_SALT_SIZE);
+    StoreKeys keys(key, manifest.salt);
+    size_t body_size = bytes.size() - MANIFEST_MAC_SIZE;
+    ChunkId mac = hmacSha256(keys.mac_key, bytes.data(), body_size);
+    if (CRYPTO_memcmp(mac.data(), bytes.data() + body_size, MANIFEST_MAC_SIZE) != 0) {
+        throw std::invalid_argument("Manifest failed authentication; wrong key or damaged store.");
+    }
+
+    manifest.min_size = readU32(pos);
+    manifest.avg_size = readU32(pos + 4);
+    manifest.max_size = readU32(pos + 8);
+    pos += 16 + HKDF_SALT_SIZE;
+    manifest.plaintext_size = readU64(pos);
+    uint64_t count = readU64(pos + 8);
+    pos += 16;
+    if (count != (body_size - fixed_size) / MANIFEST_ENTRY_SIZE || (body_size - fixed_size) % MANIFEST_ENTRY_SIZE) {
+        throw std::invalid_argument("Manifest is malformed.");
+    }
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < count; i++, pos += MANIFEST_ENTRY_SIZE) {
+        ManifestEntry entry;
+        memcpy(entry.id.data(), pos, CHUNK_ID_SIZE);
+        entry.size = readU32(pos + CHUNK_ID_SIZE);
+        total += entry.size;
+        manifest.entries.push_back(entry);
+    }
+    if (total != manifest.plaintext_size) {
+        throw std::invalid_argument("Manifest is malformed.");
+    }
+    return manifest;
+}
+
+std::vector<uint8_t> readAESKey(const std::string& key_filename) {
+    std::ifstream key_file(key_filename, std::ios::in | std::ios::binary);
+    if (!key_file.is_open()) {
+        throw std::invalid_argument("Unable to open key file " + key_filename);
+    }
+    std::vector<uint8_t> key = readKey(key_file);
+    if (key.size() != AESKeyLengthInBytes) {
+        throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
+    }
+    return key;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+ContentChunker::ContentChunker(uint32_t min_size, uint32_t avg_size, uint32_t max_size) :
+                               min_size(min_size), avg_size(avg_size), max_size(max_size) {
+    if (min_size < 64 || min_size > avg_size || avg_size > max_size) {
+        throw std::invalid_argument("Invalid chunk sizes; need 64 <= min <= average <= max");
+    }
+    // Normalized chunking: two more bits than log2(avg_size) must be zero to cut before the average size,
+    // two fewer after it, which keeps most chunks close to the average
+    int bits = 0;
+    while ((2ull << bits) <= avg_size) {
+        bits++;
+    }
+    mask_small = ~0ull << (64 - std::min(bits + 2, 63));
+    mask_large = ~0ull << (64 - std::max(bits - 2, 1));
+}
+
+size_t ContentChunker::cut(const uint8_t* data, size_t size) const {
+    if (size <= min_size) {
+        return size;
+    }
+    size_t end = std::min<size_t>(size, max_size);
+    size_t normal = std::min<size_t>(end, avg_size);
+    const uint64_t* gear = gearTable();
+    uint64_t hash = 0;
+    // Nothing before min_size can be a boundary, so skip hashing it
+    size_t i = min_size;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & mask_small) == 0) {
+            return i + 1;
+        }
+    }
+    for (; i < end; i++) {
+        hash = (hash << 1) + gear[data[i]];
+        if ((hash & mask_large) == 0) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+IncrementalSummary encryptIncremental(const std::string& input_filename, const std::string& store_dir,
+                                      const std::string& key_filename) {
+    TRACE_SCOPE("encryptIncremental");
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> key = readAESKey(key_filename);
+    std::ifstream input(input_filename, std::ios::in | std::ios::binary);
+    if (!input.is_open()) {
+        throw std::invalid_argument("Unable to open input file " + input_filename);
+    }
+    fs::create_directories(fs::path(store_dir) / "chunks");
+    FileLock lock(manifestPath(store_dir).string());
+
+    // Keep the salt and chunk sizes of an existing store, so unchanged chunks keep their ids
+    Manifest manifest;
+    if (fs::exists(manifestPath(store_dir))) {
+        Manifest previous = readManifest(store_dir, key);
+        manifest.min_size = previous.min_size;
+        manifest.avg_size = previous.avg_size;
+        manifest.max_size = previous.max_size;
+        manifest.salt = previous.salt;
+    }
+    else {
+        manifest.salt.resize(HKDF_SALT_SIZE);
+        if (RAND_bytes(manifest.salt.data(), manifest.salt.size()) != OPENSSL_SUCCESS) {
+            throw std::runtime_error("RAND_bytes() failed!");
+        }
+    }
+    StoreKeys keys(key, manifest.salt);
+    ContentChunker chunker(manifest.min_size, manifest.avg_size, manifest.max_size);
+
+    IncrementalSummary summary;
+    std::set<std::string> referenced;
+    std::vector<fs::path> new_chunks;
+    std::vector<uint8_t> buffer(4 * (size_t)manifest.max_size);
+    size_t begin = 0, end = 0;
+    bool eof = false;
+    while (true) {
+        // Keep at least one maximum-size chunk buffered, so every cut sees the bytes it needs
+        if (!eof && end - begin < manifest.max_size) {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+            TRACE_SCOPE("read input", buffer.size() - end);
+            input.read((char*)buffer.data() + end, buffer.size() - end);
+            end += input.gcount();
+            if (input.bad()) {
+                throw std::runtime_error("Unable to read " + input_filename);
+            }
+            eof = !input;
+            continue;
+        }
+        if (begin == end) {
+            break;
+        }
+
+        size_t size = chunker.cut(buffer.data() + begin, end - begin);
+        const uint8_t* chunk = buffer.data() + begin;
+        ManifestEntry entry = { hmacSha256(keys.id_key, chunk, size), (uint32_t)size };
+        std::string id_hex = chunkIdHex(entry.id);
+        fs::path path = chunkPath(store_dir, id_hex);
+        if (referenced.insert(id_hex).second && !fs::exists(path)) {
+            TRACE_SCOPE("encrypt chunk", size);
+            std::vector<uint8_t> ciphertext = cryptChunk("encrypt", key, entry.id, chunk, size);
+            fs::create_directories(path.parent_path());
+            writeFileUnsynced(path.string() + ".tmp", std::string(ciphertext.begin(), ciphertext.end()));
+            new_chunks.push_back(path);
+            summary.new_chunks++;
+            summary.new_bytes += size;
+        }
+        manifest.entries.push_back(entry);
+        manifest.plaintext_size += size;
+        begin += size;
+    }
+
+    // Flush the new chunks with one sync of the store rather than one per chunk, and only then give them their
+    // names, so a chunk that exists is complete. A crash before this leaves .tmp files the next run removes.
+    if (!new_chunks.empty()) {
+        syncFileSystem(store_dir);
+        std::set<fs::path> chunk_dirs;
+        for (const fs::path& path : new_chunks) {
+            fs::rename(path.string() + ".tmp", path);
+            chunk_dirs.insert(path.parent_path());
+        }
+        for (const fs::path& dir : chunk_dirs) {
+            syncDirectory(dir.string());
+        }
+    }
+    replaceFile(manifestPath(store_dir).string(), serializeManifest(manifest, keys));
+
+    // Only now that the new manifest is in place can chunks it no longer uses be removed
+    std::vector<fs::path> unused;
+    for (const auto& entry : fs::recursive_directory_iterator(fs::path(store_dir) / "chunks")) {
+        if (entry.is_regular_file() && referenced.count(entry.path().filename().string()) == 0) {
+            unused.push_back(entry.path());
+        }
+    }
+    for (const fs::path& path : unused) {
+        fs::remove(path);
+        summary.removed_chunks++;
+    }
+
+    summary.plaintext_size = manifest.plaintext_size;
+    summary.chunks = manifest.entries.size();
+    summary.seconds = secondsSince(start);
+    return summary;
+}
+
+IncrementalSummary decryptIncremental(const std::string& store_dir, const std::string& key_filename,
+                                      std::ostream& output) {
+    TRACE_SCOPE("decryptIncremental");
+    auto start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> key = readAESKey(key_filename);
+    Manifest manifest = readManifest(store_dir, key);
+
+    std::vector<uint8_t> ciphertext;
+    for (const ManifestEntry& entry : manifest.entries) {
+        fs::path path = chunkPath(store_dir, chunkIdHex(entry.id));
+        std::ifstream chunk_file(path, std::ios::in | std::ios::binary);
+        if (!chunk_file.is_open()) {
+            throw std::runtime_error("Chunk " + path.string() + " is missing from the store.");
+        }
+        ciphertext.resize(fs::file_size(path));
+        if (!chunk_file.read((char*)ciphertext.data(), ciphertext.size())) {
+            throw std::runtime_error("Unable to read chunk " + path.string());
+        }
+        std::vector<uint8_t> plaintext = cryptChunk("decrypt", key, entry.id, ciphertext.data(), ciphertext.size());
+        if (plaintext.size() != entry.size) {
+            throw std::runtime_error("Chunk " + path.string() + " does not match the manifest.");
+        }
+        if (!output.write((const char*)plaintext.data(), plaintext.size())) {
+            throw std::runtime_error("Unable to write the output.");
+        }
+    }
+    output.flush();
+
+    IncrementalSummary summary;
+    summary.plaintext_size = manifest.plaintext_size;
+    summary.chunks = manifest.entries.size();
+    summary.seconds = secondsSince(start);
+    return summary;
+}
+
+IncrementalSummary decryptIncremental(const std::string& store_dir, const std::string& key_filename,
+                                      const std::string& output_filename) {
+    std::ofstream output_file(output_filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!output_file.is_open()) {
+        throw std::invalid_argument("Unable to open output file " + output_filename);
+    }
+    try {
+        return decryptIncremental(store_dir, key_filename, output_file);
+    }
+    catch (...) {
+        output_file.close();
+        std::error_code ignored;
+        fs::remove(output_filename, ignored);
+        throw;
+    }
+}
+
+void printIncrementalSummary(const std::string& operation, const IncrementalSummary& summary, std::ostream& out) {
+    out << std::fixed << std::setprecision(1) << (operation == "encrypt" ? "Encrypted " : "Decrypted ")
+        << summary.plaintext_size / 1e6 << " MB in " << summary.chunks << " chunks";
+    if (operation == "encrypt") {
+        out << ": " << summary.new_chunks << " new (" << summary.new_bytes / 1e6 << " MB re-encrypted), "
+            << summary.removed_chunks << " removed";
+    }
+    out << ", in " << std::setprecision(2) << summary.seconds << " s" << std::endl;
+}
@@ -0,0 +1,71 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// Incremental encryption of a large file that changes a little between runs. The plaintext is cut into
+// chunks with a content-defined chunker, so an edit only changes the chunks around it rather than shifting
+// every chunk boundary after it, and each chunk is stored encrypted in its own file, named after a keyed hash
+// of its contents. Re-encrypting the file writes only the chunks that are not already in the store. Layout:
+//
+//   <store>/manifest          the chunk parameters, the store's salt, the plaintext size and each chunk's id
+//                             and size in order, followed by an HMAC-SHA256 of everything before it
+//   <store>/chunks/xx/<id>    a chunk encrypted with AES-256-OCB under the key derived from the chunk's id,
+//                             with the id as associated data. xx is the first byte of the id in hex.
+//
+// Chunk ids are HMAC-SHA256 of the plaintext under a key derived from the AES key and the store's salt, so
+// they reveal nothing about the contents to anyone without the key.
+
+// FastCDC content-defined chunking with normalized chunk sizes. Boundaries depend only on the bytes around
+// them, so they are the same from one run to the next.
+class ContentChunker {
+public:
+    ContentChunker(uint32_t min_size, uint32_t avg_size, uint32_t max_size);
+
+    // Length of the chunk at the start of data. size must be at least max_size unless data runs to the end
+    // of the input.
+    size_t cut(const uint8_t* data, size_t size) const;
+
+    uint32_t minSize() const { return min_size; }
+    uint32_t avgSize() const { return avg_size; }
+    uint32_t maxSize() const { return max_size; }
+
+private:
+    uint32_t min_size;
+    uint32_t avg_size;
+    uint32_t max_size;
+    uint64_t mask_small; // used before avg_size, harder to match
+    uint64_t mask_large; // used after it, easier to match
+};
+
+const uint32_t DEFAULT_CDC_MIN_SIZE = 16 * 1024;
+const uint32_t DEFAULT_CDC_AVG_SIZE = 64 * 1024;
+const uint32_t DEFAULT_CDC_MAX_SIZE = 256 * 1024;
+
+struct IncrementalSummary {
+    uint64_t plaintext_size = 0;
+    uint64_t chunks = 0;
+    uint64_t new_chunks = 0;     // encrypted and written by this run
+    uint64_t new_bytes = 0;      // plaintext bytes in them
+    uint64_t removed_chunks = 0; // no longer in the file, deleted from the store
+    double seconds = 0;
+};
+
+// Encrypt input_filename into store_dir with an AES-256 key, reusing the chunks already in the store
+IncrementalSummary encryptIncremental(const std::string& input_filename, const std::string& store_dir,
+                                      const std::string& key_filename);
+
+// Rebuild the file from store_dir. Throws if the manifest or any chunk fails authentication.
+IncrementalSummary decryptIncremental(const std::string& store_dir, const std::string& key_filename,
+                                      std::ostream& output);
+// As above, writing to output_filename, which is removed if any chunk fails so no truncated plaintext is left
+IncrementalSummary decryptIncremental(const std::string& store_dir, const std::string& key_filename,
+                                      const std::string& output_filename);
+
+void printIncrementalSummary(const std::string& operation, const IncrementalSummary& summary,
+                             std::ostream& out = std::cout);
+
+#endif /* INCREMENTAL_H */
@@ -0,0 +1,656 @@
+#include "common.h"
+#include "crypt_header.h"
+#include "encrypt.h"
+#include "io_engine.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+// IORING_OP_OPENAT and IORING_OP_CLOSE arrived with the 5.6 headers, which also define IORING_FEAT_RW_CUR_POS
+#ifdef IORING_FEAT_RW_CUR_POS
+#define QRYPT_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef QRYPT_HAVE_IO_URING
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+void runSyncJob(CryptJob& job, const std::string& operation, const std::string& aes_mode,
+                const std::string& key_type, size_t block_size, bool compress,
+                const std::optional<std::string>& key_context) {
+    TRACE_SCOPE("runSyncJob");
+    try {
+        std::ifstream input_file(job.input_filename, std::ios::in | std::ios::binary);
+        if (!input_file.is_open()) {
+            throw std::invalid_argument("Unable to open input file " + job.input_filename);
+        }
+        std::ifstream key_file(job.key_filename, std::ios::in | std::ios::binary);
+        if (!key_file.is_open()) {
+            throw std::invalid_argument("Unable to open key file " + job.key_filename);
+        }
+        std::ofstream output_file(job.output_filename, std::ios::out | std::ios::binary);
+        if (!output_file.is_open()) {
+            throw std::invalid_argument("Unable to open output file " + job.output_filename);
+        }
+        encryptDecryptStream(operation, input_file, key_file, output_file, job.file_type, aes_mode, key_type, block_size,
+                             compress, key_context, job.pad_range);
+        output_file.close();
+        if (!output_file) {
+            throw std::runtime_error("Unable to write output file " + job.output_filename);
+        }
+    }
+    catch (const std::exception& ex) {
+        job.error = ex.what();
+        std::error_code ignored;
+        fs::remove(job.output_filename, ignored);
+    }
+}
+
+#ifdef QRYPT_HAVE_IO_URING
+
+// Minimal io_uring wrapper over the raw system calls, so that liburing is not needed
+class IoUring {
+public:
+    explicit IoUring(unsigned entries) {
+        io_uring_params params = {};
+        fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+        }
+        sq_entries = params.sq_entries;
+
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring :
+                  mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = (io_uring_sqe*)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+            unmap();
+            ::close(fd);
+            throw std::runtime_error("Unable to map the io_uring rings");
+        }
+
+        uint8_t* sq = (uint8_t*)sq_ring;
+        sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+        sq_mask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+        sq_array = (uint32_t*)(sq + params.sq_off.array);
+        uint8_t* cq = (uint8_t*)cq_ring;
+        cq_head = (uint32_t*)(cq + params.cq_off.head);
+        cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+        cq_mask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+        local_tail = *sq_tail;
+    }
+
+    ~IoUring() {
+        unmap();
+        ::close(fd);
+    }
+
+    bool supports(const std::vector<uint8_t>& opcodes) {
+        const unsigned op_count = 256;
+        std::vector<uint8_t> buffer(sizeof(io_uring_probe) + op_count * sizeof(io_uring_probe_op), 0);
+        io_uring_probe* probe = (io_uring_probe*)buffer.data();
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, op_count) < 0) {
+            return false;
+        }
+        for (uint8_t opcode : opcodes) {
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void registerBuffers(const std::vector<iovec>& buffers) {
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers.data(), buffers.size()) < 0) {
+            throw std::runtime_error(std::string("Unable to register io_uring buffers: ") + strerror(errno));
+        }
+    }
+
+    // Queue a request. Callers keep fewer than sq_entries requests queued or in flight.
+    io_uring_sqe* nextSqe() {
+        uint32_t index = local_tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_array[index] = index;
+        local_tail++;
+        return sqe;
+    }
+
+    // Submit everything queued and wait for at least one completion
+    void submitAndWait() {
+        TRACE_SCOPE("io_uring wait");
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+        unsigned to_submit = local_tail - submitted_tail;
+        while (true) {
+            int res = (int)syscall(__NR_io_uring_enter, fd, to_submit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (res >= 0) {
+                submitted_tail += res;
+                return;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+            }
+            // Out of resources: reap what has completed and submit the rest later
+            if (errno != EINTR) {
+                to_submit = 0;
+            }
+        }
+    }
+
+    template <typename Fn>
+    void forEachCompletion(Fn fn) {
+        uint32_t head = *cq_head;
+        uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            io_uring_cqe cqe = cqes[head & cq_mask];
+            head++;
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+            fn(cqe.user_data, cqe.res);
+            tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    unsigned entries() const { return sq_entries; }
+
+private:
+    void unmap() {
+        if (sqes != MAP_FAILED && sqes != nullptr) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_ring != MAP_FAILED && cq_ring != nullptr && cq_ring != sq_ring) {
+            munmap(cq_ring, cq_ring_size);
+        }
+        if (sq_ring != MAP_FAILED && sq_ring != nullptr) {
+            munmap(sq_ring, sq_ring_size);
+        }
+    }
+
+    int fd = -1;
+    unsigned sq_entries = 0;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    size_t sq_ring_size = 0, cq_ring_size = 0, sqes_size = 0;
+    uint32_t* sq_tail = nullptr;
+    uint32_t* sq_array = nullptr;
+    uint32_t sq_mask = 0;
+    uint32_t* cq_head = nullptr;
+    uint32_t* cq_tail = nullptr;
+    uint32_t cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+    uint32_t local_tail = 0;
+    uint32_t submitted_tail = 0;
+};
+
+const std::vector<uint8_t> RequiredOps = {
+    IORING_OP_OPENAT, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED, IORING_OP_CLOSE
+};
+
+// Room in each output buffer for the CryptHeader written before the first block: a salt, a key context of
+// at most MAX_KEY_CONTEXT_SIZE bytes and a pad range
+const size_t MAX_PREAMBLE_SIZE = 512;
+
+enum FileOp : uint8_t {
+    OP_OPEN_INPUT,
+    OP_OPEN_OUTPUT,
+    OP_READ,
+    OP_WRITE,
+    OP_CLOSE_INPUT,
+    OP_CLOSE_OUTPUT
+};
+
+// State of one file in flight. Each slot owns two registered buffers: input blocks are read into
+// 2 * slot and encrypted into 2 * slot + 1, so the next read can start while the last block is written.
+struct FileSlot {
+    CryptJob* job = nullptr;
+    std::unique_ptr<std::ifstream> key_file;
+    std::unique_ptr<CryptStream> cipher;
+    int input_fd = -1;
+    int output_fd = -1;
+    unsigned in_flight = 0;
+    uint64_t read_offset = 0;
+    uint64_t write_offset = 0;
+    size_t header_remaining = 0;
+    std::vector<uint8_t> preamble; // CryptHeader to write after any bitmap header when encrypting
+    bool preamble_written = false;
+    size_t input_len = 0;   // bytes waiting in the input buffer
+    size_t output_len = 0;  // bytes of the output buffer being written
+    size_t output_pos = 0;
+    bool input_ready = false;
+    bool reading = false;
+    bool writing = false;
+    bool eof = false;
+    bool finished = false;  // cipher output is complete
+    bool closing = false;
+    bool failed = false;
+    bool data_started = false;
+    bool fallback = false;  // hand the file to the sync engine instead
+};
+
+class IoUringRunner {
+public:
+    IoUringRunner(const std::string& operation, const std::string& aes_mode, const std::string& key_type,
+                  unsigned queue_depth, size_t block_size, const std::optional<std::string>& key_context) :
+                  operation(operation), aes_mode(aes_mode), key_type(key_type), key_context(key_context),
+                  // The first block must reach past a bitmap header to where a CryptHeader would start
+                  block_size(std::max<size_t>(block_size, BMP_HEADER_SIZE + CRYPT_HEADER_MAGIC_SIZE)),
+                  ring(roundUpPow2(2 * queue_depth)), slots(queue_depth) {
+
+        if (!ring.supports(RequiredOps)) {
+            throw std::runtime_error("This kernel's io_uring lacks openat, close or fixed-buffer reads and writes");
+        }
+        buffers.resize(2 * queue_depth);
+        std::vector<iovec> iovecs;
+        for (auto& buffer : buffers) {
+            buffer.resize(this->block_size + CRYPT_STREAM_OVERHEAD + MAX_PREAMBLE_SIZE);
+            iovecs.push_back({buffer.data(), buffer.size()});
+        }
+        ring.registerBuffers(iovecs);
+    }
+
+    size_t run(std::vector<CryptJob>& jobs) {
+        size_t next_job = 0;
+        size_t active = 0;
+        while (true) {
+            for (unsigned s = 0; s < slots.size() && next_job < jobs.size(); s++) {
+                if (slots[s].job == nullptr) {
+                    start(s, jobs[next_job++]);
+                    active++;
+                    if (slots[s].failed) {
+                        release(s);
+                        active--;
+                    }
+                }
+            }
+            if (active == 0) {
+                if (next_job == jobs.size()) {
+                    break;
+                }
+                continue; // every job just started failed before submitting anything
+            }
+            ring.submitAndWait();
+            ring.forEachCompletion([&](uint64_t user_data, int res) {
+                unsigned s = (unsigned)(user_data >> 8);
+                complete(s, (FileOp)(user_data & 0xFF), res);
+                if (slots[s].job != nullptr && slots[s].in_flight == 0 && (slots[s].failed || slots[s].closing)) {
+                    CryptJob* job = slots[s].job;
+                    bool fallback = slots[s].fallback;
+                    release(s);
+                    active--;
+                    if (fallback) {
+                        runSyncJob(*job, operation, aes_mode, key_type, block_size, false, key_context);
+                    }
+                }
+            });
+        }
+
+        size_t failures = 0;
+        for (const auto& job : jobs) {
+            failures += !job.error.empty();
+        }
+        return failures;
+    }
+
+private:
+    static unsigned roundUpPow2(unsigned n) {
+        unsigned pow2 = 1;
+        while (pow2 < n) {
+            pow2 <<= 1;
+        }
+        return pow2;
+    }
+
+    io_uring_sqe* submit(unsigned s, FileOp op, uint8_t opcode, int fd, uint64_t addr, uint32_t len,
+                         uint64_t offset, int buf_index = -1) {
+        io_uring_sqe* sqe = ring.nextSqe();
+        sqe->opcode = opcode;
+        sqe->fd = fd;
+        sqe->addr = addr;
+        sqe->len = len;
+        sqe->off = offset;
+        if (buf_index >= 0) {
+            sqe->buf_index = (uint16_t)buf_index;
+        }
+        sqe->user_data = ((uint64_t)s << 8) | op;
+        slots[s].in_flight++;
+        return sqe;
+    }
+
+    void submitOpen(unsigned s, FileOp op, const std::string& filename, int flags) {
+        // openat takes the mode in len and its flags in the union shared with the read/write flags
+        io_uring_sqe* sqe = submit(s, op, IORING_OP_OPENAT, AT_FDCWD, (uint64_t)filename.c_str(), 0644, 0);
+        sqe->open_flags = flags | O_CLOEXEC;
+    }
+
+    void submitRead(unsigned s) {
+        FileSlot& slot = slots[s];
+        slot.reading = true;
+        submit(s, OP_READ, IORING_OP_READ_FIXED, slot.input_fd, (uint64_t)buffers[2 * s].data(),
+               (uint32_t)block_size, slot.read_offset, 2 * s);
+    }
+
+    void submitWrite(unsigned s) {
+        FileSlot& slot = slots[s];
+        slot.writing = true;
+        submit(s, OP_WRITE, IORING_OP_WRITE_FIXED, slot.output_fd,
+               (uint64_t)(buffers[2 * s + 1].data() + slot.output_pos),
+               (uint32_t)(slot.output_len - slot.output_pos), slot.write_offset, 2 * s + 1);
+    }
+
+    void submitClose(unsigned s) {
+        FileSlot& slot = slots[s];
+        slot.closing = true;
+        submit(s, OP_CLOSE_INPUT, IORING_OP_CLOSE, slot.input_fd, 0, 0, 0);
+        submit(s, OP_CLOSE_OUTPUT, IORING_OP_CLOSE, slot.output_fd, 0, 0, 0);
+        slot.input_fd = slot.output_fd = -1;
+    }
+
+    void start(unsigned s, CryptJob& job) {
+        FileSlot& slot = slots[s];
+        slot = FileSlot();
+        slot.job = &job;
+        try {
+            slot.key_file = std::make_unique<std::ifstream>(job.key_filename, std::ios::in | std::ios::binary);
+            if (!slot.key_file->is_open()) {
+                throw std::invalid_argument("Unable to open key file " + job.key_filename);
+            }
+            slot.cipher = std::make_unique<CryptStream>(operation, *slot.key_file, aes_mode, key_type);
+            if (job.file_type != "binary" && job.file_type != "bitmap") {
+                throw std::invalid_argument("Invalid file type: \"" + job.file_type + "\"");
+            }
+            slot.header_remaining = job.file_type == "bitmap" ? BMP_HEADER_SIZE : 0;
+            if (key_context && (operation != "encrypt" || key_type != "aes")) {
+                throw std::invalid_argument("Key derivation is only supported when encrypting with an AES key.");
+            }
+            if (job.pad_range && (operation != "encrypt" || key_type != "otp")) {
+                throw std::invalid_argument("A pad range is only supported when encrypting with a one-time-pad.");
+            }
+            if (operation == "encrypt") {
+                slot.preamble = beginEncryptHeader(*slot.cipher, false, key_context, job.pad_range);
+                if (slot.preamble.size() > MAX_PREAMBLE_SIZE) {
+                    throw std::logic_error("CryptHeader is larger than MAX_PREAMBLE_SIZE");
+                }
+            }
+            slot.preamble_written = slot.preamble.empty();
+        }
+        catch (const std::exception& ex) {
+            fail(s, ex.what());
+            return;
+        }
+        submitOpen(s, OP_OPEN_INPUT, job.input_filename, O_RDONLY);
+        submitOpen(s, OP_OPEN_OUTPUT, job.output_filename, O_WRONLY | O_CREAT | O_TRUNC);
+    }
+
+    void complete(unsigned s, FileOp op, int res) {
+        FileSlot& slot = slots[s];
+        slot.in_flight--;
+        if (res < 0 && op != OP_CLOSE_INPUT && op != OP_CLOSE_OUTPUT) {
+            // Keep the descriptor that did open so it can be closed
+            std::string what = op == OP_OPEN_INPUT ? "open " + slot.job->input_filename :
+                               op == OP_OPEN_OUTPUT ? "open " + slot.job->output_filename :
+                               op == OP_READ ? "read " + slot.job->input_filename : "write " + slot.job->output_filename;
+            fail(s, "Unable to " + what + ": " + strerror(-res));
+            return;
+        }
+        if (slot.failed) {
+            // Close anything that opened after the failure
+            if (op == OP_OPEN_INPUT || op == OP_OPEN_OUTPUT) {
+                ::close(res);
+            }
+            return;
+        }
+
+        try {
+            switch (op) {
+                case OP_OPEN_INPUT:
+                    slot.input_fd = res;
+                    if (slot.output_fd >= 0) {
+                        submitRead(s);
+                    }
+                    break;
+                case OP_OPEN_OUTPUT:
+                    slot.output_fd = res;
+                    if (slot.input_fd >= 0) {
+                        submitRead(s);
+                    }
+                    break;
+                case OP_READ:
+                    slot.reading = false;
+                    if (res == 0) {
+                        slot.eof = true;
+                    } else {
+                        slot.input_len = res;
+                        slot.read_offset += res;
+                        slot.input_ready = true;
+                    }
+                    process(s);
+                    break;
+                case OP_WRITE:
+                    slot.output_pos += res;
+                    slot.write_offset += res;
+                    if (slot.output_pos < slot.output_len) {
+                        submitWrite(s); // short write
+                    } else {
+                        slot.writing = false;
+                        process(s);
+                    }
+                    break;
+                case OP_CLOSE_INPUT:
+                case OP_CLOSE_OUTPUT:
+                    if (res < 0 && op == OP_CLOSE_OUTPUT) {
+                        fail(s, "Unable to close " + slot.job->output_filename + ": " + strerror(-res));
+                    }
+                    break;
+            }
+        }
+        catch (const std::exception& ex) {
+            fail(s, ex.what());
+        }
+    }
+
+    // Encrypt the block that was read, once the previous output has been written
+    void process(unsigned s) {
+        FileSlot& slot = slots[s];
+        if (slot.writing || slot.closing) {
+            return;
+        }
+        uint8_t* input = buffers[2 * s].data();
+        uint8_t* output = buffers[2 * s + 1].data();
+        if (slot.input_ready) {
+            size_t header = std::min(slot.header_remaining, slot.input_len);
+            size_t consumed = header; // input bytes that are not ciphertext or plaintext
+            memcpy(output, input, header);
+            slot.header_remaining -= header;
+            slot.output_len = header;
+            if (operation == "decrypt" && !slot.data_started && header < slot.input_len) {
+                slot.data_started = true;
+                if (startsWithCryptHeader(input + header, slot.input_len - header) &&
+                    !useHeader(slot, input + header, slot.input_len - header, consumed)) {
+                    // Compressed or chunked ciphertext, or a header that runs past this block, is decrypted by
+                    // the sync engine
+                    slot.fallback = true;
+                    slot.failed = true;
+                    return;
+                }
+            }
+            writePreamble(slot, output);
+            slot.output_len += slot.cipher->update(input + consumed, slot.input_len - consumed,
+                                                   output + slot.output_len);
+            slot.input_ready = false;
+            submitRead(s); // the input buffer is free again
+        }
+        else if (slot.eof && !slot.finished) {
+            if (slot.header_remaining > 0) {
+                throw std::invalid_argument("Input is too short to be a bitmap.");
+            }
+            slot.output_len = 0;
+            writePreamble(slot, output);
+            slot.output_len += slot.cipher->finish(output + slot.output_len);
+            slot.finished = true;
+        }
+        else {
+            if (slot.finished && !slot.reading) {
+                submitClose(s);
+            }
+            return;
+        }
+
+        slot.output_pos = 0;
+        if (slot.output_len > 0) {
+            submitWrite(s);
+        } else {
+            process(s);
+        }
+    }
+
+    // Append the CryptHeader to the output once any bitmap header is through
+    void writePreamble(FileSlot& slot, uint8_t* output) {
+        if (!slot.preamble_written && slot.header_remaining == 0) {
+            memcpy(output + slot.output_len, slot.preamble.data(), slot.preamble.size());
+            slot.output_len += slot.preamble.size();
+            slot.preamble_written = true;
+        }
+    }
+
+    // Set the cipher up from the CryptHeader at the start of data, adding its size to consumed. Returns false
+    // if the header is incomplete or needs more than a derived key or pad range.
+    bool useHeader(FileSlot& slot, const uint8_t* data, size_t size, size_t& consumed) {
+        try {
+            std::istringstream stream(std::string((const char*)data + CRYPT_HEADER_MAGIC_SIZE,
+                                                  size - CRYPT_HEADER_MAGIC_SIZE));
+            std::vector<uint8_t> raw_header;
+            CryptHeader header = CryptHeader::read(stream, raw_header);
+            if (header.flags & ~(CRYPT_HEADER_FLAG_HKDF | CRYPT_HEADER_FLAG_PAD_RANGE)) {
+                return false;
+            }
+            useCryptHeader(*slot.cipher, header);
+            slot.cipher->setAssociatedData(raw_header.data(), raw_header.size());
+            consumed += raw_header.size();
+            return true;
+        }
+        catch (const std::exception&) {
+            // The sync engine reports what is wrong with the header
+            return false;
+        }
+    }
+
+    // Stop submitting for this file; it is cleaned up once nothing is in flight
+    void fail(unsigned s, const std::string& error) {
+        FileSlot& slot = slots[s];
+        if (!slot.failed) {
+            slot.failed = true;
+            slot.job->error = error;
+        }
+    }
+
+    void release(unsigned s) {
+        FileSlot& slot = slots[s];
+        if (slot.failed) {
+            if (slot.input_fd >= 0) {
+                ::close(slot.input_fd);
+            }
+            if (slot.output_fd >= 0) {
+                ::close(slot.output_fd);
+            }
+            std::error_code ignored;
+            fs::remove(slot.job->output_filename, ignored);
+        }
+        slot = FileSlot();
+    }
+
+    std::string operation;
+    std::string aes_mode;
+    std::string key_type;
+    std::optional<std::string> key_context;
+    size_t block_size;
+    IoUring ring;
+    std::vector<FileSlot> slots;
+    std::vector<std::vector<uint8_t>> buffers;
+};
+
+#endif // QRYPT_HAVE_IO_URING
+
+} // namespace
+
+bool ioUringAvailable() {
+#ifdef QRYPT_HAVE_IO_URING
+    static const bool available = []() {
+        try {
+            IoUring ring(2);
+            return ring.supports(RequiredOps);
+        }
+        catch (const std::exception&) {
+            return false;
+        }
+    }();
+    return available;
+#else
+    return false;
+#endif
+}
+
+IoEngine parseIoEngine(const std::string& name) {
+    if (name == "sync") {
+        return IoEngine::Sync;
+    }
+    if (name == "io_uring") {
+        if (!ioUringAvailable()) {
+            throw std::invalid_argument("io_uring is not available on this system");
+        }
+        return IoEngine::IoUring;
+    }
+    if (name == "auto") {
+        return ioUringAvailable() ? IoEngine::IoUring : IoEngine::Sync;
+    }
+    throw std::invalid_argument("Invalid io-engine: \"" + name + "\"");
+}
+
+size_t runCryptJobs(std::vector<CryptJob>& jobs, const std::string& operation, const std::string& aes_mode,
+                    const std::string& key_type, IoEngine engine, unsigned queue_depth, size_t block_size,
+                    bool compress, const std::optional<std::string>& key_context) {
+    TRACE_SCOPE("runCryptJobs");
+    if (queue_depth == 0 || block_size == 0) {
+        throw std::invalid_argument("Queue depth and block size must be greater than zero");
+    }
+#ifdef QRYPT_HAVE_IO_URING
+    // Compressed output has no size bound per block, so it is produced by the sync engine
+    if (engine == IoEngine::IoUring && !compress) {
+        // No point holding more slots and registered buffers than there are files
+        unsigned depth = (unsigned)std::min<size_t>(queue_depth, std::max<size_t>(jobs.size(), 1));
+        IoUringRunner runner(operation, aes_mode, key_type, depth, block_size, key_context);
+        return runner.run(jobs);
+    }
+#endif
+    size_t failures = 0;
+    for (auto& job : jobs) {
+        runSyncJob(job, operation, aes_mode, key_type, block_size, compress, key_context);
+        failures += !job.error.empty();
+    }
+    return failures;
+}
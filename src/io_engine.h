@@ -0,0 +1,46 @@
+#ifndef IO_ENGINE_H
+#define IO_ENGINE_H
+
+#include "encrypt.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+// One file to encrypt or decrypt
+struct CryptJob {
+    std::string input_filename;
+    std::string output_filename;
+    std::string key_filename;
+    std::string file_type = "binary";
+    std::optional<PadRange> pad_range; // part of a one-time-pad to use, see PadLedger
+    std::string error; // set if the job failed
+};
+
+enum class IoEngine {
+    Sync,    // blocking reads and writes, one file at a time
+    IoUring  // Linux io_uring, many files in flight
+};
+
+const unsigned DEFAULT_IO_QUEUE_DEPTH = 32;
+const size_t DEFAULT_IO_BLOCK_SIZE = 256 * 1024;
+
+// Whether this kernel (and any seccomp policy) allows io_uring with the operations the engine needs
+bool ioUringAvailable();
+
+// Parse "auto", "sync" or "io_uring". "auto" picks io_uring where it is available.
+IoEngine parseIoEngine(const std::string& name);
+
+// Encrypt or decrypt every job, producing the same output as encryptDecrypt(). With io_uring, up to
+// queue_depth files are kept in flight on the calling thread: opens, reads, writes and closes are
+// batched into shared submissions and read into registered buffers, and each block is encrypted while
+// the I/O of the other files proceeds. Key derivation and pad ranges are handled by both engines; compression,
+// and decrypting compressed or chunked ciphertext, always use the sync engine. A failed job has its error set
+// and its output file removed.
+// Returns the number of failed jobs.
+size_t runCryptJobs(std::vector<CryptJob>& jobs, const std::string& operation, const std::string& aes_mode,
+                    const std::string& key_type, IoEngine engine, unsigned queue_depth = DEFAULT_IO_QUEUE_DEPTH,
+                    size_t block_size = DEFAULT_IO_BLOCK_SIZE, bool compress = false,
+                    const std::optional<std::string>& key_context = std::nullopt);
+
+#endif /* IO_ENGINE_H */
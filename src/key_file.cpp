@@ -0,0 +1,209 @@
+#include "key_file.h"
+#include "common.h"
+#include "trace.h"
+
+#include <openssl/sha.h>
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint8_t KEY_TYPE_AES = 1;
+const uint8_t KEY_TYPE_OTP = 2;
+const size_t KEY_FILE_HEADER_CHECKSUM_OFFSET = 56;
+
+void putU64(uint8_t* out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        out[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+uint64_t getU64(const uint8_t* in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+std::array<uint8_t, 32> sha256(ByteSpan data) {
+    std::array<uint8_t, 32> digest;
+    SHA256(data.data(), data.size(), digest.data());
+    return digest;
+}
+
+bool hasMagic(const uint8_t* data, size_t size) {
+    return size >= sizeof(KEY_FILE_MAGIC) && memcmp(data, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC)) == 0;
+}
+
+// Check a header that starts with KEY_FILE_MAGIC and decode it
+KeyFileHeader parseHeader(const uint8_t* raw) {
+    std::array<uint8_t, 32> header_checksum = sha256(ByteSpan(raw, KEY_FILE_HEADER_CHECKSUM_OFFSET));
+    if (memcmp(raw + KEY_FILE_HEADER_CHECKSUM_OFFSET, header_checksum.data(),
+               KEY_FILE_HEADER_SIZE - KEY_FILE_HEADER_CHECKSUM_OFFSET) != 0) {
+        throw std::invalid_argument("Key file header is damaged.");
+    }
+    if (raw[8] != KEY_FILE_VERSION) {
+        throw std::invalid_argument("Unsupported key file version " + std::to_string(raw[8]) + ".");
+    }
+    KeyFileHeader header;
+    if (raw[9] == KEY_TYPE_AES) {
+        header.key_type = "aes";
+    } else if (raw[9] == KEY_TYPE_OTP) {
+        header.key_type = "otp";
+    } else {
+        throw std::invalid_argument("Unknown key type in key file header.");
+    }
+    header.length = getU64(raw + 16);
+    if (header.key_type == "aes" && header.length != AESKeyLengthInBytes) {
+        throw std::invalid_argument("AES-256 key is invalid. The file is not the correct size.");
+    }
+    memcpy(header.checksum.data(), raw + 24, header.checksum.size());
+    return header;
+}
+
+std::string describeKeyType(const std::string& key_type) {
+    return key_type == "aes" ? "an AES-256 key" : "a one-time-pad";
+}
+
+void checkHeaderType(const KeyFileHeader& header, const std::string& key_type) {
+    if (header.key_type != key_type) {
+        throw std::invalid_argument("The key file holds " + describeKeyType(header.key_type) + ", not " +
+                                    describeKeyType(key_type) + ".");
+    }
+}
+
+} // namespace
+
+void writeKeyFile(std::ostream& key_out, const std::string& key_type, ByteSpan key) {
+    if (key_type != "aes" && key_type != "otp") {
+        throw std::invalid_argument("Invalid key type: \"" + key_type + "\"");
+    }
+    uint8_t header[KEY_FILE_HEADER_SIZE] = {};
+    memcpy(header, KEY_FILE_MAGIC, sizeof(KEY_FILE_MAGIC));
+    header[8] = KEY_FILE_VERSION;
+    header[9] = key_type == "aes" ? KEY_TYPE_AES : KEY_TYPE_OTP;
+    putU64(header + 16, key.size());
+    std::array<uint8_t, 32> checksum = sha256(key);
+    memcpy(header + 24, checksum.data(), checksum.size());
+    std::array<uint8_t, 32> header_checksum = sha256(ByteSpan(header, KEY_FILE_HEADER_CHECKSUM_OFFSET));
+    memcpy(header + KEY_FILE_HEADER_CHECKSUM_OFFSET, header_checksum.data(),
+           KEY_FILE_HEADER_SIZE - KEY_FILE_HEADER_CHECKSUM_OFFSET);
+
+    key_out.write((const char*)header, sizeof(header));
+    key_out.write((const char*)key.data(), key.size());
+}
+
+std::optional<KeyFileHeader> readKeyFileHeader(std::istream& key_stream) {
+    uint8_t raw[KEY_FILE_HEADER_SIZE];
+    key_stream.read((char*)raw, sizeof(raw));
+    size_t len = key_stream.gcount();
+    key_stream.clear();
+    if (!key_stream.seekg(0)) {
+        throw std::invalid_argument("The key file must be seekable.");
+    }
+    if (!hasMagic(raw, len)) {
+        return std::nullopt;
+    }
+    if (len < KEY_FILE_HEADER_SIZE) {
+        throw std::invalid_argument("Key file header is truncated.");
+    }
+    return parseHeader(raw);
+}
+
+void verifyKeyChecksum(const KeyFileHeader& header, ByteSpan key) {
+    TRACE_SCOPE("verifyKeyChecksum", key.size());
+    if (key.size() != header.length || sha256(key) != header.checksum) {
+        throw std::invalid_argument("Key file is damaged; the key does not match its checksum.");
+    }
+}
+
+void checkKeyFileType(std::istream& key_stream, const std::string& key_type) {
+    if (std::optional<KeyFileHeader> header = readKeyFileHeader(key_stream)) {
+        checkHeaderType(*header, key_type);
+    }
+}
+
+bool isKeyFileContainer(const std::string& filename) {
+    std::ifstream key_stream(filename, std::ios::in | std::ios::binary);
+    uint8_t magic[sizeof(KEY_FILE_MAGIC)];
+    key_stream.read((char*)magic, sizeof(magic));
+    return hasMagic(magic, key_stream.gcount());
+}
+
+KeyFile::KeyFile(const std::string& filename) {
+    TRACE_SCOPE("KeyFile open");
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::invalid_argument("Unable to open key file " + filename);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)KEY_FILE_HEADER_SIZE) {
+        close(fd);
+        throw std::invalid_argument("Key file " + filename + " is too short to be a key file container.");
+    }
+    mapping_size = st.st_size;
+    mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw std::runtime_error("Unable to map key file " + filename);
+    }
+    const uint8_t* raw = (const uint8_t*)mapping;
+    uint64_t file_size = mapping_size;
+#else
+    std::ifstream key_stream(filename, std::ios::in | std::ios::binary);
+    if (!key_stream.is_open()) {
+        throw std::invalid_argument("Unable to open key file " + filename);
+    }
+    contents.assign(std::istreambuf_iterator<char>(key_stream), {});
+    const uint8_t* raw = contents.data();
+    uint64_t file_size = contents.size();
+#endif
+
+    try {
+        if (!hasMagic(raw, file_size) || file_size < KEY_FILE_HEADER_SIZE) {
+            throw std::invalid_argument("Key file " + filename + " is not a key file container.");
+        }
+        header = parseHeader(raw);
+        if (file_size - KEY_FILE_HEADER_SIZE != header.length) {
+            throw std::invalid_argument("Key file " + filename + " is truncated or has trailing data.");
+        }
+        data = raw + KEY_FILE_HEADER_SIZE;
+        if (header.key_type == "aes") {
+            verifyKeyChecksum(header, key());
+        }
+#ifndef _WIN32
+        // Pads are mostly read front to back
+        madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+#endif
+    }
+    catch (...) {
+#ifndef _WIN32
+        munmap(mapping, mapping_size);
+#endif
+        throw;
+    }
+}
+
+KeyFile::~KeyFile() {
+#ifndef _WIN32
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+#endif
+}
+
+void KeyFile::checkType(const std::string& key_type) const {
+    checkHeaderType(header, key_type);
+}
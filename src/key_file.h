@@ -0,0 +1,73 @@
+#ifndef KEY_FILE_H
+#define KEY_FILE_H
+
+#include "byte_span.h"
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Self-describing binary key file, written by "qrypt generate --key-format=container". Unlike a hex or raw
+// key file, its type and length are known from the header without looking at the key, and a raw key can
+// never be mistaken for hex. Layout, with integers little endian:
+//
+//   0   KEY_FILE_MAGIC
+//   8   version (1 byte), key type (1 byte: 1 AES-256, 2 one-time-pad), 6 reserved zero bytes
+//   16  key length (8 bytes)
+//   24  SHA-256 of the key
+//   56  first 8 bytes of the SHA-256 of bytes 0 to 55, so a damaged header is caught without reading the key
+//   64  the key
+const uint8_t KEY_FILE_MAGIC[] = {'Q', 'R', 'Y', 'P', 'T', 'K', 'E', 'Y'};
+const uint8_t KEY_FILE_VERSION = 1;
+const size_t KEY_FILE_HEADER_SIZE = 64;
+
+struct KeyFileHeader {
+    std::string key_type; // "aes" or "otp"
+    uint64_t length;
+    std::array<uint8_t, 32> checksum;
+};
+
+// Write key to key_out as a key file
+void writeKeyFile(std::ostream& key_out, const std::string& key_type, ByteSpan key);
+
+// Parse and check the header if key_stream starts with one; returns std::nullopt for a hex or raw key file.
+// key_stream must be seekable and is left at its start.
+std::optional<KeyFileHeader> readKeyFileHeader(std::istream& key_stream);
+
+// Throw std::invalid_argument if key is not the key described by header
+void verifyKeyChecksum(const KeyFileHeader& header, ByteSpan key);
+
+// Throw std::invalid_argument if the key file is a container holding a different type of key than key_type
+void checkKeyFileType(std::istream& key_stream, const std::string& key_type);
+
+// Whether filename is a key file container, judged from its header
+bool isKeyFileContainer(const std::string& filename);
+
+// A key file container opened for use. Opening checks only the header and the file size, and the key is
+// memory-mapped rather than read, so a large one-time-pad costs the same to open as an AES key and its
+// pages are read as they are used. The SHA-256 of an AES key is checked too; a pad's is checked only by
+// readKey(), which reads the whole pad anyway. Safe to share between threads.
+class KeyFile {
+public:
+    explicit KeyFile(const std::string& filename);
+    ~KeyFile();
+    KeyFile(const KeyFile&) = delete;
+    KeyFile& operator=(const KeyFile&) = delete;
+
+    ByteSpan key() const { return ByteSpan(data, header.length); }
+    const std::string& keyType() const { return header.key_type; }
+    // Throw std::invalid_argument if this is not a key of type key_type
+    void checkType(const std::string& key_type) const;
+
+private:
+    KeyFileHeader header;
+    const uint8_t* data = nullptr;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    std::vector<uint8_t> contents; // where memory mapping is not available
+};
+
+#endif /* KEY_FILE_H */
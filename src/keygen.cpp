@@ -1,5 +1,19 @@
+#include "bounded_queue.h"
 #include "common.h"
 #include "keygen.h"
+#include "key_file.h"
+#include "metrics.h"
+#include "trace.h"
+
+#include <curl/curl.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
 
 using KeyValuePair = std::tuple<std::string, std::string>;
 
@@ -10,39 +24,44 @@ KeyGen::KeyGen(std::string token, std::string key_type, size_t key_len, uint32_t
     if (key_type != "aes" && key_type != "otp") {
         throw std::invalid_argument("Invalid key type: \"" + key_type + "\"");
     }
-    if (key_format != "hexstr" && key_format != "binary") {
+    if (key_format != "hexstr" && key_format != "binary" && key_format != "container") {
         throw std::invalid_argument("Invalid key format: \"" + key_format + "\"");
     }
 
-    QryptSecurity::setLogLevel(log_level);
-    // Create and initialize a client from the QryptSecurity SDK
-    sdk_client = QryptSecurity::IKeyGenDistributedClient::create();
-    if (cacert_path.empty()) {
-        sdk_client->initialize(token);
-    }
-    else {
-        QryptSecurity::ClientConfiguration clientConfig = {};
-        clientConfig.caCertPath = cacert_path;
-        sdk_client->initialize(token, clientConfig);
-    }
+    // Create and initialize a client from the QryptSecurity SDK, which loads the SDK
+    TRACE_SCOPE("KeyGen initialize");
+    setSdkLogLevel(log_level);
+    sdk_client = std::make_unique<SdkClient>(token, cacert_path.empty() ? nullptr : cacert_path.c_str());
 }
 
 // Generate a key using the Qrypt SDK
 void KeyGen::generate(std::ostream& key_out, std::ostream& meta_out) {
+    TRACE_SCOPE("KeyGen::generate");
 
     // Generate the key and metadata
     QryptSecurity::SymmetricKeyData key_and_metadata = {};
-    if (key_type == "aes") {
-        key_and_metadata = sdk_client->genInit(QryptSecurity::AES_256_SIZE, QryptSecurity::KeyConfiguration(key_ttl));
+    incrementCounter(METRIC_KEYGEN_REQUESTS, {{"operation", "generate"}});
+    try {
+        TRACE_SCOPE("genInit");
+        if (key_type == "aes") {
+            key_and_metadata = sdk_client->genInit(QryptSecurity::AES_256_SIZE, key_ttl);
+        }
+        else if (key_type == "otp") {
+            key_and_metadata = sdk_client->genInit(key_len, key_ttl);
+        }
     }
-    else if (key_type == "otp") {
-        key_and_metadata = sdk_client->genInit(key_len, QryptSecurity::KeyConfiguration(key_ttl));
+    catch (...) {
+        incrementCounter(METRIC_KEYGEN_FAILURES, {{"operation", "generate"}});
+        throw;
     }
 
-    // Output key in either hexadecimal or binary format
+    // Output key in hexadecimal, binary or key file container format
     if (key_format == "hexstr") {
         key_out << byteVecToHexStr(key_and_metadata.key);
     } 
+    else if (key_format == "container") {
+        writeKeyFile(key_out, key_type, key_and_metadata.key);
+    }
     else  {
         key_out.write((char *)&(key_and_metadata.key)[0], key_and_metadata.key.size());
     }
@@ -52,18 +71,144 @@ void KeyGen::generate(std::ostream& key_out, std::ostream& meta_out) {
 }
 
 void KeyGen::replicate(std::ostream& key_out, std::istream& meta_in) {
+    TRACE_SCOPE("KeyGen::replicate");
 
     // Read metadata
     std::vector<uint8_t> metadata(std::istreambuf_iterator<char>(meta_in), {});
 
     // Replicate the key using the retrieved metadata
-    std::vector<uint8_t> key = sdk_client->genSync(metadata);
+    std::vector<uint8_t> key;
+    incrementCounter(METRIC_KEYGEN_REQUESTS, {{"operation", "replicate"}});
+    try {
+        TRACE_SCOPE("genSync");
+        key = sdk_client->genSync(metadata);
+    }
+    catch (...) {
+        incrementCounter(METRIC_KEYGEN_FAILURES, {{"operation", "replicate"}});
+        throw;
+    }
 
-    // Output key in either hexadecimal or binary format
+    // Output key in hexadecimal, binary or key file container format
     if (key_format == "hexstr") {
         key_out << byteVecToHexStr(key);
     } 
+    else if (key_format == "container") {
+        writeKeyFile(key_out, key_type, key);
+    }
     else  {
         key_out.write((char *)&(key)[0], key.size());
     }
-}
\ No newline at end of file
+}
+
+std::string numberedFilename(const std::string& filename, size_t index) {
+    fs::path path(filename);
+    return (path.parent_path() / (path.stem().string() + "." + std::to_string(index) + path.extension().string())).string();
+}
+
+void KeyGen::generateBatch(const std::string& key_filename, const std::string& metadata_filename, size_t count,
+                           const std::string& upload_url, size_t depth) {
+    if (count == 0 || depth == 0) {
+        throw std::invalid_argument("Key count and queue depth must be greater than zero");
+    }
+    TRACE_SCOPE("KeyGen::generateBatch");
+
+    // libcurl has to be initialized before a second thread uses it
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    BoundedQueue<std::string> metadata_queue(depth);
+    std::mutex output_mutex;
+    std::string upload_error;
+
+    // Send each metadata file as soon as it has been written, while the next key is generated
+    std::thread uploader;
+    if (!upload_url.empty()) {
+        uploader = std::thread([&]() {
+            std::string metadata_path;
+            try {
+                while (metadata_queue.pop(metadata_path)) {
+                    std::string response = curlRequest(upload_url, metadata_path, {});
+                    std::lock_guard<std::mutex> lock(output_mutex);
+                    std::cout << response << std::endl;
+                }
+            }
+            catch (const std::exception& ex) {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                upload_error = "Unable to send " + metadata_path + ": " + ex.what();
+                metadata_queue.close();
+            }
+        });
+    }
+    auto stop = [&]() {
+        metadata_queue.close();
+        if (uploader.joinable()) {
+            uploader.join();
+        }
+        curl_global_cleanup();
+    };
+
+    try {
+        for (size_t i = 0; i < count; i++) {
+            std::string key_path = numberedFilename(key_filename, i);
+            std::string metadata_path = numberedFilename(metadata_filename, i);
+            {
+                std::ofstream key_file(key_path, std::ios::out | std::ios::binary);
+                if (!key_file.is_open()) {
+                    throw std::invalid_argument("Unable to open key file " + key_path);
+                }
+                std::ofstream metadata_file(metadata_path, std::ios::out | std::ios::binary);
+                if (!metadata_file.is_open()) {
+                    throw std::invalid_argument("Unable to open metadata file " + metadata_path);
+                }
+                generate(key_file, metadata_file);
+                if (!key_file.flush() || !metadata_file.flush()) {
+                    throw std::runtime_error("Unable to write " + key_path + " or " + metadata_path);
+                }
+            }
+            {
+                std::lock_guard<std::mutex> lock(output_mutex);
+                std::cout << "Wrote key to file: " << key_path << "\n"
+                          << "Wrote metadata to file: " << metadata_path << std::endl;
+            }
+            // Refused only once the uploader has failed
+            if (uploader.joinable() && !metadata_queue.push(metadata_path)) {
+                break;
+            }
+        }
+    }
+    catch (...) {
+        // Metadata already queued is still sent, so that the peer can replicate the keys written so far
+        stop();
+        throw;
+    }
+    stop();
+    if (!upload_error.empty()) {
+        throw std::runtime_error(upload_error);
+    }
+}
+
+void KeyGen::replicateWatch(const std::string& watch_dir, const std::string& key_filename,
+                            const std::string& metadata_filename, size_t count) {
+    TRACE_SCOPE("KeyGen::replicateWatch");
+    if (!fs::is_directory(watch_dir)) {
+        throw std::invalid_argument("Watch directory \"" + watch_dir + "\" does not exist!");
+    }
+    std::string metadata_name = fs::path(metadata_filename).filename().string();
+
+    for (size_t i = 0; count == 0 || i < count; i++) {
+        // Receivers move each upload into place once it is complete, so a file that exists is whole
+        fs::path metadata_path = fs::path(watch_dir) / numberedFilename(metadata_name, i);
+        while (!fs::exists(metadata_path)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        std::ifstream metadata_file(metadata_path, std::ios::in | std::ios::binary);
+        if (!metadata_file.is_open()) {
+            throw std::runtime_error("Unable to open metadata file " + metadata_path.string());
+        }
+        std::string key_path = numberedFilename(key_filename, i);
+        std::ofstream key_file(key_path, std::ios::out | std::ios::binary);
+        if (!key_file.is_open()) {
+            throw std::invalid_argument("Unable to open key file " + key_path);
+        }
+        replicate(key_file, metadata_file);
+        std::cout << "Replicated key from " << metadata_path.string() << " to " << key_path << std::endl;
+    }
+}
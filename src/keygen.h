@@ -1,11 +1,10 @@
 #ifndef KEYGEN_H
 #define KEYGEN_H
 
-#include "QryptSecurity/qryptsecurity.h"
-#include "QryptSecurity/qryptsecurity_exceptions.h"
-#include "QryptSecurity/qryptsecurity_logging.h"
+#include "sdk_loader.h"
 
 #include <iostream>
+#include <memory>
 #include <string>
 #include <stdexcept>
 #include <vector>
@@ -18,12 +17,25 @@ public:
 
     void generate(std::ostream& key_out, std::ostream& metadata_out);
     void replicate(std::ostream& key_out, std::istream& metadata_in);
+
+    // Generate count keys into numberedFilename(key_filename, i) and numberedFilename(metadata_filename, i).
+    // Unless upload_url is empty, each metadata file is uploaded to it on another thread while the next key is
+    // generated; at most depth metadata files wait to be uploaded before generation pauses.
+    void generateBatch(const std::string& key_filename, const std::string& metadata_filename, size_t count,
+                       const std::string& upload_url = "", size_t depth = 4);
+    // Replicate a key from each numbered metadata file in watch_dir as soon as it appears, in order, until
+    // count keys have been replicated, or indefinitely if count is 0
+    void replicateWatch(const std::string& watch_dir, const std::string& key_filename,
+                        const std::string& metadata_filename, size_t count);
 private:
-    std::unique_ptr<QryptSecurity::IKeyGenDistributedClient> sdk_client;
+    std::unique_ptr<SdkClient> sdk_client;
     std::string key_type;
     size_t key_len;
     uint32_t key_ttl;
     std::string key_format;
 };
 
+// Name of file index of a batch: numberedFilename("meta.dat", 3) is "meta.3.dat"
+std::string numberedFilename(const std::string& filename, size_t index);
+
 #endif /* KEYGEN_H */
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include "mem_profile.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <malloc.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#include <sys/resource.h>
+#elif defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace {
+
+const size_t SITE_TABLE_SIZE = 1024;
+const auto RSS_SAMPLE_INTERVAL = std::chrono::milliseconds(5);
+const char NO_SITE[] = "(outside any scope)";
+const char OVERFLOW_SITE[] = "(too many call sites)";
+
+thread_local uint64_t allocation_count = 0;
+std::atomic<bool> profile_enabled(false);
+
+// Counters for one call site. The hooks must not allocate, so sites live in a fixed open-addressed table keyed
+// by the scope name's address.
+struct SiteStats {
+    std::atomic<const char*> name{nullptr};
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> largest{0};
+    std::atomic<int64_t> peak_heap{0}; // live heap bytes just after one of its allocations
+    std::atomic<int64_t> peak_rss{0};  // resident bytes sampled while it made the latest allocation
+};
+
+SiteStats sites[SITE_TABLE_SIZE];
+SiteStats overflow_site;
+std::atomic<SiteStats*> latest_site(nullptr);
+// Relative to when profiling started, since memory allocated before then may be freed during it
+std::atomic<int64_t> live_heap(0);
+std::atomic<int64_t> peak_heap(0);
+
+std::thread sampler;
+std::mutex sampler_mutex;
+std::condition_variable sampler_wake;
+bool sampler_stop = false;
+int64_t peak_rss = 0;
+std::string peak_rss_site;
+uint64_t rss_samples = 0;
+
+template <typename T>
+void atomicMax(std::atomic<T>& value, T candidate) {
+    T current = value.load(std::memory_order_relaxed);
+    while (candidate > current && !value.compare_exchange_weak(current, candidate, std::memory_order_relaxed)) {
+    }
+}
+
+SiteStats& siteStats(const char* name) {
+    size_t index = (size_t)(((uintptr_t)name * 0x9E3779B97F4A7C15ull) >> 32) % SITE_TABLE_SIZE;
+    for (size_t probe = 0; probe < SITE_TABLE_SIZE; probe++) {
+        SiteStats& site = sites[(index + probe) % SITE_TABLE_SIZE];
+        const char* current = site.name.load(std::memory_order_acquire);
+        if (current == nullptr) {
+            site.name.compare_exchange_strong(current, name, std::memory_order_acq_rel);
+            current = site.name.load(std::memory_order_acquire);
+        }
+        if (current == name) {
+            return site;
+        }
+    }
+    return overflow_site;
+}
+
+size_t allocatedSize(void* ptr) {
+#if defined(__linux__)
+    return malloc_usable_size(ptr);
+#elif defined(__APPLE__)
+    return malloc_size(ptr);
+#elif defined(_WIN32)
+    return _msize(ptr);
+#else
+    return 0;
+#endif
+}
+
+void recordAllocation(void* ptr, size_t size) {
+    const char* name = traceSite();
+    SiteStats& site = siteStats(name ? name : NO_SITE);
+    site.allocations.fetch_add(1, std::memory_order_relaxed);
+    site.bytes.fetch_add(size, std::memory_order_relaxed);
+    atomicMax(site.largest, (uint64_t)size);
+    int64_t allocated = allocatedSize(ptr);
+    int64_t live = live_heap.fetch_add(allocated, std::memory_order_relaxed) + allocated;
+    atomicMax(peak_heap, live);
+    atomicMax(site.peak_heap, live);
+    latest_site.store(&site, std::memory_order_relaxed);
+}
+
+void recordFree(void* ptr) {
+    live_heap.fetch_sub(allocatedSize(ptr), std::memory_order_relaxed);
+}
+
+// Current resident set size in bytes, or 0 where it cannot be read. macOS only offers the peak so far.
+int64_t residentBytes() {
+#if defined(__linux__)
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    char text[128];
+    ssize_t len = read(fd, text, sizeof(text) - 1);
+    close(fd);
+    unsigned long long pages = 0, resident = 0;
+    if (len <= 0) {
+        return 0;
+    }
+    text[len] = '\0';
+    if (sscanf(text, "%llu %llu", &pages, &resident) != 2) {
+        return 0;
+    }
+    return (int64_t)resident * sysconf(_SC_PAGESIZE);
+#elif defined(__APPLE__)
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? (int64_t)usage.ru_maxrss : 0;
+#else
+    return 0;
+#endif
+}
+
+void sampleRss() {
+    int64_t rss = residentBytes();
+    if (rss <= 0) {
+        return;
+    }
+    rss_samples++;
+    SiteStats* site = latest_site.load(std::memory_order_relaxed);
+    if (rss > peak_rss) {
+        peak_rss = rss;
+        peak_rss_site = site ? site->name.load() : NO_SITE;
+    }
+    if (site) {
+        atomicMax(site->peak_rss, rss);
+    }
+}
+
+void runSampler() {
+    std::unique_lock<std::mutex> lock(sampler_mutex);
+    while (!sampler_wake.wait_for(lock, RSS_SAMPLE_INTERVAL, []() { return sampler_stop; })) {
+        sampleRss();
+    }
+}
+
+// The stage of a command that a call site belongs to, from its TRACE_SCOPE name
+const char* stageOf(const std::string& site) {
+    static const std::pair<const char*, const char*> prefixes[] = {
+        {"read", "read"}, {"KeyFile open", "read"}, {"archive read", "read"}, {"io_uring wait", "read"},
+        {"hexStrToByteVec", "hex decode"},
+        {"write", "write"},
+        {"KeyGen", "SDK"}, {"genInit", "SDK"}, {"genSync", "SDK"}, {"curl", "SDK"},
+        {"encrypt", "crypto"}, {"decrypt", "crypto"}, {"EVP", "crypto"}, {"CryptStream", "crypto"},
+        {"xorBytes", "crypto"}, {"deriveKey", "crypto"}, {"zstd", "crypto"}, {"verifyKeyChecksum", "crypto"},
+        {"archive segment", "crypto"}
+    };
+    // The command's own scope is named after the command, which must not make "encrypt" look like crypto
+    if (site == "encrypt" || site == "decrypt") {
+        return "other";
+    }
+    for (const auto& [prefix, stage] : prefixes) {
+        if (site.compare(0, strlen(prefix), prefix) == 0) {
+            return stage;
+        }
+    }
+    return "other";
+}
+
+struct Totals {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+    uint64_t largest = 0;
+    int64_t peak_heap = 0;
+    int64_t peak_rss = 0;
+
+    void add(const SiteStats& site) {
+        allocations += site.allocations;
+        bytes += site.bytes;
+        largest = std::max(largest, site.largest.load());
+        peak_heap = std::max(peak_heap, site.peak_heap.load());
+        peak_rss = std::max(peak_rss, site.peak_rss.load());
+    }
+};
+
+void printRow(std::ostream& out, const std::string& label, const Totals& totals, bool have_rss) {
+    out << "  " << std::left << std::setw(28) << label.substr(0, 27) << std::right
+        << std::setw(12) << totals.allocations
+        << std::setw(14) << totals.bytes / 1e6
+        << std::setw(12) << totals.largest / 1e6
+        << std::setw(13) << std::max<int64_t>(totals.peak_heap, 0) / 1e6;
+    if (have_rss) {
+        out << std::setw(12) << totals.peak_rss / 1e6;
+    }
+    out << "\n";
+}
+
+void printHeading(std::ostream& out, const std::string& label, bool have_rss) {
+    out << "  " << std::left << std::setw(28) << label << std::right
+        << std::setw(12) << "allocations" << std::setw(14) << "allocated MB" << std::setw(12) << "largest MB"
+        << std::setw(13) << "peak heap MB";
+    if (have_rss) {
+        out << std::setw(12) << "peak RSS MB";
+    }
+    out << "\n";
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+    allocation_count++;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    if (profile_enabled.load(std::memory_order_relaxed)) {
+        recordAllocation(ptr, size);
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (ptr && profile_enabled.load(std::memory_order_relaxed)) {
+        recordFree(ptr);
+    }
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t /*size*/) noexcept {
+    ::operator delete(ptr);
+}
+
+uint64_t threadAllocationCount() {
+    return allocation_count;
+}
+
+void startMemoryProfile() {
+    overflow_site.name = OVERFLOW_SITE;
+    sampleRss();
+    trace_sites_enabled = true;
+    profile_enabled = true;
+    sampler_stop = false;
+    sampler = std::thread(runSampler);
+}
+
+void writeMemoryProfile(std::ostream& out) {
+    {
+        std::lock_guard<std::mutex> lock(sampler_mutex);
+        sampler_stop = true;
+    }
+    sampler_wake.notify_all();
+    if (sampler.joinable()) {
+        sampler.join();
+    }
+    sampleRss();
+    profile_enabled = false;
+    trace_sites_enabled = false;
+
+    // Scope names with the same text but different addresses are one site
+    std::map<std::string, Totals> by_site;
+    std::map<std::string, Totals> by_stage;
+    Totals total;
+    for (const SiteStats* site = sites; site != sites + SITE_TABLE_SIZE + 1; site++) {
+        const SiteStats& stats = site == sites + SITE_TABLE_SIZE ? overflow_site : *site;
+        if (stats.name == nullptr || stats.allocations == 0) {
+            continue;
+        }
+        std::string name = stats.name.load();
+        by_site[name].add(stats);
+        by_stage[stageOf(name)].add(stats);
+        total.add(stats);
+    }
+    std::vector<std::pair<std::string, Totals>> top_sites(by_site.begin(), by_site.end());
+    std::sort(top_sites.begin(), top_sites.end(), [](const auto& a, const auto& b) {
+        return a.second.bytes > b.second.bytes;
+    });
+
+    bool have_rss = rss_samples > 0;
+    out << "\nMemory profile: " << total.allocations << " allocations, " << std::fixed << std::setprecision(1)
+        << total.bytes / 1e6 << " MB allocated, peak heap " << std::max<int64_t>(peak_heap, 0) / 1e6 << " MB";
+    if (have_rss) {
+        out << ", peak RSS " << peak_rss / 1e6 << " MB (" << rss_samples << " samples, latest allocation at peak in \""
+            << peak_rss_site << "\")";
+    }
+    out << "\n";
+    printHeading(out, "stage", have_rss);
+    for (const char* stage : {"read", "hex decode", "crypto", "write", "SDK", "other"}) {
+        if (by_stage.count(stage)) {
+            printRow(out, stage, by_stage[stage], have_rss);
+        }
+    }
+    printHeading(out, "call site", have_rss);
+    for (size_t i = 0; i < top_sites.size() && i < 15; i++) {
+        printRow(out, top_sites[i].first, top_sites[i].second, have_rss);
+    }
+    out << std::defaultfloat;
+}
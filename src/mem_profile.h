@@ -0,0 +1,20 @@
+#ifndef MEM_PROFILE_H
+#define MEM_PROFILE_H
+
+#include <cstdint>
+#include <iostream>
+
+// Heap and resident memory profiling for --profile-memory, which any command accepts. mem_profile.cpp replaces
+// the global operator new and delete, so it is linked into the qrypt executable only, never into libqrypt_core.
+// Each allocation is counted against the innermost TRACE_SCOPE on its thread, its call site, and a sampler thread
+// reads the resident set size every few milliseconds. The report groups call sites into the stages of a command:
+// read, hex decode, crypto, write, SDK and other.
+
+// Number of operator new calls made by the calling thread so far, whether or not profiling is on
+uint64_t threadAllocationCount();
+
+void startMemoryProfile();
+// Stop profiling and print the report
+void writeMemoryProfile(std::ostream& out = std::cerr);
+
+#endif /* MEM_PROFILE_H */
@@ -0,0 +1,183 @@
+#include "metrics.h"
+#include "file_lock.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+
+struct MetricInfo {
+    const char* type;
+    const char* help;
+};
+
+const std::map<std::string, MetricInfo> MetricInfos = {
+    {METRIC_CRYPT_BYTES, {"counter", "Bytes of input encrypted or decrypted."}},
+    {METRIC_CRYPT_THROUGHPUT, {"gauge", "Bytes encrypted or decrypted per second of the last run that did any."}},
+    {METRIC_KEYGEN_REQUESTS, {"counter", "BLAST key generation and replication requests."}},
+    {METRIC_KEYGEN_FAILURES, {"counter", "BLAST key generation and replication requests that failed."}},
+    {METRIC_EAAS_BYTES, {"counter", "Bytes of entropy received from EaaS."}},
+    {METRIC_HTTP_RESPONSES, {"counter", "HTTP responses by status code; code 0 means no response was received."}},
+    {METRIC_RUNS, {"counter", "qrypt commands run, by result."}},
+    {METRIC_LAST_RUN_TIMESTAMP, {"gauge", "Unix time at which the last run of each command finished."}},
+    {METRIC_LAST_RUN_DURATION, {"gauge", "Duration of the last run of each command."}},
+};
+
+const char* CryptModes[] = {"otp", "ecb", "ocb"};
+std::atomic<uint64_t> crypt_bytes[2][3];
+
+std::mutex metrics_mutex;
+std::map<std::string, double> counters;
+std::map<std::string, double> gauges;
+
+std::string escapeLabel(const std::string& value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+        }
+        escaped += (c == '\n') ? std::string("\\n") : std::string(1, c);
+    }
+    return escaped;
+}
+
+// The series name as it appears in the file, e.g. name{label="value"}
+std::string seriesName(const std::string& name, const MetricLabels& labels) {
+    if (labels.empty()) {
+        return name;
+    }
+    std::string series = name + "{";
+    for (size_t i = 0; i < labels.size(); i++) {
+        series += (i ? "," : "") + labels[i].first + "=\"" + escapeLabel(labels[i].second) + "\"";
+    }
+    return series + "}";
+}
+
+std::string metricName(const std::string& series) {
+    return series.substr(0, series.find('{'));
+}
+
+bool isCounter(const std::string& series) {
+    auto info = MetricInfos.find(metricName(series));
+    return info != MetricInfos.end() && strcmp(info->second.type, "counter") == 0;
+}
+
+std::string formatValue(double value) {
+    std::ostringstream out;
+    if (value == std::floor(value) && std::fabs(value) < 1e15) {
+        out << (long long)value;
+    } else {
+        out.precision(15);
+        out << value;
+    }
+    return out.str();
+}
+
+std::map<std::string, double> snapshot() {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    std::map<std::string, double> series = counters;
+    series.insert(gauges.begin(), gauges.end());
+    for (int encrypt = 0; encrypt < 2; encrypt++) {
+        for (int mode = 0; mode < 3; mode++) {
+            uint64_t bytes = crypt_bytes[encrypt][mode].load(std::memory_order_relaxed);
+            if (bytes > 0) {
+                MetricLabels labels = {{"operation", encrypt ? "encrypt" : "decrypt"}, {"mode", CryptModes[mode]}};
+                series[seriesName(METRIC_CRYPT_BYTES, labels)] += bytes;
+            }
+        }
+    }
+    return series;
+}
+
+std::string format(const std::map<std::string, double>& series) {
+    std::ostringstream out;
+    std::string current_name;
+    for (const auto& [name, value] : series) {
+        std::string metric = metricName(name);
+        if (metric != current_name) {
+            current_name = metric;
+            auto info = MetricInfos.find(metric);
+            if (info != MetricInfos.end()) {
+                out << "# HELP " << metric << " " << info->second.help << "\n";
+                out << "# TYPE " << metric << " " << info->second.type << "\n";
+            }
+        }
+        out << name << " " << formatValue(value) << "\n";
+    }
+    return out.str();
+}
+
+std::map<std::string, double> parse(std::istream& in) {
+    std::map<std::string, double> series;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t split = line.rfind(' ');
+        if (line.empty() || line[0] == '#' || split == std::string::npos) {
+            continue;
+        }
+        try {
+            series[line.substr(0, split)] = std::stod(line.substr(split + 1));
+        }
+        catch (const std::exception&) {
+            // Skip lines that are not samples
+        }
+    }
+    return series;
+}
+
+} // namespace
+
+void incrementCounter(const std::string& name, const MetricLabels& labels, double value) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    counters[seriesName(name, labels)] += value;
+}
+
+void setGauge(const std::string& name, const MetricLabels& labels, double value) {
+    std::lock_guard<std::mutex> lock(metrics_mutex);
+    gauges[seriesName(name, labels)] = value;
+}
+
+void countCryptBytes(bool encrypt, const char* mode, uint64_t bytes) {
+    int index = strcmp(mode, "ecb") == 0 ? 1 : strcmp(mode, "ocb") == 0 ? 2 : 0;
+    crypt_bytes[encrypt][index].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+uint64_t cryptBytesCounted() {
+    uint64_t total = 0;
+    for (auto& by_mode : crypt_bytes) {
+        for (auto& bytes : by_mode) {
+            total += bytes.load(std::memory_order_relaxed);
+        }
+    }
+    return total;
+}
+
+void countHttpResponse(long code) {
+    incrementCounter(METRIC_HTTP_RESPONSES, {{"code", std::to_string(code)}});
+}
+
+std::string formatMetrics() {
+    return format(snapshot());
+}
+
+void writeMetricsFile(const std::string& path) {
+    FileLock lock(path);
+
+    std::map<std::string, double> merged;
+    std::ifstream existing(path);
+    if (existing.is_open()) {
+        merged = parse(existing);
+        existing.close();
+    }
+    for (const auto& [series, value] : snapshot()) {
+        merged[series] = isCounter(series) ? merged[series] + value : value;
+    }
+
+    replaceFile(path, format(merged));
+}
@@ -0,0 +1,43 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Counters and gauges for this process, exported in the Prometheus text format. qrypt runs as a short-lived
+// command, so instead of serving them the totals are merged into a file for node_exporter's textfile collector.
+
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+// Metric names; see the help text in metrics.cpp
+const std::string METRIC_CRYPT_BYTES = "qrypt_crypt_bytes_total";
+const std::string METRIC_CRYPT_THROUGHPUT = "qrypt_crypt_throughput_bytes_per_second";
+const std::string METRIC_KEYGEN_REQUESTS = "qrypt_keygen_requests_total";
+const std::string METRIC_KEYGEN_FAILURES = "qrypt_keygen_failures_total";
+const std::string METRIC_EAAS_BYTES = "qrypt_eaas_bytes_total";
+const std::string METRIC_HTTP_RESPONSES = "qrypt_http_responses_total";
+const std::string METRIC_RUNS = "qrypt_runs_total";
+const std::string METRIC_LAST_RUN_TIMESTAMP = "qrypt_last_run_timestamp_seconds";
+const std::string METRIC_LAST_RUN_DURATION = "qrypt_last_run_duration_seconds";
+
+void incrementCounter(const std::string& name, const MetricLabels& labels = {}, double value = 1);
+void setGauge(const std::string& name, const MetricLabels& labels, double value);
+
+// Lock-free and allocation-free, for the crypto hot paths. mode is "otp", "ecb" or "ocb".
+void countCryptBytes(bool encrypt, const char* mode, uint64_t bytes);
+uint64_t cryptBytesCounted();
+
+// HTTP status of a request, or 0 if no response arrived
+void countHttpResponse(long code);
+
+// This process's metrics in the Prometheus text format
+std::string formatMetrics();
+
+// Merge this process's metrics into the file at path: counters are added to the totals already there and
+// gauges replace them. Concurrent writers are serialized with a lock file, and the file is replaced by a
+// rename, so the collector never reads a partial file.
+void writeMetricsFile(const std::string& path);
+
+#endif /* METRICS_H */
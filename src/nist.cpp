@@ -0,0 +1,468 @@
+#include "nist.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+    NIST SP 800-22 Rev 1a statistical tests
+
+    The sequence is packed into big-endian 64-bit words so that most tests reduce to popcounts and
+    shifts over whole words, or to lookups in per-byte tables. Every test that walks the whole
+    sequence splits it into contiguous ranges, one per thread, and merges the partial results.
+ */
+
+namespace {
+
+const size_t MIN_NIST_WORDS = 16;            // 1024 bits
+const size_t MAX_SPECTRAL_BITS = 1 << 21;    // bounds the DFT working set to 32MB
+
+inline int popcount64(uint64_t x) {
+#ifdef _MSC_VER
+    return (int)__popcnt64(x);
+#else
+    return __builtin_popcountll(x);
+#endif
+}
+
+// Split [0, count) into one contiguous range per thread and run fn(begin, end, thread_index) on each
+template <typename Fn>
+void parallelFor(size_t count, unsigned threads, Fn fn) {
+    threads = (unsigned)std::max<size_t>(1, std::min<size_t>(threads, count));
+    std::vector<std::thread> workers;
+    size_t per_thread = (count + threads - 1) / threads;
+    for (unsigned t = 0; t < threads; t++) {
+        size_t begin = std::min(count, t * per_thread);
+        size_t end = std::min(count, begin + per_thread);
+        workers.emplace_back(fn, begin, end, t);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+struct BitSequence {
+    std::vector<uint64_t> words;
+    size_t n; // length in bits
+
+    int bit(size_t index) const {
+        return (words[index >> 6] >> (63 - (index & 63))) & 1;
+    }
+};
+
+double normalCdf(double x) {
+    return 0.5 * std::erfc(-x / std::sqrt(2.0));
+}
+
+// Regularized upper incomplete gamma function Q(a, x)
+double igamc(double a, double x) {
+    const double eps = 1e-15;
+    const double tiny = 1e-300;
+    if (x <= 0 || a <= 0) {
+        return 1.0;
+    }
+    double log_prefix = -x + a * std::log(x) - std::lgamma(a);
+    if (x < a + 1) {
+        // Series expansion of P(a, x)
+        double term = 1.0 / a;
+        double sum = term;
+        for (double ap = a + 1; std::fabs(term) > std::fabs(sum) * eps; ap += 1) {
+            term *= x / ap;
+            sum += term;
+        }
+        return 1.0 - sum * std::exp(log_prefix);
+    }
+    // Continued fraction for Q(a, x), evaluated with the modified Lentz method
+    double b = x + 1 - a;
+    double c = 1 / tiny;
+    double d = 1 / b;
+    double h = d;
+    for (int i = 1; i < 100000; i++) {
+        double an = -i * (i - a);
+        b += 2;
+        d = an * d + b;
+        if (std::fabs(d) < tiny) {
+            d = tiny;
+        }
+        c = b + an / c;
+        if (std::fabs(c) < tiny) {
+            c = tiny;
+        }
+        d = 1 / d;
+        double delta = d * c;
+        h *= delta;
+        if (std::fabs(delta - 1) < eps) {
+            break;
+        }
+    }
+    return std::exp(log_prefix) * h;
+}
+
+size_t countOnes(const BitSequence& seq, unsigned threads) {
+    std::vector<size_t> partial(threads, 0);
+    parallelFor(seq.words.size(), threads, [&](size_t begin, size_t end, unsigned t) {
+        size_t ones = 0;
+        for (size_t i = begin; i < end; i++) {
+            ones += popcount64(seq.words[i]);
+        }
+        partial[t] = ones;
+    });
+    size_t ones = 0;
+    for (size_t count : partial) {
+        ones += count;
+    }
+    return ones;
+}
+
+NistResult frequencyTest(const BitSequence& seq, size_t ones) {
+    double s_obs = std::fabs(2.0 * ones - (double)seq.n) / std::sqrt((double)seq.n);
+    double p_value = std::erfc(s_obs / std::sqrt(2.0));
+    return { "Frequency", p_value, p_value >= NIST_ALPHA };
+}
+
+NistResult blockFrequencyTest(const BitSequence& seq, unsigned threads) {
+    // Block length is a whole number of words chosen so that M > 0.01n and there are fewer than 100 blocks
+    size_t words_per_block = std::max<size_t>(2, (seq.words.size() + 98) / 99);
+    size_t block_count = seq.words.size() / words_per_block;
+    double block_bits = 64.0 * words_per_block;
+
+    std::vector<double> partial(threads, 0);
+    parallelFor(block_count, threads, [&](size_t begin, size_t end, unsigned t) {
+        double sum = 0;
+        for (size_t block = begin; block < end; block++) {
+            size_t ones = 0;
+            const uint64_t* words = &seq.words[block * words_per_block];
+            for (size_t i = 0; i < words_per_block; i++) {
+                ones += popcount64(words[i]);
+            }
+            double pi = ones / block_bits - 0.5;
+            sum += pi * pi;
+        }
+        partial[t] = sum;
+    });
+    double chi_squared = 0;
+    for (double sum : partial) {
+        chi_squared += sum;
+    }
+    chi_squared *= 4.0 * block_bits;
+    double p_value = igamc(block_count / 2.0, chi_squared / 2.0);
+    return { "Block Frequency", p_value, p_value >= NIST_ALPHA };
+}
+
+NistResult runsTest(const BitSequence& seq, size_t ones, unsigned threads) {
+    double n = (double)seq.n;
+    double pi = ones / n;
+    if (std::fabs(pi - 0.5) >= 2.0 / std::sqrt(n)) {
+        return { "Runs", 0.0, false }; // frequency prerequisite failed
+    }
+
+    std::vector<size_t> partial(threads, 0);
+    parallelFor(seq.words.size(), threads, [&](size_t begin, size_t end, unsigned t) {
+        size_t transitions = 0;
+        for (size_t i = begin; i < end; i++) {
+            uint64_t word = seq.words[i];
+            // Each set bit marks a position that differs from its predecessor within the word
+            transitions += popcount64((word ^ (word << 1)) & ~1ULL);
+            if (i + 1 < seq.words.size()) {
+                transitions += (word & 1) != (seq.words[i + 1] >> 63);
+            }
+        }
+        partial[t] = transitions;
+    });
+    double v_obs = 1;
+    for (size_t transitions : partial) {
+        v_obs += transitions;
+    }
+    double p_value = std::erfc(std::fabs(v_obs - 2.0 * n * pi * (1 - pi)) / (2.0 * std::sqrt(2.0 * n) * pi * (1 - pi)));
+    return { "Runs", p_value, p_value >= NIST_ALPHA };
+}
+
+NistResult longestRunTest(const BitSequence& seq, unsigned threads) {
+    // Parameters from section 2.4.2, selected by sequence length
+    size_t block_bits;
+    int min_run;
+    std::vector<double> probabilities;
+    if (seq.n < 6272) {
+        block_bits = 8;
+        min_run = 1;
+        probabilities = { 0.2148, 0.3672, 0.2305, 0.1875 };
+    } else if (seq.n < 750000) {
+        block_bits = 128;
+        min_run = 4;
+        probabilities = { 0.1174, 0.2430, 0.2493, 0.1752, 0.1027, 0.1124 };
+    } else {
+        block_bits = 10000;
+        min_run = 10;
+        probabilities = { 0.0882, 0.2092, 0.2483, 0.1933, 0.1208, 0.0675, 0.0727 };
+    }
+    const int categories = (int)probabilities.size();
+
+    // Per-byte leading ones, trailing ones and longest internal run
+    static const auto byte_runs = []() {
+        std::vector<std::array<uint8_t, 3>> table(256);
+        for (int b = 0; b < 256; b++) {
+            int lead = 0, trail = 0, longest = 0, run = 0;
+            while (lead < 8 && (b & (0x80 >> lead))) {
+                lead++;
+            }
+            while (trail < 8 && (b & (1 << trail))) {
+                trail++;
+            }
+            for (int i = 7; i >= 0; i--) {
+                run = ((b >> i) & 1) ? run + 1 : 0;
+                longest = std::max(longest, run);
+            }
+            table[b] = { (uint8_t)lead, (uint8_t)trail, (uint8_t)longest };
+        }
+        return table;
+    }();
+
+    size_t block_bytes = block_bits / 8;
+    size_t block_count = seq.n / block_bits;
+    std::vector<std::vector<size_t>> partial(threads, std::vector<size_t>(categories, 0));
+    parallelFor(block_count, threads, [&](size_t begin, size_t end, unsigned t) {
+        for (size_t block = begin; block < end; block++) {
+            int longest = 0, run = 0;
+            for (size_t i = block * block_bytes; i < (block + 1) * block_bytes; i++) {
+                uint8_t byte = (seq.words[i / 8] >> (56 - 8 * (i % 8))) & 0xFF;
+                if (byte == 0xFF) {
+                    run += 8;
+                    continue;
+                }
+                const auto& runs = byte_runs[byte];
+                longest = std::max({ longest, run + runs[0], (int)runs[2] });
+                run = runs[1];
+            }
+            longest = std::max(longest, run);
+            int category = std::min(std::max(longest, min_run), min_run + categories - 1) - min_run;
+            partial[t][category]++;
+        }
+    });
+
+    double chi_squared = 0;
+    for (int c = 0; c < categories; c++) {
+        size_t observed = 0;
+        for (const auto& counts : partial) {
+            observed += counts[c];
+        }
+        double expected = block_count * probabilities[c];
+        chi_squared += (observed - expected) * (observed - expected) / expected;
+    }
+    double p_value = igamc((categories - 1) / 2.0, chi_squared / 2.0);
+    return { "Longest Run of Ones", p_value, p_value >= NIST_ALPHA };
+}
+
+NistResult spectralTest(const BitSequence& seq) {
+    // Radix-2 FFT over the longest power-of-two prefix of the sequence
+    size_t n = 1;
+    while (n * 2 <= std::min(seq.n, MAX_SPECTRAL_BITS)) {
+        n *= 2;
+    }
+    std::vector<std::complex<double>> x(n);
+    for (size_t i = 0, j = 0; i < n; i++) {
+        x[j] = seq.bit(i) ? 1.0 : -1.0;
+        // Bit-reversed increment of j
+        size_t mask = n >> 1;
+        while (j & mask) {
+            j ^= mask;
+            mask >>= 1;
+        }
+        j |= mask;
+    }
+    const double pi = std::acos(-1.0);
+    for (size_t len = 2; len <= n; len <<= 1) {
+        std::complex<double> step = std::polar(1.0, -2 * pi / len);
+        for (size_t i = 0; i < n; i += len) {
+            std::complex<double> w(1.0, 0.0);
+            for (size_t k = 0; k < len / 2; k++) {
+                std::complex<double> even = x[i + k];
+                std::complex<double> odd = x[i + k + len / 2] * w;
+                x[i + k] = even + odd;
+                x[i + k + len / 2] = even - odd;
+                w *= step;
+            }
+        }
+    }
+
+    double threshold = std::sqrt(std::log(1 / 0.05) * n);
+    double expected_below = 0.95 * n / 2.0;
+    size_t observed_below = 0;
+    for (size_t i = 0; i < n / 2; i++) {
+        observed_below += std::abs(x[i]) < threshold;
+    }
+    double d = (observed_below - expected_below) / std::sqrt(n * 0.95 * 0.05 / 4);
+    double p_value = std::erfc(std::fabs(d) / std::sqrt(2.0));
+    return { "Spectral (DFT)", p_value, p_value >= NIST_ALPHA };
+}
+
+NistResult approximateEntropyTest(const BitSequence& seq, unsigned threads) {
+    // Largest recommended block length (m < log2(n) - 5), capped at 10
+    int m = std::max(2, std::min(10, (int)std::floor(std::log2((double)seq.n)) - 6));
+    size_t patterns = (size_t)1 << (m + 1);
+    uint32_t mask = (uint32_t)patterns - 1;
+
+    // Count every overlapping (m+1)-bit window, wrapping around the end of the sequence.
+    // The m-bit window at the same position is the top m bits of the (m+1)-bit window.
+    std::vector<std::vector<uint64_t>> partial(threads, std::vector<uint64_t>(patterns, 0));
+    parallelFor(seq.n, threads, [&](size_t begin, size_t end, unsigned t) {
+        auto& counts = partial[t];
+        uint32_t window = 0;
+        for (int k = 0; k < m; k++) {
+            window = (window << 1) | seq.bit((begin + k) % seq.n);
+        }
+        for (size_t i = begin; i < end; i++) {
+            size_t next = i + m;
+            window = ((window << 1) | seq.bit(next < seq.n ? next : next - seq.n)) & mask;
+            counts[window]++;
+        }
+    });
+
+    std::vector<uint64_t> counts_m1(patterns, 0);
+    std::vector<uint64_t> counts_m(patterns / 2, 0);
+    for (const auto& counts : partial) {
+        for (size_t p = 0; p < patterns; p++) {
+            counts_m1[p] += counts[p];
+            counts_m[p >> 1] += counts[p];
+        }
+    }
+    auto phi = [&](const std::vector<uint64_t>& counts) {
+        double sum = 0;
+        for (uint64_t count : counts) {
+            if (count > 0) {
+                double frequency = (double)count / seq.n;
+                sum += frequency * std::log(frequency);
+            }
+        }
+        return sum;
+    };
+    double ap_en = phi(counts_m) - phi(counts_m1);
+    double chi_squared = 2.0 * seq.n * (std::log(2.0) - ap_en);
+    double p_value = igamc(std::pow(2.0, m - 1), chi_squared / 2.0);
+    return { "Approximate Entropy (m=" + std::to_string(m) + ")", p_value, p_value >= NIST_ALPHA };
+}
+
+std::vector<NistResult> cumulativeSumsTests(const BitSequence& seq, unsigned threads) {
+    // Per-byte net walk and extreme partial sums, for most and least significant bit first
+    struct ByteWalk {
+        int8_t net, max_prefix, min_prefix;
+    };
+    static const auto byte_walks = []() {
+        std::vector<std::array<ByteWalk, 2>> table(256);
+        for (int b = 0; b < 256; b++) {
+            for (int reversed = 0; reversed < 2; reversed++) {
+                int sum = 0, max_prefix = -8, min_prefix = 8;
+                for (int i = 0; i < 8; i++) {
+                    int bit = reversed ? (b >> i) & 1 : (b >> (7 - i)) & 1;
+                    sum += bit ? 1 : -1;
+                    max_prefix = std::max(max_prefix, sum);
+                    min_prefix = std::min(min_prefix, sum);
+                }
+                table[b][reversed] = { (int8_t)sum, (int8_t)max_prefix, (int8_t)min_prefix };
+            }
+        }
+        return table;
+    }();
+
+    struct Segment {
+        int64_t net = 0, max_prefix = 0, min_prefix = 0;
+    };
+    size_t byte_count = seq.n / 8;
+    auto byte_at = [&](size_t i) { return (uint8_t)((seq.words[i / 8] >> (56 - 8 * (i % 8))) & 0xFF); };
+
+    std::vector<NistResult> results;
+    for (int backward = 0; backward < 2; backward++) {
+        std::vector<Segment> segments(threads);
+        parallelFor(byte_count, threads, [&](size_t begin, size_t end, unsigned t) {
+            Segment segment;
+            for (size_t k = begin; k < end; k++) {
+                const ByteWalk& walk = byte_walks[byte_at(backward ? byte_count - 1 - k : k)][backward];
+                segment.max_prefix = std::max(segment.max_prefix, segment.net + walk.max_prefix);
+                segment.min_prefix = std::min(segment.min_prefix, segment.net + walk.min_prefix);
+                segment.net += walk.net;
+            }
+            segments[t] = segment;
+        });
+        int64_t sum = 0, sup = 0, inf = 0;
+        for (const Segment& segment : segments) {
+            sup = std::max(sup, sum + segment.max_prefix);
+            inf = std::min(inf, sum + segment.min_prefix);
+            sum += segment.net;
+        }
+
+        // Integer arithmetic for the summation bounds matches the reference implementation
+        long long n = (long long)seq.n;
+        long long z = std::max(sup, -inf);
+        double sqrt_n = std::sqrt((double)n);
+        double sum1 = 0, sum2 = 0;
+        for (long long k = (-n / z + 1) / 4; k <= (n / z - 1) / 4; k++) {
+            sum1 += normalCdf((4 * k + 1) * z / sqrt_n) - normalCdf((4 * k - 1) * z / sqrt_n);
+        }
+        for (long long k = (-n / z - 3) / 4; k <= (n / z - 1) / 4; k++) {
+            sum2 += normalCdf((4 * k + 3) * z / sqrt_n) - normalCdf((4 * k + 1) * z / sqrt_n);
+        }
+        double p_value = 1.0 - sum1 + sum2;
+        results.push_back({ backward ? "Cumulative Sums (backward)" : "Cumulative Sums (forward)",
+                            p_value, p_value >= NIST_ALPHA });
+    }
+    return results;
+}
+
+} // namespace
+
+std::vector<NistResult> runNistTests(const std::vector<uint8_t>& data, unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    BitSequence seq;
+    seq.words.resize(data.size() / 8);
+    seq.n = seq.words.size() * 64;
+    if (seq.words.size() < MIN_NIST_WORDS) {
+        throw std::invalid_argument("At least " + std::to_string(MIN_NIST_WORDS * 8) + " bytes are required for NIST testing");
+    }
+    parallelFor(seq.words.size(), threads, [&](size_t begin, size_t end, unsigned) {
+        for (size_t i = begin; i < end; i++) {
+            uint64_t word = 0;
+            for (size_t b = 0; b < 8; b++) {
+                word = (word << 8) | data[i * 8 + b];
+            }
+            seq.words[i] = word;
+        }
+    });
+
+    // The DFT is the only test that does not split across threads, so overlap it with the others
+    auto spectral = std::async(std::launch::async, spectralTest, std::cref(seq));
+
+    std::vector<NistResult> results;
+    size_t ones = countOnes(seq, threads);
+    results.push_back(frequencyTest(seq, ones));
+    results.push_back(blockFrequencyTest(seq, threads));
+    results.push_back(runsTest(seq, ones, threads));
+    results.push_back(longestRunTest(seq, threads));
+    results.push_back(spectral.get());
+    results.push_back(approximateEntropyTest(seq, threads));
+    for (auto& result : cumulativeSumsTests(seq, threads)) {
+        results.push_back(result);
+    }
+    return results;
+}
+
+void printNistResults(const std::vector<NistResult>& results) {
+    std::cout << std::left << std::setw(34) << "Test" << std::setw(12) << "P-value" << "Result" << std::endl;
+    for (const auto& result : results) {
+        std::cout << std::left << std::setw(34) << result.test_name
+                  << std::setw(12) << std::fixed << std::setprecision(6) << result.p_value
+                  << (result.passed ? "PASS" : "FAIL") << std::endl;
+    }
+    std::cout.unsetf(std::ios::fixed);
+}
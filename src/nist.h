@@ -0,0 +1,24 @@
+#ifndef NIST_H
+#define NIST_H
+
+#include <string>
+#include <vector>
+
+// Significance level used by NIST SP 800-22 to decide whether a sequence passes a test
+constexpr double NIST_ALPHA = 0.01;
+
+struct NistResult {
+    std::string test_name;
+    double p_value;
+    bool passed;
+};
+
+// Run the frequency, block frequency, runs, longest run, spectral, approximate entropy and
+// cumulative sums tests from NIST SP 800-22 Rev 1a over the bits of data (most significant bit first).
+// Bytes that do not fill a whole 64-bit word at the end of data are ignored.
+// threads = 0 uses every available core.
+std::vector<NistResult> runNistTests(const std::vector<uint8_t>& data, unsigned threads = 0);
+
+void printNistResults(const std::vector<NistResult>& results);
+
+#endif /* NIST_H */
@@ -0,0 +1,66 @@
+#include "common.h"
+#include "offline_keygen.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+const char OfflineMetadataMagic[8] = {'Q', 'R', 'Y', 'P', 'T', 'O', 'F', 'F'};
+const size_t OfflineSeedLength = 32;
+const size_t OfflineMetadataLength = sizeof(OfflineMetadataMagic) + OfflineSeedLength + sizeof(uint64_t);
+
+// Expand the seed to key_size bytes with SHAKE256
+std::vector<uint8_t> expandSeed(const uint8_t* seed, size_t key_size) {
+    std::unique_ptr<EVP_MD_CTX, decltype(&::EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), ::EVP_MD_CTX_free);
+    if (ctx == nullptr) {
+        throw std::runtime_error("EVP_MD_CTX_new() returned NULL!");
+    }
+    std::vector<uint8_t> key(key_size);
+    if (EVP_DigestInit_ex(ctx.get(), EVP_shake256(), nullptr) != OPENSSL_SUCCESS ||
+        EVP_DigestUpdate(ctx.get(), seed, OfflineSeedLength) != OPENSSL_SUCCESS ||
+        EVP_DigestFinalXOF(ctx.get(), key.data(), key.size()) != OPENSSL_SUCCESS) {
+        throw std::runtime_error("SHAKE256 key expansion failed!");
+    }
+    return key;
+}
+
+} // namespace
+
+QryptSecurity::SymmetricKeyData OfflineKeyGen::genInit(size_t key_size) {
+    if (key_size == 0) {
+        throw std::invalid_argument("Key size must be greater than zero");
+    }
+
+    // Metadata: magic, seed, key size (little endian)
+    std::vector<uint8_t> metadata(OfflineMetadataLength);
+    memcpy(metadata.data(), OfflineMetadataMagic, sizeof(OfflineMetadataMagic));
+    uint8_t* seed = metadata.data() + sizeof(OfflineMetadataMagic);
+    if (RAND_bytes(seed, OfflineSeedLength) != OPENSSL_SUCCESS) {
+        throw std::runtime_error("RAND_bytes() failed!");
+    }
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        metadata[OfflineMetadataLength - sizeof(uint64_t) + i] = (uint8_t)((uint64_t)key_size >> (8 * i));
+    }
+
+    QryptSecurity::SymmetricKeyData key_and_metadata = {};
+    key_and_metadata.key = expandSeed(seed, key_size);
+    key_and_metadata.metadata = metadata;
+    return key_and_metadata;
+}
+
+std::vector<uint8_t> OfflineKeyGen::genSync(const std::vector<uint8_t>& metadata) {
+    if (metadata.size() != OfflineMetadataLength ||
+        memcmp(metadata.data(), OfflineMetadataMagic, sizeof(OfflineMetadataMagic)) != 0) {
+        throw std::invalid_argument("Metadata was not produced by the offline key generator");
+    }
+    uint64_t key_size = 0;
+    for (size_t i = 0; i < sizeof(uint64_t); i++) {
+        key_size |= (uint64_t)metadata[OfflineMetadataLength - sizeof(uint64_t) + i] << (8 * i);
+    }
+    return expandSeed(metadata.data() + sizeof(OfflineMetadataMagic), key_size);
+}
@@ -0,0 +1,18 @@
+#ifndef OFFLINE_KEYGEN_H
+#define OFFLINE_KEYGEN_H
+
+#include "QryptSecurity/qryptsecurity.h"
+
+#include <string>
+#include <vector>
+
+// Stand-in for the BLAST key generation in the Qrypt SDK, with the same genInit()/genSync() flow but
+// no network access, for benchmarks and tests. The metadata carries the seed that the key is expanded
+// from, so anyone holding it can recreate the key. Never use it for keys that protect real data.
+class OfflineKeyGen {
+public:
+    QryptSecurity::SymmetricKeyData genInit(size_t key_size);
+    std::vector<uint8_t> genSync(const std::vector<uint8_t>& metadata);
+};
+
+#endif /* OFFLINE_KEYGEN_H */
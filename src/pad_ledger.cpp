@@ -0,0 +1,57 @@
+#include "pad_ledger.h"
+#include "file_lock.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+static const char* LedgerComment = "# qrypt one-time-pad ledger. Bytes before \"consumed\" have been used; do not edit.";
+
+PadLedger::PadLedger(const std::string& ledger_filename, uint64_t pad_size) :
+                     ledger_filename(ledger_filename), pad_size(pad_size) {}
+
+uint64_t PadLedger::consumed() const {
+    std::ifstream ledger(ledger_filename);
+    if (!ledger.is_open()) {
+        return 0;
+    }
+    uint64_t recorded_pad_size = pad_size, consumed = 0;
+    std::string line;
+    while (std::getline(ledger, line)) {
+        std::istringstream fields(line);
+        std::string name;
+        fields >> name;
+        if (name == "pad_size") {
+            fields >> recorded_pad_size;
+        }
+        else if (name == "consumed") {
+            fields >> consumed;
+        }
+        if (!name.empty() && name[0] != '#' && fields.fail()) {
+            throw std::runtime_error("Pad ledger " + ledger_filename + " is corrupt.");
+        }
+    }
+    if (recorded_pad_size != pad_size) {
+        throw std::runtime_error("Pad ledger " + ledger_filename + " is for a pad of " +
+                                 std::to_string(recorded_pad_size) + " bytes, but the key file has " +
+                                 std::to_string(pad_size) + " bytes.");
+    }
+    return consumed;
+}
+
+PadRange PadLedger::reserve(uint64_t length) {
+    FileLock lock(ledger_filename);
+    uint64_t offset = consumed();
+    if (offset > pad_size || length > pad_size - offset) {
+        throw std::invalid_argument("One-time-pad has " + std::to_string(pad_size - std::min(offset, pad_size)) +
+                                    " unused bytes left, but " + std::to_string(length) + " are needed.");
+    }
+    replaceFile(ledger_filename, std::string(LedgerComment) + "\npad_size " + std::to_string(pad_size) +
+                                 "\nconsumed " + std::to_string(offset + length) + "\n");
+    return { offset, length };
+}
+
+std::string padLedgerFilename(const std::string& key_filename) {
+    return key_filename + ".ledger";
+}
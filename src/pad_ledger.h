@@ -0,0 +1,34 @@
+#ifndef PAD_LEDGER_H
+#define PAD_LEDGER_H
+
+#include "encrypt.h"
+
+#include <cstdint>
+#include <string>
+
+// Hands out successive, non-overlapping ranges of one large one-time-pad, so that a single key generation
+// covers many messages. The bytes used so far are recorded in a sidecar file next to the pad. Each
+// reservation is written to disk before any of its bytes are used, so a crash can waste pad bytes but
+// never lets them be used twice.
+class PadLedger {
+public:
+    // pad_size is the length of the pad in bytes, see keySize()
+    PadLedger(const std::string& ledger_filename, uint64_t pad_size);
+
+    // Mark the next length bytes of the pad as used and return them. Safe across processes.
+    // Throws if fewer than length bytes are left.
+    PadRange reserve(uint64_t length);
+
+    // Bytes of the pad used so far
+    uint64_t consumed() const;
+    uint64_t padSize() const { return pad_size; }
+
+private:
+    std::string ledger_filename;
+    uint64_t pad_size;
+};
+
+// The sidecar file for the pad in key_filename
+std::string padLedgerFilename(const std::string& key_filename);
+
+#endif /* PAD_LEDGER_H */
@@ -0,0 +1,254 @@
+#include "common.h"
+#include "drbg.h"
+#include "eaas.h"
+#include "encrypt.h"
+#include "metrics.h"
+#include "qrypt_core.h"
+#include "sdk_loader.h"
+
+#include <cstring>
+#include <memory>
+
+struct qrypt_keygen {
+    std::unique_ptr<SdkClient> sdk_client;
+
+    // Result of a call that returned QRYPT_ERROR_BUFFER_TOO_SMALL, and the arguments it was made with,
+    // tagged 'G' for generate or 'R' for replicate
+    bool has_pending = false;
+    std::vector<uint8_t> pending_request;
+    QryptSecurity::SymmetricKeyData pending;
+};
+
+namespace {
+
+thread_local std::string last_error;
+
+qrypt_status fail(qrypt_status status, const std::string& message) {
+    last_error = message;
+    return status;
+}
+
+// Translate C++ exceptions into status codes at the API boundary
+template <typename Fn>
+qrypt_status guard(Fn fn) {
+    try {
+        return fn();
+    }
+    catch (const SdkError& ex) {
+        return fail(QRYPT_ERROR_SDK, ex.what());
+    }
+    catch (const std::invalid_argument& ex) {
+        return fail(QRYPT_ERROR_INVALID_ARGUMENT, ex.what());
+    }
+    catch (const std::exception& ex) {
+        return fail(QRYPT_ERROR_FAILED, ex.what());
+    }
+    catch (...) {
+        return fail(QRYPT_ERROR_FAILED, "Unknown error");
+    }
+}
+
+// Copy a result to a caller buffer, or report the size needed
+bool copyOut(const std::vector<uint8_t>& result, uint8_t* out, size_t capacity, size_t* out_len) {
+    *out_len = result.size();
+    if (capacity < result.size()) {
+        return false;
+    }
+    if (!result.empty()) {
+        memcpy(out, result.data(), result.size());
+    }
+    return true;
+}
+
+// Encrypts or decrypts straight into the caller's buffer, without allocating
+qrypt_status crypt(bool encrypt, qrypt_key_type key_type, qrypt_aes_mode aes_mode,
+                   const uint8_t* key, size_t key_len, const uint8_t* input, size_t input_len,
+                   uint8_t* output, size_t output_capacity, size_t* output_len) {
+    return guard([&]() {
+        if ((key == nullptr && key_len > 0) || (input == nullptr && input_len > 0) || output_len == nullptr) {
+            throw std::invalid_argument("Null buffer");
+        }
+        if (key_type != QRYPT_KEY_OTP && key_type != QRYPT_KEY_AES) {
+            throw std::invalid_argument("Invalid key type");
+        }
+        if (aes_mode != QRYPT_AES_OCB && aes_mode != QRYPT_AES_ECB) {
+            throw std::invalid_argument("Invalid aes mode");
+        }
+        if (key_type == QRYPT_KEY_AES && key_len != AESKeyLengthInBytes) {
+            throw std::invalid_argument("AES-256 key is invalid. The key is not the correct size.");
+        }
+        if (key_type == QRYPT_KEY_OTP && key_len != input_len) {
+            throw std::invalid_argument("One-time-pad is invalid. The key must be the same length as the data.");
+        }
+
+        // Check the output size before doing any work
+        size_t needed = encrypt ? qrypt_encrypted_size(key_type, aes_mode, input_len)
+                                : qrypt_decrypted_size_max(key_type, aes_mode, input_len);
+        if (output_capacity < needed) {
+            *output_len = needed;
+            return fail(QRYPT_ERROR_BUFFER_TOO_SMALL, "Output buffer is too small");
+        }
+
+        ByteSpan key_span(key, key_len), input_span(input, input_len);
+        MutableByteSpan output_span(output, output_capacity);
+        if (key_type == QRYPT_KEY_OTP) {
+            *output_len = xorBytes(key_span, input_span, output_span);
+            countCryptBytes(encrypt, "otp", input_len);
+        }
+        else if (aes_mode == QRYPT_AES_ECB) {
+            *output_len = encrypt ? encryptAES256ECB(key_span, input_span, output_span)
+                                  : decryptAES256ECB(key_span, input_span, output_span);
+        }
+        else {
+            *output_len = encrypt ? encryptAES256OCB(key_span, input_span, output_span)
+                                  : decryptAES256OCB(key_span, input_span, output_span);
+        }
+        return QRYPT_OK;
+    });
+}
+
+} // namespace
+
+const char* qrypt_last_error(void) {
+    return last_error.c_str();
+}
+
+size_t qrypt_encrypted_size(qrypt_key_type key_type, qrypt_aes_mode aes_mode, size_t plaintext_len) {
+    return (size_t)encryptedSize(plaintext_len, aes_mode == QRYPT_AES_ECB ? "ecb" : "ocb",
+                                 key_type == QRYPT_KEY_AES ? "aes" : "otp");
+}
+
+size_t qrypt_decrypted_size_max(qrypt_key_type key_type, qrypt_aes_mode aes_mode, size_t ciphertext_len) {
+    if (key_type == QRYPT_KEY_AES && aes_mode == QRYPT_AES_OCB) {
+        return ciphertext_len > AETagSizeInBytes ? ciphertext_len - AETagSizeInBytes : 0;
+    }
+    return ciphertext_len;
+}
+
+qrypt_status qrypt_encrypt(qrypt_key_type key_type, qrypt_aes_mode aes_mode, const uint8_t* key, size_t key_len,
+                           const uint8_t* plaintext, size_t plaintext_len,
+                           uint8_t* ciphertext, size_t ciphertext_capacity, size_t* ciphertext_len) {
+    return crypt(true, key_type, aes_mode, key, key_len, plaintext, plaintext_len,
+                 ciphertext, ciphertext_capacity, ciphertext_len);
+}
+
+qrypt_status qrypt_decrypt(qrypt_key_type key_type, qrypt_aes_mode aes_mode, const uint8_t* key, size_t key_len,
+                           const uint8_t* ciphertext, size_t ciphertext_len,
+                           uint8_t* plaintext, size_t plaintext_capacity, size_t* plaintext_len) {
+    return crypt(false, key_type, aes_mode, key, key_len, ciphertext, ciphertext_len,
+                 plaintext, plaintext_capacity, plaintext_len);
+}
+
+qrypt_status qrypt_keygen_create(const char* token, const char* ca_cert_path, qrypt_keygen** keygen) {
+    return guard([&]() {
+        if (token == nullptr || keygen == nullptr) {
+            throw std::invalid_argument("Null argument");
+        }
+        auto handle = std::make_unique<qrypt_keygen>();
+        handle->sdk_client = std::make_unique<SdkClient>(token, ca_cert_path);
+        *keygen = handle.release();
+        return QRYPT_OK;
+    });
+}
+
+void qrypt_keygen_free(qrypt_keygen* keygen) {
+    delete keygen;
+}
+
+qrypt_status qrypt_keygen_generate(qrypt_keygen* keygen, qrypt_key_type key_type, size_t key_len_request,
+                                   uint32_t ttl_seconds, uint8_t* key, size_t key_capacity, size_t* key_len,
+                                   uint8_t* metadata, size_t metadata_capacity, size_t* metadata_len) {
+    return guard([&]() {
+        if (keygen == nullptr || key_len == nullptr || metadata_len == nullptr) {
+            throw std::invalid_argument("Null argument");
+        }
+        if (key_type != QRYPT_KEY_OTP && key_type != QRYPT_KEY_AES) {
+            throw std::invalid_argument("Invalid key type");
+        }
+        size_t key_size = key_type == QRYPT_KEY_AES ? QryptSecurity::AES_256_SIZE : key_len_request;
+
+        // Reuse a key that did not fit last time, if this is the same request
+        std::vector<uint8_t> request(1 + sizeof(key_size) + sizeof(ttl_seconds), 'G');
+        memcpy(request.data() + 1, &key_size, sizeof(key_size));
+        memcpy(request.data() + 1 + sizeof(key_size), &ttl_seconds, sizeof(ttl_seconds));
+        if (!keygen->has_pending || keygen->pending_request != request) {
+            keygen->pending = keygen->sdk_client->genInit(key_size, ttl_seconds);
+            keygen->pending_request = request;
+        }
+
+        bool key_fits = copyOut(keygen->pending.key, key, key_capacity, key_len);
+        bool metadata_fits = copyOut(keygen->pending.metadata, metadata, metadata_capacity, metadata_len);
+        keygen->has_pending = !(key_fits && metadata_fits);
+        if (keygen->has_pending) {
+            return fail(QRYPT_ERROR_BUFFER_TOO_SMALL, "Key or metadata buffer is too small");
+        }
+        keygen->pending = {};
+        return QRYPT_OK;
+    });
+}
+
+qrypt_status qrypt_keygen_replicate(qrypt_keygen* keygen, const uint8_t* metadata, size_t metadata_len,
+                                    uint8_t* key, size_t key_capacity, size_t* key_len) {
+    return guard([&]() {
+        if (keygen == nullptr || metadata == nullptr || key_len == nullptr) {
+            throw std::invalid_argument("Null argument");
+        }
+        std::vector<uint8_t> request(1, 'R');
+        request.insert(request.end(), metadata, metadata + metadata_len);
+        if (!keygen->has_pending || keygen->pending_request != request) {
+            keygen->pending = {};
+            keygen->pending.key = keygen->sdk_client->genSync(std::vector<uint8_t>(metadata, metadata + metadata_len));
+            keygen->pending_request = request;
+        }
+
+        keygen->has_pending = !copyOut(keygen->pending.key, key, key_capacity, key_len);
+        if (keygen->has_pending) {
+            return fail(QRYPT_ERROR_BUFFER_TOO_SMALL, "Key buffer is too small");
+        }
+        keygen->pending = {};
+        return QRYPT_OK;
+    });
+}
+
+qrypt_status qrypt_entropy(const char* token, uint32_t size_kb,
+                           uint8_t* entropy, size_t entropy_capacity, size_t* entropy_len) {
+    return guard([&]() {
+        if (token == nullptr || entropy_len == nullptr) {
+            throw std::invalid_argument("Null argument");
+        }
+        if (size_kb < 1 || size_kb > 512) {
+            throw std::invalid_argument("Entropy request size must be between 1 and 512 KB");
+        }
+        // EaaS returns exactly the size requested, so check the buffer before the request is made
+        if (entropy_capacity < (size_t)size_kb * 1024) {
+            *entropy_len = (size_t)size_kb * 1024;
+            return fail(QRYPT_ERROR_BUFFER_TOO_SMALL, "Entropy buffer is too small");
+        }
+        EaaS eaas_client(token);
+        std::vector<uint8_t> bytes = EaaS::decodeEntropy(eaas_client.requestEntropy(size_kb));
+        if (!copyOut(bytes, entropy, entropy_capacity, entropy_len)) {
+            return fail(QRYPT_ERROR_BUFFER_TOO_SMALL, "Entropy buffer is too small");
+        }
+        return QRYPT_OK;
+    });
+}
+
+qrypt_status qrypt_random_init(const char* token, uint64_t reseed_bytes) {
+    return guard([&]() {
+        if (token == nullptr) {
+            throw std::invalid_argument("Null argument");
+        }
+        setRandomSource(eaasEntropySource(token), reseed_bytes ? reseed_bytes : DEFAULT_RESEED_BYTES);
+        return QRYPT_OK;
+    });
+}
+
+qrypt_status qrypt_random_bytes(uint8_t* out, size_t out_len) {
+    return guard([&]() {
+        if (out == nullptr && out_len > 0) {
+            throw std::invalid_argument("Null argument");
+        }
+        randomBytes(out, out_len);
+        return QRYPT_OK;
+    });
+}
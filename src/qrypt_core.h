@@ -0,0 +1,99 @@
+#ifndef QRYPT_CORE_H
+#define QRYPT_CORE_H
+
+/*
+ * C API of the qrypt_core library, for calling keygen, encryption and EaaS in-process from other
+ * languages and programs. Every function works on buffers owned by the caller: outputs are written to
+ * the buffer passed in and nothing returned by the library has to be freed, except keygen handles.
+ *
+ * Functions return QRYPT_OK on success. On failure, qrypt_last_error() describes the error that was
+ * most recently returned on the calling thread. When an output buffer is too small, the function
+ * returns QRYPT_ERROR_BUFFER_TOO_SMALL and sets the *_len outputs to the sizes that are needed.
+ *
+ * Functions without a handle are thread-safe. A keygen handle must not be used by two threads at once.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && !defined(QRYPT_CORE_STATIC)
+#if defined(QRYPT_CORE_BUILD)
+#define QRYPT_CORE_API __declspec(dllexport)
+#else
+#define QRYPT_CORE_API __declspec(dllimport)
+#endif
+#else
+#define QRYPT_CORE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    QRYPT_OK = 0,
+    QRYPT_ERROR_INVALID_ARGUMENT = 1,
+    QRYPT_ERROR_BUFFER_TOO_SMALL = 2,
+    QRYPT_ERROR_SDK = 3,             /* the Qrypt SDK failed, e.g. keygen metadata has expired */
+    QRYPT_ERROR_FAILED = 4           /* any other failure, e.g. a ciphertext that fails authentication */
+} qrypt_status;
+
+typedef enum {
+    QRYPT_KEY_OTP = 0,
+    QRYPT_KEY_AES = 1
+} qrypt_key_type;
+
+typedef enum {
+    QRYPT_AES_OCB = 0,
+    QRYPT_AES_ECB = 1                /* legacy, for demonstrations only */
+} qrypt_aes_mode;
+
+QRYPT_CORE_API const char* qrypt_last_error(void);
+
+/* Encryption with a binary AES-256 key or one-time-pad. The ciphertext format is the same as that of
+ * "qrypt encrypt", so either side may be the CLI. aes_mode is ignored for one-time-pads, whose length
+ * must equal the data length. */
+QRYPT_CORE_API size_t qrypt_encrypted_size(qrypt_key_type key_type, qrypt_aes_mode aes_mode, size_t plaintext_len);
+QRYPT_CORE_API size_t qrypt_decrypted_size_max(qrypt_key_type key_type, qrypt_aes_mode aes_mode, size_t ciphertext_len);
+
+QRYPT_CORE_API qrypt_status qrypt_encrypt(qrypt_key_type key_type, qrypt_aes_mode aes_mode,
+                                          const uint8_t* key, size_t key_len,
+                                          const uint8_t* plaintext, size_t plaintext_len,
+                                          uint8_t* ciphertext, size_t ciphertext_capacity, size_t* ciphertext_len);
+QRYPT_CORE_API qrypt_status qrypt_decrypt(qrypt_key_type key_type, qrypt_aes_mode aes_mode,
+                                          const uint8_t* key, size_t key_len,
+                                          const uint8_t* ciphertext, size_t ciphertext_len,
+                                          uint8_t* plaintext, size_t plaintext_capacity, size_t* plaintext_len);
+
+/* BLAST distributed key generation through the Qrypt SDK. ca_cert_path may be NULL.
+ * If qrypt_keygen_generate() or qrypt_keygen_replicate() returns QRYPT_ERROR_BUFFER_TOO_SMALL, the
+ * result is kept by the handle, and calling again with the same arguments and larger buffers returns
+ * that same key instead of generating another one. */
+typedef struct qrypt_keygen qrypt_keygen;
+
+QRYPT_CORE_API qrypt_status qrypt_keygen_create(const char* token, const char* ca_cert_path, qrypt_keygen** keygen);
+QRYPT_CORE_API void qrypt_keygen_free(qrypt_keygen* keygen);
+
+/* key_len_request is the one-time-pad length and is ignored for AES-256 keys */
+QRYPT_CORE_API qrypt_status qrypt_keygen_generate(qrypt_keygen* keygen, qrypt_key_type key_type,
+                                                  size_t key_len_request, uint32_t ttl_seconds,
+                                                  uint8_t* key, size_t key_capacity, size_t* key_len,
+                                                  uint8_t* metadata, size_t metadata_capacity, size_t* metadata_len);
+QRYPT_CORE_API qrypt_status qrypt_keygen_replicate(qrypt_keygen* keygen, const uint8_t* metadata, size_t metadata_len,
+                                                   uint8_t* key, size_t key_capacity, size_t* key_len);
+
+/* Request size_kb KB (1 to 512) of quantum entropy from Qrypt EaaS */
+QRYPT_CORE_API qrypt_status qrypt_entropy(const char* token, uint32_t size_kb,
+                                          uint8_t* entropy, size_t entropy_capacity, size_t* entropy_len);
+
+/* Random bytes from an AES-256 CTR_DRBG (NIST SP 800-90A) on each calling thread, seeded with EaaS entropy and
+ * reseeded after every reseed_bytes of output, or every 1 GB when reseed_bytes is 0. qrypt_random_init() must be
+ * called before qrypt_random_bytes(); calling it again makes every thread reseed from the new token. */
+QRYPT_CORE_API qrypt_status qrypt_random_init(const char* token, uint64_t reseed_bytes);
+QRYPT_CORE_API qrypt_status qrypt_random_bytes(uint8_t* out, size_t out_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* QRYPT_CORE_H */
@@ -0,0 +1,115 @@
+#include "sdk_loader.h"
+#include "sdk_module.h"
+#include "trace.h"
+
+#include <cstdlib>
+#include <filesystem>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const size_t ERROR_SIZE = 512;
+
+#ifndef _WIN32
+const qrypt_sdk_module_t* loadModule() {
+    TRACE_SCOPE("load SDK module");
+    std::string path;
+    if (const char* env = getenv("QRYPT_SDK_MODULE")) {
+        path = env;
+    }
+    else {
+        // Next to the executable or library this code was linked into
+        Dl_info info;
+        if (dladdr((void*)&loadModule, &info) != 0 && info.dli_fname != nullptr) {
+            fs::path candidate = fs::path(info.dli_fname).parent_path() / QRYPT_SDK_MODULE_NAME;
+            if (fs::exists(candidate)) {
+                path = candidate.string();
+            }
+        }
+        if (path.empty()) {
+            path = QRYPT_SDK_MODULE_NAME;
+        }
+    }
+
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        throw std::runtime_error("Unable to load the Qrypt SDK module: " + std::string(dlerror()));
+    }
+    auto entry = (qrypt_sdk_module_fn)dlsym(handle, QRYPT_SDK_MODULE_ENTRY);
+    const qrypt_sdk_module_t* module = entry ? entry() : nullptr;
+    if (module == nullptr || module->version != QRYPT_SDK_MODULE_VERSION) {
+        dlclose(handle);
+        throw std::runtime_error(path + " is not a compatible Qrypt SDK module.");
+    }
+    // Kept open for the life of the process
+    return module;
+}
+#endif
+
+const qrypt_sdk_module_t& sdkModule() {
+#ifndef _WIN32
+    // A failed load throws out of the initializer, so the next call tries again
+    static const qrypt_sdk_module_t* module = loadModule();
+    return *module;
+#else
+    return *qrypt_sdk_module();
+#endif
+}
+
+void check(qrypt_sdk_status status, const char* error) {
+    if (status == QRYPT_SDK_ERROR) {
+        throw SdkError(error);
+    }
+    if (status != QRYPT_SDK_OK) {
+        throw std::runtime_error(error);
+    }
+}
+
+// Take ownership of a buffer returned by the module
+std::vector<uint8_t> takeBuffer(uint8_t* buffer, size_t len) {
+    std::vector<uint8_t> result(buffer, buffer + len);
+    sdkModule().free_buffer(buffer);
+    return result;
+}
+
+} // namespace
+
+SdkClient::SdkClient(const std::string& token, const char* ca_cert_path) {
+    char error[ERROR_SIZE] = "";
+    check(sdkModule().create(token.c_str(), ca_cert_path, &client, error, sizeof(error)), error);
+}
+
+SdkClient::~SdkClient() {
+    if (client) {
+        sdkModule().destroy(client);
+    }
+}
+
+QryptSecurity::SymmetricKeyData SdkClient::genInit(size_t key_size, uint32_t ttl_seconds) {
+    char error[ERROR_SIZE] = "";
+    uint8_t *key = nullptr, *metadata = nullptr;
+    size_t key_len = 0, metadata_len = 0;
+    check(sdkModule().gen_init(client, key_size, ttl_seconds, &key, &key_len, &metadata, &metadata_len,
+                               error, sizeof(error)), error);
+    QryptSecurity::SymmetricKeyData key_and_metadata = {};
+    key_and_metadata.key = takeBuffer(key, key_len);
+    key_and_metadata.metadata = takeBuffer(metadata, metadata_len);
+    return key_and_metadata;
+}
+
+std::vector<uint8_t> SdkClient::genSync(const std::vector<uint8_t>& metadata) {
+    char error[ERROR_SIZE] = "";
+    uint8_t* key = nullptr;
+    size_t key_len = 0;
+    check(sdkModule().gen_sync(client, metadata.data(), metadata.size(), &key, &key_len, error, sizeof(error)), error);
+    return takeBuffer(key, key_len);
+}
+
+void setSdkLogLevel(QryptSecurity::LogLevel log_level) {
+    sdkModule().set_log_level((int)log_level);
+}
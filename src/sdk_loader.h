@@ -0,0 +1,46 @@
+#ifndef SDK_LOADER_H
+#define SDK_LOADER_H
+
+#include "QryptSecurity/qryptsecurity.h"
+#include "QryptSecurity/qryptsecurity_logging.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// The Qrypt SDK is loaded the first time a key generation client is created, through the qrypt_sdk module (see
+// sdk_module.h), rather than linked, so commands that never generate keys start without it. The module is
+// found at the path in the QRYPT_SDK_MODULE environment variable, else next to the qrypt executable or
+// libqrypt_core, else on the library search path. On Windows the module is built in and QryptSecurity.dll is
+// delay-loaded instead.
+
+// Thrown for an error reported by the Qrypt SDK
+class SdkError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+struct qrypt_sdk_client;
+
+// BLAST key generation client of the Qrypt SDK
+class SdkClient {
+public:
+    // ca_cert_path may be nullptr
+    SdkClient(const std::string& token, const char* ca_cert_path);
+    ~SdkClient();
+    SdkClient(const SdkClient&) = delete;
+    SdkClient& operator=(const SdkClient&) = delete;
+
+    // ttl_seconds defaults to the SDK's own default key time-to-live
+    QryptSecurity::SymmetricKeyData genInit(size_t key_size,
+                                            uint32_t ttl_seconds = QryptSecurity::KeyConfiguration().ttl);
+    std::vector<uint8_t> genSync(const std::vector<uint8_t>& metadata);
+
+private:
+    qrypt_sdk_client* client = nullptr;
+};
+
+void setSdkLogLevel(QryptSecurity::LogLevel log_level);
+
+#endif /* SDK_LOADER_H */
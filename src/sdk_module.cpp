@@ -0,0 +1,119 @@
+#include "sdk_module.h"
+
+#include "QryptSecurity/qryptsecurity.h"
+#include "QryptSecurity/qryptsecurity_exceptions.h"
+#include "QryptSecurity/qryptsecurity_logging.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+struct qrypt_sdk_client {
+    std::unique_ptr<QryptSecurity::IKeyGenDistributedClient> sdk_client;
+};
+
+namespace {
+
+void setError(char* error, size_t error_size, const char* message) {
+    if (error_size > 0) {
+        strncpy(error, message, error_size - 1);
+        error[error_size - 1] = '\0';
+    }
+}
+
+// No exception may cross the C interface
+template <typename Fn>
+qrypt_sdk_status guard(char* error, size_t error_size, Fn fn) {
+    try {
+        fn();
+        return QRYPT_SDK_OK;
+    }
+    catch (const QryptSecurity::QryptSecurityException& ex) {
+        setError(error, error_size, ex.what());
+        return QRYPT_SDK_ERROR;
+    }
+    catch (const std::exception& ex) {
+        setError(error, error_size, ex.what());
+        return QRYPT_SDK_FAILED;
+    }
+    catch (...) {
+        setError(error, error_size, "Unknown error");
+        return QRYPT_SDK_FAILED;
+    }
+}
+
+// Copy a result into a buffer owned by the caller until it calls freeBuffer()
+void copyOut(const std::vector<uint8_t>& result, uint8_t** out, size_t* out_len) {
+    *out = (uint8_t*)malloc(result.empty() ? 1 : result.size());
+    if (*out == nullptr) {
+        throw std::bad_alloc();
+    }
+    if (!result.empty()) {
+        memcpy(*out, result.data(), result.size());
+    }
+    *out_len = result.size();
+}
+
+void setLogLevel(int level) {
+    QryptSecurity::setLogLevel((QryptSecurity::LogLevel)level);
+}
+
+qrypt_sdk_status create(const char* token, const char* ca_cert_path, qrypt_sdk_client** client,
+                        char* error, size_t error_size) {
+    return guard(error, error_size, [&]() {
+        auto handle = std::make_unique<qrypt_sdk_client>();
+        handle->sdk_client = QryptSecurity::IKeyGenDistributedClient::create();
+        if (ca_cert_path == nullptr) {
+            handle->sdk_client->initialize(token);
+        }
+        else {
+            QryptSecurity::ClientConfiguration clientConfig = {};
+            clientConfig.caCertPath = ca_cert_path;
+            handle->sdk_client->initialize(token, clientConfig);
+        }
+        *client = handle.release();
+    });
+}
+
+void destroy(qrypt_sdk_client* client) {
+    delete client;
+}
+
+qrypt_sdk_status genInit(qrypt_sdk_client* client, size_t key_size, uint32_t ttl_seconds, uint8_t** key,
+                         size_t* key_len, uint8_t** metadata, size_t* metadata_len, char* error, size_t error_size) {
+    *key = *metadata = nullptr;
+    qrypt_sdk_status status = guard(error, error_size, [&]() {
+        QryptSecurity::SymmetricKeyData key_and_metadata =
+            client->sdk_client->genInit(key_size, QryptSecurity::KeyConfiguration(ttl_seconds));
+        copyOut(key_and_metadata.key, key, key_len);
+        copyOut(key_and_metadata.metadata, metadata, metadata_len);
+    });
+    if (status != QRYPT_SDK_OK) {
+        free(*key);
+        *key = nullptr;
+    }
+    return status;
+}
+
+qrypt_sdk_status genSync(qrypt_sdk_client* client, const uint8_t* metadata, size_t metadata_len, uint8_t** key,
+                         size_t* key_len, char* error, size_t error_size) {
+    *key = nullptr;
+    return guard(error, error_size, [&]() {
+        copyOut(client->sdk_client->genSync(std::vector<uint8_t>(metadata, metadata + metadata_len)), key, key_len);
+    });
+}
+
+void freeBuffer(uint8_t* buffer) {
+    free(buffer);
+}
+
+const qrypt_sdk_module_t module = {
+    QRYPT_SDK_MODULE_VERSION, setLogLevel, create, destroy, genInit, genSync, freeBuffer
+};
+
+} // namespace
+
+const qrypt_sdk_module_t* qrypt_sdk_module(void) {
+    return &module;
+}
@@ -0,0 +1,56 @@
+#ifndef SDK_MODULE_H
+#define SDK_MODULE_H
+
+/*
+ * C interface of the qrypt_sdk module, the only part of qrypt that links the Qrypt SDK. qrypt and
+ * libqrypt_core open the module with dlopen the first time key generation is needed (see sdk_loader.h), so
+ * commands such as encrypt, decrypt and entropy never load the SDK and its dependencies. A C interface keeps
+ * the module independent of the C++ runtime of whatever opens it.
+ *
+ * Functions that fail write a NUL-terminated message to error, which holds error_size bytes. Buffers
+ * returned through key and metadata are allocated by the module and must be released with free_buffer.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define QRYPT_SDK_MODULE_VERSION 1
+#define QRYPT_SDK_MODULE_ENTRY "qrypt_sdk_module"
+
+typedef enum {
+    QRYPT_SDK_OK = 0,
+    QRYPT_SDK_ERROR = 1,    /* the SDK threw a QryptSecurityException */
+    QRYPT_SDK_FAILED = 2    /* any other failure */
+} qrypt_sdk_status;
+
+typedef struct qrypt_sdk_client qrypt_sdk_client;
+
+typedef struct {
+    uint32_t version;       /* QRYPT_SDK_MODULE_VERSION */
+    void (*set_log_level)(int level);
+    /* ca_cert_path may be NULL */
+    qrypt_sdk_status (*create)(const char* token, const char* ca_cert_path, qrypt_sdk_client** client,
+                               char* error, size_t error_size);
+    void (*destroy)(qrypt_sdk_client* client);
+    qrypt_sdk_status (*gen_init)(qrypt_sdk_client* client, size_t key_size, uint32_t ttl_seconds,
+                                 uint8_t** key, size_t* key_len, uint8_t** metadata, size_t* metadata_len,
+                                 char* error, size_t error_size);
+    qrypt_sdk_status (*gen_sync)(qrypt_sdk_client* client, const uint8_t* metadata, size_t metadata_len,
+                                 uint8_t** key, size_t* key_len, char* error, size_t error_size);
+    void (*free_buffer)(uint8_t* buffer);
+} qrypt_sdk_module_t;
+
+typedef const qrypt_sdk_module_t* (*qrypt_sdk_module_fn)(void);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The module's only exported symbol, named QRYPT_SDK_MODULE_ENTRY */
+const qrypt_sdk_module_t* qrypt_sdk_module(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SDK_MODULE_H */
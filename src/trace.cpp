@@ -0,0 +1,129 @@
+#include "trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+std::atomic<bool> trace_enabled(false);
+std::atomic<bool> trace_sites_enabled(false);
+
+namespace {
+
+struct TraceSpan {
+    const char* name;
+    int64_t start;
+    int64_t end;
+    uint64_t bytes;
+};
+
+// Spans from one thread. Buffers belong to the registry so they outlive the threads that fill them.
+struct ThreadSpans {
+    uint32_t tid;
+    std::mutex mutex;
+    std::vector<TraceSpan> spans;
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadSpans>> registry;
+std::atomic<int64_t> trace_epoch(0);
+
+ThreadSpans& threadSpans() {
+    thread_local ThreadSpans* spans = nullptr;
+    if (spans == nullptr) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(std::make_unique<ThreadSpans>());
+        spans = registry.back().get();
+        spans->tid = (uint32_t)registry.size();
+    }
+    return *spans;
+}
+
+// Trace timestamps are in microseconds
+std::string microseconds(int64_t nanoseconds) {
+    char text[32];
+    snprintf(text, sizeof(text), "%lld.%03lld", (long long)(nanoseconds / 1000), (long long)(nanoseconds % 1000));
+    return text;
+}
+
+std::string jsonEscape(const char* text) {
+    std::string escaped;
+    for (; *text; text++) {
+        if (*text == '"' || *text == '\\') {
+            escaped += '\\';
+        }
+        if ((unsigned char)*text >= 0x20) {
+            escaped += *text;
+        }
+    }
+    return escaped;
+}
+
+} // namespace
+
+const char*& traceSite() {
+    thread_local const char* site = nullptr;
+    return site;
+}
+
+int64_t traceNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void recordTraceSpan(const char* name, int64_t start, int64_t end, uint64_t bytes) {
+    ThreadSpans& spans = threadSpans();
+    std::lock_guard<std::mutex> lock(spans.mutex);
+    spans.spans.push_back({name, start, end, bytes});
+}
+
+void startTrace() {
+    // The thread that starts the trace is listed first, as "main"
+    threadSpans();
+    trace_epoch = traceNow();
+    trace_enabled = true;
+}
+
+void writeTrace(const std::string& path) {
+    trace_enabled = false;
+    int64_t epoch = trace_epoch;
+
+    std::ofstream out(path, std::ios::out | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Unable to write trace file " + path);
+    }
+    std::string pid = std::to_string(getpid());
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"qrypt\"}}";
+
+    std::lock_guard<std::mutex> registry_lock(registry_mutex);
+    for (auto& thread : registry) {
+        std::lock_guard<std::mutex> lock(thread->mutex);
+        std::string tid = std::to_string(thread->tid);
+        out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+            << ",\"args\":{\"name\":\"" << (thread->tid == 1 ? "main" : "thread " + tid) << "\"}}";
+        for (const TraceSpan& span : thread->spans) {
+            out << ",\n{\"name\":\"" << jsonEscape(span.name) << "\",\"cat\":\"qrypt\",\"ph\":\"X\",\"pid\":" << pid
+                << ",\"tid\":" << tid << ",\"ts\":" << microseconds(span.start - epoch)
+                << ",\"dur\":" << microseconds(span.end - span.start);
+            if (span.bytes > 0) {
+                out << ",\"args\":{\"bytes\":" << span.bytes << "}";
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    if (!out.flush()) {
+        throw std::runtime_error("Unable to write trace file " + path);
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped spans recorded per thread and written as Chrome trace-event JSON, which opens in Perfetto
+// (ui.perfetto.dev) or chrome://tracing. Until startTrace() or site tracking is turned on, a span costs two
+// relaxed atomic loads.
+
+extern std::atomic<bool> trace_enabled;
+
+inline bool traceEnabled() {
+    return trace_enabled.load(std::memory_order_relaxed);
+}
+
+// While site tracking is on (--profile-memory), each thread's innermost TraceScope name, so memory can be
+// attributed to the code that allocates it. nullptr outside any scope.
+extern std::atomic<bool> trace_sites_enabled;
+const char*& traceSite();
+
+inline bool traceSitesEnabled() {
+    return trace_sites_enabled.load(std::memory_order_relaxed);
+}
+
+int64_t traceNow();
+void recordTraceSpan(const char* name, int64_t start, int64_t end, uint64_t bytes);
+
+// Start recording spans from every thread
+void startTrace();
+// Stop recording and write the spans recorded so far to path
+void writeTrace(const std::string& path);
+
+// Records a span from construction to destruction. name must outlive the trace, e.g. a string literal.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, uint64_t bytes = 0) :
+        name(name), bytes(bytes), start(traceEnabled() ? traceNow() : -1) {
+        if (traceSitesEnabled()) {
+            site = &traceSite();
+            parent_site = *site;
+            *site = name;
+        }
+    }
+    ~TraceScope() {
+        if (start >= 0) {
+            recordTraceSpan(name, start, traceNow(), bytes);
+        }
+        if (site) {
+            *site = parent_site;
+        }
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    uint64_t bytes;
+    int64_t start;
+    const char** site = nullptr;
+    const char* parent_site = nullptr;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Trace the rest of the enclosing scope, optionally with the number of bytes it processes
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif /* TRACE_H */
@@ -0,0 +1,457 @@
+#include "bounded_queue.h"
+#include "common.h"
+#include "encrypt.h"
+#include "metrics.h"
+#include "upload.h"
+
+#include <curl/curl.h>
+#include <openssl/evp.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const long UploadConnectTimeout = 10L;
+const long UploadLowSpeedLimit = 1024L; // bytes per second
+const long UploadLowSpeedTime = 30L;    // seconds spent below the limit before a chunk is abandoned
+const int UploadMaxAttempts = 5;
+
+struct FormField {
+    std::string name;
+    std::string value;
+};
+
+using CurlHandle = std::unique_ptr<CURL, decltype(&::curl_easy_cleanup)>;
+
+// The receiver answered 404 or 409 for a chunked upload session it no longer holds, so the upload has to
+// start again from /status rather than retry the request
+class UploadSessionLost : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// libcurl global state has to be initialized before worker threads create their handles
+struct CurlGlobalScope {
+    CurlGlobalScope() { curl_global_init(CURL_GLOBAL_DEFAULT); }
+    ~CurlGlobalScope() { curl_global_cleanup(); }
+};
+
+size_t writeCallback(char* data, size_t size, size_t nmemb, std::string* response) {
+    response->append(data, size * nmemb);
+    return size * nmemb;
+}
+
+std::string sha256Hex(const uint8_t* data, size_t size) {
+    std::vector<uint8_t> digest(EVP_MAX_MD_SIZE);
+    unsigned int digest_len = 0;
+    if (EVP_Digest(data, size, digest.data(), &digest_len, EVP_sha256(), nullptr) != OPENSSL_SUCCESS) {
+        throw std::runtime_error("EVP_Digest() failed!");
+    }
+    digest.resize(digest_len);
+    return byteVecToHexStr(digest);
+}
+
+// Send a GET, or a multipart POST if there are form fields, on a handle that is reused between
+// requests so that each worker keeps its connection open.
+std::string performRequest(CURL* curl, const std::string& url, const std::vector<FormField>& fields,
+                           const uint8_t* data = nullptr, size_t size = 0, const std::string& data_filename = "") {
+    std::string response;
+    curl_easy_reset(curl);
+    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, UploadConnectTimeout);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, UploadLowSpeedLimit);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, UploadLowSpeedTime);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response);
+
+    curl_mime* mime = nullptr;
+    if (!fields.empty()) {
+        mime = curl_mime_init(curl);
+        for (const auto& field : fields) {
+            curl_mimepart* part = curl_mime_addpart(mime);
+            curl_mime_name(part, field.name.c_str());
+            curl_mime_data(part, field.value.c_str(), CURL_ZERO_TERMINATED);
+        }
+        if (data != nullptr) {
+            curl_mimepart* part = curl_mime_addpart(mime);
+            curl_mime_name(part, "chunk");
+            curl_mime_filename(part, data_filename.c_str());
+            curl_mime_data(part, (const char*)data, size);
+        }
+        curl_easy_setopt(curl, CURLOPT_MIMEPOST, mime);
+    }
+
+    CURLcode res = curl_easy_perform(curl);
+    long http_response_code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_response_code);
+    countHttpResponse(http_response_code);
+    curl_mime_free(mime);
+
+    if (res != CURLE_OK) {
+        throw std::runtime_error(std::string(curl_easy_strerror(res)));
+    }
+    if (http_response_code == 404 || http_response_code == 409) {
+        throw UploadSessionLost("Unexpected HTTP response:\n" + response);
+    }
+    if (http_response_code != 200) {
+        throw std::runtime_error("Unexpected HTTP response:\n" + response);
+    }
+    return response;
+}
+
+// Retry transient failures with exponential backoff
+template <typename Fn>
+std::string withRetries(Fn request) {
+    auto backoff = std::chrono::milliseconds(500);
+    for (int attempt = 1; ; attempt++) {
+        try {
+            return request();
+        }
+        catch (const UploadSessionLost&) {
+            throw;
+        }
+        catch (const std::runtime_error&) {
+            if (attempt == UploadMaxAttempts) {
+                throw;
+            }
+        }
+        std::this_thread::sleep_for(backoff);
+        backoff *= 2;
+    }
+}
+
+// Parse the chunk indices out of a status response of the form {"received":[0,1,5]}
+std::vector<bool> parseAcknowledged(const std::string& status, size_t chunk_count) {
+    std::vector<bool> acknowledged(chunk_count, false);
+    size_t pos = status.find('[');
+    size_t end = status.find(']', pos);
+    if (pos == std::string::npos || end == std::string::npos) {
+        throw std::runtime_error("Unexpected upload status response:\n" + status);
+    }
+    while (++pos < end) {
+        size_t digits_end = status.find_first_not_of("0123456789", pos);
+        if (digits_end > pos) {
+            size_t index = std::stoull(status.substr(pos, digits_end - pos));
+            if (index < chunk_count) {
+                acknowledged[index] = true;
+            }
+            pos = digits_end;
+        }
+    }
+    return acknowledged;
+}
+
+using Block = std::vector<uint8_t>;
+
+// Shared by the stages of uploadFileEncrypted(). The first stage to fail records its error and closes
+// both queues, which wakes every other stage so that it can stop.
+struct EncryptPipeline {
+    EncryptPipeline(size_t depth) : plaintext(depth), ciphertext(depth) {}
+
+    void fail(const std::string& error) {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!failed.exchange(true)) {
+                first_error = error;
+            }
+        }
+        plaintext.close();
+        ciphertext.close();
+    }
+
+    BoundedQueue<Block> plaintext;
+    BoundedQueue<Block> ciphertext;
+    std::atomic<bool> failed{false};
+    std::mutex error_mutex;
+    std::string first_error;
+
+    // Read position of the block curl is currently sending
+    Block sending;
+    size_t sending_pos = 0;
+};
+
+// curl read callback that drains the ciphertext queue into the request body
+size_t readCiphertext(char* buffer, size_t size, size_t nitems, void* arg) {
+    EncryptPipeline* pipeline = (EncryptPipeline*)arg;
+    size_t capacity = size * nitems;
+    size_t copied = 0;
+    while (copied < capacity) {
+        if (pipeline->sending_pos == pipeline->sending.size()) {
+            // Send what is already copied rather than waiting for the next block
+            if (copied > 0) {
+                break;
+            }
+            if (!pipeline->ciphertext.pop(pipeline->sending)) {
+                return pipeline->failed ? CURL_READFUNC_ABORT : 0;
+            }
+            pipeline->sending_pos = 0;
+        }
+        size_t len = std::min(capacity - copied, pipeline->sending.size() - pipeline->sending_pos);
+        memcpy(buffer + copied, pipeline->sending.data() + pipeline->sending_pos, len);
+        pipeline->sending_pos += len;
+        copied += len;
+    }
+    return copied;
+}
+
+// Send the chunks the receiver does not hold yet, then ask it to reassemble the file
+void sendChunks(CURL* curl, const std::string& filename, const std::string& url, const std::string& query,
+                const std::vector<FormField>& session, uint64_t file_size, size_t chunk_size, size_t chunk_count,
+                unsigned parallel) {
+    std::string name = fs::path(filename).filename().string();
+
+    // Skip chunks the receiver already holds from an earlier attempt
+    std::string status = withRetries([&]() { return performRequest(curl, url + "/status" + query, {}); });
+    std::vector<bool> acknowledged = parseAcknowledged(status, chunk_count);
+    std::vector<size_t> pending;
+    for (size_t index = 0; index < chunk_count; index++) {
+        if (!acknowledged[index]) {
+            pending.push_back(index);
+        }
+    }
+
+    // Send the remaining chunks over parallel connections
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    bool session_lost = false;
+    std::mutex error_mutex;
+    std::string first_error;
+    std::vector<std::thread> workers;
+    unsigned worker_count = (unsigned)std::min<size_t>(parallel, pending.size());
+    for (unsigned w = 0; w < worker_count; w++) {
+        workers.emplace_back([&]() {
+            try {
+                CurlHandle worker_curl(curl_easy_init(), ::curl_easy_cleanup);
+                std::ifstream file(filename, std::ios::in | std::ios::binary);
+                if (!worker_curl || !file.is_open()) {
+                    throw std::runtime_error("Unable to open file " + filename);
+                }
+                std::vector<uint8_t> buffer(std::max<uint64_t>(1, std::min<uint64_t>(chunk_size, file_size)));
+                size_t i;
+                while (!failed && (i = next++) < pending.size()) {
+                    size_t index = pending[i];
+                    uint64_t offset = (uint64_t)index * chunk_size;
+                    size_t len = (size_t)std::min<uint64_t>(chunk_size, file_size - offset);
+                    file.seekg(offset);
+                    file.read((char*)buffer.data(), len);
+                    if ((size_t)file.gcount() != len) {
+                        throw std::runtime_error("Unable to read chunk " + std::to_string(index) + " of " + filename);
+                    }
+
+                    std::vector<FormField> fields = session;
+                    fields.push_back({"index", std::to_string(index)});
+                    fields.push_back({"sha256", sha256Hex(buffer.data(), len)});
+                    withRetries([&]() {
+                        return performRequest(worker_curl.get(), url + "/chunk", fields, buffer.data(), len, name);
+                    });
+                }
+            }
+            catch (const std::exception& ex) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!failed.exchange(true)) {
+                    first_error = ex.what();
+                    session_lost = dynamic_cast<const UploadSessionLost*>(&ex) != nullptr;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    if (session_lost) {
+        throw UploadSessionLost(first_error);
+    }
+    if (failed) {
+        throw std::runtime_error("Upload interrupted. Run the same command again to resume.\n" + first_error);
+    }
+
+    // Ask the receiver to reassemble the file
+    std::string response = withRetries([&]() { return performRequest(curl, url + "/complete", session); });
+
+    std::cout << "Sent " << pending.size() << " of " << chunk_count << " chunks ("
+              << chunk_count - pending.size() << " already on the receiver)" << std::endl;
+    std::cout << response << std::endl;
+}
+
+} // namespace
+
+void uploadFileChunked(const std::string& filename, const std::string& url, size_t chunk_size, unsigned parallel) {
+    if (chunk_size == 0 || parallel == 0) {
+        throw std::invalid_argument("Chunk size and parallelism must be greater than zero");
+    }
+
+    uint64_t file_size = fs::file_size(filename);
+    size_t chunk_count = std::max<uint64_t>(1, (file_size + chunk_size - 1) / chunk_size);
+    std::string name = fs::path(filename).filename().string();
+
+    CurlGlobalScope curl_global;
+    CurlHandle curl(curl_easy_init(), ::curl_easy_cleanup);
+    if (!curl) {
+        throw std::runtime_error("Failed to initialize libcurl");
+    }
+    char* escaped_name = curl_easy_escape(curl.get(), name.c_str(), name.size());
+    std::string query = "?name=" + std::string(escaped_name) + "&size=" + std::to_string(file_size) +
+                        "&chunk_size=" + std::to_string(chunk_size);
+    curl_free(escaped_name);
+
+    // Session fields identify the upload so that the receiver can resume it
+    const std::vector<FormField> session = {
+        {"name", name}, {"size", std::to_string(file_size)}, {"chunk_size", std::to_string(chunk_size)}
+    };
+
+    // Restart from the status request if the receiver loses the session part way through
+    for (int attempt = 1; ; attempt++) {
+        try {
+            sendChunks(curl.get(), filename, url, query, session, file_size, chunk_size, chunk_count, parallel);
+            return;
+        }
+        catch (const UploadSessionLost&) {
+            if (attempt == UploadMaxAttempts) {
+                throw;
+            }
+            std::cout << "The receiver lost the upload session. Starting the upload again." << std::endl;
+        }
+    }
+}
+
+void uploadFileEncrypted(const std::string& filename, std::istream& key_stream, const std::string& key_type,
+                         const std::string& aes_mode, const std::string& url, size_t block_size, size_t depth) {
+    if (block_size == 0 || depth == 0) {
+        throw std::invalid_argument("Block size and pipeline depth must be greater than zero");
+    }
+
+    uint64_t file_size = fs::file_size(filename);
+    if (key_type == "otp") {
+        if (keySize(key_stream) != file_size) {
+            throw std::invalid_argument("One-time-pad is invalid. The key file must be the same length as the input file.");
+        }
+        key_stream.clear();
+        key_stream.seekg(0);
+    }
+    std::ifstream file(filename, std::ios::in | std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open file " + filename);
+    }
+    CryptStream cipher("encrypt", key_stream, aes_mode, key_type);
+    std::string name = fs::path(filename).filename().string() + ".enc";
+
+    EncryptPipeline pipeline(depth);
+
+    // Stage 1: read plaintext blocks
+    std::thread reader([&]() {
+        try {
+            uint64_t total = 0;
+            while (file) {
+                Block block(block_size);
+                file.read((char*)block.data(), block_size);
+                block.resize(file.gcount());
+                total += block.size();
+                if (total > file_size) {
+                    throw std::runtime_error(filename + " grew while it was being sent.");
+                }
+                if (!block.empty() && !pipeline.plaintext.push(std::move(block))) {
+                    return;
+                }
+            }
+            if (file.bad()) {
+                throw std::runtime_error("Unable to read " + filename);
+            }
+            if (total != file_size) {
+                throw std::runtime_error(filename + " shrank while it was being sent.");
+            }
+            pipeline.plaintext.close();
+        }
+        catch (const std::exception& ex) {
+            pipeline.fail(ex.what());
+        }
+    });
+
+    // Stage 2: encrypt each block as it arrives
+    std::thread encryptor([&]() {
+        try {
+            Block block;
+            while (pipeline.plaintext.pop(block)) {
+                Block encrypted;
+                encrypted.reserve(block.size() + EVP_MAX_BLOCK_LENGTH);
+                cipher.update(block.data(), block.size(), encrypted);
+                if (!pipeline.ciphertext.push(std::move(encrypted))) {
+                    return;
+                }
+            }
+            if (pipeline.failed) {
+                return;
+            }
+            Block last;
+            cipher.finish(last);
+            pipeline.ciphertext.push(std::move(last));
+            pipeline.ciphertext.close();
+        }
+        catch (const std::exception& ex) {
+            pipeline.fail(ex.what());
+        }
+    });
+
+    // Stage 3: stream the ciphertext into the request body on this thread. The ciphertext size is known
+    // up front, so the body is sent with a Content-Length rather than chunked transfer encoding.
+    std::string response;
+    CURLcode res = CURLE_OK;
+    long http_response_code = 0;
+    {
+        CurlGlobalScope curl_global;
+        CurlHandle curl(curl_easy_init(), ::curl_easy_cleanup);
+        if (curl) {
+            curl_easy_setopt(curl.get(), CURLOPT_URL, url.c_str());
+            curl_easy_setopt(curl.get(), CURLOPT_CONNECTTIMEOUT, UploadConnectTimeout);
+            curl_easy_setopt(curl.get(), CURLOPT_LOW_SPEED_LIMIT, UploadLowSpeedLimit);
+            curl_easy_setopt(curl.get(), CURLOPT_LOW_SPEED_TIME, UploadLowSpeedTime);
+            curl_easy_setopt(curl.get(), CURLOPT_WRITEFUNCTION, writeCallback);
+            curl_easy_setopt(curl.get(), CURLOPT_WRITEDATA, &response);
+
+            curl_mime* mime = curl_mime_init(curl.get());
+            curl_mimepart* part = curl_mime_addpart(mime);
+            curl_mime_name(part, "file");
+            curl_mime_filename(part, name.c_str());
+            curl_mime_data_cb(part, (curl_off_t)encryptedSize(file_size, aes_mode, key_type),
+                              readCiphertext, nullptr, nullptr, &pipeline);
+            curl_easy_setopt(curl.get(), CURLOPT_MIMEPOST, mime);
+
+            res = curl_easy_perform(curl.get());
+            curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &http_response_code);
+            countHttpResponse(http_response_code);
+            curl_mime_free(mime);
+        }
+        if (!curl || res != CURLE_OK || http_response_code != 200) {
+            pipeline.fail(!curl ? "Failed to initialize libcurl" :
+                          res != CURLE_OK ? curl_easy_strerror(res) :
+                          "Unexpected HTTP response:\n" + response);
+        }
+    }
+
+    // curl stops reading at the Content-Length. Drain whatever is left so that no stage stays blocked on a
+    // full queue; any ciphertext past the declared length means the file grew while it was being sent.
+    bool overrun = pipeline.sending_pos < pipeline.sending.size();
+    Block extra;
+    while (pipeline.ciphertext.pop(extra)) {
+        overrun = overrun || !extra.empty();
+    }
+    reader.join();
+    encryptor.join();
+    if (overrun) {
+        pipeline.fail(filename + " grew while it was being sent.");
+    }
+
+    if (pipeline.failed) {
+        throw std::runtime_error(pipeline.first_error);
+    }
+    std::cout << response << std::endl;
+}
@@ -0,0 +1,30 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+const size_t DEFAULT_UPLOAD_CHUNK_SIZE = 4 * 1024 * 1024;
+const unsigned DEFAULT_UPLOAD_PARALLELISM = 4;
+
+// Upload a file to <url>/chunk in checksummed chunks over several parallel connections, then ask
+// <url>/complete to reassemble it. Chunks acknowledged by <url>/status during an earlier, interrupted
+// attempt are not sent again.
+void uploadFileChunked(const std::string& filename, const std::string& url,
+                       size_t chunk_size = DEFAULT_UPLOAD_CHUNK_SIZE, unsigned parallel = DEFAULT_UPLOAD_PARALLELISM);
+
+const size_t DEFAULT_PIPELINE_BLOCK_SIZE = 1024 * 1024;
+const size_t DEFAULT_PIPELINE_DEPTH = 4;
+
+// Encrypt a file while uploading it to <url> as "<filename>.enc". Reading, encryption and the transfer
+// run concurrently on blocks of block_size bytes, with at most depth blocks buffered between each
+// stage, so memory use does not depend on the file size. The uploaded file is identical to the output
+// of "qrypt encrypt" with the same key and can be decrypted with "qrypt decrypt". A one-time-pad is read
+// from key_stream, which must be seekable, only as it is used. Fails if the file changes size while it is
+// being sent.
+void uploadFileEncrypted(const std::string& filename, std::istream& key_stream, const std::string& key_type,
+                         const std::string& aes_mode, const std::string& url,
+                         size_t block_size = DEFAULT_PIPELINE_BLOCK_SIZE, size_t depth = DEFAULT_PIPELINE_DEPTH);
+
+#endif /* UPLOAD_H */
@@ -0,0 +1,110 @@
+#include "work_stealing_pool.h"
+
+#include <algorithm>
+
+// The pool and index of the worker running on this thread, if any
+static thread_local WorkStealingPool* current_pool = nullptr;
+static thread_local unsigned current_worker = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned thread_count) {
+    if (thread_count == 0) {
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (unsigned i = 0; i < thread_count; i++) {
+        threads.emplace_back(&WorkStealingPool::run, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        all_done.wait(lock, [this]() { return unfinished == 0; });
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+    unsigned target = current_pool == this ? current_worker : next_worker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        unfinished++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers[target]->mutex);
+        workers[target]->tasks.push_back(std::move(task));
+    }
+    {
+        // Counted under the pool lock so a worker about to sleep cannot miss it
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    work_available.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    all_done.wait(lock, [this]() { return unfinished == 0; });
+    if (error) {
+        std::exception_ptr first_error = error;
+        error = nullptr;
+        std::rethrow_exception(first_error);
+    }
+}
+
+bool WorkStealingPool::take(unsigned self, std::function<void()>& task) {
+    for (unsigned i = 0; i < workers.size(); i++) {
+        Worker& worker = *workers[(self + i) % workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) {
+            continue;
+        }
+        // Newest from our own queue, whose data is most likely still in cache; oldest from anyone else's
+        if (i == 0) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        } else {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::run(unsigned self) {
+    current_pool = this;
+    current_worker = self;
+    while (true) {
+        std::function<void()> task;
+        if (!take(self, task)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_available.wait(lock, [this]() { return stopping || queued > 0; });
+            if (stopping) {
+                return;
+            }
+            continue;
+        }
+
+        try {
+            task();
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--unfinished == 0) {
+            all_done.notify_all();
+        }
+    }
+}
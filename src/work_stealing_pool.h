@@ -0,0 +1,57 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, each with its own queue of tasks. A worker runs the newest task on its own
+// queue first and, once that is empty, steals the oldest task from another worker, so tasks of very
+// different sizes, and tasks that submit more tasks, still keep every worker busy.
+class WorkStealingPool {
+public:
+    // threads of 0 means one per core
+    explicit WorkStealingPool(unsigned threads = 0);
+    // Waits for the queued tasks to finish
+    ~WorkStealingPool();
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Queue a task. Tasks submitted from a worker go on that worker's own queue; others are dealt out in turn.
+    void submit(std::function<void()> task);
+
+    // Block until every task submitted so far, and every task they submit, has finished. Rethrows the first
+    // exception a task threw.
+    void wait();
+
+    unsigned size() const { return (unsigned)threads.size(); }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool take(unsigned self, std::function<void()>& task);
+    void run(unsigned self);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    std::atomic<long> queued{0};
+    std::atomic<unsigned> next_worker{0};
+
+    std::mutex mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    size_t unfinished = 0;
+    bool stopping = false;
+    std::exception_ptr error;
+};
+
+#endif /* WORK_STEALING_POOL_H */
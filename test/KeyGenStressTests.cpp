@@ -0,0 +1,272 @@
+#include "common.h"
+#include "offline_keygen.h"
+#include "sdk_loader.h"
+
+#include "QryptSecurity/qryptsecurity.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <gtest/gtest.h>
+
+using namespace QryptSecurity;
+
+/*
+    Stress and soak tests
+
+    Many threads each run genInit()/genSync() pairs on an Alice and a Bob client of their own for a fixed time,
+    checking that every pair of keys matches, then report throughput, latency percentiles and memory use over
+    time. Skipped unless QRYPT_STRESS_SECONDS is set, e.g.
+
+        QRYPT_STRESS_SECONDS=600 QRYPT_STRESS_THREADS=16 ./qrypt test --gtest_filter='KeyGenStressTest.*'
+
+    Optional settings:
+        QRYPT_STRESS_THREADS        Worker threads. Default 8.
+        QRYPT_STRESS_KEY_SIZE       Key size in bytes. Default 32.
+        QRYPT_STRESS_SDK            If 1, use the Qrypt SDK with the --token given to "qrypt test" instead of
+                                    the offline stand-in, OfflineKeyGen.
+        QRYPT_STRESS_MAX_GROWTH_MB  Fail if resident memory grows by more than this after the first quarter.
+ */
+
+namespace {
+
+struct StressConfig {
+    double seconds;
+    unsigned threads = 8;
+    size_t key_size = 32;
+    bool use_sdk = false;
+    std::optional<double> max_growth_mb;
+};
+
+// Latencies in a fixed log-scale histogram, so recording them does not itself grow memory during a soak.
+// Percentiles are the upper bound of their bucket, within 5%.
+class LatencyHistogram {
+public:
+    void record(double ms) {
+        counts[bucket(ms)]++;
+        total++;
+        max_ms = std::max(max_ms, ms);
+    }
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < Buckets; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        max_ms = std::max(max_ms, other.max_ms);
+    }
+    double percentile(double pct) const {
+        uint64_t seen = 0;
+        for (size_t i = 0; i < Buckets; i++) {
+            seen += counts[i];
+            if (seen > 0 && seen >= pct / 100.0 * total) {
+                return std::min(max_ms, MinMs * std::pow(Growth, (double)i));
+            }
+        }
+        return max_ms;
+    }
+    double max() const { return max_ms; }
+
+private:
+    static constexpr double MinMs = 0.001; // bucket 0 holds everything up to a microsecond
+    static constexpr double Growth = 1.05;
+    static const size_t Buckets = 640;     // up to about 10^11 ms
+
+    static size_t bucket(double ms) {
+        if (ms <= MinMs) {
+            return 0;
+        }
+        return std::min(Buckets - 1, (size_t)std::ceil(std::log(ms / MinMs) / std::log(Growth)));
+    }
+
+    std::array<uint64_t, Buckets> counts{};
+    uint64_t total = 0;
+    double max_ms = 0;
+};
+
+struct StressResult {
+    uint64_t pairs = 0;
+    uint64_t mismatches = 0;
+    uint64_t failures = 0;
+    std::string first_error;
+    LatencyHistogram latencies; // of each genInit()/genSync() pair
+    std::vector<std::pair<double, uint64_t>> rss_samples; // seconds since the start, resident bytes
+    double seconds = 0;
+};
+
+std::optional<StressConfig> stressConfig() {
+    const char* seconds = getenv("QRYPT_STRESS_SECONDS");
+    if (seconds == nullptr) {
+        return std::nullopt;
+    }
+    StressConfig config;
+    config.seconds = std::stod(seconds);
+    if (const char* threads = getenv("QRYPT_STRESS_THREADS")) {
+        config.threads = std::max(1ul, std::stoul(threads));
+    }
+    if (const char* key_size = getenv("QRYPT_STRESS_KEY_SIZE")) {
+        config.key_size = std::stoul(key_size);
+    }
+    if (const char* use_sdk = getenv("QRYPT_STRESS_SDK")) {
+        config.use_sdk = strcmp(use_sdk, "1") == 0;
+    }
+    if (const char* max_growth = getenv("QRYPT_STRESS_MAX_GROWTH_MB")) {
+        config.max_growth_mb = std::stod(max_growth);
+    }
+    return config;
+}
+
+// Resident memory of the process in bytes, or 0 where it cannot be read
+uint64_t readRss() {
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            return std::stoull(line.substr(strlen("VmRSS:"))) * 1024;
+        }
+    }
+#endif
+    return 0;
+}
+
+// Run pairs on config.threads threads until config.seconds have passed, sampling memory from this thread
+template <typename Client>
+StressResult runPairs(const StressConfig& config, const std::function<std::unique_ptr<Client>()>& make_client) {
+    StressResult result;
+    std::mutex result_mutex;
+    std::atomic<unsigned> running(config.threads);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::duration<double>(config.seconds);
+
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < config.threads; t++) {
+        workers.emplace_back([&]() {
+            uint64_t pairs = 0, mismatches = 0, failures = 0;
+            std::string first_error;
+            LatencyHistogram latencies;
+            try {
+                std::unique_ptr<Client> alice = make_client();
+                std::unique_ptr<Client> bob = make_client();
+                while (std::chrono::steady_clock::now() < deadline) {
+                    auto pair_start = std::chrono::steady_clock::now();
+                    try {
+                        SymmetricKeyData alice_key = alice->genInit(config.key_size);
+                        std::vector<uint8_t> bob_key = bob->genSync(alice_key.metadata);
+                        latencies.record(std::chrono::duration<double, std::milli>(
+                            std::chrono::steady_clock::now() - pair_start).count());
+                        pairs++;
+                        if (alice_key.key.size() != config.key_size || alice_key.key != bob_key) {
+                            mismatches++;
+                        }
+                    }
+                    catch (const std::exception& ex) {
+                        failures++;
+                        if (first_error.empty()) {
+                            first_error = ex.what();
+                        }
+                    }
+                }
+            }
+            catch (const std::exception& ex) {
+                // The clients could not be created
+                failures++;
+                first_error = ex.what();
+            }
+            std::lock_guard<std::mutex> lock(result_mutex);
+            result.pairs += pairs;
+            result.mismatches += mismatches;
+            result.failures += failures;
+            if (result.first_error.empty()) {
+                result.first_error = first_error;
+            }
+            result.latencies.merge(latencies);
+            running--;
+        });
+    }
+
+    // About 20 samples over the run, at most one every 100ms
+    auto interval = std::chrono::duration<double>(std::max(0.1, config.seconds / 20));
+    while (running > 0) {
+        auto now = std::chrono::steady_clock::now();
+        result.rss_samples.push_back({ std::chrono::duration<double>(now - start).count(), readRss() });
+        auto next_sample = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval);
+        while (running > 0 && std::chrono::steady_clock::now() < next_sample) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.rss_samples.push_back({ result.seconds, readRss() });
+    return result;
+}
+
+// Resident memory growth from the first quarter of the run, once buffers and caches have warmed up, to the end
+double rssGrowthMB(const StressResult& result) {
+    if (result.rss_samples.empty()) {
+        return 0;
+    }
+    auto warm = std::find_if(result.rss_samples.begin(), result.rss_samples.end(), [&](const auto& sample) {
+        return sample.first >= result.seconds / 4;
+    });
+    if (warm == result.rss_samples.end()) {
+        warm = result.rss_samples.begin();
+    }
+    return ((double)result.rss_samples.back().second - (double)warm->second) / 1e6;
+}
+
+void printStressReport(const StressConfig& config, const StressResult& result) {
+    std::cout << std::fixed << std::setprecision(2)
+              << (config.use_sdk ? "Qrypt SDK" : "OfflineKeyGen") << ", " << config.threads << " threads, "
+              << config.key_size << " byte keys, " << result.seconds << " s\n"
+              << "  pairs " << result.pairs << " (" << result.pairs / result.seconds << "/s), mismatches "
+              << result.mismatches << ", failures " << result.failures << "\n"
+              << std::setprecision(3)
+              << "  latency ms: p50 " << result.latencies.percentile(50)
+              << "  p90 " << result.latencies.percentile(90)
+              << "  p99 " << result.latencies.percentile(99)
+              << "  p99.9 " << result.latencies.percentile(99.9)
+              << "  max " << result.latencies.max() << "\n"
+              << "  rss MB over time:";
+    for (const auto& [seconds, rss] : result.rss_samples) {
+        std::cout << " " << std::setprecision(1) << seconds << "s=" << rss / 1e6;
+    }
+    std::cout << "\n  rss growth after the first quarter: " << std::setprecision(2) << rssGrowthMB(result)
+              << " MB" << std::endl;
+}
+
+} // namespace
+
+TEST(KeyGenStressTest, ConcurrentPairsMatch) {
+    std::optional<StressConfig> config = stressConfig();
+    if (!config) {
+        GTEST_SKIP() << "Set QRYPT_STRESS_SECONDS to run the stress suite";
+    }
+
+    StressResult result;
+    if (config->use_sdk) {
+        result = runPairs<SdkClient>(*config, []() { return std::make_unique<SdkClient>(sdk_token, nullptr); });
+    } else {
+        result = runPairs<OfflineKeyGen>(*config, []() { return std::make_unique<OfflineKeyGen>(); });
+    }
+    printStressReport(*config, result);
+
+    EXPECT_GT(result.pairs, 0u);
+    EXPECT_EQ(result.mismatches, 0u);
+    EXPECT_EQ(result.failures, 0u) << "First error: " << result.first_error;
+    if (config->max_growth_mb) {
+        EXPECT_LE(rssGrowthMB(result), *config->max_growth_mb);
+    }
+}
@@ -1,14 +1,37 @@
 #include "QryptSecurity/qryptsecurity.h"
-#include "QryptSecurity/qryptsecurity_exceptions.h"
 #include "QryptSecurity/qryptsecurity_logging.h"
 
 #include "common.h"
+#include "compress.h"
+#include "crypt_header.h"
 #include "eaas.h"
+#include "keygen.h"
+#include "key_file.h"
+#include "encrypt.h"
+#include "mem_profile.h"
+#include "metrics.h"
+#include "trace.h"
+#include "nist.h"
+#include "archive.h"
+#include "dir_crypt.h"
+#include "io_engine.h"
+#include "drbg.h"
+#include "incremental.h"
+#include "pad_ledger.h"
+#include "qrypt_core.h"
+#include "sdk_loader.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <thread>
 #include <gtest/gtest.h>
+#include <openssl/core_names.h>
+#include <openssl/hmac.h>
+#include <random>
 #include <sstream>
 
 using namespace QryptSecurity;
@@ -21,6 +44,29 @@ static const std::string red_fail = "\x1B[31mFAIL\x1B[0m";
 static const std::string gray_text = "\x1B[90m";
 static const std::string white_text = "\x1B[0m";
 
+static std::string randomString(std::mt19937& generator, size_t size) {
+    std::string data(size, '\0');
+    for (auto& byte : data) {
+        byte = (char)generator();
+    }
+    return data;
+}
+
+// Creates the parent directories of path if needed
+static void writeFile(const std::filesystem::path& path, const std::string& contents) {
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream(path, std::ios::out | std::ios::binary | std::ios::trunc) << contents;
+}
+
+static void writeRandom(const std::filesystem::path& path, std::mt19937& generator, size_t size) {
+    writeFile(path, randomString(generator, size));
+}
+
+static std::string readFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
 /*
     Validation tests
 
@@ -30,14 +76,12 @@ static const std::string white_text = "\x1B[0m";
 
 class KeyGenTest : public ::testing::Test {
   protected:
-    std::unique_ptr<IKeyGenDistributedClient> _AliceClient = nullptr;
-    std::unique_ptr<IKeyGenDistributedClient> _BobClient = nullptr;
+    std::unique_ptr<SdkClient> _AliceClient = nullptr;
+    std::unique_ptr<SdkClient> _BobClient = nullptr;
 
     void SetUp() override {
-        _AliceClient = IKeyGenDistributedClient::create();
-        _AliceClient->initialize(sdk_token);
-        _BobClient = IKeyGenDistributedClient::create();
-        _BobClient->initialize(sdk_token);
+        _AliceClient = std::make_unique<SdkClient>(sdk_token, nullptr);
+        _BobClient = std::make_unique<SdkClient>(sdk_token, nullptr);
         std::cout << white_text;
     }
 
@@ -146,7 +190,7 @@ TEST_F(KeyGenTest, CustomTTL) {
     std::cout << gen_msg << std::flush;
     std::cout << std::string(gen_msg.length(), '\b') << gray_text;
     ASSERT_NO_THROW(
-        aliceKey = _AliceClient->genInit(AES_256_SIZE, keyConfig)
+        aliceKey = _AliceClient->genInit(AES_256_SIZE, keyConfig.ttl)
     ) << gen_msg << red_fail;
     std::cout << gen_msg << green_pass << std::endl;
 
@@ -178,7 +222,7 @@ TEST_F(KeyGenTest, CustomTTL) {
     std::cout << sync_msg_2 << std::flush;
     std::cout << std::string(sync_msg_2.length(), '\b') << gray_text;
     ASSERT_THROW(
-        bobKey = _BobClient->genSync(aliceKey.metadata), QryptSecurityException
+        bobKey = _BobClient->genSync(aliceKey.metadata), SdkError
     ) << sync_msg_2 << red_fail;
     std::cout << sync_msg_2 << green_pass << std::endl;
 }
@@ -199,7 +243,7 @@ TEST(EaaSTest, VerifyNISTSuccess) {
     std::string script_stderr = testing::internal::GetCapturedStderr();
     if (fail || script_stderr.length() > 0) {
         std::cout << std::string(case_msg.length(), '\b') << gray_text;
-        FAIL() << script_stderr << case_msg << red_fail;
+        FAIL() << script_stdout << script_stderr << case_msg << red_fail;
     }
      std::cout << green_pass << std::endl;
 }
@@ -220,3 +264,931 @@ TEST(EaaSTest, 1KBRequest) {
     ASSERT_EQ((eaasResponse.length() -1), os.str().length()) << gen_msg << red_fail;
     std::cout << gen_msg << green_pass << std::endl;
 }
+
+TEST(EaaSTest, VerifyLocalNIST) {
+    const std::string gen_msg = white_text + "Requesting 512KB entropy from EaaS....";
+    std::cout << gen_msg << std::flush;
+    std::cout << std::string(gen_msg.length(), '\b') << gray_text;
+    EaaS eaasClient(sdk_token);
+    std::vector<uint8_t> entropy;
+    ASSERT_NO_THROW(
+        entropy = EaaS::decodeEntropy(eaasClient.requestEntropy(512))
+    ) << gen_msg << red_fail;
+    ASSERT_EQ(entropy.size(), 512 * KB) << gen_msg << red_fail;
+    std::cout << gen_msg << green_pass << std::endl;
+
+    // A truly random stream fails each test at the 0.01 level 1% of the time, so only flag
+    // p-values that are implausible for a random source.
+    const std::string nist_msg = white_text + "Verifying randomness of the received bytes locally...";
+    std::cout << nist_msg << std::flush;
+    std::cout << std::string(nist_msg.length(), '\b') << gray_text;
+    std::vector<NistResult> results;
+    ASSERT_NO_THROW(
+        results = runNistTests(entropy)
+    ) << nist_msg << red_fail;
+    for (const auto& result : results) {
+        ASSERT_GT(result.p_value, 0.0001) << result.test_name << std::endl << nist_msg << red_fail;
+    }
+    std::cout << nist_msg << green_pass << std::endl;
+}
+
+TEST(NistTest, SeededGeneratorPasses) {
+    std::mt19937_64 generator(20231019);
+    std::vector<uint8_t> data(MB);
+    for (size_t i = 0; i < data.size(); i += 8) {
+        uint64_t word = generator();
+        std::memcpy(&data[i], &word, 8);
+    }
+    for (const auto& result : runNistTests(data)) {
+        EXPECT_TRUE(result.passed) << result.test_name << " p-value " << result.p_value;
+    }
+}
+
+TEST(NistTest, BiasedInputFails) {
+    std::mt19937_64 generator(20231019);
+    std::vector<uint8_t> data(MB);
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = (uint8_t)generator() | 0x01; // every eighth bit is set
+    }
+    std::vector<NistResult> results = runNistTests(data);
+    ASSERT_EQ(results.size(), 8);
+    EXPECT_FALSE(results[0].passed) << "Frequency p-value " << results[0].p_value;
+    EXPECT_FALSE(results[2].passed) << "Runs p-value " << results[2].p_value;
+}
+
+TEST(CoreApiTest, MatchesCliFormat) {
+    std::mt19937_64 generator(20231019);
+    std::vector<uint8_t> plaintext(1000), aes_key(AESKeyLengthInBytes), otp(plaintext.size());
+    for (auto* bytes : {&plaintext, &aes_key, &otp}) {
+        std::generate(bytes->begin(), bytes->end(), [&]() { return (uint8_t)generator(); });
+    }
+
+    struct { qrypt_key_type key_type; qrypt_aes_mode aes_mode; std::vector<uint8_t>& key; std::string type, mode; } cases[] = {
+        {QRYPT_KEY_OTP, QRYPT_AES_OCB, otp, "otp", "ocb"},
+        {QRYPT_KEY_AES, QRYPT_AES_ECB, aes_key, "aes", "ecb"},
+        {QRYPT_KEY_AES, QRYPT_AES_OCB, aes_key, "aes", "ocb"},
+    };
+    for (const auto& c : cases) {
+        std::vector<uint8_t> ciphertext(qrypt_encrypted_size(c.key_type, c.aes_mode, plaintext.size()));
+        size_t ciphertext_len = 0;
+        ASSERT_EQ(qrypt_encrypt(c.key_type, c.aes_mode, c.key.data(), c.key.size(), plaintext.data(), plaintext.size(),
+                                ciphertext.data(), ciphertext.size(), &ciphertext_len), QRYPT_OK) << qrypt_last_error();
+        ASSERT_EQ(ciphertext_len, ciphertext.size());
+
+        // Same bytes as "qrypt encrypt"
+        std::istringstream input(std::string(plaintext.begin(), plaintext.end()));
+        std::istringstream key(std::string(c.key.begin(), c.key.end()));
+        std::ostringstream output;
+        encryptDecrypt("encrypt", input, key, output, "binary", c.mode, c.type);
+        EXPECT_EQ(output.str(), std::string(ciphertext.begin(), ciphertext.end())) << c.type << " " << c.mode;
+
+        std::vector<uint8_t> decrypted(qrypt_decrypted_size_max(c.key_type, c.aes_mode, ciphertext_len));
+        size_t decrypted_len = 0;
+        ASSERT_EQ(qrypt_decrypt(c.key_type, c.aes_mode, c.key.data(), c.key.size(), ciphertext.data(), ciphertext_len,
+                                decrypted.data(), decrypted.size(), &decrypted_len), QRYPT_OK) << qrypt_last_error();
+        decrypted.resize(decrypted_len);
+        EXPECT_EQ(decrypted, plaintext) << c.type << " " << c.mode;
+    }
+}
+
+TEST(CoreApiTest, ReportsErrors) {
+    std::vector<uint8_t> key(AESKeyLengthInBytes, 1), data(64, 2), out(64);
+    size_t out_len = 0;
+    EXPECT_EQ(qrypt_encrypt(QRYPT_KEY_AES, QRYPT_AES_OCB, key.data(), key.size(), data.data(), data.size(),
+                            out.data(), out.size(), &out_len), QRYPT_ERROR_BUFFER_TOO_SMALL);
+    EXPECT_EQ(out_len, data.size() + AETagSizeInBytes);
+
+    EXPECT_EQ(qrypt_encrypt(QRYPT_KEY_AES, QRYPT_AES_OCB, key.data(), 16, data.data(), data.size(),
+                            out.data(), out.size(), &out_len), QRYPT_ERROR_INVALID_ARGUMENT);
+    EXPECT_STRNE(qrypt_last_error(), "");
+
+    // A ciphertext that fails authentication
+    EXPECT_EQ(qrypt_decrypt(QRYPT_KEY_AES, QRYPT_AES_OCB, key.data(), key.size(), data.data(), data.size(),
+                            out.data(), out.size(), &out_len), QRYPT_ERROR_FAILED);
+}
+
+TEST(EncryptTest, CompressedRoundTrip) {
+    if (!compressionAvailable()) {
+        GTEST_SKIP() << "Built without zstd";
+    }
+    std::string plaintext;
+    for (int i = 0; i < 20000; i++) {
+        plaintext += "INFO request " + std::to_string(i % 100) + " completed\n";
+    }
+    std::string aes_key(AESKeyLengthInBytes, 'k');
+
+    for (std::string aes_mode : {"ecb", "ocb"}) {
+        std::istringstream input(plaintext), key(aes_key);
+        std::ostringstream ciphertext;
+        encryptDecrypt("encrypt", input, key, ciphertext, "binary", aes_mode, "aes", true);
+        EXPECT_LT(ciphertext.str().size(), plaintext.size() / 4) << aes_mode;
+
+        // Decrypt finds the header and decompresses without being told
+        std::istringstream encrypted(ciphertext.str()), key_again(aes_key);
+        std::ostringstream decrypted;
+        encryptDecrypt("decrypt", encrypted, key_again, decrypted, "binary", aes_mode, "aes");
+        EXPECT_EQ(decrypted.str(), plaintext) << aes_mode;
+    }
+}
+
+// Discards what is written, keeping the total and the largest single write
+class WriteSizeBuf : public std::streambuf {
+public:
+    size_t total = 0;
+    size_t largest_write = 0;
+
+protected:
+    std::streamsize xsputn(const char* /*data*/, std::streamsize size) override {
+        total += size;
+        largest_write = std::max(largest_write, (size_t)size);
+        return size;
+    }
+    int_type overflow(int_type ch) override {
+        total++;
+        largest_write = std::max<size_t>(largest_write, 1);
+        return ch;
+    }
+};
+
+TEST(EncryptTest, DecompressionWritesAsItGoes) {
+    if (!compressionAvailable()) {
+        GTEST_SKIP() << "Built without zstd";
+    }
+    // A long run of zeros compresses to a few KB, all of it inside the first block of ciphertext
+    const size_t plaintext_size = 32 << 20;
+    std::string aes_key(AESKeyLengthInBytes, 'k');
+    std::istringstream input(std::string(plaintext_size, '\0')), key(aes_key);
+    std::ostringstream ciphertext;
+    encryptDecrypt("encrypt", input, key, ciphertext, "binary", "ocb", "aes", true);
+    ASSERT_LT(ciphertext.str().size(), (size_t)64 << 10);
+
+    std::istringstream encrypted(ciphertext.str()), key_again(aes_key);
+    WriteSizeBuf sink;
+    std::ostream decrypted(&sink);
+    encryptDecrypt("decrypt", encrypted, key_again, decrypted, "binary", "ocb", "aes");
+    EXPECT_EQ(sink.total, plaintext_size);
+    // One zstd output buffer at a time, not the whole expanded block
+    EXPECT_LE(sink.largest_write, (size_t)1 << 20);
+}
+
+TEST(EncryptTest, SpanFunctionsDoNotAllocate) {
+    std::vector<uint8_t> key(AESKeyLengthInBytes, 7), other_key(AESKeyLengthInBytes, 8), plaintext(4096, 3);
+    std::vector<uint8_t> ciphertext(plaintext.size() + 16), decrypted(plaintext.size() + 16);
+
+    using SpanFn = size_t (*)(ByteSpan, ByteSpan, MutableByteSpan);
+    struct { SpanFn encrypt, decrypt; std::string mode; } modes[] = {
+        {encryptAES256ECB, decryptAES256ECB, "ecb"},
+        {encryptAES256OCB, decryptAES256OCB, "ocb"},
+    };
+    for (const auto& m : modes) {
+        // Alternating keys must not leak state between calls on the reused contexts
+        for (const auto* k : {&key, &other_key, &key}) {
+            size_t ciphertext_len = m.encrypt(*k, plaintext, ciphertext);
+            std::vector<uint8_t> expected;
+            CryptStream reference("encrypt", *k, m.mode, "aes");
+            reference.update(plaintext.data(), plaintext.size(), expected);
+            reference.finish(expected);
+            ASSERT_EQ(std::vector<uint8_t>(ciphertext.begin(), ciphertext.begin() + ciphertext_len), expected) << m.mode;
+        }
+
+        uint64_t before = threadAllocationCount();
+        for (int i = 0; i < 100; i++) {
+            size_t ciphertext_len = m.encrypt(key, plaintext, ciphertext);
+            size_t decrypted_len = m.decrypt(key, ByteSpan(ciphertext.data(), ciphertext_len), decrypted);
+            ASSERT_EQ(decrypted_len, plaintext.size());
+        }
+        EXPECT_EQ(threadAllocationCount() - before, 0u) << m.mode;
+    }
+
+    uint64_t before = threadAllocationCount();
+    size_t out_len = 0;
+    EXPECT_EQ(xorBytes(plaintext, plaintext, ciphertext), plaintext.size());
+    EXPECT_EQ(qrypt_encrypt(QRYPT_KEY_AES, QRYPT_AES_OCB, key.data(), key.size(), plaintext.data(), plaintext.size(),
+                            ciphertext.data(), ciphertext.size(), &out_len), QRYPT_OK);
+    EXPECT_EQ(qrypt_decrypt(QRYPT_KEY_AES, QRYPT_AES_OCB, key.data(), key.size(), ciphertext.data(), out_len,
+                            decrypted.data(), decrypted.size(), &out_len), QRYPT_OK);
+    EXPECT_EQ(threadAllocationCount() - before, 0u) << "xorBytes and the C API";
+}
+
+TEST(MetricsTest, FileMergesCounters) {
+    std::string path = (std::filesystem::temp_directory_path() / "qrypt_metrics_test.prom").string();
+    std::filesystem::remove(path);
+    incrementCounter("qrypt_runs_total", {{"command", "test\"quoted\""}, {"result", "success"}}, 2);
+    setGauge("qrypt_last_run_duration_seconds", {{"command", "test"}}, 1.5);
+
+    writeMetricsFile(path);
+    writeMetricsFile(path);
+
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    // Counters add up across writes, gauges are replaced
+    EXPECT_NE(contents.str().find("qrypt_runs_total{command=\"test\\\"quoted\\\"\",result=\"success\"} 4\n"),
+              std::string::npos) << contents.str();
+    EXPECT_NE(contents.str().find("qrypt_last_run_duration_seconds{command=\"test\"} 1.5\n"), std::string::npos);
+    EXPECT_NE(contents.str().find("# TYPE qrypt_runs_total counter\n"), std::string::npos);
+    EXPECT_NE(contents.str().find("# TYPE qrypt_last_run_duration_seconds gauge\n"), std::string::npos);
+    EXPECT_FALSE(std::filesystem::exists(path + ".tmp"));
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + ".lock");
+}
+
+TEST(TraceTest, RecordsSpansFromEachThread) {
+    std::string path = (std::filesystem::temp_directory_path() / "qrypt_trace_test.json").string();
+    {
+        TRACE_SCOPE("before start");
+    }
+    startTrace();
+    {
+        TRACE_SCOPE("on main", 42);
+        std::thread worker([]() { TRACE_SCOPE("on worker"); });
+        worker.join();
+    }
+    writeTrace(path);
+    {
+        TRACE_SCOPE("after write");
+    }
+
+    std::ifstream file(path);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    std::string trace = contents.str();
+    EXPECT_EQ(trace.find("before start"), std::string::npos);
+    EXPECT_EQ(trace.find("after write"), std::string::npos);
+    EXPECT_NE(trace.find("\"name\":\"on main\",\"cat\":\"qrypt\",\"ph\":\"X\""), std::string::npos) << trace;
+    EXPECT_NE(trace.find("\"args\":{\"bytes\":42}"), std::string::npos);
+    // The worker's span is on a thread of its own
+    size_t main_tid = trace.find("\"tid\":", trace.find("on main"));
+    size_t worker_tid = trace.find("\"tid\":", trace.find("on worker"));
+    ASSERT_NE(worker_tid, std::string::npos);
+    EXPECT_NE(trace.substr(main_tid, 8), trace.substr(worker_tid, 8));
+    std::filesystem::remove(path);
+}
+
+TEST(EncryptTest, DerivedKeysMatchHKDF) {
+    std::vector<uint8_t> master(AESKeyLengthInBytes, 0x0b), salt(HKDF_SALT_SIZE, 0x5a);
+
+    // HKDF-SHA256 (RFC 5869) written out with HMAC: extract, then two blocks of expand for 44 bytes
+    unsigned int len = 0;
+    uint8_t prk[32], okm[64];
+    HMAC(EVP_sha256(), salt.data(), salt.size(), master.data(), master.size(), prk, &len);
+    std::string info = std::string("qrypt file key v1") + '\0' + "backups";
+    std::vector<uint8_t> block;
+    for (uint8_t counter = 1; counter <= 2; counter++) {
+        block.insert(block.end(), info.begin(), info.end());
+        block.push_back(counter);
+        HMAC(EVP_sha256(), prk, sizeof(prk), block.data(), block.size(), okm + 32 * (counter - 1), &len);
+        block.assign(okm + 32 * (counter - 1), okm + 32 * counter);
+    }
+
+    DerivedKey derived = deriveKey(master, salt, "backups");
+    EXPECT_EQ(derived.key, std::vector<uint8_t>(okm, okm + AESKeyLengthInBytes));
+    EXPECT_EQ(derived.iv, std::vector<uint8_t>(okm + AESKeyLengthInBytes, okm + AESKeyWithIVLengthInBytes));
+    EXPECT_NE(deriveKey(master, salt, "other").key, derived.key);
+
+    // Each encryption picks a new salt, and decrypt finds it in the header
+    std::string plaintext(100000, 'p');
+    std::string master_key(master.begin(), master.end());
+    std::string first;
+    for (int i = 0; i < 2; i++) {
+        std::istringstream input(plaintext), key(master_key);
+        std::ostringstream ciphertext;
+        encryptDecrypt("encrypt", input, key, ciphertext, "binary", "ocb", "aes", false, std::string("backups"));
+        EXPECT_NE(ciphertext.str(), first);
+        first = ciphertext.str();
+
+        std::istringstream encrypted(ciphertext.str()), key_again(master_key);
+        std::ostringstream decrypted;
+        encryptDecrypt("decrypt", encrypted, key_again, decrypted, "binary", "ocb", "aes");
+        EXPECT_EQ(decrypted.str(), plaintext);
+    }
+}
+
+TEST(EncryptTest, RejectsForgedChunkLayout) {
+    EXPECT_EQ(ChunkLayout(33, 16, "ocb").count, 3u);
+    EXPECT_EQ(ChunkLayout(33, 16, "ocb").ciphertextTotalSize(), 33u + 3 * AETagSizeInBytes);
+    EXPECT_EQ(ChunkLayout(0, 16, "ocb").ciphertextTotalSize(), 0u);
+    EXPECT_THROW(ChunkLayout(100, MAX_CHUNK_SIZE + 16, "ocb"), std::invalid_argument);
+    EXPECT_THROW(ChunkLayout(UINT64_MAX, 1, "ocb"), std::invalid_argument);
+    EXPECT_THROW(ChunkLayout(UINT64_MAX, MAX_CHUNK_SIZE, "ecb"), std::invalid_argument);
+
+    // Sizes in a chunked header must match the ciphertext that follows before any chunk is read
+    std::string key(AESKeyLengthInBytes, '\0');
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (char)(i * 13 + 1);
+    }
+    for (uint64_t chunk_size : {(uint64_t)1, MAX_CHUNK_SIZE, (uint64_t)1 << 40}) {
+        CryptHeader header;
+        header.flags = CRYPT_HEADER_FLAG_HKDF | CRYPT_HEADER_FLAG_CHUNKED;
+        header.fields[CRYPT_HEADER_FIELD_HKDF_SALT] = std::vector<uint8_t>(HKDF_SALT_SIZE, 1);
+        header.fields[CRYPT_HEADER_FIELD_CHUNK_SIZE] = encodeU64Field(chunk_size);
+        header.fields[CRYPT_HEADER_FIELD_PLAINTEXT_SIZE] = encodeU64Field((uint64_t)1 << 40);
+        std::vector<uint8_t> bytes = header.serialize();
+        bytes.resize(bytes.size() + 100);
+        std::istringstream input(std::string(bytes.begin(), bytes.end()));
+        std::istringstream key_stream(key);
+        std::ostringstream output;
+        EXPECT_THROW(encryptDecryptStream("decrypt", input, key_stream, output, "binary", "ocb", "aes"),
+                     std::invalid_argument) << chunk_size;
+    }
+}
+
+TEST(PadLedgerTest, HandsOutEachByteOnce) {
+    std::string ledger_filename = (std::filesystem::temp_directory_path() / "qrypt_pad_test.ledger").string();
+    std::filesystem::remove(ledger_filename);
+    std::string pad(1000, '\0');
+    std::mt19937 generator(7);
+    for (auto& byte : pad) {
+        byte = (char)generator();
+    }
+
+    PadLedger ledger(ledger_filename, pad.size());
+    std::vector<std::string> messages = {"first message", "second", std::string(900, 'x')};
+    std::vector<std::string> ciphertexts;
+    uint64_t expected_offset = 0;
+    for (const auto& message : messages) {
+        PadRange range = ledger.reserve(message.size());
+        EXPECT_EQ(range.offset, expected_offset);
+        expected_offset += message.size();
+
+        std::istringstream input(message), key(pad);
+        std::ostringstream ciphertext;
+        encryptDecrypt("encrypt", input, key, ciphertext, "binary", "ocb", "otp", false, std::nullopt, range);
+        ciphertexts.push_back(ciphertext.str());
+    }
+    EXPECT_EQ(ledger.consumed(), expected_offset);
+    EXPECT_THROW(ledger.reserve(pad.size() - expected_offset + 1), std::invalid_argument);
+    // The ledger belongs to a pad of this size only
+    EXPECT_THROW(PadLedger(ledger_filename, pad.size() + 1).reserve(1), std::runtime_error);
+
+    // Decrypt finds each range in the header
+    for (size_t i = 0; i < messages.size(); i++) {
+        std::istringstream encrypted(ciphertexts[i]), key(pad);
+        std::ostringstream decrypted;
+        encryptDecrypt("decrypt", encrypted, key, decrypted, "binary", "ocb", "otp");
+        EXPECT_EQ(decrypted.str(), messages[i]);
+    }
+    std::filesystem::remove(ledger_filename);
+    std::filesystem::remove(ledger_filename + ".lock");
+}
+
+TEST(DirCryptTest, ChunkedTreeRoundTrip) {
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / "qrypt_dir_test";
+    fs::remove_all(root);
+    std::mt19937 generator(11);
+    writeRandom(root / "plain" / "large.bin", generator, 10 * 4096 + 5);
+    writeRandom(root / "plain" / "a" / "small.bin", generator, 100);
+    writeRandom(root / "plain" / "a" / "b" / "empty.bin", generator, 0);
+    writeRandom(root / "key.bin", generator, AESKeyLengthInBytes);
+
+    DirCryptConfig config;
+    config.operation = "encrypt";
+    config.input_dir = (root / "plain").string();
+    config.output_dir = (root / "encrypted").string();
+    config.key_filename = (root / "key.bin").string();
+    config.key_type = "aes";
+    config.threads = 3;
+    config.chunk_size = 4096;
+    DirCryptSummary summary = encryptDecryptDirectory(config);
+    EXPECT_TRUE(summary.failures.empty());
+    EXPECT_EQ(summary.files, 3u);
+    EXPECT_EQ(summary.chunks, 11u);
+
+    config.operation = "decrypt";
+    config.input_dir = config.output_dir;
+    config.output_dir = (root / "decrypted").string();
+    summary = encryptDecryptDirectory(config);
+    EXPECT_TRUE(summary.failures.empty());
+    EXPECT_EQ(summary.chunks, 11u);
+    for (const char* name : {"large.bin", "a/small.bin", "a/b/empty.bin"}) {
+        EXPECT_EQ(readFile(root / "decrypted" / name), readFile(root / "plain" / name)) << name;
+    }
+
+    // A chunked file also decrypts on its own, one chunk after another
+    std::ifstream encrypted(root / "encrypted" / "large.bin", std::ios::binary);
+    std::ifstream key(root / "key.bin", std::ios::binary);
+    std::ostringstream decrypted;
+    encryptDecrypt("decrypt", encrypted, key, decrypted, "binary", "ocb", "aes");
+    EXPECT_EQ(decrypted.str(), readFile(root / "plain" / "large.bin"));
+    fs::remove_all(root);
+}
+
+TEST(DirCryptTest, RejectsForgedChunkCountBeforePlanning) {
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / "qrypt_dir_forged_test";
+    fs::remove_all(root);
+    fs::create_directories(root / "encrypted");
+    std::string key(AESKeyLengthInBytes, '\0');
+    for (size_t i = 0; i < key.size(); i++) {
+        key[i] = (char)(i * 13 + 1);
+    }
+    writeFile(root / "key.bin", key);
+
+    // Chunk size 1 and a huge plaintext size would be billions of chunk plans
+    CryptHeader header;
+    header.flags = CRYPT_HEADER_FLAG_HKDF | CRYPT_HEADER_FLAG_CHUNKED;
+    header.fields[CRYPT_HEADER_FIELD_HKDF_SALT] = std::vector<uint8_t>(HKDF_SALT_SIZE, 1);
+    header.fields[CRYPT_HEADER_FIELD_CHUNK_SIZE] = encodeU64Field(1);
+    header.fields[CRYPT_HEADER_FIELD_PLAINTEXT_SIZE] = encodeU64Field((uint64_t)1 << 40);
+    std::vector<uint8_t> bytes = header.serialize();
+    bytes.resize(bytes.size() + 8192);
+    std::ofstream(root / "encrypted" / "forged.bin", std::ios::binary).write((const char*)bytes.data(), bytes.size());
+
+    DirCryptConfig config;
+    config.operation = "decrypt";
+    config.input_dir = (root / "encrypted").string();
+    config.output_dir = (root / "decrypted").string();
+    config.key_filename = (root / "key.bin").string();
+    config.key_type = "aes";
+    config.threads = 1;
+    config.chunk_size = 4096;
+    DirCryptSummary summary = encryptDecryptDirectory(config);
+    ASSERT_EQ(summary.failures.size(), 1u);
+    EXPECT_NE(summary.failures[0].second.find("truncated"), std::string::npos) << summary.failures[0].second;
+    EXPECT_FALSE(fs::exists(root / "decrypted" / "forged.bin"));
+    fs::remove_all(root);
+}
+
+TEST(DirCryptTest, IoUringBatchesRoundTrip) {
+    if (!ioUringAvailable()) {
+        GTEST_SKIP() << "io_uring is not available";
+    }
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / "qrypt_dir_io_uring_test";
+    fs::remove_all(root);
+    std::mt19937 generator(17);
+    // Enough small files for several batches per thread, and one that is split into chunks
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 40; i++) {
+        names.push_back("d" + std::to_string(i % 3) + "/f" + std::to_string(i) + ".bin");
+        writeRandom(root / "plain" / names.back(), generator, i * 97);
+    }
+    names.push_back("large.bin");
+    writeRandom(root / "plain" / "large.bin", generator, 3 * 4096 + 1);
+    writeRandom(root / "aes.key", generator, AESKeyLengthInBytes);
+    writeRandom(root / "otp.key", generator, 200 * KB);
+
+    for (const char* key_type : {"aes", "otp"}) {
+        DirCryptConfig config;
+        config.operation = "encrypt";
+        config.input_dir = (root / "plain").string();
+        config.output_dir = (root / key_type / "encrypted").string();
+        config.key_filename = (root / (std::string(key_type) + ".key")).string();
+        config.key_type = key_type;
+        config.threads = 2;
+        config.chunk_size = 4096;
+        config.io_engine = IoEngine::IoUring;
+        config.queue_depth = 4;
+        DirCryptSummary summary = encryptDecryptDirectory(config);
+        EXPECT_TRUE(summary.failures.empty()) << key_type;
+        EXPECT_EQ(summary.files, names.size()) << key_type;
+        EXPECT_EQ(summary.chunked_files, 1u) << key_type;
+
+        // Either engine decrypts what io_uring wrote
+        for (IoEngine engine : {IoEngine::IoUring, IoEngine::Sync}) {
+            config.operation = "decrypt";
+            config.input_dir = (root / key_type / "encrypted").string();
+            config.output_dir = (root / key_type / (engine == IoEngine::Sync ? "sync" : "io_uring")).string();
+            config.io_engine = engine;
+            summary = encryptDecryptDirectory(config);
+            EXPECT_TRUE(summary.failures.empty()) << key_type;
+            for (const auto& name : names) {
+                EXPECT_EQ(readFile(fs::path(config.output_dir) / name), readFile(root / "plain" / name))
+                    << key_type << " " << name;
+            }
+        }
+    }
+    fs::remove_all(root);
+}
+
+TEST(IoEngineTest, EnginesMatchWholeFileOutput) {
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / "qrypt_io_engine_test";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    std::mt19937 generator(13);
+    // Empty, shorter than a block, several blocks with a short last one, and a bitmap
+    struct Input {
+        std::string name;
+        size_t size;
+        std::string file_type;
+    };
+    std::vector<Input> inputs = {
+        {"empty.bin", 0, "binary"}, {"small.bin", 100, "binary"}, {"large.bin", 3 * 4096 + 7, "binary"},
+        {"image.bmp", BMP_HEADER_SIZE + 5000, "bitmap"}
+    };
+    size_t shared_pad_size = 0;
+    for (const auto& input : inputs) {
+        size_t data_size = input.size - (input.file_type == "bitmap" ? BMP_HEADER_SIZE : 0);
+        writeRandom(root / input.name, generator, input.size);
+        writeRandom(root / (input.name + ".pad"), generator, data_size);
+        shared_pad_size += data_size + 3;
+    }
+    writeRandom(root / "aes.key", generator, AESKeyLengthInBytes);
+    writeRandom(root / "shared.pad", generator, shared_pad_size);
+
+    std::vector<IoEngine> engines = {IoEngine::Sync};
+    if (ioUringAvailable()) {
+        engines.push_back(IoEngine::IoUring);
+    }
+    auto wholeFile = [&](const std::string& operation, const CryptJob& job, const std::string& aes_mode,
+                         const std::string& key_type, const std::optional<std::string>& key_context) {
+        std::ifstream input(job.input_filename, std::ios::binary);
+        std::ifstream key(job.key_filename, std::ios::binary);
+        std::ostringstream output;
+        encryptDecrypt(operation, input, key, output, job.file_type, aes_mode, key_type, false, key_context,
+                       job.pad_range);
+        return output.str();
+    };
+
+    // Without key derivation the ciphertext is deterministic, so every engine must write the same bytes
+    struct Case {
+        std::string aes_mode;
+        std::string key_type;
+        bool pad_ranges; // ranges of one shared pad, as a PadLedger hands them out
+    };
+    for (const Case& c : std::vector<Case>{{"ocb", "aes", false}, {"ecb", "aes", false}, {"ocb", "otp", false},
+                                           {"ocb", "otp", true}}) {
+        std::string label = c.aes_mode + " " + c.key_type + (c.pad_ranges ? " pad range" : "");
+        std::vector<CryptJob> encrypt_jobs;
+        uint64_t pad_offset = 1;
+        for (const auto& input : inputs) {
+            CryptJob job;
+            job.input_filename = (root / input.name).string();
+            job.file_type = input.file_type;
+            if (c.key_type == "aes") {
+                job.key_filename = (root / "aes.key").string();
+            }
+            else if (c.pad_ranges) {
+                size_t data_size = input.size - (input.file_type == "bitmap" ? BMP_HEADER_SIZE : 0);
+                job.key_filename = (root / "shared.pad").string();
+                job.pad_range = PadRange{pad_offset, data_size};
+                pad_offset += data_size + 3;
+            }
+            else {
+                job.key_filename = (root / (input.name + ".pad")).string();
+            }
+            encrypt_jobs.push_back(job);
+        }
+        std::vector<std::string> expected;
+        for (const auto& job : encrypt_jobs) {
+            expected.push_back(wholeFile("encrypt", job, c.aes_mode, c.key_type, std::nullopt));
+        }
+
+        for (IoEngine engine : engines) {
+            std::string suffix = engine == IoEngine::Sync ? ".sync" : ".io_uring";
+            std::vector<CryptJob> jobs = encrypt_jobs;
+            for (auto& job : jobs) {
+                job.output_filename = job.input_filename + suffix + ".enc";
+            }
+            // Fewer slots than files, so slots are reused
+            EXPECT_EQ(runCryptJobs(jobs, "encrypt", c.aes_mode, c.key_type, engine, 2, 4096), 0u) << label;
+            for (size_t i = 0; i < jobs.size(); i++) {
+                EXPECT_EQ(readFile(jobs[i].output_filename), expected[i]) << label << " " << jobs[i].output_filename;
+            }
+
+            // The pad range comes back from the CryptHeader
+            for (auto& job : jobs) {
+                job.input_filename = job.output_filename;
+                job.output_filename = job.input_filename + ".dec";
+                job.pad_range.reset();
+            }
+            EXPECT_EQ(runCryptJobs(jobs, "decrypt", c.aes_mode, c.key_type, engine, 2, 4096), 0u) << label;
+            for (size_t i = 0; i < jobs.size(); i++) {
+                EXPECT_EQ(readFile(jobs[i].output_filename), readFile(encrypt_jobs[i].input_filename))
+                    << label << " " << jobs[i].output_filename;
+            }
+        }
+    }
+
+    // Derived keys use a random salt, so check that each engine's ciphertext decrypts with every path
+    std::string key_context = "io engine test";
+    for (IoEngine encrypt_engine : engines) {
+        std::vector<CryptJob> jobs;
+        for (const auto& input : inputs) {
+            CryptJob job;
+            job.input_filename = (root / input.name).string();
+            job.output_filename = job.input_filename + ".derived.enc";
+            job.key_filename = (root / "aes.key").string();
+            job.file_type = input.file_type;
+            jobs.push_back(job);
+        }
+        EXPECT_EQ(runCryptJobs(jobs, "encrypt", "ocb", "aes", encrypt_engine, 2, 4096, false, key_context), 0u);
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].input_filename = jobs[i].output_filename;
+            EXPECT_EQ(wholeFile("decrypt", jobs[i], "ocb", "aes", std::nullopt), readFile(root / inputs[i].name))
+                << jobs[i].input_filename;
+        }
+        for (IoEngine decrypt_engine : engines) {
+            for (auto& job : jobs) {
+                job.output_filename = job.input_filename + ".dec";
+            }
+            EXPECT_EQ(runCryptJobs(jobs, "decrypt", "ocb", "aes", decrypt_engine, 2, 4096), 0u);
+            for (size_t i = 0; i < jobs.size(); i++) {
+                EXPECT_EQ(readFile(jobs[i].output_filename), readFile(root / inputs[i].name)) << jobs[i].output_filename;
+            }
+        }
+    }
+    fs::remove_all(root);
+}
+
+TEST(IoEngineTest, FailedJobRemovesItsOutput) {
+    namespace fs = std::filesystem;
+    fs::path root = fs::temp_directory_path() / "qrypt_io_engine_fail_test";
+    fs::remove_all(root);
+    fs::create_directories(root);
+    std::string plain(5000, '\0');
+    for (size_t i = 0; i < plain.size(); i++) {
+        plain[i] = (char)(i * 7);
+    }
+    writeFile(root / "key.bin", plain.substr(1, AESKeyLengthInBytes));
+    // A ciphertext with and without a CryptHeader, each with its tag spoiled
+    for (const auto& key_context : {std::optional<std::string>(), std::optional<std::string>("tamper")}) {
+        std::istringstream input(plain);
+        std::ifstream key(root / "key.bin", std::ios::binary);
+        std::ostringstream output;
+        encryptDecrypt("encrypt", input, key, output, "binary", "ocb", "aes", false, key_context);
+        std::string name = key_context ? "derived" : "plain";
+        std::string ciphertext = output.str();
+        writeFile(root / (name + ".enc"), ciphertext);
+        ciphertext.back() ^= 1;
+        writeFile(root / (name + "_tampered.enc"), ciphertext);
+    }
+
+    std::vector<IoEngine> engines = {IoEngine::Sync};
+    if (ioUringAvailable()) {
+        engines.push_back(IoEngine::IoUring);
+    }
+    for (IoEngine engine : engines) {
+        std::vector<CryptJob> jobs;
+        for (const char* name : {"plain", "missing", "plain_tampered", "derived", "derived_tampered"}) {
+            CryptJob job;
+            job.input_filename = (root / (std::string(name) + ".enc")).string();
+            job.output_filename = (root / (std::string(name) + ".out")).string();
+            job.key_filename = (root / "key.bin").string();
+            jobs.push_back(job);
+        }
+        // Blocks smaller than the file, so plaintext is written before the tag is checked
+        EXPECT_EQ(runCryptJobs(jobs, "decrypt", "ocb", "aes", engine, 4, 1024), 3u);
+        for (const auto& job : jobs) {
+            bool good = job.input_filename.find("tampered") == std::string::npos &&
+                        job.input_filename.find("missing") == std::string::npos;
+            EXPECT_EQ(job.error.empty(), good) << job.input_filename;
+            if (good) {
+                EXPECT_EQ(readFile(job.output_filename), plain) << job.output_filename;
+            }
+            else {
+                EXPECT_FALSE(fs::exists(job.output_filename)) << job.output_filename;
+            }
+        }
+        for (const auto& job : jobs) {
+            fs::remove(job.output_filename);
+        }
+    }
+    fs::remove_all(root);
+}
+
+TEST(ArchiveTest, ExtractsOneMemberFromItsSegments) {
+    std::vector<uint8_t> key(AESKeyLengthInBytes, 0x42);
+    std::vector<std::pair<std::string, std::string>> files = {
+        {"a.txt", "first"}, {"dir/empty", ""}, {"dir/large.bin", std::string(1000, 'L')}, {"z.txt", "last"}
+    };
+    std::stringstream archive;
+    ArchiveWriter writer(archive, key, "test", 64);
+    for (const auto& [name, contents] : files) {
+        std::istringstream data(contents);
+        writer.add(name, data);
+    }
+    std::istringstream duplicate("again");
+    EXPECT_THROW(writer.add("a.txt", duplicate), std::invalid_argument);
+    writer.finish();
+
+    ArchiveReader reader(archive, key);
+    ASSERT_EQ(reader.members().size(), files.size());
+    for (const auto& [name, contents] : files) {
+        std::ostringstream extracted;
+        reader.extract(reader.find(name), extracted);
+        EXPECT_EQ(extracted.str(), contents) << name;
+    }
+    EXPECT_THROW(reader.find("missing"), std::invalid_argument);
+
+    // A member is authenticated by its segments, and the index by itself
+    std::string bytes = archive.str();
+    std::string tampered = bytes;
+    tampered[tampered.size() - ARCHIVE_TRAILER_SIZE - 1] ^= 1;
+    std::istringstream tampered_index(tampered);
+    EXPECT_ANY_THROW(ArchiveReader(tampered_index, key));
+    std::istringstream wrong_key(bytes);
+    EXPECT_ANY_THROW(ArchiveReader(wrong_key, std::vector<uint8_t>(AESKeyLengthInBytes, 0x43)));
+}
+
+TEST(ArchiveTest, DecryptsEachSegmentOnce) {
+    std::vector<uint8_t> key(AESKeyLengthInBytes, 0x42);
+    std::stringstream archive;
+    ArchiveWriter writer(archive, key, "", 1024);
+    for (int i = 0; i < 100; i++) {
+        std::istringstream data(std::string(100, (char)i));
+        writer.add("f" + std::to_string(i), data);
+    }
+    writer.finish();
+
+    // Ten members share each segment, but extracting them in order decrypts it only once
+    ArchiveReader reader(archive, key);
+    uint64_t counted = cryptBytesCounted();
+    std::ostringstream extracted;
+    for (const ArchiveMember& member : reader.members()) {
+        reader.extract(member, extracted);
+    }
+    EXPECT_EQ(extracted.str().size(), writer.contentsSize());
+    EXPECT_EQ(cryptBytesCounted() - counted, encryptedSize(writer.contentsSize(), "ocb", "aes") + 9 * AETagSizeInBytes);
+}
+
+TEST(KeyGenBatchTest, NumbersFilesBeforeTheExtension) {
+    // generate --count and replicate --watch-dir must agree on these names
+    EXPECT_EQ(numberedFilename("meta.dat", 0), "meta.0.dat");
+    EXPECT_EQ(numberedFilename("keys/key.hex", 12), (std::filesystem::path("keys") / "key.12.hex").string());
+    EXPECT_EQ(numberedFilename("pad", 3), "pad.3");
+}
+
+TEST(KeyFileTest, ContainerIsReadWithoutSniffing) {
+    // A raw pad made only of hex digits, which a plain key file would mistake for hex
+    std::string pad_chars(64, 'a');
+    std::vector<uint8_t> pad(pad_chars.begin(), pad_chars.end());
+    std::string filename = (std::filesystem::temp_directory_path() / "qrypt_key_file_test.qkey").string();
+    {
+        std::ofstream key_out(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+        writeKeyFile(key_out, "otp", pad);
+    }
+
+    std::ifstream key_stream(filename, std::ios::in | std::ios::binary);
+    bool hex = true;
+    uint64_t data_offset = 0;
+    EXPECT_EQ(keySize(key_stream, &hex, &data_offset), pad.size());
+    EXPECT_FALSE(hex);
+    EXPECT_EQ(data_offset, KEY_FILE_HEADER_SIZE);
+    EXPECT_EQ(readKey(key_stream), pad);
+
+    // The mapped and streamed pads give the same ciphertext
+    KeyFile key_file(filename);
+    EXPECT_EQ(key_file.keyType(), "otp");
+    EXPECT_THROW(key_file.checkType("aes"), std::invalid_argument);
+    std::string message(pad.size(), 'm');
+    std::istringstream mapped_input(message), streamed_input(message);
+    std::ostringstream mapped_output, streamed_output;
+    encryptDecrypt("encrypt", mapped_input, key_file, mapped_output);
+    key_stream.clear();
+    key_stream.seekg(0);
+    encryptDecryptStream("encrypt", streamed_input, key_stream, streamed_output);
+    EXPECT_EQ(mapped_output.str(), streamed_output.str());
+    std::vector<uint8_t> expected = xorVectors(pad, std::vector<uint8_t>(message.begin(), message.end()));
+    EXPECT_EQ(mapped_output.str(), std::string(expected.begin(), expected.end()));
+
+    // A damaged key is caught by its checksum, a damaged header by its own
+    key_stream.clear();
+    key_stream.seekg(0);
+    std::string contents(std::istreambuf_iterator<char>(key_stream), {});
+    for (size_t damaged_byte : {KEY_FILE_HEADER_SIZE + 3, (size_t)16}) {
+        std::string damaged = contents;
+        damaged[damaged_byte] ^= 1;
+        std::istringstream damaged_stream(damaged);
+        EXPECT_THROW(readKey(damaged_stream), std::invalid_argument) << damaged_byte;
+    }
+    std::filesystem::remove(filename);
+}
+
+TEST(IncrementalTest, ReencryptsOnlyChangedChunks) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "qrypt_incremental_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::string key_filename = (dir / "key.bin").string();
+    std::string input_filename = (dir / "input.bin").string();
+    std::string store_dir = (dir / "store").string();
+    writeFile(key_filename, std::string(AESKeyLengthInBytes, 'k'));
+    std::mt19937 rng(7);
+    std::string contents = randomString(rng, 2 * 1024 * 1024);
+    writeFile(input_filename, contents);
+    IncrementalSummary first = encryptIncremental(input_filename, store_dir, key_filename);
+    EXPECT_EQ(first.new_chunks, first.chunks);
+
+    // An insertion moves every byte after it, but only the chunks around it change
+    contents.insert(1000000, "inserted");
+    writeFile(input_filename, contents);
+    IncrementalSummary second = encryptIncremental(input_filename, store_dir, key_filename);
+    EXPECT_EQ(second.plaintext_size, contents.size());
+    EXPECT_GE(second.new_chunks, 1u);
+    EXPECT_LE(second.new_chunks, 2u);
+    EXPECT_EQ(second.removed_chunks, second.new_chunks);
+
+    std::ostringstream decrypted;
+    decryptIncremental(store_dir, key_filename, decrypted);
+    EXPECT_TRUE(decrypted.str() == contents);
+
+    // A tampered chunk fails authentication, and no partly written plaintext is left behind
+    std::string output_filename = (dir / "output.bin").string();
+    std::filesystem::path tampered;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(std::filesystem::path(store_dir) / "chunks")) {
+        if (entry.is_regular_file() && entry.path() > tampered) {
+            tampered = entry.path();
+        }
+    }
+    ASSERT_FALSE(tampered.empty());
+    {
+        std::fstream chunk(tampered, std::ios::in | std::ios::out | std::ios::binary);
+        chunk.seekg(20);
+        char byte = (char)chunk.get();
+        chunk.seekp(20);
+        chunk.put((char)(byte ^ 1));
+    }
+    EXPECT_THROW(decryptIncremental(store_dir, key_filename, output_filename), std::runtime_error);
+    EXPECT_FALSE(std::filesystem::exists(output_filename));
+    std::filesystem::remove_all(dir);
+}
+
+TEST(DrbgTest, MatchesOpenSslCtrDrbg) {
+    std::mt19937 rng(11);
+    auto bytes = [&rng](size_t size) {
+        std::vector<uint8_t> result(size);
+        for (auto& b : result) {
+            b = (uint8_t)rng();
+        }
+        return result;
+    };
+    std::vector<uint8_t> entropy = bytes(CTR_DRBG_SEED_SIZE), reseed_entropy = bytes(CTR_DRBG_SEED_SIZE);
+    std::vector<uint8_t> personalization = bytes(20), additional = bytes(CTR_DRBG_SEED_SIZE);
+
+    // OpenSSL's CTR-DRBG without a derivation function, fed the same entropy by a TEST-RAND parent
+    EVP_RAND* test_rand = EVP_RAND_fetch(nullptr, "TEST-RAND", nullptr);
+    EVP_RAND* ctr_rand = EVP_RAND_fetch(nullptr, "CTR-DRBG", nullptr);
+    ASSERT_TRUE(test_rand && ctr_rand);
+    EVP_RAND_CTX* parent = EVP_RAND_CTX_new(test_rand, nullptr);
+    EVP_RAND_CTX* reference = EVP_RAND_CTX_new(ctr_rand, parent);
+    unsigned int strength = 256;
+    int use_df = 0;
+    char cipher[] = "AES-256-CTR";
+    OSSL_PARAM parent_params[] = {
+        OSSL_PARAM_construct_uint(OSSL_RAND_PARAM_STRENGTH, &strength),
+        OSSL_PARAM_construct_octet_string(OSSL_RAND_PARAM_TEST_ENTROPY, entropy.data(), entropy.size()),
+        OSSL_PARAM_construct_end()
+    };
+    OSSL_PARAM drbg_params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_DRBG_PARAM_CIPHER, cipher, 0),
+        OSSL_PARAM_construct_int(OSSL_DRBG_PARAM_USE_DF, &use_df),
+        OSSL_PARAM_construct_end()
+    };
+    ASSERT_EQ(EVP_RAND_instantiate(parent, strength, 0, nullptr, 0, parent_params), 1);
+    ASSERT_EQ(EVP_RAND_instantiate(reference, strength, 0, personalization.data(), personalization.size(),
+                                   drbg_params), 1);
+
+    CtrDrbg drbg(entropy, personalization);
+    std::vector<uint8_t> expected(CTR_DRBG_MAX_REQUEST), actual(CTR_DRBG_MAX_REQUEST);
+    for (size_t size : {(size_t)1, (size_t)64, (size_t)1000, CTR_DRBG_MAX_REQUEST}) {
+        ASSERT_EQ(EVP_RAND_generate(reference, expected.data(), size, strength, 0, nullptr, 0), 1);
+        drbg.generate(actual.data(), size);
+        EXPECT_TRUE(std::equal(expected.begin(), expected.begin() + size, actual.begin())) << size;
+    }
+    ASSERT_EQ(EVP_RAND_generate(reference, expected.data(), 100, strength, 0, additional.data(), additional.size()), 1);
+    drbg.generate(actual.data(), 100, additional);
+    EXPECT_TRUE(std::equal(expected.begin(), expected.begin() + 100, actual.begin()));
+
+    // OpenSSL reseeds from its parent after any entropy passed in, so hand the reseed entropy to the parent
+    OSSL_PARAM reseed_params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_RAND_PARAM_TEST_ENTROPY, reseed_entropy.data(), reseed_entropy.size()),
+        OSSL_PARAM_construct_end()
+    };
+    ASSERT_EQ(EVP_RAND_CTX_set_params(parent, reseed_params), 1);
+    ASSERT_EQ(EVP_RAND_reseed(reference, 0, nullptr, 0, additional.data(), 10), 1);
+    drbg.reseed(reseed_entropy, ByteSpan(additional.data(), 10));
+    ASSERT_EQ(EVP_RAND_generate(reference, expected.data(), 4096, strength, 0, nullptr, 0), 1);
+    drbg.generate(actual.data(), 4096);
+    EXPECT_TRUE(std::equal(expected.begin(), expected.begin() + 4096, actual.begin()));
+
+    EVP_RAND_CTX_free(reference);
+    EVP_RAND_CTX_free(parent);
+    EVP_RAND_free(ctr_rand);
+    EVP_RAND_free(test_rand);
+}
+
+TEST(DrbgTest, ThreadsDrawSeparateSeeds) {
+    // A counting source, so every seed differs and the draws can be checked
+    size_t drawn = 0;
+    setRandomSource([&drawn](size_t size) {
+        std::vector<uint8_t> entropy(size, (uint8_t)drawn);
+        entropy[0] = (uint8_t)(drawn >> 8);
+        drawn += size;
+        return entropy;
+    }, 1 << 20);
+
+    std::ostringstream first, second;
+    writeRandomBytes(first, (3 << 20) + 5, 2);
+    EXPECT_EQ(first.str().size(), (3u << 20) + 5);
+    // Each 1 MB block is a reseed interval, so four seeds at least
+    EXPECT_GE(drawn, 4 * CTR_DRBG_SEED_SIZE);
+    writeRandomBytes(second, 1 << 20, 1);
+    EXPECT_NE(first.str().substr(0, 1 << 20), second.str());
+
+    setRandomSource(EntropySource());
+    uint8_t byte;
+    EXPECT_THROW(randomBytes(&byte, 1), std::runtime_error);
+}
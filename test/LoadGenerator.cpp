@@ -0,0 +1,195 @@
+#include "common.h"
+#include "eaas.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <numeric>
+#include <thread>
+
+/*
+    Load generator
+
+    Drives the real curlRequest() code through EaaS::requestEntropy() or uploadFile() from many threads
+    and reports throughput and latency. Intended to be pointed at qrypt_standin, but any compatible
+    server can be used.
+ */
+
+static const char* LoadGenUsage =
+    "Usage: qrypt_loadgen [Optional Arguments]\n"
+    "\n"
+    "Drive the EaaS or upload client code against a server and report requests per second and latency.\n"
+    "\n"
+    "Optional Arguments:\n"
+    "  --help                          Display this message.\n"
+    "  --url=<base_url>                Server base url. Default \"http://127.0.0.1:5000\".\n"
+    "  --target=<entropy|upload>       Endpoint to exercise. Default \"entropy\".\n"
+    "  --threads=<count>               Number of concurrent clients. Default 4.\n"
+    "  --requests=<count>              Total number of requests to send. Default 1000.\n"
+    "  --size=<amount in KB>           (entropy) Amount of entropy per request, in KBs. Default 1.\n"
+    "  --filename=<filename>           (upload) Path of the file to upload. Default \"./meta.dat\".\n"
+    "  --token=<token>                 (entropy) API token sent as the bearer token. Defaults to a demo token.\n"
+    "\n";
+
+struct LoadGenArgs {
+    std::string url = "http://127.0.0.1:5000";
+    std::string target = "entropy";
+    uint32_t threads = 4;
+    uint64_t requests = 1000;
+    uint32_t size = 1;
+    std::string filename = "meta.dat";
+};
+
+static LoadGenArgs parseLoadGenArgs(char** unparsed_args) {
+    LoadGenArgs args;
+    while (*unparsed_args) {
+        auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
+        try {
+            if (arg_name == "--url") {
+                args.url = arg_value;
+            } else if (arg_name == "--target") {
+                args.target = arg_value;
+            } else if (arg_name == "--threads") {
+                args.threads = std::stoul(arg_value);
+            } else if (arg_name == "--requests") {
+                args.requests = std::stoull(arg_value);
+            } else if (arg_name == "--size") {
+                args.size = std::stoul(arg_value);
+            } else if (arg_name == "--filename") {
+                args.filename = arg_value;
+            } else if (arg_name == "--token") {
+                sdk_token = arg_value;
+            } else {
+                throw std::invalid_argument("Invalid argument: " + arg_name);
+            }
+        }
+        catch (std::invalid_argument&) {
+            throw;
+        }
+        catch (...) {
+            throw std::invalid_argument("Could not interpret " + arg_name + "=\"" + arg_value + "\" as a number!");
+        }
+    }
+    if (args.target != "entropy" && args.target != "upload") {
+        throw std::invalid_argument("Invalid target: \"" + args.target + "\"");
+    }
+    if (args.threads == 0 || args.requests == 0) {
+        throw std::invalid_argument("--threads and --requests must be greater than zero");
+    }
+    if (args.target == "upload" && !std::filesystem::exists(args.filename)) {
+        throw std::invalid_argument("File \"" + args.filename + "\" does not exist!");
+    }
+    return args;
+}
+
+// Swallows the responses that uploadFile() prints on success
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+static double percentile(const std::vector<double>& sorted, double pct) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = std::min(sorted.size() - 1, (size_t)(pct / 100.0 * sorted.size()));
+    return sorted[index];
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            std::cout << LoadGenUsage;
+            return 0;
+        }
+    }
+
+    LoadGenArgs args;
+    try {
+        args = parseLoadGenArgs(argv + 1);
+    }
+    catch (std::invalid_argument& ex) {
+        std::cout << LoadGenUsage;
+        std::cout << "\nERROR: " << ex.what() << std::endl << std::endl;
+        return 1;
+    }
+
+    // libcurl global state must be set up before any worker thread creates a handle
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    const std::string entropy_url = args.url + "/api/v1/quantum-entropy";
+    const std::string upload_url = args.url + "/upload";
+
+    std::atomic<uint64_t> next_request{0};
+    std::atomic<uint64_t> failures{0};
+    std::mutex latencies_mutex;
+    std::vector<double> latencies;
+    std::string first_error;
+
+    NullBuffer null_buffer;
+    std::streambuf* cout_buffer = std::cout.rdbuf(&null_buffer);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < args.threads; t++) {
+        workers.emplace_back([&]() {
+            EaaS eaas_client(sdk_token, entropy_url);
+            std::vector<double> local_latencies;
+            while (next_request++ < args.requests) {
+                auto request_start = std::chrono::steady_clock::now();
+                try {
+                    if (args.target == "entropy") {
+                        eaas_client.requestEntropy(args.size);
+                    } else {
+                        uploadFile(args.filename, upload_url);
+                    }
+                    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - request_start;
+                    local_latencies.push_back(elapsed.count());
+                }
+                catch (const std::exception& ex) {
+                    if (failures++ == 0) {
+                        std::lock_guard<std::mutex> lock(latencies_mutex);
+                        first_error = ex.what();
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(latencies_mutex);
+            latencies.insert(latencies.end(), local_latencies.begin(), local_latencies.end());
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout.rdbuf(cout_buffer);
+    curl_global_cleanup();
+
+    // Report
+    std::sort(latencies.begin(), latencies.end());
+    double mean = latencies.empty() ? 0 : std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size();
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "Target:        " << ((args.target == "entropy") ? entropy_url : upload_url) << std::endl;
+    std::cout << "Threads:       " << args.threads << std::endl;
+    std::cout << "Requests:      " << args.requests << " (" << failures << " failed)" << std::endl;
+    std::cout << "Elapsed:       " << elapsed.count() << " s" << std::endl;
+    std::cout << "Throughput:    " << latencies.size() / elapsed.count() << " successful requests/s" << std::endl;
+    std::cout << "Latency (ms):  mean " << mean
+              << "  p50 " << percentile(latencies, 50)
+              << "  p90 " << percentile(latencies, 90)
+              << "  p99 " << percentile(latencies, 99)
+              << "  max " << (latencies.empty() ? 0 : latencies.back()) << std::endl;
+    if (failures > 0) {
+        std::cout << "First error:   " << first_error << std::endl;
+    }
+
+    return (failures > 0) ? 1 : 0;
+}
@@ -0,0 +1,504 @@
+#include "common.h"
+#include "offline_keygen.h"
+
+#include "QryptSecurity/qryptsecurity.h"
+
+#include <openssl/evp.h>
+
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+extern char** environ;
+
+/*
+    Replication simulation
+
+    Measures how BLAST replication scales when one producer fans metadata out to many consumers. For each
+    node count N, one generator process and N replicator processes are started on this machine, connected by
+    a Unix domain socket. The generator creates keys and sends each key's metadata to every replicator; each
+    replicator recreates the key and sends back its SHA-256 digest, which the generator checks against its own
+    key. A key is agreed once all N digests are back, and the time from the start of genInit() to then is its
+    time to agreement.
+
+    The processes are this executable run again with --role=generator or --role=replicator.
+ */
+
+static const char* ReplicationSimUsage =
+    "Usage: qrypt_replication_sim [Optional Arguments]\n"
+    "\n"
+    "Start one generator process and N replicator processes, fan key metadata out to the replicators over a local\n"
+    "socket, and report the time to key agreement and throughput for each N.\n"
+    "\n"
+    "Optional Arguments:\n"
+    "  --help                          Display this message.\n"
+    "  --nodes=<n1,n2,...>             Replicator counts to run, one after another. Default \"1,2,4,8\".\n"
+    "  --keys=<count>                  Keys generated per run. Default 200.\n"
+    "  --key-len=<bytes>               Key length in bytes. Default 32.\n"
+    "  --in-flight=<count>             Keys sent but not yet agreed at any time. Default 1, which measures time to\n"
+    "                                  agreement without queueing; raise it to measure throughput.\n"
+    "  --sdk                           Generate and replicate keys with the Qrypt SDK. Without it keys come from the\n"
+    "                                  offline stand-in, OfflineKeyGen, so only the fan-out is measured.\n"
+    "  --token=<token>                 (With --sdk) API token for the SDK. Defaults to a demo token.\n"
+    "\n";
+
+namespace {
+
+const uint32_t END_OF_KEYS = 0xFFFFFFFF;
+const size_t DIGEST_SIZE = 32;
+const auto AGREEMENT_TIMEOUT = std::chrono::seconds(60);
+
+struct SimArgs {
+    std::string role;           // empty for the driver
+    std::vector<unsigned> nodes = {1, 2, 4, 8};
+    uint32_t keys = 200;
+    size_t key_len = 32;
+    unsigned in_flight = 1;
+    bool use_sdk = false;
+    std::string socket_path;
+};
+
+SimArgs parseSimArgs(char** unparsed_args) {
+    SimArgs args;
+    while (*unparsed_args) {
+        auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
+        try {
+            if (arg_name == "--nodes") {
+                args.nodes.clear();
+                std::stringstream list(arg_value);
+                for (std::string count; std::getline(list, count, ',');) {
+                    args.nodes.push_back(std::stoul(count));
+                }
+            } else if (arg_name == "--keys") {
+                args.keys = std::stoul(arg_value);
+            } else if (arg_name == "--key-len") {
+                args.key_len = std::stoul(arg_value);
+            } else if (arg_name == "--in-flight") {
+                args.in_flight = std::stoul(arg_value);
+            } else if (arg_name == "--sdk") {
+                args.use_sdk = true;
+            } else if (arg_name == "--token") {
+                sdk_token = arg_value;
+            } else if (arg_name == "--role") {
+                args.role = arg_value;
+            } else if (arg_name == "--socket") {
+                args.socket_path = arg_value;
+            } else {
+                throw std::invalid_argument("Invalid argument: " + arg_name);
+            }
+        }
+        catch (std::invalid_argument&) {
+            throw;
+        }
+        catch (...) {
+            throw std::invalid_argument("Could not interpret " + arg_name + "=\"" + arg_value + "\" as a number!");
+        }
+    }
+    if (args.nodes.empty() || std::count(args.nodes.begin(), args.nodes.end(), 0u) > 0) {
+        throw std::invalid_argument("--nodes must list counts greater than zero");
+    }
+    if (args.keys == 0 || args.keys == END_OF_KEYS || args.key_len == 0 || args.in_flight == 0) {
+        throw std::invalid_argument("--keys, --key-len and --in-flight must be greater than zero");
+    }
+    if (!args.role.empty() && args.role != "generator" && args.role != "replicator") {
+        throw std::invalid_argument("Invalid role: \"" + args.role + "\"");
+    }
+    return args;
+}
+
+// genInit() and genSync() from the SDK or from OfflineKeyGen
+struct KeySource {
+    std::function<QryptSecurity::SymmetricKeyData(size_t)> gen_init;
+    std::function<std::vector<uint8_t>(const std::vector<uint8_t>&)> gen_sync;
+};
+
+KeySource makeKeySource(bool use_sdk) {
+    if (!use_sdk) {
+        auto offline = std::make_shared<OfflineKeyGen>();
+        return {
+            [offline](size_t key_len) { return offline->genInit(key_len); },
+            [offline](const std::vector<uint8_t>& metadata) { return offline->genSync(metadata); }
+        };
+    }
+    std::shared_ptr<QryptSecurity::IKeyGenDistributedClient> client = QryptSecurity::IKeyGenDistributedClient::create();
+    client->initialize(sdk_token);
+    return {
+        [client](size_t key_len) { return client->genInit(key_len); },
+        [client](const std::vector<uint8_t>& metadata) { return client->genSync(metadata); }
+    };
+}
+
+std::vector<uint8_t> digest(const std::vector<uint8_t>& key) {
+    std::vector<uint8_t> hash(DIGEST_SIZE);
+    unsigned int size = 0;
+    if (EVP_Digest(key.data(), key.size(), hash.data(), &size, EVP_sha256(), nullptr) != OPENSSL_SUCCESS) {
+        throw std::runtime_error("EVP_Digest() failed!");
+    }
+    return hash;
+}
+
+bool readAll(int fd, void* data, size_t size) {
+    uint8_t* bytes = (uint8_t*)data;
+    while (size > 0) {
+        ssize_t len = read(fd, bytes, size);
+        if (len <= 0) {
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += len;
+        size -= len;
+    }
+    return true;
+}
+
+void writeAll(int fd, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (size > 0) {
+        ssize_t len = write(fd, bytes, size);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("Socket write failed: ") + strerror(errno));
+        }
+        bytes += len;
+        size -= len;
+    }
+}
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("Socket path is too long: " + path);
+    }
+    strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+double percentile(const std::vector<double>& sorted, double pct) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = std::min(sorted.size() - 1, (size_t)(pct / 100.0 * sorted.size()));
+    return sorted[index];
+}
+
+// Replicator: recreate each key whose metadata arrives and answer with its digest
+int runReplicator(const SimArgs& args) {
+    KeySource keys = makeKeySource(args.use_sdk);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = socketAddress(args.socket_path);
+    // The generator may not be listening yet
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        if (std::chrono::steady_clock::now() > give_up) {
+            throw std::runtime_error("Unable to connect to the generator at " + args.socket_path);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::vector<uint8_t> metadata;
+    while (true) {
+        uint32_t frame[2]; // key id, metadata size
+        if (!readAll(fd, frame, sizeof(frame)) || frame[0] == END_OF_KEYS) {
+            break;
+        }
+        metadata.resize(frame[1]);
+        if (!readAll(fd, metadata.data(), metadata.size())) {
+            break;
+        }
+        uint8_t reply[sizeof(uint32_t) + 1 + DIGEST_SIZE] = {}; // key id, 0 on success, digest
+        memcpy(reply, &frame[0], sizeof(uint32_t));
+        try {
+            std::vector<uint8_t> hash = digest(keys.gen_sync(metadata));
+            memcpy(reply + sizeof(uint32_t) + 1, hash.data(), DIGEST_SIZE);
+        }
+        catch (const std::exception& ex) {
+            reply[sizeof(uint32_t)] = 1;
+            std::cerr << "Replicator: " << ex.what() << std::endl;
+        }
+        writeAll(fd, reply, sizeof(reply));
+    }
+    close(fd);
+    return 0;
+}
+
+struct PendingKey {
+    std::chrono::steady_clock::time_point start;
+    std::vector<uint8_t> digest;
+    unsigned replies_left;
+};
+
+// Generator: fan each key's metadata out to every replicator and time how long until all agree. Prints one
+// line of results for the driver.
+int runGenerator(const SimArgs& args) {
+    unsigned nodes = args.nodes.at(0);
+    KeySource keys = makeKeySource(args.use_sdk);
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = socketAddress(args.socket_path);
+    if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, nodes) != 0) {
+        throw std::runtime_error(std::string("Unable to listen on " + args.socket_path + ": ") + strerror(errno));
+    }
+    std::vector<int> replicators;
+    for (unsigned i = 0; i < nodes; i++) {
+        pollfd ready = { listener, POLLIN, 0 };
+        if (poll(&ready, 1, (int)std::chrono::milliseconds(AGREEMENT_TIMEOUT).count()) <= 0) {
+            throw std::runtime_error("Timed out waiting for the replicators to connect");
+        }
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            throw std::runtime_error(std::string("accept() failed: ") + strerror(errno));
+        }
+        replicators.push_back(fd);
+    }
+    close(listener);
+    unlink(args.socket_path.c_str());
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::map<uint32_t, PendingKey> pending;
+    std::vector<double> latencies;
+    uint64_t mismatches = 0, failures = 0;
+
+    // One reader per replicator collects its digests
+    std::vector<std::thread> readers;
+    for (int fd : replicators) {
+        readers.emplace_back([&, fd]() {
+            uint8_t reply[sizeof(uint32_t) + 1 + DIGEST_SIZE];
+            while (readAll(fd, reply, sizeof(reply))) {
+                uint32_t key_id;
+                memcpy(&key_id, reply, sizeof(key_id));
+                auto now = std::chrono::steady_clock::now();
+                std::lock_guard<std::mutex> lock(mutex);
+                auto key = pending.find(key_id);
+                if (key == pending.end()) {
+                    continue;
+                }
+                if (reply[sizeof(uint32_t)] != 0) {
+                    failures++;
+                } else if (memcmp(reply + sizeof(uint32_t) + 1, key->second.digest.data(), DIGEST_SIZE) != 0) {
+                    mismatches++;
+                }
+                if (--key->second.replies_left == 0) {
+                    latencies.push_back(std::chrono::duration<double, std::milli>(now - key->second.start).count());
+                    pending.erase(key);
+                    changed.notify_all();
+                }
+            }
+        });
+    }
+
+    // On any error, closing the sockets for reading lets the readers finish before the error is reported
+    auto stop = [&]() {
+        for (int fd : replicators) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        for (int fd : replicators) {
+            close(fd);
+        }
+    };
+    auto wait_until = [&](const std::function<bool()>& done) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!changed.wait_for(lock, AGREEMENT_TIMEOUT, done)) {
+            throw std::runtime_error("Timed out waiting for the replicators");
+        }
+    };
+
+    auto run_start = std::chrono::steady_clock::now();
+    double seconds = 0;
+    try {
+        for (uint32_t key_id = 0; key_id < args.keys; key_id++) {
+            wait_until([&]() { return pending.size() < args.in_flight; });
+            auto start = std::chrono::steady_clock::now();
+            QryptSecurity::SymmetricKeyData key = keys.gen_init(args.key_len);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                pending[key_id] = { start, digest(key.key), nodes };
+            }
+            uint32_t frame[2] = { key_id, (uint32_t)key.metadata.size() };
+            for (int fd : replicators) {
+                writeAll(fd, frame, sizeof(frame));
+                writeAll(fd, key.metadata.data(), key.metadata.size());
+            }
+        }
+        wait_until([&]() { return pending.empty(); });
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - run_start).count();
+
+        uint32_t end_frame[2] = { END_OF_KEYS, 0 };
+        for (int fd : replicators) {
+            writeAll(fd, end_frame, sizeof(end_frame));
+        }
+    }
+    catch (...) {
+        stop();
+        throw;
+    }
+    stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << std::fixed << std::setprecision(3) << nodes << " " << args.keys << " " << seconds << " "
+              << args.keys / seconds << " " << args.keys * nodes / seconds << " " << percentile(latencies, 50) << " "
+              << percentile(latencies, 90) << " " << percentile(latencies, 99) << " "
+              << (latencies.empty() ? 0 : latencies.back()) << " " << mismatches << " " << failures << std::endl;
+    return 0;
+}
+
+pid_t spawn(const std::string& executable, const std::vector<std::string>& args, int stdout_fd = -1) {
+    std::vector<char*> argv = { (char*)executable.c_str() };
+    for (const std::string& arg : args) {
+        argv.push_back((char*)arg.c_str());
+    }
+    argv.push_back(nullptr);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (stdout_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, stdout_fd, STDOUT_FILENO);
+    }
+    pid_t pid;
+    int result = posix_spawn(&pid, executable.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (result != 0) {
+        throw std::runtime_error("Unable to start " + executable + ": " + strerror(result));
+    }
+    return pid;
+}
+
+bool waitForExit(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Driver: one run per node count, each with fresh processes
+int runDriver(const SimArgs& args, const std::string& executable) {
+    std::cout << "Keys from " << (args.use_sdk ? "the Qrypt SDK" : "OfflineKeyGen") << ", " << args.keys
+              << " keys of " << args.key_len << " bytes per run, " << args.in_flight << " in flight\n\n";
+    std::cout << std::setw(6) << "nodes" << std::setw(10) << "seconds" << std::setw(10) << "keys/s"
+              << std::setw(12) << "replicas/s" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << std::setw(12) << "mismatches"
+              << std::setw(10) << "failures" << std::endl;
+
+    bool all_agreed = true;
+    for (unsigned nodes : args.nodes) {
+        std::string socket_path = (std::filesystem::temp_directory_path() /
+            ("qrypt_replication_" + std::to_string(getpid()) + "_" + std::to_string(nodes) + ".sock")).string();
+        std::vector<std::string> common_args = {
+            "--socket=" + socket_path, "--keys=" + std::to_string(args.keys),
+            "--key-len=" + std::to_string(args.key_len), "--in-flight=" + std::to_string(args.in_flight)
+        };
+        if (args.use_sdk) {
+            common_args.push_back("--sdk");
+            common_args.push_back("--token=" + sdk_token);
+        }
+
+        int result_pipe[2];
+        if (pipe(result_pipe) != 0) {
+            throw std::runtime_error(std::string("pipe() failed: ") + strerror(errno));
+        }
+        std::vector<std::string> generator_args = common_args;
+        generator_args.push_back("--role=generator");
+        generator_args.push_back("--nodes=" + std::to_string(nodes));
+        pid_t generator = spawn(executable, generator_args, result_pipe[1]);
+        close(result_pipe[1]);
+
+        std::vector<std::string> replicator_args = common_args;
+        replicator_args.push_back("--role=replicator");
+        std::vector<pid_t> replicators;
+        for (unsigned i = 0; i < nodes; i++) {
+            replicators.push_back(spawn(executable, replicator_args));
+        }
+
+        std::string line;
+        char buffer[256];
+        for (ssize_t len; (len = read(result_pipe[0], buffer, sizeof(buffer))) > 0;) {
+            line.append(buffer, len);
+        }
+        close(result_pipe[0]);
+        bool ok = waitForExit(generator);
+        for (pid_t replicator : replicators) {
+            ok = waitForExit(replicator) && ok;
+        }
+
+        std::istringstream fields(line);
+        unsigned run_nodes;
+        uint32_t keys;
+        double seconds, keys_per_sec, replicas_per_sec, p50, p90, p99, max;
+        uint64_t mismatches, failures;
+        if (!ok || !(fields >> run_nodes >> keys >> seconds >> keys_per_sec >> replicas_per_sec >> p50 >> p90 >> p99 >>
+                     max >> mismatches >> failures)) {
+            std::cout << std::setw(6) << nodes << "  run failed" << std::endl;
+            all_agreed = false;
+            continue;
+        }
+        all_agreed = all_agreed && mismatches == 0 && failures == 0;
+        std::cout << std::fixed << std::setprecision(2) << std::setw(6) << nodes << std::setw(10) << seconds
+                  << std::setw(10) << keys_per_sec << std::setw(12) << replicas_per_sec << std::setprecision(3)
+                  << std::setw(10) << p50 << std::setw(10) << p90 << std::setw(10) << p99 << std::setw(10) << max
+                  << std::setw(12) << mismatches << std::setw(10) << failures << std::endl;
+    }
+    return all_agreed ? 0 : 1;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            std::cout << ReplicationSimUsage;
+            return 0;
+        }
+    }
+
+    SimArgs args;
+    try {
+        args = parseSimArgs(argv + 1);
+    }
+    catch (std::invalid_argument& ex) {
+        std::cout << ReplicationSimUsage;
+        std::cout << "\nERROR: " << ex.what() << std::endl << std::endl;
+        return 1;
+    }
+
+    // A replicator that exits early must show up as an error, not kill the generator
+    signal(SIGPIPE, SIG_IGN);
+
+    try {
+        if (args.role == "generator") {
+            return runGenerator(args);
+        }
+        if (args.role == "replicator") {
+            return runReplicator(args);
+        }
+        std::string executable = std::filesystem::exists("/proc/self/exe") ?
+            std::filesystem::read_symlink("/proc/self/exe").string() : std::filesystem::absolute(argv[0]).string();
+        return runDriver(args, executable);
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "ERROR: " << ex.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,586 @@
+#include "common.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+/*
+    Local stand-in server
+
+    Emulates the Qrypt quantum-entropy endpoint and the codespace /upload endpoints (including the
+    chunked upload protocol) served by scripts/flask_app.py so that the EaaS and upload paths can be exercised without network access.
+    Latency and failures can be injected to observe client behavior under degraded conditions.
+ */
+
+static const char* StandInUsage =
+    "Usage: qrypt_standin [Optional Arguments]\n"
+    "\n"
+    "Serve a local stand-in for /api/v1/quantum-entropy, /upload and the chunked /upload/* endpoints.\n"
+    "\n"
+    "Optional Arguments:\n"
+    "  --help                          Display this message.\n"
+    "  --port=<port>                   Port to listen on. Default 5000.\n"
+    "  --latency-ms=<ms>               Delay added before every response. Default 0.\n"
+    "  --jitter-ms=<ms>                Random extra delay of up to <ms> added to every response. Default 0.\n"
+    "  --failure-rate=<0..1>           Fraction of requests answered with HTTP 503. Default 0.\n"
+    "  --drop-rate=<0..1>              Fraction of requests whose connection is closed without a response. Default 0.\n"
+    "  --session-loss-rate=<0..1>      Fraction of chunk requests for which the upload session is forgotten first,\n"
+    "                                  as when the receiver restarts. Default 0.\n"
+    "  --upload-dir=<dir>              Directory where uploaded files are saved. Uploads are discarded if not set.\n"
+    "\n";
+
+struct StandInConfig {
+    uint16_t port = 5000;
+    uint32_t latency_ms = 0;
+    uint32_t jitter_ms = 0;
+    double failure_rate = 0;
+    double drop_rate = 0;
+    double session_loss_rate = 0;
+    std::string upload_dir;
+};
+
+struct HttpRequest {
+    std::string method;
+    std::string path;
+    std::string query;
+    std::map<std::string, std::string> headers;
+    std::string body;
+};
+
+static const uint32_t MIN_ENTROPY_REQUEST = 1;
+static const uint32_t MAX_ENTROPY_REQUEST = 512;
+static const size_t MAX_HEADER_SIZE = 64 * 1024;
+
+static std::string toLower(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+    return str;
+}
+
+static bool sendAll(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static void sendResponse(int fd, int status, const std::string& reason, const std::string& body,
+                         const std::string& content_type = "text/plain") {
+    std::ostringstream oss;
+    oss << "HTTP/1.1 " << status << " " << reason << "\r\n"
+        << "Content-Type: " << content_type << "\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n"
+        << "\r\n"
+        << body;
+    std::string response = oss.str();
+    sendAll(fd, response.data(), response.size());
+}
+
+// Buffered reader over a connected socket
+class SocketReader {
+public:
+    SocketReader(int fd): _fd{fd} {};
+
+    bool readLine(std::string& line) {
+        line.clear();
+        while (true) {
+            size_t eol = _buffer.find("\r\n", _pos);
+            if (eol != std::string::npos) {
+                line = _buffer.substr(_pos, eol - _pos);
+                _pos = eol + 2;
+                return true;
+            }
+            if (_buffer.size() - _pos > MAX_HEADER_SIZE || !fill()) {
+                return false;
+            }
+        }
+    }
+
+    bool readExact(std::string& out, size_t size) {
+        while (_buffer.size() - _pos < size) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        out.append(_buffer, _pos, size);
+        _pos += size;
+        return true;
+    }
+
+private:
+    bool fill() {
+        char chunk[16 * 1024];
+        ssize_t received = recv(_fd, chunk, sizeof(chunk), 0);
+        if (received <= 0) {
+            return false;
+        }
+        _buffer.erase(0, _pos);
+        _pos = 0;
+        _buffer.append(chunk, received);
+        return true;
+    }
+
+    int _fd;
+    std::string _buffer;
+    size_t _pos = 0;
+};
+
+static bool readRequest(int fd, HttpRequest& request) {
+    SocketReader reader(fd);
+    std::string line;
+    if (!reader.readLine(line)) {
+        return false;
+    }
+    std::istringstream request_line(line);
+    std::string target;
+    request_line >> request.method >> target;
+    size_t query_pos = target.find('?');
+    request.path = target.substr(0, query_pos);
+    if (query_pos != std::string::npos) {
+        request.query = target.substr(query_pos + 1);
+    }
+
+    while (reader.readLine(line) && !line.empty()) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        request.headers[toLower(line.substr(0, colon))] = value;
+    }
+
+    // curl asks for permission before sending large bodies
+    auto expect = request.headers.find("expect");
+    if (expect != request.headers.end() && toLower(expect->second) == "100-continue") {
+        const std::string proceed = "HTTP/1.1 100 Continue\r\n\r\n";
+        sendAll(fd, proceed.data(), proceed.size());
+    }
+
+    auto encoding = request.headers.find("transfer-encoding");
+    if (encoding != request.headers.end() && toLower(encoding->second) == "chunked") {
+        while (reader.readLine(line)) {
+            size_t chunk_size = std::stoul(line, nullptr, 16);
+            if (chunk_size == 0) {
+                reader.readLine(line); // trailing CRLF
+                return true;
+            }
+            if (!reader.readExact(request.body, chunk_size) || !reader.readLine(line)) {
+                return false;
+            }
+        }
+        return false;
+    }
+    auto length = request.headers.find("content-length");
+    if (length != request.headers.end()) {
+        return reader.readExact(request.body, std::stoul(length->second));
+    }
+    return true;
+}
+
+static std::string queryValue(const std::string& query, const std::string& name) {
+    std::istringstream iss(query);
+    std::string pair;
+    while (std::getline(iss, pair, '&')) {
+        size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == name) {
+            return (eq == std::string::npos) ? "" : pair.substr(eq + 1);
+        }
+    }
+    return "";
+}
+
+static void handleEntropy(int fd, const HttpRequest& request) {
+    if (request.headers.find("authorization") == request.headers.end()) {
+        sendResponse(fd, 401, "Unauthorized", "{\"error\":\"missing bearer token\"}", "application/json");
+        return;
+    }
+    uint32_t size = 0;
+    try {
+        size = std::stoul(queryValue(request.query, "size"));
+    }
+    catch (...) {}
+    if (size < MIN_ENTROPY_REQUEST || size > MAX_ENTROPY_REQUEST) {
+        sendResponse(fd, 400, "Bad Request", "{\"error\":\"invalid size\"}", "application/json");
+        return;
+    }
+
+    // Each KB of entropy is returned as its own base64 encoded element, as with the real service
+    std::vector<uint8_t> random(1024);
+    std::string encoded(4 * ((random.size() + 2) / 3) + 1, '\0');
+    std::ostringstream body;
+    body << "{\"random\":[";
+    for (uint32_t i = 0; i < size; i++) {
+        RAND_bytes(random.data(), random.size());
+        int encoded_len = EVP_EncodeBlock((unsigned char*)encoded.data(), random.data(), random.size());
+        body << (i ? ",\"" : "\"") << encoded.substr(0, encoded_len) << "\"";
+    }
+    body << "],\"size\":" << size << "}";
+    sendResponse(fd, 200, "OK", body.str(), "application/json");
+}
+
+struct FormPart {
+    std::string filename;
+    std::string data;
+};
+
+// Split a multipart/form-data body into its parts, keyed by field name
+static std::map<std::string, FormPart> parseMultipart(const HttpRequest& request) {
+    std::map<std::string, FormPart> parts;
+    std::string content_type = request.headers.count("content-type") ? request.headers.at("content-type") : "";
+    size_t boundary_pos = content_type.find("boundary=");
+    if (boundary_pos == std::string::npos) {
+        return parts;
+    }
+    std::string delimiter = "\r\n--" + content_type.substr(boundary_pos + 9);
+    std::string body = "\r\n" + request.body;
+    size_t part_start = body.find(delimiter);
+    while (part_start != std::string::npos) {
+        size_t headers_start = part_start + delimiter.size() + 2;
+        size_t headers_end = body.find("\r\n\r\n", headers_start);
+        size_t part_end = (headers_end == std::string::npos) ? headers_end : body.find(delimiter, headers_end);
+        if (part_end == std::string::npos) {
+            break;
+        }
+        std::string part_headers = body.substr(headers_start, headers_end - headers_start);
+        auto attribute = [&](const std::string& key) {
+            size_t pos = part_headers.find(key + "=\"");
+            if (pos == std::string::npos) {
+                return std::string();
+            }
+            pos += key.size() + 2;
+            return part_headers.substr(pos, part_headers.find('"', pos) - pos);
+        };
+        FormPart part;
+        part.filename = attribute("filename");
+        part.data = body.substr(headers_end + 4, part_end - headers_end - 4);
+        parts[attribute("name")] = part;
+        part_start = part_end;
+    }
+    return parts;
+}
+
+static std::string saveUpload(const StandInConfig& config, const std::string& filename, const std::string& data) {
+    std::string name = std::filesystem::path(filename.empty() ? "upload.dat" : filename).filename().string();
+    if (config.upload_dir.empty()) {
+        return "(discarded) " + name;
+    }
+    // Written under a temporary name and renamed into place, as scripts/flask_app.py does
+    std::string dest_path = (std::filesystem::path(config.upload_dir) / name).string();
+    std::string tmp_path = (std::filesystem::path(config.upload_dir) / ("." + name + ".tmp")).string();
+    {
+        std::ofstream dest(tmp_path, std::ios::out | std::ios::binary);
+        dest.write(data.data(), data.size());
+    }
+    std::filesystem::rename(tmp_path, dest_path);
+    return dest_path;
+}
+
+static void handleUpload(int fd, const HttpRequest& request, const StandInConfig& config) {
+    auto parts = parseMultipart(request);
+    auto file = parts.find("file");
+    if (file == parts.end()) {
+        sendResponse(fd, 400, "Bad Request", "No file received.");
+        return;
+    }
+    std::string dest_path = saveUpload(config, file->second.filename, file->second.data);
+    sendResponse(fd, 200, "OK", "File uploaded successfully to the remote codespace at " + dest_path);
+}
+
+// Chunked uploads, held in memory until every chunk has arrived
+struct ChunkedUpload {
+    uint64_t size;
+    uint64_t chunk_size;
+    std::map<uint64_t, std::string> chunks;
+};
+static std::mutex chunked_uploads_mutex;
+static std::map<std::string, ChunkedUpload> chunked_uploads;
+
+// A chunk or completion request for a session that is gone (404) or belongs to another upload (409)
+struct UploadSessionError {
+    int status;
+    std::string reason;
+    std::string message;
+};
+
+// Look up the upload session described by name, size and chunk_size. Only a status request creates a session,
+// starting over if they changed, as scripts/flask_app.py does.
+static ChunkedUpload& chunkedUploadSession(const std::string& name, const std::string& size, const std::string& chunk_size,
+                                           bool create = false) {
+    uint64_t total = std::stoull(size);
+    uint64_t chunk = std::stoull(chunk_size);
+    if (name.empty() || chunk == 0) {
+        throw std::invalid_argument("Missing or invalid name, size or chunk_size");
+    }
+    auto it = chunked_uploads.find(name);
+    if (it == chunked_uploads.end() || it->second.size != total || it->second.chunk_size != chunk) {
+        if (!create && it == chunked_uploads.end()) {
+            throw UploadSessionError{404, "Not Found", "Upload session for " + name + " not found. Restart the upload."};
+        }
+        if (!create) {
+            throw UploadSessionError{409, "Conflict", "Upload session for " + name +
+                                     " belongs to another upload. Restart the upload."};
+        }
+        chunked_uploads[name] = { total, chunk, {} };
+    }
+    return chunked_uploads[name];
+}
+
+static uint64_t chunkCount(const ChunkedUpload& upload) {
+    return std::max<uint64_t>(1, (upload.size + upload.chunk_size - 1) / upload.chunk_size);
+}
+
+static void handleUploadStatus(int fd, const HttpRequest& request) {
+    std::ostringstream body;
+    try {
+        std::lock_guard<std::mutex> lock(chunked_uploads_mutex);
+        ChunkedUpload& upload = chunkedUploadSession(queryValue(request.query, "name"),
+                                                     queryValue(request.query, "size"),
+                                                     queryValue(request.query, "chunk_size"), true);
+        body << "{\"received\":[";
+        for (auto it = upload.chunks.begin(); it != upload.chunks.end(); it++) {
+            body << (it == upload.chunks.begin() ? "" : ",") << it->first;
+        }
+        body << "]}";
+    }
+    catch (...) {
+        sendResponse(fd, 400, "Bad Request", "Missing or invalid name, size or chunk_size");
+        return;
+    }
+    sendResponse(fd, 200, "OK", body.str(), "application/json");
+}
+
+static void handleUploadChunk(int fd, const HttpRequest& request, const StandInConfig& config) {
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    auto parts = parseMultipart(request);
+    std::lock_guard<std::mutex> lock(chunked_uploads_mutex);
+    if (std::uniform_real_distribution<double>(0.0, 1.0)(rng) < config.session_loss_rate) {
+        chunked_uploads.erase(parts["name"].data);
+    }
+    try {
+        ChunkedUpload& upload = chunkedUploadSession(parts["name"].data, parts["size"].data, parts["chunk_size"].data);
+        uint64_t index = std::stoull(parts.at("index").data);
+        const std::string& data = parts.at("chunk").data;
+        if (index >= chunkCount(upload)) {
+            throw std::invalid_argument("Chunk index out of range");
+        }
+
+        std::vector<uint8_t> digest(EVP_MAX_MD_SIZE);
+        unsigned int digest_len = 0;
+        EVP_Digest(data.data(), data.size(), digest.data(), &digest_len, EVP_sha256(), nullptr);
+        digest.resize(digest_len);
+        uint64_t expected_len = std::min(upload.chunk_size, upload.size - index * upload.chunk_size);
+        if (data.size() != expected_len || byteVecToHexStr(digest) != parts["sha256"].data) {
+            sendResponse(fd, 400, "Bad Request", "Chunk " + std::to_string(index) + " failed its checksum.");
+            return;
+        }
+        upload.chunks[index] = data;
+    }
+    catch (const UploadSessionError& ex) {
+        sendResponse(fd, ex.status, ex.reason, ex.message);
+        return;
+    }
+    catch (...) {
+        sendResponse(fd, 400, "Bad Request", "No chunk received.");
+        return;
+    }
+    sendResponse(fd, 200, "OK", "ok");
+}
+
+static void handleUploadComplete(int fd, const HttpRequest& request, const StandInConfig& config) {
+    auto parts = parseMultipart(request);
+    std::string name = parts["name"].data;
+    std::string data;
+    {
+        std::lock_guard<std::mutex> lock(chunked_uploads_mutex);
+        try {
+            ChunkedUpload& upload = chunkedUploadSession(name, parts["size"].data, parts["chunk_size"].data);
+            if (upload.chunks.size() != chunkCount(upload)) {
+                sendResponse(fd, 400, "Bad Request", "Missing chunks.");
+                return;
+            }
+            for (const auto& chunk : upload.chunks) {
+                data += chunk.second;
+            }
+            chunked_uploads.erase(name);
+        }
+        catch (const UploadSessionError& ex) {
+            sendResponse(fd, ex.status, ex.reason, ex.message);
+            return;
+        }
+        catch (...) {
+            sendResponse(fd, 400, "Bad Request", "Missing or invalid name, size or chunk_size");
+            return;
+        }
+    }
+    std::string dest_path = saveUpload(config, name, data);
+    sendResponse(fd, 200, "OK", "File uploaded successfully to the remote codespace at " + dest_path);
+}
+
+static void handleConnection(int fd, const StandInConfig& config) {
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    std::uniform_real_distribution<double> chance(0.0, 1.0);
+
+    HttpRequest request;
+    bool complete = false;
+    try {
+        complete = readRequest(fd, request);
+    }
+    catch (...) {} // malformed length fields
+    if (!complete) {
+        close(fd);
+        return;
+    }
+
+    uint32_t delay_ms = config.latency_ms;
+    if (config.jitter_ms > 0) {
+        delay_ms += std::uniform_int_distribution<uint32_t>(0, config.jitter_ms)(rng);
+    }
+    if (delay_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    }
+
+    if (chance(rng) < config.drop_rate) {
+        close(fd);
+        return;
+    }
+    if (chance(rng) < config.failure_rate) {
+        sendResponse(fd, 503, "Service Unavailable", "Injected failure");
+    }
+    else if (request.method == "GET" && request.path == "/api/v1/quantum-entropy") {
+        handleEntropy(fd, request);
+    }
+    else if (request.method == "POST" && request.path == "/upload") {
+        handleUpload(fd, request, config);
+    }
+    else if (request.method == "GET" && request.path == "/upload/status") {
+        handleUploadStatus(fd, request);
+    }
+    else if (request.method == "POST" && request.path == "/upload/chunk") {
+        handleUploadChunk(fd, request, config);
+    }
+    else if (request.method == "POST" && request.path == "/upload/complete") {
+        handleUploadComplete(fd, request, config);
+    }
+    else {
+        sendResponse(fd, 404, "Not Found", "Not found");
+    }
+    close(fd);
+}
+
+static double parseRate(const std::string& name, const std::string& value) {
+    double rate;
+    try {
+        rate = std::stod(value);
+    }
+    catch (...) {
+        throw std::invalid_argument("Could not interpret " + name + "=\"" + value + "\" as a number!");
+    }
+    if (rate < 0 || rate > 1) {
+        throw std::invalid_argument(name + " must be between 0 and 1");
+    }
+    return rate;
+}
+
+static StandInConfig parseStandInArgs(char** unparsed_args) {
+    StandInConfig config;
+    while (*unparsed_args) {
+        auto[arg_name, arg_value] = tokenizeArg(*unparsed_args++);
+        try {
+            if (arg_name == "--port") {
+                config.port = std::stoi(arg_value);
+            } else if (arg_name == "--latency-ms") {
+                config.latency_ms = std::stoul(arg_value);
+            } else if (arg_name == "--jitter-ms") {
+                config.jitter_ms = std::stoul(arg_value);
+            } else if (arg_name == "--failure-rate") {
+                config.failure_rate = parseRate(arg_name, arg_value);
+            } else if (arg_name == "--drop-rate") {
+                config.drop_rate = parseRate(arg_name, arg_value);
+            } else if (arg_name == "--session-loss-rate") {
+                config.session_loss_rate = parseRate(arg_name, arg_value);
+            } else if (arg_name == "--upload-dir") {
+                config.upload_dir = arg_value;
+            } else {
+                throw std::invalid_argument("Invalid argument: " + arg_name);
+            }
+        }
+        catch (std::invalid_argument&) {
+            throw;
+        }
+        catch (...) {
+            throw std::invalid_argument("Could not interpret " + arg_name + "=\"" + arg_value + "\" as a number!");
+        }
+    }
+    if (!config.upload_dir.empty() && !std::filesystem::is_directory(config.upload_dir)) {
+        throw std::invalid_argument("Upload directory \"" + config.upload_dir + "\" does not exist!");
+    }
+    return config;
+}
+
+int main(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--help") == 0) {
+            std::cout << StandInUsage;
+            return 0;
+        }
+    }
+
+    StandInConfig config;
+    try {
+        config = parseStandInArgs(argv + 1);
+    }
+    catch (std::invalid_argument& ex) {
+        std::cout << StandInUsage;
+        std::cout << "\nERROR: " << ex.what() << std::endl << std::endl;
+        return 1;
+    }
+
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(config.port);
+    if (bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        std::cout << "\nERROR: Unable to listen on port " << config.port << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::cout << "Stand-in server listening on http://127.0.0.1:" << config.port << std::endl;
+    std::cout << "  Entropy: http://127.0.0.1:" << config.port << "/api/v1/quantum-entropy" << std::endl;
+    std::cout << "  Upload:  http://127.0.0.1:" << config.port << "/upload" << std::endl;
+
+    while (true) {
+        int fd = accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        std::thread(handleConnection, fd, std::cref(config)).detach();
+    }
+    close(listen_fd);
+    return 0;
+}
@@ -0,0 +1,81 @@
+# Tests of the chunked upload protocol served by scripts/flask_app.py.
+# Run with: python3 -m unittest discover -s test -p 'test_flask_app.py'
+import hashlib
+import io
+import os
+import shutil
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'scripts'))
+import flask_app
+
+CHUNK_SIZE = 4
+
+class ChunkedUploadTest(unittest.TestCase):
+    def setUp(self):
+        self.upload_dir = tempfile.mkdtemp()
+        flask_app.UPLOAD_DIR = self.upload_dir + os.sep
+        self.client = flask_app.app.test_client()
+        self.data = b'0123456789'
+        self.session = {'name': 'file.bin', 'size': str(len(self.data)), 'chunk_size': str(CHUNK_SIZE)}
+
+    def tearDown(self):
+        shutil.rmtree(self.upload_dir)
+
+    def status(self):
+        return self.client.get('/upload/status', query_string=self.session)
+
+    def send_chunk(self, index):
+        chunk = self.data[index * CHUNK_SIZE:(index + 1) * CHUNK_SIZE]
+        form = dict(self.session, index=str(index), sha256=hashlib.sha256(chunk).hexdigest(),
+                    chunk=(io.BytesIO(chunk), 'file.bin'))
+        return self.client.post('/upload/chunk', data=form, content_type='multipart/form-data')
+
+    def complete(self):
+        return self.client.post('/upload/complete', data=self.session, content_type='multipart/form-data')
+
+    def test_resumes_with_the_chunks_already_received(self):
+        self.assertEqual(self.status().get_json(), {'received': []})
+        self.assertEqual(self.send_chunk(0).status_code, 200)
+        self.assertEqual(self.send_chunk(2).status_code, 200)
+
+        # An interrupted client asks again and only sends what is missing
+        self.assertEqual(self.status().get_json(), {'received': [0, 2]})
+        self.assertEqual(self.complete().status_code, 400)
+        self.assertEqual(self.send_chunk(1).status_code, 200)
+        self.assertEqual(self.complete().status_code, 200)
+        with open(os.path.join(self.upload_dir, 'file.bin'), 'rb') as uploaded:
+            self.assertEqual(uploaded.read(), self.data)
+        self.assertFalse(os.path.exists(os.path.join(self.upload_dir, '.file.bin.parts')))
+
+    def test_lost_session_asks_the_client_to_restart(self):
+        self.status()
+        self.send_chunk(0)
+        shutil.rmtree(os.path.join(self.upload_dir, '.file.bin.parts'))
+        self.assertEqual(self.send_chunk(1).status_code, 404)
+        self.assertEqual(self.complete().status_code, 404)
+
+        # Starting over from the status request works
+        self.assertEqual(self.status().get_json(), {'received': []})
+        for index in range(3):
+            self.assertEqual(self.send_chunk(index).status_code, 200)
+        self.assertEqual(self.complete().status_code, 200)
+
+    def test_missing_session_file_starts_a_new_session(self):
+        self.status()
+        self.send_chunk(0)
+        os.remove(os.path.join(self.upload_dir, '.file.bin.parts', 'session'))
+        self.assertEqual(self.send_chunk(1).status_code, 404)
+        self.assertEqual(self.status().get_json(), {'received': []})
+
+    def test_session_of_another_upload_conflicts(self):
+        self.status()
+        other = dict(self.session, size='100')
+        self.client.get('/upload/status', query_string=other)
+        self.assertEqual(self.send_chunk(0).status_code, 409)
+        self.assertEqual(self.complete().status_code, 409)
+
+if __name__ == '__main__':
+    unittest.main()